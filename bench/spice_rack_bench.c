@@ -0,0 +1,583 @@
+//Microbenchmarks for the app's hot functions. Run with "make bench".
+//The app's source is included so its static functions are measured as they are built, with main renamed
+//out of the way. Calls to the file and device system calls and to malloc are counted through the linker's
+//--wrap (see BENCH_WRAP in the Makefile), so the counts cover calls made by the app's own code. Calls libc
+//makes internally, such as syslog's socket writes and fopen's buffer, aren't counted.
+//
+//  spice_rack_bench [-c conversions.csv] [-b baseline.json] [-o results.json] [-t ms]
+//
+//Results are printed as a table, compared against the baseline when one is given and written as JSON in
+//the same format as the baseline so a run can become the next baseline.
+//For nftw(), which has to come before any system header
+#define _GNU_SOURCE
+#include <ftw.h>
+#include <stdarg.h>
+
+#define main spice_rack_app_main
+#include "spice_rack_app.c"
+#undef main
+
+#define BENCH_MIN_MS_DEF 200
+#define BENCH_MAX_BENCHES 24
+#define BENCH_ADC_SAMPLES 4096
+#define BENCH_NAME_LEN 48
+#define BENCH_HX711_VALUE "9000\n"
+#define BENCH_CONVERSIONS_FILE "spice_conversions.csv"
+#define BENCH_PARSE_LINE "Spice_Location:Spice2,Spice_Name:Paprika,ADC_Reading:9100,Calibrated_Mass(grams):30.000000,Teaspoons:13.200000"
+
+struct bench_result{
+	char name[BENCH_NAME_LEN];
+	double ns_per_op;
+	double syscalls_per_op;
+	double allocs_per_op;
+};
+
+//One benchmark. run does one iteration and returns the number of operations it did.
+struct bench{
+	char name[BENCH_NAME_LEN];
+	long (*run)(void *arg);
+	void *arg;
+};
+
+static unsigned long bench_syscalls;
+static unsigned long bench_allocs;
+
+//Wrapped calls, counted and passed on
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+ssize_t __real_read(int fd, void *buf, size_t len);
+ssize_t __real_write(int fd, const void *buf, size_t len);
+off_t __real_lseek(int fd, off_t offset, int whence);
+ssize_t __real_pread(int fd, void *buf, size_t len, off_t offset);
+ssize_t __real_pwrite(int fd, const void *buf, size_t len, off_t offset);
+int __real_fstat(int fd, struct stat *file_stat);
+int __real_fsync(int fd);
+int __real_fdatasync(int fd);
+int __real_ftruncate(int fd, off_t len);
+int __real_rename(const char *old_path, const char *new_path);
+int __real_unlink(const char *path);
+int __real_mkdir(const char *path, mode_t mode);
+int __real_access(const char *path, int mode);
+void *__real_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int __real_munmap(void *addr, size_t len);
+long __real_syscall(long number, ...);
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t num, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+int __wrap_open(const char *path, int flags, ...){
+	va_list args;
+	mode_t mode = 0;
+
+	if(flags & O_CREAT){
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	bench_syscalls++;
+	return __real_open(path, flags, mode);
+}
+
+int __wrap_close(int fd){
+	bench_syscalls++;
+	return __real_close(fd);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t len){
+	bench_syscalls++;
+	return __real_read(fd, buf, len);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t len){
+	bench_syscalls++;
+	return __real_write(fd, buf, len);
+}
+
+off_t __wrap_lseek(int fd, off_t offset, int whence){
+	bench_syscalls++;
+	return __real_lseek(fd, offset, whence);
+}
+
+ssize_t __wrap_pread(int fd, void *buf, size_t len, off_t offset){
+	bench_syscalls++;
+	return __real_pread(fd, buf, len, offset);
+}
+
+ssize_t __wrap_pwrite(int fd, const void *buf, size_t len, off_t offset){
+	bench_syscalls++;
+	return __real_pwrite(fd, buf, len, offset);
+}
+
+int __wrap_fstat(int fd, struct stat *file_stat){
+	bench_syscalls++;
+	return __real_fstat(fd, file_stat);
+}
+
+int __wrap_fsync(int fd){
+	bench_syscalls++;
+	return __real_fsync(fd);
+}
+
+int __wrap_fdatasync(int fd){
+	bench_syscalls++;
+	return __real_fdatasync(fd);
+}
+
+int __wrap_ftruncate(int fd, off_t len){
+	bench_syscalls++;
+	return __real_ftruncate(fd, len);
+}
+
+int __wrap_rename(const char *old_path, const char *new_path){
+	bench_syscalls++;
+	return __real_rename(old_path, new_path);
+}
+
+int __wrap_unlink(const char *path){
+	bench_syscalls++;
+	return __real_unlink(path);
+}
+
+int __wrap_mkdir(const char *path, mode_t mode){
+	bench_syscalls++;
+	return __real_mkdir(path, mode);
+}
+
+int __wrap_access(const char *path, int mode){
+	bench_syscalls++;
+	return __real_access(path, mode);
+}
+
+void *__wrap_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset){
+	bench_syscalls++;
+	return __real_mmap(addr, len, prot, flags, fd, offset);
+}
+
+int __wrap_munmap(void *addr, size_t len){
+	bench_syscalls++;
+	return __real_munmap(addr, len);
+}
+
+//Only used for the io_uring calls, which take at most six arguments
+long __wrap_syscall(long number, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6){
+	bench_syscalls++;
+	return __real_syscall(number, arg1, arg2, arg3, arg4, arg5, arg6);
+}
+
+void *__wrap_malloc(size_t size){
+	bench_allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t num, size_t size){
+	bench_allocs++;
+	return __real_calloc(num, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+	bench_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+static char bench_dir[] = "/tmp/spice_rack_bench.XXXXXX";
+static char conversions_path[PATH_MAX];
+
+//read_file and read_line over the conversions file, one operation per line
+static long bench_read_line(void *arg){
+	int fd = *(int *)arg;
+	char line[MAX_LINE_LENGTH];
+	char *contents;
+	size_t len;
+	size_t offset = 0;
+	long lines = 0;
+
+	if((contents = read_file(fd, &len)) == NULL){
+		return 1;
+	}
+	while(offset < len){
+		read_line(contents, len, &offset, line, sizeof(line));
+		lines++;
+	}
+	free(contents);
+	return lines;
+}
+
+//search_file for the last row of the conversions file, the most it ever reads, with the read_file before it
+static long bench_search_file(void *arg){
+	int fd = *(int *)arg;
+	char search_term[SPICE_NAME_MAX_LEN];
+	char *contents;
+	size_t len;
+	size_t line_start;
+
+	snprintf(search_term, sizeof(search_term), "%s", conversions->rows[conversions->num_rows - 1].name);
+	if((contents = read_file(fd, &len)) != NULL){
+		search_file(contents, len, search_term, &line_start);
+		free(contents);
+	}
+	return 1;
+}
+
+//convert_grams_to_tsp for every spice in the table
+static long bench_convert(void *arg){
+	char name[SPICE_NAME_MAX_LEN];
+	int i;
+
+	for(i=0;i<conversions->num_rows;i++){
+		snprintf(name, sizeof(name), "%s", conversions->rows[i].name);
+		convert_grams_to_tsp(name, 25.0f + i);
+	}
+	return conversions->num_rows;
+}
+
+static long bench_parse_line(void *arg){
+	struct rack *rack = arg;
+	char line[MAX_LINE_LENGTH];
+
+	snprintf(line, sizeof(line), "%s", BENCH_PARSE_LINE);
+	parse_line(rack, line, 2);
+	return 1;
+}
+
+//store_measurement replacing the middle line of a measurements file with num_lines lines
+struct store_arg{
+	struct rack *rack;
+	int num_lines;
+	float mass;
+};
+
+static long bench_store_measurement(void *arg){
+	struct store_arg *store = arg;
+	char adc[READ_LEN];
+
+	store->mass = store->mass + 1;
+	snprintf(adc, sizeof(adc), "%i", (int)store->mass);
+	store_measurement(store->rack, store->num_lines / 2, "Paprika", adc, store->mass, store->mass / 2);
+	return 1;
+}
+
+//consolidated_spice_file with a slot changed each time, so a new snapshot is built and both files written
+static long bench_consolidated(void *arg){
+	struct rack *rack = arg;
+	static int mass;
+
+	mass++;
+	snprintf(rack->spice_rack->spices[2].spice_entries.entries[MASS_COLUMN], MAX_FILE_ENTRY_LEN, "%i.000000", mass);
+	consolidated_spice_file(rack);
+	return 1;
+}
+
+//One weight measurement, weight_samples readings of the fake HX711 averaged
+static long bench_average_weight(void *arg){
+	struct rack *rack = arg;
+
+	get_average_weight(rack, rack->read_val, rack->read_len, rack->config.weight_samples);
+	return 1;
+}
+
+//A debug message at the default runtime level, which is all a sensor read or conversion pays for its
+//debug logging
+static long bench_log_filtered(void *arg){
+	log_message(LOG_DEBUG, "spice_rack_bench: bench_log_filtered - %f grams of %s\n", 25.0f, "Paprika");
+	return 1;
+}
+
+//A message handed to the background thread. Once the ring is full this is the cost of dropping one.
+static long bench_log_queued(void *arg){
+	log_message(LOG_INFO, "spice_rack_bench: bench_log_queued - %f grams of %s\n", 25.0f, "Paprika");
+	return 1;
+}
+
+//A batch of ADC samples decoded or summarised with the named kernel, one operation per sample
+struct adc_arg{
+	const char *kernel;
+	struct adc_scan_type type;
+	unsigned char raw[BENCH_ADC_SAMPLES * 4];
+	int32_t samples[BENCH_ADC_SAMPLES];
+};
+
+static long bench_adc_decode(void *arg){
+	struct adc_arg *adc = arg;
+
+	adc_use_kernel(adc->kernel);
+	adc_decode(adc->raw, sizeof(adc->raw), &adc->type, adc->samples, BENCH_ADC_SAMPLES);
+	return BENCH_ADC_SAMPLES;
+}
+
+static long bench_adc_stats(void *arg){
+	struct adc_arg *adc = arg;
+	struct adc_stats stats;
+
+	adc_use_kernel(adc->kernel);
+	adc_compute_stats(adc->samples, BENCH_ADC_SAMPLES, &stats);
+	return BENCH_ADC_SAMPLES;
+}
+
+static void bench_run(const struct bench *bench, long min_ns, struct bench_result *result){
+	struct timespec start;
+	struct timespec now;
+	unsigned long syscalls;
+	unsigned long allocs;
+	long elapsed;
+	long ops = 0;
+
+	//One untimed pass to warm the page cache and any lazily opened files
+	bench->run(bench->arg);
+	syscalls = bench_syscalls;
+	allocs = bench_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do{
+		ops = ops + bench->run(bench->arg);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec);
+	}while(elapsed < min_ns);
+	memcpy(result->name, bench->name, sizeof(result->name));
+	result->ns_per_op = (double)elapsed / ops;
+	result->syscalls_per_op = (double)(bench_syscalls - syscalls) / ops;
+	result->allocs_per_op = (double)(bench_allocs - allocs) / ops;
+}
+
+//Reads results written by write_results. Returns the number read.
+static int read_results(const char *file_name, struct bench_result *results, int max_results){
+	struct bench_result *result;
+	char line[256];
+	FILE *file;
+	int num_results = 0;
+
+	if((file = fopen(file_name, "r")) == NULL){
+		return 0;
+	}
+	while(num_results < max_results && fgets(line, sizeof(line), file) != NULL){
+		result = &results[num_results];
+		if(sscanf(line, " {\"name\": \"%47[^\"]\", \"ns_per_op\": %lf, \"syscalls_per_op\": %lf, \"allocs_per_op\": %lf}",
+			result->name, &result->ns_per_op, &result->syscalls_per_op, &result->allocs_per_op) == 4){
+			num_results++;
+		}
+	}
+	fclose(file);
+	return num_results;
+}
+
+static int write_results(const char *file_name, const struct bench_result *results, int num_results){
+	FILE *file;
+	int i;
+
+	if((file = fopen(file_name, "w")) == NULL){
+		return -1;
+	}
+	fprintf(file, "{\n\"benchmarks\": [\n");
+	for(i=0;i<num_results;i++){
+		fprintf(file, "  {\"name\": \"%s\", \"ns_per_op\": %.1f, \"syscalls_per_op\": %.2f, \"allocs_per_op\": %.2f}%s\n",
+			results[i].name, results[i].ns_per_op, results[i].syscalls_per_op, results[i].allocs_per_op, i + 1 < num_results ? "," : "");
+	}
+	fprintf(file, "]\n}\n");
+	return fclose(file);
+}
+
+static void print_results(FILE *out, const struct bench_result *results, int num_results, const struct bench_result *baseline, int num_baseline){
+	char change[32];
+	int i;
+	int j;
+
+	fprintf(out, "%-32s %12s %12s %10s %12s\n", "benchmark", "ns/op", "syscalls/op", "allocs/op", "vs baseline");
+	for(i=0;i<num_results;i++){
+		snprintf(change, sizeof(change), "-");
+		for(j=0;j<num_baseline;j++){
+			if(strcmp(baseline[j].name, results[i].name) == 0 && baseline[j].ns_per_op > 0){
+				snprintf(change, sizeof(change), "%+.1f%%", (results[i].ns_per_op - baseline[j].ns_per_op) * 100 / baseline[j].ns_per_op);
+			}
+		}
+		fprintf(out, "%-32s %12.1f %12.2f %10.2f %12s\n", results[i].name, results[i].ns_per_op, results[i].syscalls_per_op, results[i].allocs_per_op, change);
+	}
+}
+
+//Writes a measurements file of num_lines slots for store_measurement to update
+static int write_measurements(const char *file_name, int num_lines){
+	char location[MAX_FILE_ENTRY_LEN];
+	char line[MAX_LINE_LENGTH];
+	int len;
+	int fd;
+	int i;
+
+	if((fd = open(file_name, O_CREAT | O_WRONLY | O_TRUNC, 0666)) == -1){
+		return -1;
+	}
+	for(i=1;i<=num_lines;i++){
+		spice_format_location(location, sizeof(location), i, "Paprika");
+		len = spice_format_line(line, sizeof(line), location, "Paprika", "9100", 30, 13.2f);
+		write(fd, line, len);
+	}
+	return close(fd);
+}
+
+static int remove_entry(const char *path, const struct stat *file_stat, int flag, struct FTW *ftw){
+	return remove(path);
+}
+
+int main(int argc, char *argv[]){
+	static const int store_lines[] = {8, 32, 128, 512};
+	//Word and packed samples with each kernel, the best the CPU runs and plain C
+	static const char *const adc_types[] = {"be:s24/32>>8", "be:s24/24"};
+	static struct adc_arg adc[4];
+	const char *best_kernel;
+	int j;
+	struct store_arg store[sizeof(store_lines) / sizeof(store_lines[0])];
+	struct bench benches[BENCH_MAX_BENCHES];
+	struct bench_result results[BENCH_MAX_BENCHES];
+	struct bench_result baseline[BENCH_MAX_BENCHES];
+	struct rack *rack = &racks[0];
+	char hx711_path[PATH_MAX];
+	const char *baseline_file = NULL;
+	const char *output_file = NULL;
+	long min_ns = BENCH_MIN_MS_DEF * 1000000L;
+	int num_benches = 0;
+	int num_baseline = 0;
+	int conversions_fd;
+	int hx711_fd;
+	int uring_ready;
+	int quiet_fd;
+	FILE *out;
+	int i;
+
+	snprintf(conversions_path, sizeof(conversions_path), "%s", BENCH_CONVERSIONS_FILE);
+	for(i=1;i+1<argc;i+=2){
+		if(strcmp(argv[i], "-c") == 0){
+			snprintf(conversions_path, sizeof(conversions_path), "%s", argv[i+1]);
+		}
+		else if(strcmp(argv[i], "-b") == 0){
+			baseline_file = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-o") == 0){
+			output_file = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-t") == 0){
+			min_ns = atol(argv[i+1]) * 1000000L;
+		}
+	}
+	if(mkdtemp(bench_dir) == NULL){
+		perror("spice_rack_bench: Unable to create a working directory - ");
+		return 1;
+	}
+	if((conversions = spice_conversions_load(conversions_path)) == NULL || conversions->num_rows == 0 ||
+		(conversions_fd = open(conversions_path, O_RDONLY)) == -1){
+		printf("spice_rack_bench: Unable to load %s\n", conversions_path);
+		return 1;
+	}
+	join_path(hx711_path, bench_dir, "hx711");
+	if((hx711_fd = open(hx711_path, O_CREAT | O_WRONLY | O_TRUNC, 0666)) == -1 ||
+		write(hx711_fd, BENCH_HX711_VALUE, strlen(BENCH_HX711_VALUE)) == -1){
+		perror("spice_rack_bench: Unable to create the fake HX711 - ");
+		return 1;
+	}
+	close(hx711_fd);
+
+	//The functions under test print as they go, so their output goes to /dev/null and the results to
+	//what stdout was
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	quiet_fd = open("/dev/null", O_WRONLY);
+	fflush(stdout);
+	dup2(quiet_fd, STDOUT_FILENO);
+	dup2(quiet_fd, STDERR_FILENO);
+
+	//One rack set up as the app would, in a scratch directory, with no persistence thread so measurements
+	//and publishing are done in the calling thread
+	snprintf(config_file, sizeof(config_file), "/dev/null");
+	snprintf(config.rack.data_dir, sizeof(config.rack.data_dir), "%s", bench_dir);
+	snprintf(config.rack.hx711_file, sizeof(config.rack.hx711_file), "%s", hx711_path);
+	config.rack.stuck_samples = 0;
+	epoch_init(&snapshot_epochs);
+	setup_rack(rack, 1);
+	uring_ready = rack->uring_ready;
+
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "read_line");
+	benches[num_benches].run = bench_read_line;
+	benches[num_benches++].arg = &conversions_fd;
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "search_file");
+	benches[num_benches].run = bench_search_file;
+	benches[num_benches++].arg = &conversions_fd;
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "convert_grams_to_tsp");
+	benches[num_benches].run = bench_convert;
+	benches[num_benches++].arg = NULL;
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "parse_line");
+	benches[num_benches].run = bench_parse_line;
+	benches[num_benches++].arg = rack;
+	for(i=0;i<(int)(sizeof(store_lines) / sizeof(store_lines[0]));i++){
+		store[i].rack = rack;
+		store[i].num_lines = store_lines[i];
+		store[i].mass = 0;
+		snprintf(benches[num_benches].name, BENCH_NAME_LEN, "store_measurement_%i_lines", store_lines[i]);
+		benches[num_benches].run = bench_store_measurement;
+		benches[num_benches++].arg = &store[i];
+	}
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "consolidated_spice_file");
+	benches[num_benches].run = bench_consolidated;
+	benches[num_benches++].arg = rack;
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "get_average_weight_read");
+	benches[num_benches].run = bench_average_weight;
+	benches[num_benches++].arg = rack;
+	if(uring_ready == 1){
+		snprintf(benches[num_benches].name, BENCH_NAME_LEN, "get_average_weight_uring");
+		benches[num_benches].run = bench_average_weight;
+		benches[num_benches++].arg = rack;
+	}
+
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "log_debug_filtered");
+	benches[num_benches].run = bench_log_filtered;
+	benches[num_benches++].arg = NULL;
+	snprintf(benches[num_benches].name, BENCH_NAME_LEN, "log_info_queued");
+	benches[num_benches].run = bench_log_queued;
+	benches[num_benches++].arg = NULL;
+
+	best_kernel = adc_kernel_name();
+	for(i=0;i<4;i++){
+		adc[i].kernel = i % 2 == 0 ? best_kernel : "scalar";
+		adc_parse_scan_type(adc_types[i / 2], &adc[i].type);
+		for(j=0;j<(int)sizeof(adc[i].raw);j++){
+			adc[i].raw[j] = j * 7919;
+		}
+		adc_decode(adc[i].raw, sizeof(adc[i].raw), &adc[i].type, adc[i].samples, BENCH_ADC_SAMPLES);
+		snprintf(benches[num_benches].name, BENCH_NAME_LEN, "adc_decode_%s_%s", i < 2 ? "word" : "packed", adc[i].kernel);
+		benches[num_benches].run = bench_adc_decode;
+		benches[num_benches++].arg = &adc[i];
+	}
+	for(i=0;i<2;i++){
+		snprintf(benches[num_benches].name, BENCH_NAME_LEN, "adc_stats_%s", adc[i].kernel);
+		benches[num_benches].run = bench_adc_stats;
+		benches[num_benches++].arg = &adc[i];
+	}
+
+	for(i=0;i<num_benches;i++){
+		if(strncmp(benches[i].name, "store_measurement", strlen("store_measurement")) == 0){
+			write_measurements(rack->measurements_file, ((struct store_arg *)benches[i].arg)->num_lines);
+		}
+		rack->uring_ready = strcmp(benches[i].name, "get_average_weight_uring") == 0 ? uring_ready : 0;
+		if(strcmp(benches[i].name, "log_info_queued") == 0){
+			log_start();
+		}
+		bench_run(&benches[i], min_ns, &results[i]);
+		log_stop();
+	}
+
+	if(baseline_file != NULL){
+		num_baseline = read_results(baseline_file, baseline, BENCH_MAX_BENCHES);
+	}
+	adc_use_kernel(best_kernel);
+	fprintf(out, "%i benchmarks, %s, %s ADC kernels\n", num_benches, uring_ready == 1 ? "io_uring available" : "io_uring not available", best_kernel);
+	print_results(out, results, num_benches, baseline, num_baseline);
+	if(output_file != NULL){
+		if(write_results(output_file, results, num_benches) != 0){
+			fprintf(out, "Unable to write %s\n", output_file);
+		}
+		else{
+			fprintf(out, "Results written to %s\n", output_file);
+		}
+	}
+
+	cleanup_rack(rack);
+	epoch_destroy(&snapshot_epochs);
+	spice_conversions_free(conversions);
+	close(conversions_fd);
+	nftw(bench_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+	fclose(out);
+	return 0;
+}
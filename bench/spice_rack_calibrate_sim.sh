@@ -0,0 +1,86 @@
+#!/bin/sh
+#Runs spice_rack_app through first time calibrations that take longer than job_timeout_sec, against
+#simulated sensors and a console fed from a FIFO. Two racks with one jar each and no calibration data share
+#one set of sensors. One rack calibrates while the other waits for the console, and the person calibrating
+#is slow to answer and slow to place the jar. Fails if the app took either rack for stalled, as it would
+#then have stopped feeding the watchdog. Needs the spice conversions installed, for the name entered.
+#
+#  spice_rack_calibrate_sim.sh [app]
+
+app=${1:-./spice_rack_app}
+timeout=10
+
+dir=$(mktemp -d) || exit 1
+mkdir -p "$dir/rack2"
+cat > "$dir/spice_rack.conf" <<EOF
+num_racks = 2
+worker_threads = 2
+fsr_poll_sec = 1
+job_timeout_sec = $timeout
+data_dir = $dir
+debounce_ms = 10
+weight_samples = 5
+rack_size = 1
+hx711_file = $dir/hx
+fsr_file = $dir/fsr
+[rack2]
+data_dir = $dir/rack2
+calibrate_gpio = 22
+EOF
+
+set_fsr(){
+	printf "\\$(printf %o "$1")%.0s" $(seq 128) 1<>"$dir/fsr"
+}
+set_weight(){
+	printf '%-8d\n' "$1" 1<>"$dir/hx"
+}
+#One rack's calibration once it has the console: the empty rack, the default jar mass, the empty jar,
+#then Paprika in Spice1. $1 is how long the person takes over each step.
+calibrate(){
+	set_fsr 0
+	set_weight 1000
+	sleep 2
+	sleep "$1"
+	echo n >&3
+	sleep "$1"
+	set_fsr 1
+	set_weight 5000
+	sleep 2
+	set_fsr 0
+	set_weight 1000
+	sleep 2
+	set_fsr 1
+	set_weight 12000
+	sleep 2
+	echo Paprika >&3
+	sleep 2
+}
+
+: > "$dir/fsr"
+: > "$dir/hx"
+set_fsr 0
+set_weight 1000
+mkfifo "$dir/console"
+#Held open read-write, so neither end waits for the other and the app never sees end of file
+exec 3<>"$dir/console"
+"$app" -c "$dir/spice_rack.conf" < "$dir/console" > "$dir/app.log" 2>&1 &
+pid=$!
+sleep 1
+
+calibrate $((timeout + 4))
+calibrate 1
+
+kill -TERM $pid
+wait $pid
+status=$?
+exec 3>&-
+calibrations=$(grep -c "Finished Calibration" "$dir/app.log")
+echo "$calibrations of 2 calibrations finished"
+if grep -q "is stalled" "$dir/app.log"; then
+	echo "A calibration was taken for a stalled job"
+	status=1
+elif [ "$calibrations" -ne 2 ]; then
+	status=1
+fi
+rm -rf "$dir"
+exit $status
@@ -0,0 +1,111 @@
+#!/bin/sh
+#Runs spice_rack_app against simulated sensors, so a profile ("make profile") comes from the app doing what
+#it does on a kitchen counter. Two racks of three jars each have every jar lifted and put back a little
+#lighter each cycle, then get swept, then the settings are reloaded. Nothing outside a scratch directory is
+#touched apart from the app's calibration button GPIOs.
+#
+#  spice_rack_sim.sh [app] [cycles] [trace]
+#
+#With trace, the app writes a Chrome trace of the session there (open it in ui.perfetto.dev).
+
+app=${1:-./spice_rack_app}
+cycles=${2:-2}
+trace=${3:+-t $3}
+#A jar's change in ADC reading. Calibration below puts the empty rack at 1000 and the empty jar at 5000.
+jar_adc=4000
+adc_per_gram=30
+
+dir=$(mktemp -d) || exit 1
+mkdir -p "$dir/rack2"
+
+#Calibration data so the app doesn't prompt for it
+for data_dir in "$dir" "$dir/rack2"; do
+	cat > "$data_dir/spice_rack_measurements.txt" <<EOF
+Spice_Location:N/A-Empty Rack,Spice_Name:Empty Rack,ADC_Reading:1000,Calibrated_Mass(grams):0.000000,Teaspoons:0.000000
+Spice_Location:N/A-Empty Jar-133g,Spice_Name:Empty Jar-133g,ADC_Reading:5000,Calibrated_Mass(grams):0.000000,Teaspoons:0.000000
+Spice_Location:Spice1,Spice_Name:Ground Cumin,ADC_Reading:12000,Calibrated_Mass(grams):60.000000,Teaspoons:30.000000
+Spice_Location:Spice2,Spice_Name:Paprika,ADC_Reading:12000,Calibrated_Mass(grams):60.000000,Teaspoons:26.000000
+Spice_Location:Spice3,Spice_Name:Ground Ginger,ADC_Reading:12000,Calibrated_Mass(grams):60.000000,Teaspoons:33.000000
+EOF
+done
+cat > "$dir/spice_rack.conf" <<EOF
+num_racks = 2
+fsr_poll_sec = 1
+flush_ms = 100
+data_dir = $dir
+debounce_ms = 10
+weight_samples = 5
+[rack1]
+hx711_file = $dir/hx1
+fsr_file = $dir/fsr1
+[rack2]
+hx711_file = $dir/hx2
+fsr_file = $dir/fsr2
+calibrate_gpio = 22
+EOF
+
+#Written in place, as the app keeps the weight sensor open. The FSR driver gives its status byte on every
+#read, so the fake one holds more copies of it than a debounce reads.
+set_fsr(){
+	printf "\\$(printf %o "$1")%.0s" $(seq 128) 1<>"$dir/fsr1"
+	printf "\\$(printf %o "$1")%.0s" $(seq 128) 1<>"$dir/fsr2"
+}
+set_weight(){
+	printf '%-8d\n' "$1" 1<>"$dir/hx1"
+	printf '%-8d\n' "$(($1 + 7))" 1<>"$dir/hx2"
+}
+#Rack reading with the jars in mask on it
+rack_weight(){
+	weight=1000
+	for slot in 1 2 3; do
+		if [ $(($1 & (1 << (slot - 1)))) -ne 0 ]; then
+			weight=$((weight + jar_adc + grams * adc_per_gram))
+		fi
+	done
+	echo "$weight"
+}
+
+grams=60
+: > "$dir/fsr1"
+: > "$dir/fsr2"
+set_fsr 7
+set_weight "$(rack_weight 7)"
+"$app" -c "$dir/spice_rack.conf" $trace > "$dir/app.log" 2>&1 &
+pid=$!
+sleep 3
+
+cycle=0
+while [ $cycle -lt "$cycles" ]; do
+	for slot in 1 2 3; do
+		lifted=$((7 & ~(1 << (slot - 1))))
+		set_fsr $lifted
+		set_weight "$(rack_weight $lifted)"
+		sleep 1.5
+		grams=$((grams - 2))
+		set_weight "$(rack_weight 7)"
+		set_fsr 7
+		sleep 1.5
+	done
+	cycle=$((cycle + 1))
+done
+
+kill -USR1 $pid
+sleep 1
+for slot in 1 2 3; do
+	lifted=$((7 & ~(1 << (slot - 1))))
+	set_fsr $lifted
+	set_weight "$(rack_weight $lifted)"
+	sleep 1
+	set_fsr 7
+	set_weight "$(rack_weight 7)"
+	sleep 1
+done
+
+kill -HUP $pid
+sleep 1
+kill -TERM $pid
+wait $pid
+status=$?
+grep -c "Weighed\|Added" "$dir/app.log" | sed 's/$/ weighings simulated/'
+rm -rf "$dir"
+exit $status
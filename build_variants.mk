@@ -0,0 +1,78 @@
+#Build variants, included by the app, server and client Makefiles. Pick one with variables on the command
+#line, which are passed on to the server's build of the common library:
+#  make BUILD=release                      optimised, what should be installed on the rack
+#  make BUILD=release LTO=1 OPT=-O3
+#  make profile; make BUILD=release PGO=use
+#  make SANITIZE=address,undefined test    or SANITIZE=thread
+#  make BUILD=release LOG_LEVEL=LOG_INFO   leaves every LOG_DEBUG message out of the binaries
+#Objects go in $(BUILD_DIR) and are all rebuilt whenever the compiler or flags change.
+
+VARIANTS_DIR := $(abspath $(dir $(lastword $(MAKEFILE_LIST))))
+
+#debug builds without optimisation, as the app always has been. release adds $(OPT), keeping -g for backtraces.
+BUILD ?= debug
+OPT ?= -O2
+#1 for link time optimisation
+LTO ?= 0
+#generate builds an instrumented binary that adds to the profile in $(PGO_DIR) each time it exits, and use
+#builds with that profile. Generate and use with the same BUILD, OPT and LTO.
+PGO ?= none
+PGO_DIR ?= $(VARIANTS_DIR)/pgo
+#Comma separated list for -fsanitize=, e.g. address,undefined
+SANITIZE ?=
+#Least important syslog priority compiled in, empty for all of them
+LOG_LEVEL ?=
+BUILD_DIR ?= build
+.DEFAULT_GOAL := default
+
+#CROSS_COMPILE=<toolchain prefix> builds for the target, e.g. CROSS_COMPILE=$(CROSS_CC)
+ifneq ($(CROSS_COMPILE), none)
+CC := $(CROSS_COMPILE)gcc
+endif
+#Plain ar can't index LTO objects
+AR := $(patsubst %gcc,%gcc-ar,$(CC))
+ifeq ($(AR), $(CC))
+AR := gcc-ar
+endif
+
+ifeq ($(BUILD), release)
+VARIANT_CFLAGS += $(OPT)
+else ifneq ($(BUILD), debug)
+$(error BUILD must be debug or release)
+endif
+ifeq ($(LTO), 1)
+VARIANT_CFLAGS += -flto=auto
+endif
+ifeq ($(PGO), generate)
+#The app's threads share counters, so updates have to be atomic for the profile to add up
+VARIANT_CFLAGS += -fprofile-generate=$(PGO_DIR) -fprofile-update=atomic
+else ifeq ($(PGO), use)
+ifeq ($(wildcard $(PGO_DIR)),)
+$(error No profile in $(PGO_DIR), collect one with make profile first)
+endif
+#Code the workload never ran, like the server's own, is optimised as it would be without a profile
+VARIANT_CFLAGS += -fprofile-use=$(PGO_DIR) -fprofile-partial-training -Wno-missing-profile
+else ifneq ($(PGO), none)
+$(error PGO must be none, generate or use)
+endif
+ifneq ($(SANITIZE),)
+VARIANT_CFLAGS += -fsanitize=$(SANITIZE) -fno-omit-frame-pointer
+endif
+ifneq ($(LOG_LEVEL),)
+VARIANT_CFLAGS += -DLOG_COMPILE_LEVEL=$(LOG_LEVEL)
+endif
+#Linking uses CFLAGS too, which LTO, profiling and the sanitizers need
+override CFLAGS += $(VARIANT_CFLAGS)
+
+#Rewritten only when the flags change, so objects depending on it rebuild exactly then
+$(BUILD_DIR)/cflags: FORCE
+	@mkdir -p $(BUILD_DIR)
+	@echo '$(CC) $(CFLAGS)' | cmp -s - $@ || echo '$(CC) $(CFLAGS)' > $@
+
+$(BUILD_DIR)/%.o: %.c $(BUILD_DIR)/cflags
+	$(CC) $(CFLAGS) $(HEADERS) -MMD -MP -c -o $@ $<
+
+-include $(wildcard $(BUILD_DIR)/*.d)
+
+.PHONY: FORCE
+FORCE:
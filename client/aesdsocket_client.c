@@ -21,24 +21,34 @@ Date: 06/18/2023
 #include <pthread.h>
 #include <time.h>
 #include <regex.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include "spice_rack_io.h"
+#include "spice_rack_log.h"
+#include "spice_rack_multicast.h"
+#include "spice_rack_process.h"
+#include "spice_rack_snapshot.h"
 
 
 #define WRITE_FILE "/var/tmp/spices.txt"
 #define BACKLOG 20
 #define READ_WRITE_SIZE 1024
+#define HTTP_PORT "9100"
+//Reply headers and a full binary snapshot
+#define FETCH_BUFFER_SIZE (SNAPSHOT_BUFFER_SIZE + 1024)
+#define FETCH_TIMEOUT_SEC 2
 
-static bool caught_signal = false;
+static const int handled_signals[] = {SIGTERM, SIGINT};
 
 static int receive_and_write_to_file(int socket_fd, int writer_fd){
-        ssize_t bytes_read, bytes_written;
+        ssize_t bytes_read;
         char *read_buffer;
        	int end_of_packet = 0;
 	char newline = '\n';
 	int result = 0;
 
 	if((read_buffer = (char *)malloc(READ_WRITE_SIZE * sizeof(char))) == NULL){
-		perror("aesdsocket_client: receive_and_write_to_file - Failed to Malloc - ");
-		syslog(LOG_DEBUG, "aesdsocket_client: receive_and_write_to_file - Failed to Malloc - %s\n", strerror(errno));
+		log_errno("aesdsocket_client: receive_and_write_to_file - Failed to Malloc");
 	}
 	memset(read_buffer, 0, READ_WRITE_SIZE);
 
@@ -48,28 +58,17 @@ static int receive_and_write_to_file(int socket_fd, int writer_fd){
                                 if (errno == EINTR){
                                         continue;
                                 }
-                                perror("aesdsocket_client: receive_and_write_to_file - Error while trying to recv: ");
-				syslog(LOG_DEBUG, "aesdsocket_client: receive_and_write_to_file - Error while trying to recv: %s", strerror(errno));
+                                log_errno("aesdsocket_client: receive_and_write_to_file - Error while trying to recv");
 				result = -1;
                                 break;
                         }
                         if(strchr(read_buffer,newline) != NULL){
                                 end_of_packet = 1;
                         }
-                        while(1){
-                                bytes_written = write(writer_fd, read_buffer, bytes_read);
-                                if(bytes_written == -1){
-					if (errno == EINTR){
-						continue;
-					}
-					perror("aesdsocket_client: receive_and_write_to_file - Error while trying to write to file: ");
-					syslog(LOG_DEBUG, "aesdsocket_client: receive_and_write_to_file - Error while trying to write to file: %s", strerror(errno));
-					result = -1;
-					break;
-				}
-				else{
-					break;
-				}
+                        if(write_all(writer_fd, read_buffer, bytes_read) != 0){
+				log_errno("aesdsocket_client: receive_and_write_to_file - Error while trying to write to file");
+				result = -1;
+				break;
                         }
                 }
 
@@ -79,45 +78,226 @@ static int receive_and_write_to_file(int socket_fd, int writer_fd){
 	return result;
 }
 
+//Gets the full binary snapshot from the server's HTTP port. Returns 0 or -1.
+static int fetch_snapshot(const char *server, const char *http_port, struct inventory_snapshot *snapshot){
+	struct addrinfo hints, *result, *rp;
+	struct timeval timeout = {FETCH_TIMEOUT_SEC, 0};
+	char request[256];
+	char *reply;
+	char *body;
+	ssize_t len;
+	int skt_fd = -1;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if((ret = getaddrinfo(server, http_port, &hints, &result)) != 0){
+		log_message(LOG_ERR, "aesdsocket_client: fetch_snapshot - getaddrinfo failed - %s\n", gai_strerror(ret));
+		return -1;
+	}
+	ret = -1;
+	for(rp = result; rp != NULL; rp = rp->ai_next){
+		if((skt_fd = socket(rp->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1){
+			continue;
+		}
+		//So a server that stops answering can't stop the datagrams being read
+		setsockopt(skt_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(skt_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		if(connect(skt_fd, rp->ai_addr, rp->ai_addrlen) == 0){
+			break;
+		}
+		close(skt_fd);
+		skt_fd = -1;
+	}
+	freeaddrinfo(result);
+	if(skt_fd == -1){
+		log_message(LOG_ERR, "aesdsocket_client: fetch_snapshot - Unable to connect to %s:%s\n", server, http_port);
+		return -1;
+	}
+	if((reply = (char *)malloc(FETCH_BUFFER_SIZE)) == NULL){
+		log_errno("aesdsocket_client: fetch_snapshot - Failed to Malloc");
+		close(skt_fd);
+		return -1;
+	}
+	len = snprintf(request, sizeof(request), "GET /inventory?format=binary HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", server);
+	if(send_all(skt_fd, request, len) != 0 || (len = read_full(skt_fd, reply, FETCH_BUFFER_SIZE - 1)) == -1){
+		log_errno("aesdsocket_client: fetch_snapshot - Request to %s:%s failed", server, http_port);
+	}
+	else{
+		reply[len] = '\0';
+		if(strncmp(reply, "HTTP/1.1 200 ", 13) != 0 || (body = strstr(reply, "\r\n\r\n")) == NULL){
+			log_message(LOG_ERR, "aesdsocket_client: fetch_snapshot - %s:%s has no inventory\n", server, http_port);
+		}
+		else if((ret = snapshot_decode(body + 4, len - (body + 4 - reply), snapshot)) != 0){
+			log_message(LOG_ERR, "aesdsocket_client: fetch_snapshot - %s:%s sent an invalid snapshot\n", server, http_port);
+		}
+	}
+	free(reply);
+	close(skt_fd);
+	return ret;
+}
+
+static void print_slot(const struct inventory_slot *slot){
+	printf("  slot %i %s: %.1f g, %.2f %s", slot->slot, slot->name, slot->grams, slot->quantity, slot->unit);
+	if(slot->days_left >= 0){
+		printf(", %.1f days left", slot->days_left);
+	}
+	printf("%s\n", slot->low_stock == 1 ? ", low" : "");
+}
+
+//Prints the slots that differ from before, or every slot when before is NULL
+static void print_changes(const struct inventory_snapshot *before, const struct inventory_snapshot *after, unsigned long lost){
+	int i;
+
+	printf("version %llu %s, %lu datagrams lost\n", (unsigned long long)after->version, snapshot_health_name(after->health), lost);
+	for(i=0;i<after->num_slots;i++){
+		if(before == NULL || memcmp(&before->slots[i], &after->slots[i], sizeof(struct inventory_slot)) != 0){
+			print_slot(&after->slots[i]);
+		}
+	}
+	fflush(stdout);
+}
+
+//Joins group on port and follows the inventory published by the server there, fetching a full snapshot
+//from server:http_port to start with and whenever a datagram can't be applied. Runs until a signal.
+static int listen_multicast(const char *group, const char *port, const char *server, const char *http_port, int signal_fd){
+	struct addrinfo hints, *result;
+	struct multicast_listener *listener;
+	struct inventory_snapshot before;
+	struct inventory_snapshot snapshot;
+	struct pollfd poll_fds[2];
+	struct ip_mreq mreq;
+	struct ipv6_mreq mreq6;
+	char buf[MULTICAST_MAX_DATAGRAM];
+	ssize_t len;
+	int skt_fd;
+	int one = 1;
+	int had_snapshot;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	if((ret = getaddrinfo(group, port, &hints, &result)) != 0){
+		printf("Invalid multicast group %s port %s - %s\n", group, port, gai_strerror(ret));
+		return -1;
+	}
+	if((skt_fd = socket(result->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1){
+		log_errno("aesdsocket_client: listen_multicast - socket() failed");
+		freeaddrinfo(result);
+		return -1;
+	}
+	//Bound to the group address, so only its datagrams arrive, and shared with any other listener on this host
+	setsockopt(skt_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(bind(skt_fd, result->ai_addr, result->ai_addrlen) != 0){
+		log_errno("aesdsocket_client: listen_multicast - bind() failed");
+		ret = -1;
+	}
+	else if(result->ai_family == AF_INET6){
+		mreq6.ipv6mr_multiaddr = ((struct sockaddr_in6 *)result->ai_addr)->sin6_addr;
+		mreq6.ipv6mr_interface = 0;
+		ret = setsockopt(skt_fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq6, sizeof(mreq6));
+	}
+	else{
+		mreq.imr_multiaddr = ((struct sockaddr_in *)result->ai_addr)->sin_addr;
+		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+		ret = setsockopt(skt_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+	}
+	freeaddrinfo(result);
+	if(ret != 0){
+		log_errno("aesdsocket_client: listen_multicast - Unable to join %s", group);
+		close(skt_fd);
+		return -1;
+	}
+	if((listener = (struct multicast_listener *)calloc(1, sizeof(struct multicast_listener))) == NULL){
+		log_errno("aesdsocket_client: listen_multicast - Failed to Malloc");
+		close(skt_fd);
+		return -1;
+	}
+	printf("Listening for inventory updates on %s port %s\n", group, port);
+	if(fetch_snapshot(server, http_port, &snapshot) == 0){
+		multicast_listener_reset(listener, &snapshot);
+		print_changes(NULL, &listener->snapshot, listener->lost);
+	}
 
-static void socket_signal_handler (int signal_number){
-	if (signal_number == SIGTERM || signal_number == SIGINT){
-		caught_signal = true;
-	} 
+	poll_fds[0].fd = skt_fd;
+	poll_fds[0].events = POLLIN;
+	poll_fds[1].fd = signal_fd;
+	poll_fds[1].events = POLLIN;
+	while(1){
+		if(poll(poll_fds, 2, -1) == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			log_errno("aesdsocket_client: listen_multicast - poll() failed");
+			break;
+		}
+		if((poll_fds[1].revents & POLLIN) != 0 && signals_read(signal_fd) > 0){
+			break;
+		}
+		if((poll_fds[0].revents & POLLIN) == 0 || (len = recv(skt_fd, buf, sizeof(buf), 0)) == -1){
+			continue;
+		}
+		before = listener->snapshot;
+		had_snapshot = listener->have_snapshot;
+		ret = multicast_listener_apply(listener, buf, len);
+		if(ret == MULTICAST_APPLIED){
+			print_changes(&before, &listener->snapshot, listener->lost);
+		}
+		else if(ret == MULTICAST_NEED_SNAPSHOT && fetch_snapshot(server, http_port, &snapshot) == 0){
+			multicast_listener_reset(listener, &snapshot);
+			print_changes(had_snapshot == 1 ? &before : NULL, &listener->snapshot, listener->lost);
+		}
+		else if(ret == -1){
+			log_message(LOG_DEBUG, "aesdsocket_client: listen_multicast - Ignoring a %zi byte datagram that isn't an update\n", len);
+		}
+	}
+	free(listener);
+	close(skt_fd);
+	return 0;
 }
 
 int main(int argc, char *argv[]){
-	int skt_fd, ret_val;
+	int skt_fd, signal_fd, ret_val;
 	char ip_address[16];
 	char port[5];
 	struct addrinfo skt_addrinfo, *res_skt_addrinfo, *rp;
-	struct sigaction socket_sigaction;
+	bool multicast = false;
 
-	if(argc != 3){
+	//-m <group> <port> <server> [http_port] follows the inventory multicast by the server instead
+	if(argc >= 5 && argc <= 6 && strcmp(argv[1], "-m") == 0){
+		multicast = true;
+	}
+	else if(argc != 3){
 		printf("Incorrect number of arguments were supplied. Use following syntax: aesdsocket_client <ip_address> <port>\n");
+		printf("or aesdsocket_client -m <multicast_group> <port> <server> [http_port]\n");
 		return -1;
 	}
-	if((strlen(argv[1]) > 15) || (strlen(argv[2]) > 4)){
+	else if((strlen(argv[1]) > 15) || (strlen(argv[2]) > 4)){
 		printf("Arguments provided are longer than xxx.xxx.xxx.xxx for IP addr and xxxx for port num\n");
 		return -1;
 	}
-	strcpy(ip_address, argv[1]);
-	strcpy(port, argv[2]);
 
 	openlog(NULL,0,LOG_USER);
-	syslog(LOG_DEBUG,"aesdsocket_client: main - Starting Script Over\n");	
+	log_message(LOG_DEBUG,"aesdsocket_client: main - Starting Script Over\n");	
 
-	//Setup signal handler
-	memset(&socket_sigaction,0,sizeof(struct sigaction));
-	socket_sigaction.sa_handler=socket_signal_handler;
-	if(sigaction(SIGTERM, &socket_sigaction, NULL) != 0) {
-		perror("aesdsocket_client: main - Error registering for SIGTERM - ");
-		syslog(LOG_DEBUG, "aesdsocket_client: main - Error registering for SIGTERM - %s\n", strerror(errno));
+	//Checked between receive attempts below
+	if((signal_fd = signals_open(handled_signals, sizeof(handled_signals)/sizeof(handled_signals[0]))) == -1){
+		return -1;
 	}
-	if(sigaction(SIGINT, &socket_sigaction, NULL) != 0) {
-		perror("aesdsocket_client: main - Error registering for SIGINT - ");
-		syslog(LOG_DEBUG, "aesdsocket_client: main - Error registering for SIGINT - %s\n", strerror(errno));
+	//Started after the signals are blocked, so its thread never takes one. Until then, and if it fails,
+	//messages are written as they are logged.
+	log_start();
+	if(multicast == true){
+		ret_val = listen_multicast(argv[2], argv[3], argv[4], argc == 6 ? argv[5] : HTTP_PORT, signal_fd);
+		close(signal_fd);
+		closelog();
+		return ret_val;
 	}
+	strcpy(ip_address, argv[1]);
+	strcpy(port, argv[2]);
 
 	//Setup addrinfo struct
 	memset(&skt_addrinfo, 0, sizeof skt_addrinfo);
@@ -127,7 +307,7 @@ int main(int argc, char *argv[]){
 	ret_val = getaddrinfo(ip_address,port,&skt_addrinfo,&res_skt_addrinfo);
 	if(ret_val != 0){
 		perror("aesdsocket_client: main - getaddrinfo failed - ");
-		syslog(LOG_DEBUG,"aesdsocket_client: main - gettaddrinfo failed - %s\n", gai_strerror(ret_val));
+		log_message(LOG_DEBUG,"aesdsocket_client: main - gettaddrinfo failed - %s\n", gai_strerror(ret_val));
 		return -1;
 	}
 
@@ -135,21 +315,27 @@ int main(int argc, char *argv[]){
 	for(rp = res_skt_addrinfo; rp != NULL; rp = rp->ai_next){
 		skt_fd = socket(rp->ai_family,SOCK_STREAM | SOCK_NONBLOCK,0);
 		if(skt_fd == -1){
-			perror("aesdsocket_client: main - socket() failed - ");
-			syslog(LOG_DEBUG, "aesdsocket_client: main - socket() failed - %s\n", strerror(errno));
+			log_errno("aesdsocket_client: main - socket() failed");
 			continue;
 		}	
 		
-		//Connect
-		if(connect(skt_fd, rp->ai_addr, rp->ai_addrlen) == -1){
-			syslog(LOG_DEBUG,"aesdsocket_client: main - connect() failed - %s\n", strerror(errno));
+		//Connect. The socket is non-blocking, so the connection usually finishes during the sleep below.
+		if(connect(skt_fd, rp->ai_addr, rp->ai_addrlen) == -1 && errno != EINPROGRESS){
+			log_message(LOG_DEBUG,"aesdsocket_client: main - connect() failed - %s\n", strerror(errno));
+			close(skt_fd);
 			continue;
 		}
 		else{
-			syslog(LOG_DEBUG,"aesdsocket_client: main - connect() successful");
+			log_message(LOG_DEBUG,"aesdsocket_client: main - connect() successful");
 			break;
 		}
 	}
+	if(rp == NULL){
+		printf("Unable to connect to %s:%s\n", ip_address, port);
+		log_message(LOG_DEBUG, "aesdsocket_client: main - Unable to connect to %s:%s\n", ip_address, port);
+		freeaddrinfo(res_skt_addrinfo);
+		return -1;
+	}
 	printf("Connection Established. Will now read data in to %s\n", WRITE_FILE); 
 
 	freeaddrinfo(res_skt_addrinfo);
@@ -159,10 +345,11 @@ int main(int argc, char *argv[]){
 	sleep(1);	
 
 	while(receive_and_write_to_file(skt_fd, writer_fd) != 0){
-		if(caught_signal == true){
-			syslog(LOG_DEBUG, "aesdsocket_client: main - Caught signal, exiting");
+		if(signals_read(signal_fd) != 0){
+			log_message(LOG_DEBUG, "aesdsocket_client: main - Caught signal, exiting");
 			close(skt_fd);
 			close(writer_fd);
+			close(signal_fd);
 			closelog();
 			return 0;
 		}
@@ -170,6 +357,7 @@ int main(int argc, char *argv[]){
 	printf("Done writing data into %s. Closing Connection and exiting\n", WRITE_FILE);
 	close(skt_fd);
 	close(writer_fd);
+	close(signal_fd);
 	closelog();
 
 	return 0;
@@ -0,0 +1,249 @@
+/*-----------------------------------------------------------------------------
+Author: Geoffrey Jensen
+ECEA 5307 Final Project
+Date: 06/18/2023
+-----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <syslog.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "aesdsocket_metrics.h"
+#include "spice_rack_log.h"
+
+//A slot name with every character escaped
+#define METRICS_LABEL_LEN (2 * SNAPSHOT_NAME_LEN)
+
+//All counters are updated by the connection threads without taking a lock. The scrape only loads them.
+static atomic_ulong connections_accepted;
+static atomic_ulong connections_closed;
+static atomic_ulong connections_rejected;
+static atomic_ulong connections_timed_out;
+static atomic_ulong bytes_sent;
+static atomic_ulong scrapes_served;
+static atomic_ulong http_responses;
+static atomic_ulong http_not_modified;
+static atomic_ulong multicast_sent;
+static atomic_ulong latency_count;
+static atomic_ulong latency_sum_us;
+static atomic_ulong latency_buckets[METRICS_LATENCY_BUCKETS + 1];
+static const unsigned long latency_bounds_us[METRICS_LATENCY_BUCKETS] = {
+	100, 500, 1000, 5000, 10000, 50000, 100000, 1000000
+};
+
+void metrics_connection_accepted(void){
+	atomic_fetch_add_explicit(&connections_accepted, 1, memory_order_relaxed);
+}
+
+void metrics_connection_rejected(void){
+	atomic_fetch_add_explicit(&connections_rejected, 1, memory_order_relaxed);
+}
+
+void metrics_connection_timed_out(void){
+	atomic_fetch_add_explicit(&connections_timed_out, 1, memory_order_relaxed);
+}
+
+void metrics_http_response(int not_modified){
+	atomic_fetch_add_explicit(&http_responses, 1, memory_order_relaxed);
+	if(not_modified == 1){
+		atomic_fetch_add_explicit(&http_not_modified, 1, memory_order_relaxed);
+	}
+}
+
+void metrics_multicast_sent(void){
+	atomic_fetch_add_explicit(&multicast_sent, 1, memory_order_relaxed);
+}
+
+void metrics_connection_closed(const struct timespec *start_time){
+	struct timespec end_time;
+	unsigned long elapsed_us;
+	int i;
+
+	atomic_fetch_add_explicit(&connections_closed, 1, memory_order_relaxed);
+	if(clock_gettime(CLOCK_MONOTONIC, &end_time) != 0){
+		return;
+	}
+	elapsed_us = (end_time.tv_sec - start_time->tv_sec) * 1000000UL;
+	elapsed_us = elapsed_us + (end_time.tv_nsec - start_time->tv_nsec) / 1000;
+	for(i=0;i<METRICS_LATENCY_BUCKETS;i++){
+		if(elapsed_us <= latency_bounds_us[i]){
+			break;
+		}
+	}
+	atomic_fetch_add_explicit(&latency_buckets[i], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&latency_sum_us, elapsed_us, memory_order_relaxed);
+	atomic_fetch_add_explicit(&latency_count, 1, memory_order_relaxed);
+}
+
+void metrics_add_bytes_sent(size_t bytes){
+	atomic_fetch_add_explicit(&bytes_sent, bytes, memory_order_relaxed);
+}
+
+void metrics_scrape_served(void){
+	atomic_fetch_add_explicit(&scrapes_served, 1, memory_order_relaxed);
+}
+
+static int append(char *buf, size_t buf_len, size_t *offset, const char *format, ...){
+	va_list args;
+	int count;
+
+	if(*offset >= buf_len){
+		return -1;
+	}
+	va_start(args, format);
+	count = vsnprintf(buf + *offset, buf_len - *offset, format, args);
+	va_end(args);
+	if(count < 0 || (size_t)count >= buf_len - *offset){
+		return -1;
+	}
+	*offset = *offset + count;
+	return 0;
+}
+
+//Label values must have backslash, double quote and newline escaped
+static void escape_label(char *dest, size_t dest_len, const char *src){
+	size_t j = 0;
+	while(*src != '\0' && j + 2 < dest_len){
+		if(*src == '\\' || *src == '"'){
+			dest[j++] = '\\';
+			dest[j++] = *src;
+		}
+		else if(*src == '\n'){
+			dest[j++] = '\\';
+			dest[j++] = 'n';
+		}
+		else{
+			dest[j++] = *src;
+		}
+		src++;
+	}
+	dest[j] = '\0';
+}
+
+//Each metric family has to be contiguous in the exposition, so grams and tsp are rendered in two passes
+static int render_slots(char *buf, size_t buf_len, size_t *offset, const struct inventory_snapshot *snapshot){
+	char names[SNAPSHOT_MAX_SLOTS][METRICS_LABEL_LEN];
+	const struct inventory_slot *slot;
+	int i;
+
+	if(snapshot->num_slots == 0){
+		return 0;
+	}
+	for(i=0;i<snapshot->num_slots;i++){
+		escape_label(names[i], METRICS_LABEL_LEN, snapshot->slots[i].name);
+	}
+	if(append(buf, buf_len, offset, "# HELP spice_rack_slot_grams Mass of the spice in each slot.\n# TYPE spice_rack_slot_grams gauge\n") != 0){
+		return -1;
+	}
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		if(append(buf, buf_len, offset, "spice_rack_slot_grams{slot=\"%i\",spice=\"%s\"} %f\n", slot->slot, names[i], slot->grams) != 0){
+			return -1;
+		}
+	}
+	if(append(buf, buf_len, offset, "# HELP spice_rack_slot_tsp Spice remaining in each slot, in teaspoons or the spice's own unit.\n# TYPE spice_rack_slot_tsp gauge\n") != 0){
+		return -1;
+	}
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		if(append(buf, buf_len, offset, "spice_rack_slot_tsp{slot=\"%i\",spice=\"%s\"} %f\n", slot->slot, names[i], slot->quantity) != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int metrics_render(char *buf, size_t buf_len, const char *consolidated_file, const struct inventory_snapshot *snapshot){
+	size_t offset = 0;
+	unsigned long accepted;
+	unsigned long closed;
+	unsigned long cumulative = 0;
+	struct stat file_stat;
+	struct timespec now;
+	int i;
+
+	accepted = atomic_load_explicit(&connections_accepted, memory_order_relaxed);
+	closed = atomic_load_explicit(&connections_closed, memory_order_relaxed);
+
+	if(append(buf, buf_len, &offset,
+		"# HELP aesdsocket_connections_accepted_total Connections accepted on the data port.\n"
+		"# TYPE aesdsocket_connections_accepted_total counter\n"
+		"aesdsocket_connections_accepted_total %lu\n"
+		"# HELP aesdsocket_connections_active Connections currently being served on the data port.\n"
+		"# TYPE aesdsocket_connections_active gauge\n"
+		"aesdsocket_connections_active %lu\n"
+		"# HELP aesdsocket_connections_rejected_total Connections on either port closed unserved over max_connections.\n"
+		"# TYPE aesdsocket_connections_rejected_total counter\n"
+		"aesdsocket_connections_rejected_total %lu\n"
+		"# HELP aesdsocket_connections_timed_out_total Connections on either port dropped for idling or not reading.\n"
+		"# TYPE aesdsocket_connections_timed_out_total counter\n"
+		"aesdsocket_connections_timed_out_total %lu\n"
+		"# HELP aesdsocket_bytes_sent_total Bytes sent to data port clients.\n"
+		"# TYPE aesdsocket_bytes_sent_total counter\n"
+		"aesdsocket_bytes_sent_total %lu\n"
+		"# HELP aesdsocket_scrapes_total Metrics scrapes served.\n"
+		"# TYPE aesdsocket_scrapes_total counter\n"
+		"aesdsocket_scrapes_total %lu\n"
+		"# HELP aesdsocket_http_responses_total Replies on the HTTP port.\n"
+		"# TYPE aesdsocket_http_responses_total counter\n"
+		"aesdsocket_http_responses_total %lu\n"
+		"# HELP aesdsocket_http_not_modified_total HTTP replies that were a 304 Not Modified with no body.\n"
+		"# TYPE aesdsocket_http_not_modified_total counter\n"
+		"aesdsocket_http_not_modified_total %lu\n"
+		"# HELP aesdsocket_multicast_datagrams_total Inventory updates and heartbeats sent to the multicast group.\n"
+		"# TYPE aesdsocket_multicast_datagrams_total counter\n"
+		"aesdsocket_multicast_datagrams_total %lu\n"
+		"# HELP aesdsocket_request_duration_seconds Time from accept to close of data port requests.\n"
+		"# TYPE aesdsocket_request_duration_seconds histogram\n",
+		accepted, accepted - closed,
+		atomic_load_explicit(&connections_rejected, memory_order_relaxed),
+		atomic_load_explicit(&connections_timed_out, memory_order_relaxed),
+		atomic_load_explicit(&bytes_sent, memory_order_relaxed),
+		atomic_load_explicit(&scrapes_served, memory_order_relaxed),
+		atomic_load_explicit(&http_responses, memory_order_relaxed),
+		atomic_load_explicit(&http_not_modified, memory_order_relaxed),
+		atomic_load_explicit(&multicast_sent, memory_order_relaxed)) != 0){
+		return -1;
+	}
+	for(i=0;i<METRICS_LATENCY_BUCKETS;i++){
+		cumulative = cumulative + atomic_load_explicit(&latency_buckets[i], memory_order_relaxed);
+		if(append(buf, buf_len, &offset, "aesdsocket_request_duration_seconds_bucket{le=\"%g\"} %lu\n", latency_bounds_us[i] / 1e6, cumulative) != 0){
+			return -1;
+		}
+	}
+	cumulative = cumulative + atomic_load_explicit(&latency_buckets[METRICS_LATENCY_BUCKETS], memory_order_relaxed);
+	if(append(buf, buf_len, &offset,
+		"aesdsocket_request_duration_seconds_bucket{le=\"+Inf\"} %lu\n"
+		"aesdsocket_request_duration_seconds_sum %f\n"
+		"aesdsocket_request_duration_seconds_count %lu\n",
+		cumulative,
+		atomic_load_explicit(&latency_sum_us, memory_order_relaxed) / 1e6,
+		atomic_load_explicit(&latency_count, memory_order_relaxed)) != 0){
+		return -1;
+	}
+	if(snapshot != NULL && append(buf, buf_len, &offset,
+		"# HELP spice_rack_snapshot_version Version of the inventory snapshot published by spice_rack_app, as in /healthz and the ETags.\n"
+		"# TYPE spice_rack_snapshot_version gauge\n"
+		"spice_rack_snapshot_version %llu\n",
+		(unsigned long long)snapshot->version) != 0){
+		return -1;
+	}
+	if(stat(consolidated_file, &file_stat) == 0 && clock_gettime(CLOCK_REALTIME, &now) == 0){
+		if(append(buf, buf_len, &offset,
+			"# HELP spice_rack_snapshot_age_seconds Seconds since the consolidated snapshot was last published.\n"
+			"# TYPE spice_rack_snapshot_age_seconds gauge\n"
+			"spice_rack_snapshot_age_seconds %f\n",
+			(now.tv_sec - file_stat.st_mtim.tv_sec) + (now.tv_nsec - file_stat.st_mtim.tv_nsec) / 1e9) != 0){
+			return -1;
+		}
+	}
+	if(snapshot != NULL && render_slots(buf, buf_len, &offset, snapshot) != 0){
+		return -1;
+	}
+	return offset;
+}
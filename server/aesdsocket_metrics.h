@@ -0,0 +1,35 @@
+/*-----------------------------------------------------------------------------
+Author: Geoffrey Jensen
+ECEA 5307 Final Project
+Date: 06/18/2023
+-----------------------------------------------------------------------------*/
+
+#ifndef AESDSOCKET_METRICS_H
+#define AESDSOCKET_METRICS_H
+
+#include <stddef.h>
+#include <time.h>
+#include "spice_rack_snapshot.h"
+
+//Upper bounds (in microseconds) of the request latency histogram buckets. +Inf is implicit.
+#define METRICS_LATENCY_BUCKETS 8
+
+void metrics_connection_accepted(void);
+void metrics_connection_closed(const struct timespec *start_time);
+//A connection on either port turned away over max_connections, or dropped for going idle or not reading
+void metrics_connection_rejected(void);
+void metrics_connection_timed_out(void);
+void metrics_add_bytes_sent(size_t bytes);
+void metrics_scrape_served(void);
+//A reply on the HTTP port, not_modified when it was a 304 with no body
+void metrics_http_response(int not_modified);
+void metrics_multicast_sent(void);
+
+//Renders all counters, gauges and per-slot values in Prometheus text format (version 0.0.4).
+//consolidated_file is the text file published by spice_rack_app, whose age is reported. snapshot is the
+//inventory it published, or NULL if there isn't one, which leaves out the version and slots. Slots are
+//rack 1's, or whichever rack's inventory_file the server is set to read.
+//Returns the number of bytes written to buf (excluding the terminating NUL) or -1 if buf was too small.
+int metrics_render(char *buf, size_t buf_len, const char *consolidated_file, const struct inventory_snapshot *snapshot);
+
+#endif
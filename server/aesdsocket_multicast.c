@@ -0,0 +1,116 @@
+/*-----------------------------------------------------------------------------
+Author: Geoffrey Jensen
+ECEA 5307 Final Project
+Date: 06/18/2023
+-----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include "aesdsocket_metrics.h"
+#include "aesdsocket_multicast.h"
+#include "spice_rack_multicast.h"
+#include "spice_rack_log.h"
+#include "spice_rack_trace.h"
+
+static int multicast_fd = -1;
+static struct sockaddr_storage group_addr;
+static socklen_t group_addr_len;
+static uint32_t sequence;
+//The last version sent, which the next update is encoded against
+static int have_previous;
+static struct inventory_snapshot previous;
+static struct timespec last_sent;
+
+int multicast_open(const char *group, const char *port, int ttl){
+	struct addrinfo hints, *result;
+	int ret;
+
+	if(group[0] == '\0'){
+		return 0;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	if((ret = getaddrinfo(group, port, &hints, &result)) != 0){
+		log_message(LOG_ERR, "aesdsocket_server: multicast_open - Invalid group %s port %s - %s\n", group, port, gai_strerror(ret));
+		return -1;
+	}
+	//Non-blocking, so a full send buffer drops a datagram rather than holding up the main thread
+	if((multicast_fd = socket(result->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1){
+		log_errno("aesdsocket_server: multicast_open - socket() failed");
+		freeaddrinfo(result);
+		return -1;
+	}
+	if(result->ai_family == AF_INET6){
+		ret = setsockopt(multicast_fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+	}
+	else{
+		ret = setsockopt(multicast_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	}
+	if(ret != 0){
+		log_errno("aesdsocket_server: multicast_open - Unable to set TTL %i", ttl);
+		close(multicast_fd);
+		multicast_fd = -1;
+		freeaddrinfo(result);
+		return -1;
+	}
+	memcpy(&group_addr, result->ai_addr, result->ai_addrlen);
+	group_addr_len = result->ai_addrlen;
+	freeaddrinfo(result);
+	//There's nothing yet to encode an update against, so the first datagram is a heartbeat
+	have_previous = 0;
+	log_message(LOG_INFO, "aesdsocket_server: multicast_open - Publishing inventory to %s port %s\n", group, port);
+	return 0;
+}
+
+int multicast_is_open(void){
+	return multicast_fd != -1;
+}
+
+static void multicast_send(const struct inventory_snapshot *snapshot, const struct inventory_snapshot *base, const struct timespec *now){
+	char buf[MULTICAST_MAX_DATAGRAM];
+	int len;
+
+	len = multicast_encode(snapshot, base, sequence, buf, sizeof(buf));
+	//Counted even when the send fails, so listeners see the gap
+	sequence++;
+	if(sendto(multicast_fd, buf, len, 0, (struct sockaddr *)&group_addr, group_addr_len) != len){
+		log_message(LOG_WARNING, "aesdsocket_server: multicast_send - sendto() failed - %s\n", strerror(errno));
+	}
+	else{
+		metrics_multicast_sent();
+	}
+	TRACE_INSTANT(multicast, "bytes", len, "version", snapshot->version);
+	last_sent = *now;
+}
+
+void multicast_publish(const struct inventory_snapshot *snapshot, int heartbeat_sec, const struct timespec *now){
+	if(multicast_fd == -1){
+		return;
+	}
+	if(have_previous == 1 && snapshot->version != previous.version){
+		multicast_send(snapshot, &previous, now);
+	}
+	else if(have_previous == 0 || now->tv_sec - last_sent.tv_sec >= heartbeat_sec){
+		multicast_send(snapshot, NULL, now);
+	}
+	else{
+		return;
+	}
+	previous = *snapshot;
+	have_previous = 1;
+}
+
+void multicast_close(void){
+	if(multicast_fd != -1){
+		close(multicast_fd);
+		multicast_fd = -1;
+	}
+}
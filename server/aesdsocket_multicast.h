@@ -0,0 +1,25 @@
+/*-----------------------------------------------------------------------------
+Author: Geoffrey Jensen
+ECEA 5307 Final Project
+Date: 06/18/2023
+-----------------------------------------------------------------------------*/
+
+#ifndef AESDSOCKET_MULTICAST_H
+#define AESDSOCKET_MULTICAST_H
+
+#include <time.h>
+#include "spice_rack_snapshot.h"
+
+//Publishes inventory changes to a multicast group in the format of spice_rack_multicast.h. Only the main
+//thread uses it.
+
+//Opens the publisher for group and port, IPv4 or IPv6, sending with the given TTL (hop limit). An empty
+//group leaves it closed. Returns 0 or -1.
+int multicast_open(const char *group, const char *port, int ttl);
+int multicast_is_open(void);
+//Sends an update if snapshot is a new version, or a heartbeat if nothing has been sent for heartbeat_sec.
+//now is CLOCK_MONOTONIC.
+void multicast_publish(const struct inventory_snapshot *snapshot, int heartbeat_sec, const struct timespec *now);
+void multicast_close(void);
+
+#endif
@@ -4,6 +4,8 @@ ECEA 5307 Final Project (Leveraged work from ECEA5306 Assignment #6)
 Date: 06/18/2023
 -----------------------------------------------------------------------------*/
 
+//For accept4()
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -21,18 +23,105 @@ Date: 06/18/2023
 #include <pthread.h>
 #include <time.h>
 #include <regex.h>
+#include <poll.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+#include "aesdsocket_metrics.h"
+#include "aesdsocket_multicast.h"
+#include "spice_rack_history.h"
+#include "spice_rack_snapshot.h"
+#include "spice_rack_config.h"
+#include "spice_rack_io.h"
+#include "spice_rack_log.h"
+#include "spice_rack_trace.h"
+#include "spice_rack_process.h"
 
 
+#define CONFIG_FILE "/usr/bin/spice_rack/aesdsocket_server.conf"
 #define WRITE_FILE "/usr/bin/spice_rack/spice_rack_consolidated.txt"
+#define HISTORY_DIR "/usr/bin/spice_rack/history"
+#define INVENTORY_FILE "/usr/bin/spice_rack/spice_rack_inventory.bin"
 #define PORT "9000"
+#define HTTP_PORT "9100"
 #define BACKLOG 20
 #define READ_WRITE_SIZE 1024
+#define METRICS_BUFFER_SIZE 16384
+#define HISTORY_MAX_POINTS 2048
+#define REQUEST_TIMEOUT_SEC 2
+#define KEEPALIVE_TIMEOUT_SEC 15
+#define MAX_CONNECTIONS 32
+#define SEND_TIMEOUT_SEC 5
+#define SEND_BUFFER_SIZE 65536
+#define MULTICAST_PORT "9200"
+#define MULTICAST_TTL 1
+#define MULTICAST_HEARTBEAT_SEC 5
+//Request line and headers, and any pipelined requests behind them
+#define HTTP_REQUEST_SIZE 4096
+#define POLL_TIMEOUT_MS 100
+#define LOG_LEVEL_NAME "info"
+//Events kept for -t, 72 bytes each
+#define TRACE_MAX_EVENTS 100000
+#define HTTP_UNAVAILABLE "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
 
-static bool caught_signal = false;
+static const int handled_signals[] = {SIGTERM, SIGINT, SIGHUP};
+
+//Settings read from the config file at start and on SIGHUP. Each connection thread gets its own copy
+//when it starts, so a reload never changes a setting under a request in progress.
+struct server_config {
+	char port[8];
+	char http_port[8];
+	int backlog;
+	int read_write_size;
+	int request_timeout_sec;
+	int keepalive_timeout_sec;
+	int max_connections;
+	int send_timeout_sec;
+	int send_buffer_size;
+	char write_file[PATH_MAX];
+	char history_dir[PATH_MAX];
+	char inventory_file[PATH_MAX];
+	char log_level[16];
+	//Empty to not publish
+	char multicast_group[64];
+	char multicast_port[8];
+	int multicast_ttl;
+	int multicast_heartbeat_sec;
+};
+
+static char config_file[PATH_MAX] = CONFIG_FILE;
+static struct server_config config = {
+	PORT, HTTP_PORT, BACKLOG, READ_WRITE_SIZE, REQUEST_TIMEOUT_SEC, KEEPALIVE_TIMEOUT_SEC, MAX_CONNECTIONS, SEND_TIMEOUT_SEC, SEND_BUFFER_SIZE,
+	WRITE_FILE, HISTORY_DIR, INVENTORY_FILE, LOG_LEVEL_NAME, "", MULTICAST_PORT, MULTICAST_TTL, MULTICAST_HEARTBEAT_SEC
+};
+static const struct config_option config_options[] = {
+	CONFIG_STRING_OPTION(struct server_config, port, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct server_config, http_port, CONFIG_RELOAD),
+	CONFIG_INT_OPTION(struct server_config, backlog, CONFIG_RELOAD, 1, 4096),
+	CONFIG_INT_OPTION(struct server_config, read_write_size, CONFIG_RELOAD, 64, 1048576),
+	CONFIG_INT_OPTION(struct server_config, request_timeout_sec, CONFIG_RELOAD, 1, 600),
+	CONFIG_INT_OPTION(struct server_config, keepalive_timeout_sec, CONFIG_RELOAD, 1, 600),
+	CONFIG_INT_OPTION(struct server_config, max_connections, CONFIG_RELOAD, 1, 4096),
+	CONFIG_INT_OPTION(struct server_config, send_timeout_sec, CONFIG_RELOAD, 1, 600),
+	CONFIG_INT_OPTION(struct server_config, send_buffer_size, CONFIG_RELOAD, 4096, 4194304),
+	CONFIG_STRING_OPTION(struct server_config, write_file, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct server_config, history_dir, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct server_config, inventory_file, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct server_config, log_level, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct server_config, multicast_group, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct server_config, multicast_port, CONFIG_RELOAD),
+	CONFIG_INT_OPTION(struct server_config, multicast_ttl, CONFIG_RELOAD, 1, 255),
+	CONFIG_INT_OPTION(struct server_config, multicast_heartbeat_sec, CONFIG_RELOAD, 1, 3600)
+};
 
 struct arg_struct {
 	int connected_skt_fd;
-	int thread_complete;
+	atomic_int thread_complete;
+	int is_http;
+	struct timespec start_time;
+	struct server_config config;
 };
 
 struct thread_info {
@@ -46,117 +135,774 @@ struct slist_data_struct {
 };
 
 SLIST_HEAD(slisthead,slist_data_struct) head = SLIST_HEAD_INITIALIZER(head);
+//Entries in head, each a connection thread not yet joined. Only the main thread uses it.
+static int num_connections;
 pthread_mutex_t write_lock;
+//Rendered inventory per format, reused by every request until spice_rack_app publishes a new version
+static struct snapshot_cache inventory_cache;
 
-void read_file_and_send(int socket_fd, int reader_fd){
-	ssize_t bytes_read, bytes_written;
-	char write_buffer[READ_WRITE_SIZE] = "";
-	while ((bytes_read = read(reader_fd,write_buffer,READ_WRITE_SIZE)) != 0){
-		if(bytes_read == -1) {
-			if (errno == EINTR){
-				continue;
-			}
-			perror("aesdsocket_server: read_file_and_send - Read file error: ");
-			syslog(LOG_DEBUG, "aesdsocket_server: read_file_and_send - Read file error: %s\n", strerror(errno));
-			return;
-		}
-		while(1){
-			bytes_written = write(socket_fd,write_buffer,bytes_read);
-			printf("Sending...\n%s\n", write_buffer);
-			if(bytes_written == -1){
-				if (errno == EINTR){
-					continue;
-				}
-				perror("aesdsocket_server: read_file_and_send - socket write error: ");
-				syslog(LOG_DEBUG, "aesdsocket_server: read_file_and_send - socket write error: %s\n", strerror(errno));
-				return;
-			}
-			else{
-				break;
-			}
+//Copy of the consolidated file sent to every TCP client. spice_rack_app replaces the file by rename, so a
+//stat that shows the same inode, size and mtime means the copy is still current.
+struct file_cache {
+	pthread_mutex_t lock;
+	char file_name[PATH_MAX];
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	char *data;
+	size_t len;
+};
+static struct file_cache consolidated_cache = {PTHREAD_MUTEX_INITIALIZER};
+//Binary inventory snapshot, read again only when spice_rack_app publishes a new one
+static struct file_cache inventory_file_cache = {PTHREAD_MUTEX_INITIALIZER};
+
+//Sends on a connection's non-blocking socket, giving up on a client that reads nothing for send_timeout_sec.
+//Returns 0 or -1.
+static int connection_send(const struct arg_struct *conn, const void *buf, size_t len){
+	if(send_all_timeout(conn->connected_skt_fd, buf, len, conn->config.send_timeout_sec * 1000) == 0){
+		return 0;
+	}
+	if(errno == ETIMEDOUT){
+		metrics_connection_timed_out();
+		log_message(LOG_DEBUG, "aesdsocket_server: connection_send - Client on %i not reading, dropped after %i s\n", conn->connected_skt_fd, conn->config.send_timeout_sec);
+	}
+	else{
+		log_message(LOG_DEBUG, "aesdsocket_server: connection_send - Send on %i failed - %s\n", conn->connected_skt_fd, strerror(errno));
+	}
+	return -1;
+}
+
+//Sends the client a FIN now rather than when the main thread next joins and closes, then marks the
+//connection's thread ready to join
+static void connection_done(struct arg_struct *conn){
+	shutdown(conn->connected_skt_fd, SHUT_WR);
+	conn->thread_complete = 1;
+}
+
+void read_file_and_send(const struct arg_struct *conn, int reader_fd){
+	ssize_t bytes_read;
+	size_t bytes_sent = 0;
+	uint64_t span_start;
+	char *write_buffer;
+	if((write_buffer = (char *)malloc(conn->config.read_write_size * sizeof(char))) == NULL){
+		log_errno("aesdsocket_server: read_file_and_send - Failed to Malloc");
+		return;
+	}
+	TRACE_BEGIN(send, span_start);
+	while((bytes_read = read_full(reader_fd, write_buffer, conn->config.read_write_size)) > 0){
+		if(connection_send(conn, write_buffer, bytes_read) != 0){
+			break;
 		}
+		metrics_add_bytes_sent(bytes_read);
+		bytes_sent = bytes_sent + bytes_read;
+	}
+	TRACE_END(send, span_start, "fd", conn->connected_skt_fd, "bytes", bytes_sent);
+	if(bytes_read == -1){
+		log_errno("aesdsocket_server: read_file_and_send - Read file error");
 	}
+	free(write_buffer);
 	return;
 }
 
-static void socket_signal_handler (int signal_number){
-	if (signal_number == SIGTERM || signal_number == SIGINT){
-		caught_signal = true;
-	} 
+static int file_cache_matches(const struct file_cache *cache, const char *file_name, const struct stat *file_stat){
+	return cache->data != NULL && strcmp(cache->file_name, file_name) == 0 && cache->dev == file_stat->st_dev &&
+		cache->ino == file_stat->st_ino && cache->size == file_stat->st_size &&
+		cache->mtime.tv_sec == file_stat->st_mtim.tv_sec && cache->mtime.tv_nsec == file_stat->st_mtim.tv_nsec;
+}
+
+//Reads file_name into the cache if it changed since it was last read. Called with the cache locked.
+static int file_cache_reload(struct file_cache *cache, const char *file_name){
+	struct stat file_stat;
+	ssize_t bytes_read;
+	size_t len = 0;
+	char *data;
+	int fd;
+
+	if((fd = open(file_name, O_RDONLY)) == -1){
+		return -1;
+	}
+	if(fstat(fd, &file_stat) != 0){
+		close(fd);
+		return -1;
+	}
+	if(file_cache_matches(cache, file_name, &file_stat)){
+		close(fd);
+		return 0;
+	}
+	if((data = (char *)malloc(file_stat.st_size + 1)) == NULL){
+		log_message(LOG_DEBUG, "aesdsocket_server: file_cache_reload - Failed to Malloc - %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if((bytes_read = read_full(fd, data, file_stat.st_size)) == -1){
+		log_message(LOG_DEBUG, "aesdsocket_server: file_cache_reload - Read file error: %s\n", strerror(errno));
+		free(data);
+		close(fd);
+		return -1;
+	}
+	len = bytes_read;
+	close(fd);
+	free(cache->data);
+	cache->data = data;
+	cache->len = len;
+	snprintf(cache->file_name, sizeof(cache->file_name), "%s", file_name);
+	cache->dev = file_stat.st_dev;
+	cache->ino = file_stat.st_ino;
+	cache->size = file_stat.st_size;
+	cache->mtime = file_stat.st_mtim;
+	return 0;
+}
+
+//Returns a copy of file_name that the caller frees, reading the file only if it changed since the last
+//client. One stat per client instead of an open, reads and a close. NULL if the file can't be read.
+static char *file_cache_copy(struct file_cache *cache, const char *file_name, size_t *len){
+	struct stat file_stat;
+	char *copy = NULL;
+
+	if(stat(file_name, &file_stat) != 0){
+		return NULL;
+	}
+	pthread_mutex_lock(&cache->lock);
+	if(file_cache_matches(cache, file_name, &file_stat) || file_cache_reload(cache, file_name) == 0){
+		if((copy = (char *)malloc(cache->len + 1)) != NULL){
+			memcpy(copy, cache->data, cache->len);
+			*len = cache->len;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return copy;
 }
 
 void *data_processor(void *input_args){
 	struct arg_struct *in_args = input_args;
-	int writer_fd = open(WRITE_FILE, O_RDONLY | O_CREAT | O_APPEND, 0644);
+	uint64_t span_start;
+	size_t len;
+	char *data;
+	int writer_fd;
+
+	if((data = file_cache_copy(&consolidated_cache, in_args->config.write_file, &len)) != NULL){
+		log_message(LOG_DEBUG, "aesdsocket_server: data_processor - Sending %zu bytes\n", len);
+		TRACE_BEGIN(send, span_start);
+		if(connection_send(in_args, data, len) == 0){
+			metrics_add_bytes_sent(len);
+		}
+		TRACE_END(send, span_start, "fd", in_args->connected_skt_fd, "bytes", len);
+		free(data);
+		metrics_connection_closed(&in_args->start_time);
+		connection_done(in_args);
+		return input_args;
+	}
+	//Missing file, created empty as before
+	writer_fd = open(in_args->config.write_file, O_RDONLY | O_CREAT | O_APPEND, 0644);
 	if(writer_fd == -1){
-		perror("aesdsocket_server: data_processor - Unable to open file: ");
-		syslog(LOG_DEBUG, "aesdsocket_server: data_processor - Unable to open %s file: %s\n", WRITE_FILE, strerror(errno));
+		log_errno("aesdsocket_server: data_processor - Unable to open %s file", in_args->config.write_file);
 	}
-	read_file_and_send(in_args->connected_skt_fd, writer_fd);
-	in_args->thread_complete=1;
+	read_file_and_send(in_args, writer_fd);
+	metrics_connection_closed(&in_args->start_time);
+	connection_done(in_args);
 	close(writer_fd);
 	return input_args;
 }
 
-int add_slist_entry(int connected_skt_fd){
-	struct slist_data_struct *entry;
-	struct slist_data_struct *current_entry;
-	entry  = (struct slist_data_struct*)malloc(sizeof(struct slist_data_struct));
-	entry->tinfo.input_args.connected_skt_fd = connected_skt_fd;
-	entry->tinfo.input_args.thread_complete = 0;
-	pthread_create(&entry->tinfo.thread_id,NULL,data_processor,(void *)&entry->tinfo.input_args);
-	if(SLIST_EMPTY(&head) != 0){
-		SLIST_INSERT_HEAD(&head, entry, entries);
+//One request from the HTTP port. The strings point into the connection's request buffer.
+struct http_request {
+	int head;
+	int keep_alive;
+	char *path;
+	char *query;
+	//NULL when the client has nothing cached
+	char *if_none_match;
+};
+
+//Sends the status line, headers and body. A response with an etag tells the client to revalidate each
+//time, which costs it a 304 with no body while the inventory is unchanged.
+static void send_response(const struct arg_struct *conn, const struct http_request *req, const char *status, const char *content_type, const char *etag, const char *body, int body_len){
+	char header[384];
+	int header_len;
+	uint64_t span_start;
+
+	header_len = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %i\r\n%s%s%sConnection: %s\r\n\r\n",
+		status, content_type, body_len, etag != NULL ? "Cache-Control: no-cache\r\nETag: " : "", etag != NULL ? etag : "",
+		etag != NULL ? "\r\n" : "", req->keep_alive == 1 ? "keep-alive" : "close");
+	TRACE_BEGIN(send, span_start);
+	if(connection_send(conn, header, header_len) == 0 && body_len > 0 && req->head == 0){
+		connection_send(conn, body, body_len);
+	}
+	TRACE_END(send, span_start, "fd", conn->connected_skt_fd, "bytes", header_len + (req->head == 0 ? body_len : 0));
+	metrics_http_response(0);
+}
+
+static void send_error(const struct arg_struct *conn, const struct http_request *req, const char *status){
+	char body[64];
+
+	send_response(conn, req, status, "text/plain", NULL, body, snprintf(body, sizeof(body), "%s\n", status));
+}
+
+//Answers 304 if the client's If-None-Match has etag, in which case it returns 1 and the caller sends nothing
+//else. "*" and weak W/ tags match too.
+static int send_not_modified(const struct arg_struct *conn, const struct http_request *req, const char *etag){
+	char header[160];
+	int header_len;
+
+	if(req->if_none_match == NULL || (strcmp(req->if_none_match, "*") != 0 && strstr(req->if_none_match, etag) == NULL)){
+		return 0;
+	}
+	header_len = snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\nCache-Control: no-cache\r\nETag: %s\r\nConnection: %s\r\n\r\n",
+		etag, req->keep_alive == 1 ? "keep-alive" : "close");
+	connection_send(conn, header, header_len);
+	metrics_http_response(1);
+	return 1;
+}
+
+//Copies the value of key from a "a=1&b=2" query string. Returns 0 if found.
+static int query_param(const char *query, const char *key, char *value, size_t value_len){
+	size_t key_len = strlen(key);
+	size_t len;
+	while(query != NULL && *query != '\0'){
+		if(strncmp(query, key, key_len) == 0 && query[key_len] == '='){
+			query = query + key_len + 1;
+			len = strcspn(query, "&");
+			if(len >= value_len){
+				len = value_len - 1;
+			}
+			memcpy(value, query, len);
+			value[len] = '\0';
+			return 0;
+		}
+		query = strchr(query, '&');
+		if(query != NULL){
+			query++;
+		}
+	}
+	return -1;
+}
+
+//Parses a whole query value as seconds since the epoch. Returns 0 on success, -1 if it isn't a number, is
+//out of range or is negative.
+static int parse_time_param(const char *value, time_t *time){
+	char *end;
+	long long seconds;
+
+	errno = 0;
+	seconds = strtoll(value, &end, 10);
+	if(end == value || *end != '\0' || errno != 0 || seconds < 0){
+		return -1;
+	}
+	*time = (time_t)seconds;
+	return 0;
+}
+
+//Decodes the binary snapshot published by spice_rack_app, reading the file only when the app has replaced
+//it. Returns 0 or -1.
+static int load_inventory(const char *inventory_file, struct inventory_snapshot *snapshot){
+	size_t len;
+	char *data;
+	int ret;
+
+	if((data = file_cache_copy(&inventory_file_cache, inventory_file, &len)) == NULL){
+		log_message(LOG_DEBUG, "aesdsocket_server: load_inventory - Unable to read %s\n", inventory_file);
+		return -1;
+	}
+	if((ret = snapshot_decode(data, len, snapshot)) != 0){
+		log_message(LOG_DEBUG, "aesdsocket_server: load_inventory - %s is not a valid snapshot\n", inventory_file);
+	}
+	free(data);
+	return ret;
+}
+
+static void serve_metrics(const struct arg_struct *conn, const struct http_request *req){
+	const struct server_config *config = &conn->config;
+	struct inventory_snapshot snapshot;
+	char *body;
+	int body_len;
+
+	if((body = (char *)malloc(METRICS_BUFFER_SIZE * sizeof(char))) == NULL){
+		log_errno("aesdsocket_server: serve_metrics - Failed to Malloc");
+		send_error(conn, req, "500 Internal Server Error");
+		return;
+	}
+	body_len = metrics_render(body, METRICS_BUFFER_SIZE, config->write_file,
+		load_inventory(config->inventory_file, &snapshot) == 0 ? &snapshot : NULL);
+	if(body_len == -1){
+		log_message(LOG_DEBUG, "aesdsocket_server: serve_metrics - Metrics did not fit in %i bytes\n", METRICS_BUFFER_SIZE);
+		send_error(conn, req, "500 Internal Server Error");
+	}
+	else{
+		send_response(conn, req, "200 OK", "text/plain; version=0.0.4", NULL, body, body_len);
+		metrics_scrape_served();
+	}
+	free(body);
+}
+
+//GET /history?slot=N&res=raw|minute|hour|day&from=<unix time>&to=<unix time>, answered as CSV
+static void serve_history(const struct arg_struct *conn, const struct http_request *req){
+	const struct server_config *config = &conn->config;
+	struct history_point *points;
+	char value[32];
+	char *body;
+	char *new_body;
+	size_t body_size = HISTORY_MAX_POINTS * 96;
+	int body_len = 0;
+	int row_len;
+	int num_points;
+	int slot;
+	int resolution = HISTORY_MINUTE;
+	time_t to = time(NULL);
+	time_t from = to - 86400;
+	int i;
+
+	if(query_param(req->query, "slot", value, sizeof(value)) != 0 || (slot = atoi(value)) < 1){
+		send_response(conn, req, "400 Bad Request", "text/plain", NULL, "slot is required\n", 17);
+		return;
+	}
+	if(query_param(req->query, "res", value, sizeof(value)) == 0 && (resolution = history_resolution_from_string(value)) == -1){
+		send_response(conn, req, "400 Bad Request", "text/plain", NULL, "res must be raw, minute, hour or day\n", 37);
+		return;
+	}
+	if(query_param(req->query, "to", value, sizeof(value)) == 0 && parse_time_param(value, &to) != 0){
+		send_response(conn, req, "400 Bad Request", "text/plain", NULL, "to must be a time in seconds\n", 29);
+		return;
+	}
+	if(query_param(req->query, "from", value, sizeof(value)) == 0 && parse_time_param(value, &from) != 0){
+		send_response(conn, req, "400 Bad Request", "text/plain", NULL, "from must be a time in seconds\n", 31);
+		return;
+	}
+	if(from > to){
+		send_response(conn, req, "400 Bad Request", "text/plain", NULL, "from must not be after to\n", 26);
+		return;
+	}
+
+	points = (struct history_point *)malloc(HISTORY_MAX_POINTS * sizeof(struct history_point));
+	body = (char *)malloc(body_size * sizeof(char));
+	if(points == NULL || body == NULL){
+		log_errno("aesdsocket_server: serve_history - Failed to Malloc");
+		send_error(conn, req, "500 Internal Server Error");
+		free(points);
+		free(body);
+		return;
+	}
+	num_points = history_query(config->history_dir, slot, resolution, from, to, points, HISTORY_MAX_POINTS);
+	if(num_points == -1){
+		send_response(conn, req, "404 Not Found", "text/plain", NULL, "no history for slot\n", 20);
+	}
+	else{
+		body_len = snprintf(body, body_size, "time,min_grams,max_grams,avg_grams,last_grams,count\n");
+		i = 0;
+		while(i < num_points){
+			row_len = snprintf(body + body_len, body_size - body_len, "%lld,%.2f,%.2f,%.2f,%.2f,%u\n",
+				(long long)points[i].time, points[i].min, points[i].max, points[i].avg, points[i].last, points[i].count);
+			//A wild reading prints wider than the rows were sized for, so the row is written again into a
+			//bigger buffer rather than cut off
+			if((size_t)row_len >= body_size - body_len){
+				body_size = body_size * 2;
+				if((new_body = (char *)realloc(body, body_size * sizeof(char))) == NULL){
+					log_errno("aesdsocket_server: serve_history - Failed to Realloc");
+					break;
+				}
+				body = new_body;
+				continue;
+			}
+			body_len = body_len + row_len;
+			i++;
+		}
+		if(i < num_points){
+			send_error(conn, req, "500 Internal Server Error");
+		}
+		else{
+			send_response(conn, req, "200 OK", "text/csv", NULL, body, body_len);
+		}
+	}
+	free(points);
+	free(body);
+}
+
+//The ?format= of an inventory request, text if there isn't one. -1 if it's unknown.
+static int request_format(const struct http_request *req){
+	char value[16];
+
+	if(query_param(req->query, "format", value, sizeof(value)) != 0){
+		return SNAPSHOT_TEXT;
+	}
+	return snapshot_format_from_string(value);
+}
+
+//GET /inventory?format=text|json|csv|binary. The ETag is the snapshot version and the time it was taken,
+//so a snapshot republished under an old version after a restart still looks changed.
+static void serve_inventory(const struct arg_struct *conn, const struct http_request *req){
+	struct inventory_snapshot snapshot;
+	char etag[80];
+	char *body;
+	int format;
+	int body_len;
+
+	if((format = request_format(req)) == -1){
+		send_response(conn, req, "400 Bad Request", "text/plain", NULL, "format must be text, json, csv or binary\n", 41);
+		return;
+	}
+	if(load_inventory(conn->config.inventory_file, &snapshot) != 0){
+		send_error(conn, req, "503 Service Unavailable");
+		return;
+	}
+	snprintf(etag, sizeof(etag), "\"%llu-%lli-%i\"", (unsigned long long)snapshot.version, (long long)snapshot.taken, format);
+	if(send_not_modified(conn, req, etag) == 1){
+		return;
+	}
+	if((body = (char *)malloc(SNAPSHOT_BUFFER_SIZE * sizeof(char))) == NULL){
+		log_errno("aesdsocket_server: serve_inventory - Failed to Malloc");
+		send_error(conn, req, "500 Internal Server Error");
+		return;
+	}
+	body_len = snapshot_cache_render(&inventory_cache, &snapshot, format, body, SNAPSHOT_BUFFER_SIZE);
+	if(body_len == -1){
+		send_error(conn, req, "500 Internal Server Error");
+	}
+	else{
+		send_response(conn, req, "200 OK", snapshot_content_type(format), etag, body, body_len);
+	}
+	free(body);
+}
+
+//GET /slot/N?format=..., one slot rendered as a one slot inventory, tagged like the inventory it came from
+static void serve_slot(const struct arg_struct *conn, const struct http_request *req, const char *slot_name){
+	struct inventory_snapshot snapshot;
+	char etag[80];
+	char *body;
+	char *end;
+	long slot;
+	int format;
+	int body_len;
+
+	if((format = request_format(req)) == -1){
+		send_response(conn, req, "400 Bad Request", "text/plain", NULL, "format must be text, json, csv or binary\n", 41);
+		return;
+	}
+	if(load_inventory(conn->config.inventory_file, &snapshot) != 0){
+		send_error(conn, req, "503 Service Unavailable");
+		return;
+	}
+	slot = strtol(slot_name, &end, 10);
+	if(*slot_name == '\0' || *end != '\0' || slot < 1 || slot > snapshot.num_slots){
+		send_response(conn, req, "404 Not Found", "text/plain", NULL, "no such slot\n", 13);
+		return;
+	}
+	snprintf(etag, sizeof(etag), "\"%llu-%lli-%i-%li\"", (unsigned long long)snapshot.version, (long long)snapshot.taken, format, slot);
+	if(send_not_modified(conn, req, etag) == 1){
+		return;
+	}
+	if((body = (char *)malloc(SNAPSHOT_BUFFER_SIZE * sizeof(char))) == NULL){
+		log_errno("aesdsocket_server: serve_slot - Failed to Malloc");
+		send_error(conn, req, "500 Internal Server Error");
+		return;
+	}
+	snapshot.slots[0] = snapshot.slots[slot - 1];
+	snapshot.num_slots = 1;
+	body_len = snapshot_serialize(&snapshot, format, body, SNAPSHOT_BUFFER_SIZE);
+	if(body_len == -1){
+		send_error(conn, req, "500 Internal Server Error");
+	}
+	else{
+		send_response(conn, req, "200 OK", snapshot_content_type(format), etag, body, body_len);
+	}
+	free(body);
+}
+
+//GET /healthz, 200 while there is an inventory and the rack's sensors haven't failed, 503 otherwise
+static void serve_healthz(const struct arg_struct *conn, const struct http_request *req){
+	struct inventory_snapshot snapshot;
+	char body[64];
+	int body_len;
+
+	if(load_inventory(conn->config.inventory_file, &snapshot) != 0){
+		send_response(conn, req, "503 Service Unavailable", "text/plain", NULL, "no inventory\n", 13);
+		return;
+	}
+	body_len = snprintf(body, sizeof(body), "%s version %llu\n", snapshot_health_name(snapshot.health), (unsigned long long)snapshot.version);
+	send_response(conn, req, snapshot.health == SNAPSHOT_HEALTH_FAILED ? "503 Service Unavailable" : "200 OK", "text/plain", NULL, body, body_len);
+}
+
+//Cuts the line at the cursor off at its CRLF and moves the cursor past it. NULL after the last line.
+static char *next_line(char **cursor){
+	char *line = *cursor;
+	char *end;
+
+	if(line == NULL){
+		return NULL;
+	}
+	if((end = strstr(line, "\r\n")) != NULL){
+		*end = '\0';
+		*cursor = end + 2;
+	}
+	else{
+		*cursor = NULL;
+	}
+	return line;
+}
+
+//Splits the request line and picks out the headers the server acts on. request is the request line and
+//headers, NUL terminated at the blank line. Returns NULL, or the status to answer with before closing.
+static const char *http_parse_request(char *request, struct http_request *req){
+	char *cursor = request;
+	char *method;
+	char *version;
+	char *line;
+	char *value;
+
+	memset(req, 0, sizeof(*req));
+	method = next_line(&cursor);
+	if((req->path = strchr(method, ' ')) == NULL || (version = strchr(req->path + 1, ' ')) == NULL){
+		return "400 Bad Request";
+	}
+	*req->path++ = '\0';
+	*version++ = '\0';
+	if(strncmp(version, "HTTP/1.", 7) != 0){
+		return "505 HTTP Version Not Supported";
+	}
+	//Persistent by default from HTTP/1.1 on
+	req->keep_alive = strcmp(version, "HTTP/1.0") != 0;
+	req->head = strcmp(method, "HEAD") == 0;
+	if(req->head == 0 && strcmp(method, "GET") != 0){
+		return "501 Not Implemented";
+	}
+	if((req->query = strchr(req->path, '?')) != NULL){
+		*req->query++ = '\0';
+	}
+	while((line = next_line(&cursor)) != NULL){
+		if((value = strchr(line, ':')) == NULL){
+			continue;
+		}
+		*value++ = '\0';
+		value = value + strspn(value, " \t");
+		if(strcasecmp(line, "Connection") == 0){
+			if(strcasestr(value, "close") != NULL){
+				req->keep_alive = 0;
+			}
+			else if(strcasestr(value, "keep-alive") != NULL){
+				req->keep_alive = 1;
+			}
+		}
+		else if(strcasecmp(line, "If-None-Match") == 0){
+			req->if_none_match = value;
+		}
+		//Nothing here takes a body, and one left unread would be taken for the next request
+		else if((strcasecmp(line, "Content-Length") == 0 && strtol(value, NULL, 10) != 0) || strcasecmp(line, "Transfer-Encoding") == 0){
+			return "400 Bad Request";
+		}
+	}
+	return NULL;
+}
+
+static void http_route(const struct arg_struct *conn, const struct http_request *req){
+	if(strcmp(req->path, "/metrics") == 0 || strcmp(req->path, "/") == 0){
+		serve_metrics(conn, req);
+	}
+	else if(strcmp(req->path, "/history") == 0){
+		serve_history(conn, req);
+	}
+	else if(strcmp(req->path, "/inventory") == 0){
+		serve_inventory(conn, req);
+	}
+	else if(strncmp(req->path, "/slot/", 6) == 0){
+		serve_slot(conn, req, req->path + 6);
+	}
+	else if(strcmp(req->path, "/healthz") == 0){
+		serve_healthz(conn, req);
 	}
 	else{
-		SLIST_FOREACH(current_entry, &head, entries){
-			if(current_entry->entries.sle_next == NULL){
-				SLIST_INSERT_AFTER(current_entry, entry, entries);
+		send_error(conn, req, "404 Not Found");
+	}
+}
+
+//Holds back partial packets while replies are written, so the replies to pipelined requests go out together
+//and a header is never sent on its own ahead of its body
+static void set_cork(int socket_fd, int cork){
+	if(setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) == -1){
+		log_message(LOG_DEBUG, "aesdsocket_server: set_cork - setsockopt failed - %s\n", strerror(errno));
+	}
+}
+
+//Serves the HTTP port as HTTP/1.1. Requests on a keep-alive connection, pipelined ones included, are answered
+//in order until the client closes, asks to, or is idle for keepalive_timeout_sec.
+void *http_processor(void *input_args){
+	struct arg_struct *in_args = input_args;
+	struct http_request req;
+	char buffer[HTTP_REQUEST_SIZE];
+	const char *error;
+	char *end;
+	size_t buffered = 0;
+	size_t request_len;
+	ssize_t bytes_read;
+	int timeout_sec;
+	int served = 0;
+	int between_requests;
+	int corked = 0;
+
+	while(1){
+		if((end = memmem(buffer, buffered, "\r\n\r\n", 4)) == NULL){
+			if(buffered == sizeof(buffer)){
+				req.head = 0;
+				req.keep_alive = 0;
+				send_error(in_args, &req, "431 Request Header Fields Too Large");
+				break;
+			}
+			//Replies so far go out before waiting on the client
+			if(corked == 1){
+				set_cork(in_args->connected_skt_fd, 0);
+				corked = 0;
+			}
+			//request_timeout_sec is how long the client may go quiet part way through a request. Between
+			//requests it gets keepalive_timeout_sec.
+			between_requests = served > 0 && buffered == 0;
+			timeout_sec = between_requests == 1 ? in_args->config.keepalive_timeout_sec : in_args->config.request_timeout_sec;
+			bytes_read = recv_timeout(in_args->connected_skt_fd, buffer + buffered, sizeof(buffer) - buffered, timeout_sec * 1000);
+			if(bytes_read == -1 && errno == ETIMEDOUT && between_requests == 0){
+				metrics_connection_timed_out();
+				log_message(LOG_DEBUG, "aesdsocket_server: http_processor - Client on %i idle for %i s, closing\n", in_args->connected_skt_fd, timeout_sec);
+			}
+			if(bytes_read <= 0){
 				break;
 			}
+			buffered = buffered + bytes_read;
+			continue;
+		}
+		*end = '\0';
+		request_len = end + 4 - buffer;
+		if(corked == 0){
+			set_cork(in_args->connected_skt_fd, 1);
+			corked = 1;
 		}
+		if((error = http_parse_request(buffer, &req)) != NULL){
+			req.keep_alive = 0;
+			send_error(in_args, &req, error);
+			break;
+		}
+		http_route(in_args, &req);
+		served++;
+		if(req.keep_alive == 0){
+			break;
+		}
+		buffered = buffered - request_len;
+		memmove(buffer, buffer + request_len, buffered);
 	}
-	return 0;
+	if(corked == 1){
+		set_cork(in_args->connected_skt_fd, 0);
+	}
+	connection_done(in_args);
+	return input_args;
 }
 
-//Check the input argument count to ensure both arguments are provided
-int main(int argc, char *argv[]){
-	int skt_fd, connected_skt_fd, daemon_pid, ret_val;
-	struct addrinfo skt_addrinfo, *res_skt_addrinfo, *rp;
-	struct sockaddr connected_sktaddr;
-        char client_ip_hostview[INET_ADDRSTRLEN];
-	struct sigaction socket_sigaction;
-	int yes=1;
-	struct slist_data_struct *current_entry;
+//Refuses a connection over max_connections. It's accepted and closed straight away rather than left in the
+//listen queue, so the client finds out at once and the queue keeps moving for the ones that get in.
+static void reject_connection(int connected_skt_fd, int is_http){
+	char discard[HTTP_REQUEST_SIZE];
 
-	openlog(NULL,0,LOG_USER);
-	syslog(LOG_DEBUG,"aesdsocket_server main - Starting Script Over\n");	
+	metrics_connection_rejected();
+	log_message(LOG_WARNING, "aesdsocket_server: reject_connection - %i connections open, refusing another\n", num_connections);
+	if(is_http == 1){
+		//Best effort, as the socket's buffer is empty and the reply is tiny
+		send(connected_skt_fd, HTTP_UNAVAILABLE, strlen(HTTP_UNAVAILABLE), MSG_NOSIGNAL | MSG_DONTWAIT);
+	}
+	//Closing with a request still unread resets the connection, which can lose the reply
+	shutdown(connected_skt_fd, SHUT_WR);
+	while(recv(connected_skt_fd, discard, sizeof(discard), MSG_DONTWAIT) > 0);
+	close(connected_skt_fd);
+	TRACE_INSTANT(close, "fd", connected_skt_fd, "http", is_http);
+}
 
-	//Initialize SLIST Head
-	SLIST_INIT(&head);
+//Starts a thread for connected_skt_fd, which is non-blocking. Returns 0, or -1 if the connection was refused
+//and closed.
+int add_slist_entry(int connected_skt_fd, int is_http){
+	struct slist_data_struct *entry;
+	int ret;
 
-	//Setup signal handler
-	memset(&socket_sigaction,0,sizeof(struct sigaction));
-	socket_sigaction.sa_handler=socket_signal_handler;
-	if(sigaction(SIGTERM, &socket_sigaction, NULL) != 0) {
-		perror("aesdsocket_server: main - Error registering for SIGTERM - ");
-                syslog(LOG_DEBUG, "aesdsocket_server: main - Error registering for SIGTERM - %s\n", strerror(errno));
+	if(num_connections >= config.max_connections){
+		reject_connection(connected_skt_fd, is_http);
+		return -1;
+	}
+	if((entry = (struct slist_data_struct*)malloc(sizeof(struct slist_data_struct))) == NULL){
+		log_errno("aesdsocket_server: add_slist_entry - Failed to Malloc");
+		reject_connection(connected_skt_fd, is_http);
+		return -1;
+	}
+	//Bounds what a client that stops reading can leave queued in the kernel
+	if(setsockopt(connected_skt_fd, SOL_SOCKET, SO_SNDBUF, &config.send_buffer_size, sizeof(config.send_buffer_size)) == -1){
+		log_message(LOG_DEBUG, "aesdsocket_server: add_slist_entry - setsockopt failed - %s\n", strerror(errno));
+	}
+	entry->tinfo.input_args.connected_skt_fd = connected_skt_fd;
+	atomic_init(&entry->tinfo.input_args.thread_complete, 0);
+	entry->tinfo.input_args.is_http = is_http;
+	entry->tinfo.input_args.config = config;
+	clock_gettime(CLOCK_MONOTONIC, &entry->tinfo.input_args.start_time);
+	if(is_http == 1){
+		ret = pthread_create(&entry->tinfo.thread_id,NULL,http_processor,(void *)&entry->tinfo.input_args);
+	}
+	else{
+		ret = pthread_create(&entry->tinfo.thread_id,NULL,data_processor,(void *)&entry->tinfo.input_args);
+	}
+	if(ret != 0){
+		errno = ret;
+		log_errno("aesdsocket_server: add_slist_entry - Failed to start connection thread");
+		free(entry);
+		reject_connection(connected_skt_fd, is_http);
+		return -1;
 	}
-	if(sigaction(SIGINT, &socket_sigaction, NULL) != 0) {
-		perror("aesdsocket_server: main - Error registering for SIGINT - ");
-                syslog(LOG_DEBUG, "aesdsocket_server: main - Error registering for SIGINT - %s\n", strerror(errno));
+	if(is_http == 0){
+		metrics_connection_accepted();
 	}
+	SLIST_INSERT_HEAD(&head, entry, entries);
+	num_connections++;
+	return 0;
+}
+
+//Joins and frees every finished connection. When stopping, every other connection is shut down first so
+//its thread returns, and all of them are joined.
+static void reap_connections(bool stopping){
+	struct slist_data_struct *entry;
+	struct slist_data_struct *next;
+	struct slist_data_struct *prev = NULL;
+
+	if(stopping == true){
+		SLIST_FOREACH(entry, &head, entries){
+			shutdown(entry->tinfo.input_args.connected_skt_fd, SHUT_RDWR);
+		}
+	}
+	for(entry = SLIST_FIRST(&head); entry != NULL; entry = next){
+		next = SLIST_NEXT(entry, entries);
+		if(stopping == false && atomic_load(&entry->tinfo.input_args.thread_complete) == 0){
+			prev = entry;
+			continue;
+		}
+		log_message(LOG_DEBUG,"aesdsocket_server: reap_connections - Attempting to join thread pointed to by %i\n",entry->tinfo.input_args.connected_skt_fd);
+		pthread_join(entry->tinfo.thread_id,NULL);
+		//Close connection
+		close(entry->tinfo.input_args.connected_skt_fd);
+		TRACE_INSTANT(close, "fd", entry->tinfo.input_args.connected_skt_fd, "http", entry->tinfo.input_args.is_http);
+		if(prev == NULL){
+			SLIST_REMOVE_HEAD(&head, entries);
+		}
+		else{
+			SLIST_NEXT(prev, entries) = next;
+		}
+		free(entry);
+		num_connections--;
+	}
+}
+
+//Open a non-blocking listening socket bound to port. Returns the socket fd or -1.
+static int setup_listen_socket(const char *port, int backlog){
+	int skt_fd = -1, ret_val;
+	struct addrinfo skt_addrinfo, *res_skt_addrinfo, *rp;
+	int yes=1;
 
 	//Setup addrinfo struct
-	socklen_t sktaddr_size;
 	memset(&skt_addrinfo,0,sizeof skt_addrinfo);
 	skt_addrinfo.ai_family = AF_INET;
 	skt_addrinfo.ai_socktype = SOCK_STREAM;
 	skt_addrinfo.ai_flags = AI_PASSIVE;
-	ret_val = getaddrinfo(NULL,PORT,&skt_addrinfo,&res_skt_addrinfo);
+	ret_val = getaddrinfo(NULL,port,&skt_addrinfo,&res_skt_addrinfo);
 	if(ret_val != 0){
-		perror("aesdsocket_server: main - getaddrinfo() failed - ");
-		syslog(LOG_DEBUG,"aesdsocket_server: main - gettaddrinfo() returned %s\n",gai_strerror(ret_val));
+		perror("aesdsocket_server: setup_listen_socket - getaddrinfo() failed - ");
+		log_message(LOG_DEBUG,"aesdsocket_server: setup_listen_socket - gettaddrinfo() returned %s\n",gai_strerror(ret_val));
 		return -1;
 	}
 
@@ -164,101 +910,256 @@ int main(int argc, char *argv[]){
 	for(rp = res_skt_addrinfo; rp != NULL; rp = rp->ai_next){
 		skt_fd = socket(PF_INET,SOCK_STREAM | SOCK_NONBLOCK,0);
 		if(skt_fd == -1){
-			perror("aesdsocket_server: main - socket() failed - ");
-			syslog(LOG_DEBUG, "aesdsocket_server: main - socket() failed - %s\n", strerror(errno));
+			log_errno("aesdsocket_server: setup_listen_socket - socket() failed");
 			continue;
 		}	
 		if(setsockopt(skt_fd,SOL_SOCKET,SO_REUSEADDR,&yes,sizeof yes) == -1){
-			perror("aesdsocket_server: main - setsockopt failed - ");
-			syslog(LOG_DEBUG, "aesdsocket_server: main - setsockopt failed - %s\n", strerror(errno));
+			log_errno("aesdsocket_server: setup_listen_socket - setsockopt failed");
 		}
-		ret_val = bind(skt_fd,res_skt_addrinfo->ai_addr,res_skt_addrinfo->ai_addrlen);
+		ret_val = bind(skt_fd,rp->ai_addr,rp->ai_addrlen);
 		if(ret_val != 0){
-			perror("aesdsocket_server: main - bind() failed - ");
-			syslog(LOG_DEBUG,"aesdsocket_server: main - bind() failed - %s\n", strerror(errno));
+			log_errno("aesdsocket_server: setup_listen_socket - bind() to port %s failed", port);
+			close(skt_fd);
+			skt_fd = -1;
 			continue;
 		}
 		else{
-			syslog(LOG_DEBUG,"aesdsocket_server: main - bind() successful\n");
+			log_message(LOG_DEBUG,"aesdsocket_server: setup_listen_socket - bind() to port %s successful\n", port);
 			break;
 		}
 	}
 	freeaddrinfo(res_skt_addrinfo);
+	if(skt_fd == -1){
+		return -1;
+	}
 	
 	//Listen
-	ret_val = listen(skt_fd,BACKLOG);
+	ret_val = listen(skt_fd,backlog);
 	if(ret_val != 0){
-		perror("aesdsocket_server: main - listen() failed: ");
-		syslog(LOG_DEBUG, "aesdsocket_server: main - listen() failed - %s\n", strerror(errno));
+		log_errno("aesdsocket_server: setup_listen_socket - listen() failed");
+		close(skt_fd);
 		return -1;
 	}
+	return skt_fd;
+}
 
-	//Start Daemon if user provided -d argument
-	if(argc == 2){
-		if(strcmp(argv[1],"-d") == 0){
-			syslog(LOG_DEBUG,"aesdsocket_server: main - Starting Daemon\n");
-			//Create Daemon
-			daemon_pid = fork();
-			if (daemon_pid == -1){
+//Swaps a listening socket for one on port. The old socket keeps serving if the new port can't be bound.
+static int rebind_listen_socket(int *skt_fd, const char *port, int backlog){
+	int new_fd;
+	if((new_fd = setup_listen_socket(port, backlog)) == -1){
+		log_message(LOG_ERR, "aesdsocket_server: rebind_listen_socket - Unable to listen on port %s, keeping the current port\n", port);
+		return -1;
+	}
+	if(*skt_fd != -1){
+		close(*skt_fd);
+	}
+	*skt_fd = new_fd;
+	return 0;
+}
+
+//Applies a port or backlog change to one listening socket. Returns the port actually in use.
+static const char *apply_listen_config(int *skt_fd, const char *old_port, const char *new_port, int old_backlog, int new_backlog){
+	if(strcmp(old_port, new_port) != 0 || *skt_fd == -1){
+		return rebind_listen_socket(skt_fd, new_port, new_backlog) == 0 ? new_port : old_port;
+	}
+	//listen() on a listening socket just updates its backlog
+	if(old_backlog != new_backlog && listen(*skt_fd, new_backlog) != 0){
+		log_message(LOG_DEBUG, "aesdsocket_server: apply_listen_config - listen() failed - %s\n", strerror(errno));
+	}
+	return old_port;
+}
+
+//Sends the inventory to the multicast group when it changes, checking at most every POLL_TIMEOUT_MS
+//however busy the ports are
+static void publish_inventory(void){
+	static struct timespec last_check;
+	struct inventory_snapshot snapshot;
+	struct timespec now;
+
+	if(multicast_is_open() == 0){
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if((now.tv_sec - last_check.tv_sec) * 1000 + (now.tv_nsec - last_check.tv_nsec) / 1000000 < POLL_TIMEOUT_MS){
+		return;
+	}
+	last_check = now;
+	if(load_inventory(config.inventory_file, &snapshot) == 0){
+		multicast_publish(&snapshot, config.multicast_heartbeat_sec, &now);
+	}
+}
+
+//Re-reads the config file on SIGHUP. Connections already running keep the settings they started with.
+static void reload_config(int *skt_fd, int *http_skt_fd){
+	struct server_config new_config = config;
+	char port[sizeof(config.port)];
+	int changed;
+
+	changed = config_load(config_file, NULL, config_options, sizeof(config_options)/sizeof(config_options[0]), &new_config, &config);
+	if(changed == -1){
+		log_message(LOG_DEBUG, "aesdsocket_server: reload_config - Unable to reload %s, keeping current settings\n", config_file);
+		return;
+	}
+	snprintf(port, sizeof(port), "%s", apply_listen_config(skt_fd, config.port, new_config.port, config.backlog, new_config.backlog));
+	snprintf(new_config.port, sizeof(new_config.port), "%s", port);
+	snprintf(port, sizeof(port), "%s", apply_listen_config(http_skt_fd, config.http_port, new_config.http_port, config.backlog, new_config.backlog));
+	snprintf(new_config.http_port, sizeof(new_config.http_port), "%s", port);
+	if(strcmp(config.multicast_group, new_config.multicast_group) != 0 || strcmp(config.multicast_port, new_config.multicast_port) != 0 ||
+		config.multicast_ttl != new_config.multicast_ttl){
+		multicast_close();
+		multicast_open(new_config.multicast_group, new_config.multicast_port, new_config.multicast_ttl);
+	}
+	config = new_config;
+	log_set_level(config.log_level);
+	log_message(LOG_INFO, "aesdsocket_server: reload_config - Reloaded %s, %i settings changed\n", config_file, changed);
+}
+
+//Check the input argument count to ensure both arguments are provided
+int main(int argc, char *argv[]){
+	int skt_fd, http_skt_fd, connected_skt_fd, signal_fd, ret_val;
+	struct sockaddr connected_sktaddr;
+	struct pollfd poll_fds[3];
+	socklen_t sktaddr_size;
+	bool run_as_daemon = false;
+	bool caught_signal = false;
+	int signal_number;
+	int i;
+
+	openlog(NULL,0,LOG_USER);
+	log_message(LOG_DEBUG,"aesdsocket_server main - Starting Script Over\n");	
+
+	//Initialize SLIST Head
+	SLIST_INIT(&head);
+	if(snapshot_cache_init(&inventory_cache) != 0){
+		return -1;
+	}
+
+	//Signals are read from signal_fd in the poll below, never delivered to a connection thread
+	if((signal_fd = signals_open(handled_signals, sizeof(handled_signals)/sizeof(handled_signals[0]))) == -1){
+		return -1;
+	}
+
+	//-d runs as a daemon, -c <file> reads settings from file instead of CONFIG_FILE, -t <file> writes a
+	//Chrome trace of the tracepoints to file on exit
+	for(i=1;i<argc;i++){
+		if(strcmp(argv[i],"-d") == 0){
+			run_as_daemon = true;
+		}
+		else if(strcmp(argv[i],"-c") == 0 && i+1 < argc){
+			i++;
+			//Resolved now so a SIGHUP reload still finds it after the daemon changes directory
+			if(realpath(argv[i], config_file) == NULL){
+				log_errno("aesdsocket_server: main - Unable to find config file %s", argv[i]);
 				return -1;
 			}
-			else if (daemon_pid != 0){
-				exit(EXIT_SUCCESS);
+		}
+		else if(strcmp(argv[i],"-t") == 0 && i+1 < argc){
+			i++;
+			if(trace_set_file(argv[i]) != 0){
+				return -1;
 			}
-			setsid();
-			chdir("/");
-			open("/dev/null",O_RDWR);
-			dup(0);
-			dup(0);
 		}
 	}
+	if(config_load(config_file, NULL, config_options, sizeof(config_options)/sizeof(config_options[0]), &config, NULL) == -1){
+		log_message(LOG_DEBUG, "aesdsocket_server: main - No config file at %s, using default settings\n", config_file);
+	}
+
+	//Data port is required. HTTP port (metrics, history, inventory) is optional and the server keeps running without it.
+	if((skt_fd = setup_listen_socket(config.port, config.backlog)) == -1){
+		return -1;
+	}
+	if((http_skt_fd = setup_listen_socket(config.http_port, config.backlog)) == -1){
+		log_message(LOG_DEBUG, "aesdsocket_server: main - HTTP port %s unavailable, continuing without it\n", config.http_port);
+	}
+	poll_fds[0].fd = skt_fd;
+	poll_fds[0].events = POLLIN;
+	poll_fds[1].fd = http_skt_fd;
+	poll_fds[1].events = POLLIN;
+
+	poll_fds[2].fd = signal_fd;
+	poll_fds[2].events = POLLIN;
+
+	log_set_level(config.log_level);
+
+	//Start Daemon if user provided -d argument
+	if(run_as_daemon == true && daemonize() != 0){
+		return -1;
+	}
+	//Until this runs, and if it fails, messages are written as they are logged
+	log_start();
+	if(trace_start(TRACE_MAX_EVENTS) != 0){
+		return -1;
+	}
+	//Optional like the HTTP port. A SIGHUP with a corrected setting tries again.
+	multicast_open(config.multicast_group, config.multicast_port, config.multicast_ttl);
 
 	while(1){
-		//Establish Accepted Connection
-		sktaddr_size = sizeof connected_sktaddr; 
 		if(caught_signal == true){
-			syslog(LOG_DEBUG, "aesdsocket_server: main - Caught signal, exiting\n");
-			SLIST_FOREACH(current_entry, &head, entries){
-				if(current_entry->tinfo.input_args.thread_complete == 1){
-					pthread_join(current_entry->tinfo.thread_id,NULL);
-				}
-				//Close connection
-				close(current_entry->tinfo.input_args.connected_skt_fd);
-			}
-			//Free all elements of SLIST
-			struct slist_data_struct *tmp_slist_struct;
-			while(SLIST_EMPTY(&head) != 0){
-				tmp_slist_struct = SLIST_FIRST(&head);
-				SLIST_REMOVE_HEAD(&head, entries);
-				free(tmp_slist_struct);
-			}
+			log_message(LOG_DEBUG, "aesdsocket_server: main - Caught signal, exiting\n");
+			reap_connections(true);
+			multicast_close();
 			close(skt_fd);
+			if(http_skt_fd != -1){
+				close(http_skt_fd);
+			}
 			//close(writer_fd);
+			snapshot_cache_destroy(&inventory_cache);
+			free(consolidated_cache.data);
+			free(inventory_file_cache.data);
+			close(signal_fd);
+			trace_stop();
+			log_stop();
 			closelog();
 			return 0;
 		}
-		connected_skt_fd = accept(skt_fd,&connected_sktaddr,&sktaddr_size); 
-		if(connected_skt_fd == -1){
-			if(errno == EAGAIN || errno == EWOULDBLOCK){
+		//Wait for a connection on either port or a signal. The timeout bounds how long a finished
+		//connection thread waits to be joined.
+		ret_val = poll(poll_fds, 3, POLL_TIMEOUT_MS);
+		if(ret_val == -1 && errno != EINTR){
+			log_errno("aesdsocket_server: main - poll() failed");
+			return -1;
+		}
+		if(ret_val > 0 && (poll_fds[2].revents & POLLIN) != 0){
+			while((signal_number = signals_read(signal_fd)) > 0){
+				if(signal_number == SIGHUP){
+					reload_config(&skt_fd, &http_skt_fd);
+					poll_fds[0].fd = skt_fd;
+					poll_fds[1].fd = http_skt_fd;
+				}
+				else{
+					caught_signal = true;
+				}
+			}
+			if(caught_signal == true){
 				continue;
 			}
-			perror("aesdsocket_server: main - accept() failed - ");
-			syslog(LOG_DEBUG, "aesdsocket_server: main - accept() failed - %s\n", strerror(errno));
-			return -1;
 		}
-		//Launch Thread and Create SLIST entry to store thread ID
-		add_slist_entry(connected_skt_fd);
-		//Check for Threads ready for joining
-		SLIST_FOREACH(current_entry, &head, entries){
-			if(current_entry->tinfo.input_args.thread_complete == 1){
-				syslog(LOG_DEBUG,"aesdsocket_server: main - Attempting to join thread pointed to by %i\n",current_entry->tinfo.input_args.connected_skt_fd);
-				pthread_join(current_entry->tinfo.thread_id,NULL);
-				//Close connection
-				close(current_entry->tinfo.input_args.connected_skt_fd);
-				syslog(LOG_DEBUG,"aesdsocket_server: main - Closed connection from %s\n",client_ip_hostview);	
+		//Joined first, so the connections that just finished make room for the ones waiting
+		reap_connections(false);
+		publish_inventory();
+		for(i=0;i<2 && ret_val > 0;i++){
+			if((poll_fds[i].revents & POLLIN) == 0){
+				continue;
 			}
-			current_entry->tinfo.input_args.thread_complete = 0;
+			//Establish Accepted Connection
+			sktaddr_size = sizeof connected_sktaddr; 
+			connected_skt_fd = accept4(poll_fds[i].fd,&connected_sktaddr,&sktaddr_size,SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if(connected_skt_fd == -1){
+				if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED){
+					continue;
+				}
+				//Out of descriptors or memory. The client waits in the listen queue until a connection closes.
+				if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM){
+					log_errno("aesdsocket_server: main - accept() failed, retrying");
+					continue;
+				}
+				log_errno("aesdsocket_server: main - accept() failed");
+				return -1;
+			}
+			TRACE_INSTANT(accept, "fd", connected_skt_fd, "http", poll_fds[i].fd == http_skt_fd);
+			//Launch Thread and Create SLIST entry to store thread ID
+			add_slist_entry(connected_skt_fd, poll_fds[i].fd == http_skt_fd);
 		}
 	}
 	return 0;
-}
+}
\ No newline at end of file
@@ -0,0 +1,390 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+#include "spice_rack_log.h"
+#include "spice_conversions.h"
+
+#define CSV_MAX_FIELDS 16
+#define CSV_FIELD_LEN 128
+#define CONVERSIONS_MAX_FILE_SIZE (1024 * 1024)
+//Tbl and Tsp columns that disagree by more than this are reported, the Tsp column wins
+#define TSP_TBL_TOLERANCE 0.1
+
+enum amount_result{
+	AMOUNT_INVALID = -1,
+	AMOUNT_MISSING = 0,
+	AMOUNT_VOLUME,
+	AMOUNT_COUNT
+};
+
+struct column_map{
+	int name;
+	int tbl_per_oz;
+	int tsp_per_oz;
+	int grams_per_tsp;
+};
+
+static char *read_whole_file(const char *file_name, size_t *len){
+	struct stat file_stat;
+	char *contents;
+	ssize_t count;
+	size_t total = 0;
+	int fd;
+
+	fd = open(file_name, O_RDONLY);
+	if(fd == -1){
+		perror("spice_conversions: read_whole_file - Failed to Open Conversions File - ");
+		log_message(LOG_DEBUG, "spice_conversions: read_whole_file - Failed to Open %s - %s\n", file_name, strerror(errno));
+		return NULL;
+	}
+	if(fstat(fd, &file_stat) != 0 || file_stat.st_size > CONVERSIONS_MAX_FILE_SIZE){
+		log_message(LOG_DEBUG, "spice_conversions: read_whole_file - %s is missing or too large\n", file_name);
+		close(fd);
+		return NULL;
+	}
+	if((contents = (char *)malloc(file_stat.st_size + 1)) == NULL){
+		log_message(LOG_DEBUG, "spice_conversions: read_whole_file - Failed on Malloc - %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	while(total < (size_t)file_stat.st_size && (count = read(fd, contents + total, file_stat.st_size - total)) != 0){
+		if(count == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			log_message(LOG_DEBUG, "spice_conversions: read_whole_file - Reading %s failed - %s\n", file_name, strerror(errno));
+			free(contents);
+			close(fd);
+			return NULL;
+		}
+		total = total + count;
+	}
+	close(fd);
+	contents[total] = '\0';
+	*len = total;
+	return contents;
+}
+
+static void trim(char *field){
+	size_t len = strlen(field);
+	size_t start = 0;
+	while(len > 0 && isspace((unsigned char)field[len-1])){
+		field[--len] = '\0';
+	}
+	while(isspace((unsigned char)field[start])){
+		start++;
+	}
+	memmove(field, field + start, len - start + 1);
+}
+
+//Parses one RFC 4180 style record: quoted fields may hold commas, newlines and "" for a quote.
+//Fields past max_fields are dropped and over long fields are truncated.
+//Returns the number of fields or -1 at the end of the input. *line is advanced past the record.
+static int parse_record(const char **cursor, const char *end, char fields[][CSV_FIELD_LEN], int max_fields, int *line){
+	const char *p = *cursor;
+	int num_fields = 0;
+	int len = 0;
+	int in_quotes = 0;
+	int was_quoted = 0;
+
+	if(p >= end){
+		return -1;
+	}
+	fields[0][0] = '\0';
+	while(p < end){
+		if(in_quotes){
+			if(*p == '"' && p + 1 < end && p[1] == '"'){
+				p++;
+			}
+			else if(*p == '"'){
+				in_quotes = 0;
+				p++;
+				continue;
+			}
+			else if(*p == '\n'){
+				(*line)++;
+			}
+		}
+		else if(*p == '"' && len == 0){
+			in_quotes = 1;
+			was_quoted = 1;
+			p++;
+			continue;
+		}
+		else if(*p == ',' || *p == '\n'){
+			if(num_fields < max_fields){
+				fields[num_fields][len] = '\0';
+				if(was_quoted == 0){
+					trim(fields[num_fields]);
+				}
+				num_fields++;
+			}
+			len = 0;
+			was_quoted = 0;
+			if(*p == '\n'){
+				(*line)++;
+				p++;
+				*cursor = p;
+				return num_fields;
+			}
+			p++;
+			continue;
+		}
+		else if(*p == '\r'){
+			p++;
+			continue;
+		}
+		if(num_fields < max_fields && len < CSV_FIELD_LEN - 1){
+			fields[num_fields][len++] = *p;
+		}
+		p++;
+	}
+	//Last record without a trailing newline
+	if(num_fields < max_fields){
+		fields[num_fields][len] = '\0';
+		if(was_quoted == 0){
+			trim(fields[num_fields]);
+		}
+		num_fields++;
+	}
+	(*line)++;
+	*cursor = p;
+	return num_fields;
+}
+
+//"4.5" is a volume amount, "36/oz" (or "1.3/g") a count, "" is missing and anything else is invalid.
+//Count amounts are returned per ounce.
+static enum amount_result parse_amount(const char *field, float *value){
+	char *end_ptr;
+	float amount;
+
+	if(field[0] == '\0'){
+		return AMOUNT_MISSING;
+	}
+	amount = strtof(field, &end_ptr);
+	if(end_ptr == field || !isfinite(amount) || amount <= 0){
+		return AMOUNT_INVALID;
+	}
+	while(isspace((unsigned char)*end_ptr)){
+		end_ptr++;
+	}
+	*value = amount;
+	if(*end_ptr == '\0'){
+		return AMOUNT_VOLUME;
+	}
+	if(strcasecmp(end_ptr, "/oz") == 0){
+		return AMOUNT_COUNT;
+	}
+	if(strcasecmp(end_ptr, "/g") == 0){
+		*value = amount / OUNCES_PER_GRAM;
+		return AMOUNT_COUNT;
+	}
+	return AMOUNT_INVALID;
+}
+
+static int map_columns(char fields[][CSV_FIELD_LEN], int num_fields, struct column_map *columns){
+	char header[SPICE_NAME_MAX_LEN];
+	int i;
+
+	columns->name = -1;
+	columns->tbl_per_oz = -1;
+	columns->tsp_per_oz = -1;
+	columns->grams_per_tsp = -1;
+	for(i=0;i<num_fields;i++){
+		spice_name_normalize(fields[i], header, sizeof(header));
+		if(strcmp(header, "spices") == 0 || strcmp(header, "spice") == 0 || strcmp(header, "name") == 0){
+			columns->name = i;
+		}
+		else if(strcmp(header, "tbl per oz") == 0 || strcmp(header, "tbsp per oz") == 0){
+			columns->tbl_per_oz = i;
+		}
+		else if(strcmp(header, "tsp per oz") == 0){
+			columns->tsp_per_oz = i;
+		}
+		else if(strcmp(header, "grams per tsp") == 0 || strcmp(header, "g per tsp") == 0){
+			columns->grams_per_tsp = i;
+		}
+	}
+	//Older files without a recognised name header keep the name in the first column
+	if(columns->name == -1){
+		columns->name = 0;
+	}
+	if(columns->tbl_per_oz == -1 && columns->tsp_per_oz == -1 && columns->grams_per_tsp == -1){
+		return -1;
+	}
+	return 0;
+}
+
+static void report_bad_row(const char *file_name, int line, const char *name, const char *reason){
+	printf("Skipping %s line %i (%s): %s\n", file_name, line, name, reason);
+	log_message(LOG_WARNING, "spice_conversions: %s line %i (%s) skipped - %s\n", file_name, line, name, reason);
+}
+
+static const char *field_at(char fields[][CSV_FIELD_LEN], int num_fields, int column){
+	if(column == -1 || column >= num_fields){
+		return "";
+	}
+	return fields[column];
+}
+
+//Works out grams -> quantity for one row. Returns NULL on success or the reason the row is unusable.
+static const char *convert_row(char fields[][CSV_FIELD_LEN], int num_fields, const struct column_map *columns, struct spice_conversion *row){
+	enum amount_result grams_per_tsp_result;
+	enum amount_result tsp_result;
+	enum amount_result tbl_result;
+	float grams_per_tsp = 0;
+	float tsp_per_oz = 0;
+	float tbl_per_oz = 0;
+
+	grams_per_tsp_result = parse_amount(field_at(fields, num_fields, columns->grams_per_tsp), &grams_per_tsp);
+	tsp_result = parse_amount(field_at(fields, num_fields, columns->tsp_per_oz), &tsp_per_oz);
+	tbl_result = parse_amount(field_at(fields, num_fields, columns->tbl_per_oz), &tbl_per_oz);
+	if(grams_per_tsp_result == AMOUNT_INVALID || tsp_result == AMOUNT_INVALID || tbl_result == AMOUNT_INVALID){
+		return "unreadable amount";
+	}
+
+	//Prefer a direct density, then teaspoons, then tablespoons. A count is used only without any volume.
+	row->unit = SPICE_UNIT_TSP;
+	if(grams_per_tsp_result == AMOUNT_VOLUME){
+		row->per_gram = 1.0 / grams_per_tsp;
+	}
+	else if(tsp_result == AMOUNT_VOLUME){
+		row->per_gram = tsp_per_oz * OUNCES_PER_GRAM;
+		if(tbl_result == AMOUNT_VOLUME && fabs(tbl_per_oz * TSP_PER_TBL - tsp_per_oz) > TSP_TBL_TOLERANCE * tsp_per_oz){
+			log_message(LOG_WARNING, "spice_conversions: %s - Tsp per Oz %f and Tbl per Oz %f disagree, using Tsp\n", row->name, tsp_per_oz, tbl_per_oz);
+		}
+	}
+	else if(tbl_result == AMOUNT_VOLUME){
+		row->per_gram = tbl_per_oz * TSP_PER_TBL * OUNCES_PER_GRAM;
+	}
+	else if(tsp_result == AMOUNT_COUNT || tbl_result == AMOUNT_COUNT || grams_per_tsp_result == AMOUNT_COUNT){
+		row->unit = SPICE_UNIT_COUNT;
+		row->per_gram = (tsp_result == AMOUNT_COUNT ? tsp_per_oz : tbl_result == AMOUNT_COUNT ? tbl_per_oz : grams_per_tsp) * OUNCES_PER_GRAM;
+	}
+	else{
+		return "no conversion given";
+	}
+	return NULL;
+}
+
+struct spice_conversion_table *spice_conversions_load(const char *file_name){
+	struct spice_conversion_table *table;
+	struct spice_conversion *rows;
+	struct column_map columns;
+	char (*fields)[CSV_FIELD_LEN];
+	const char *reason;
+	const char *cursor;
+	const char *end;
+	char *contents;
+	size_t len;
+	int rows_capacity = 128;
+	int num_fields;
+	int line = 1;
+	int record_line;
+	int i;
+
+	if((contents = read_whole_file(file_name, &len)) == NULL){
+		return NULL;
+	}
+	table = (struct spice_conversion_table *)calloc(1, sizeof(struct spice_conversion_table));
+	fields = malloc(CSV_MAX_FIELDS * sizeof(*fields));
+	if(table == NULL || fields == NULL ||
+	   (table->rows = (struct spice_conversion *)malloc(rows_capacity * sizeof(struct spice_conversion))) == NULL ||
+	   (table->index = spice_name_index_create()) == NULL){
+		log_message(LOG_DEBUG, "spice_conversions: spice_conversions_load - Failed on Malloc - %s\n", strerror(errno));
+		free(fields);
+		free(contents);
+		spice_conversions_free(table);
+		return NULL;
+	}
+
+	cursor = contents;
+	end = contents + len;
+	num_fields = parse_record(&cursor, end, fields, CSV_MAX_FIELDS, &line);
+	if(num_fields == -1 || map_columns(fields, num_fields, &columns) != 0){
+		printf("%s has no Tbl per Oz, Tsp per Oz or Grams per Tsp column\n", file_name);
+		log_message(LOG_WARNING, "spice_conversions: %s has no Tbl per Oz, Tsp per Oz or Grams per Tsp column\n", file_name);
+		free(fields);
+		free(contents);
+		spice_conversions_free(table);
+		return NULL;
+	}
+
+	//Canonical names are indexed as rows are accepted so duplicates are caught in the same pass
+	while(record_line = line, (num_fields = parse_record(&cursor, end, fields, CSV_MAX_FIELDS, &line)) != -1){
+		if(num_fields == 1 && fields[0][0] == '\0'){
+			continue;
+		}
+		if(table->num_rows == rows_capacity){
+			if((rows = (struct spice_conversion *)realloc(table->rows, 2 * rows_capacity * sizeof(struct spice_conversion))) == NULL){
+				log_message(LOG_DEBUG, "spice_conversions: spice_conversions_load - Failed on Malloc - %s\n", strerror(errno));
+				break;
+			}
+			table->rows = rows;
+			rows_capacity = 2 * rows_capacity;
+		}
+		rows = &table->rows[table->num_rows];
+		snprintf(rows->name, SPICE_NAME_MAX_LEN, "%.*s", SPICE_NAME_MAX_LEN - 1, field_at(fields, num_fields, columns.name));
+		rows->line = record_line;
+		if(rows->name[0] == '\0'){
+			reason = "no spice name";
+		}
+		else{
+			reason = convert_row(fields, num_fields, &columns, rows);
+		}
+		if(reason == NULL && spice_name_index_add(table->index, rows->name, table->num_rows) != 0){
+			reason = "duplicate spice name";
+		}
+		if(reason != NULL){
+			report_bad_row(file_name, record_line, rows->name, reason);
+			table->num_bad_rows++;
+			continue;
+		}
+		table->num_rows++;
+	}
+	free(fields);
+	free(contents);
+
+	for(i=0;i<table->num_rows;i++){
+		spice_name_index_add_derived_aliases(table->index, table->rows[i].name, i);
+	}
+	spice_name_index_add_builtin_aliases(table->index);
+	log_message(LOG_DEBUG, "spice_conversions: spice_conversions_load - Loaded %i spices from %s, skipped %i rows\n", table->num_rows, file_name, table->num_bad_rows);
+	return table;
+}
+
+void spice_conversions_free(struct spice_conversion_table *table){
+	if(table == NULL){
+		return;
+	}
+	spice_name_index_free(table->index);
+	free(table->rows);
+	free(table);
+}
+
+int spice_conversions_find(const struct spice_conversion_table *table, const char *name){
+	if(table == NULL){
+		return -1;
+	}
+	return spice_name_index_lookup(table->index, name);
+}
+
+float spice_conversions_convert(const struct spice_conversion_table *table, int row, float grams){
+	return grams * table->rows[row].per_gram;
+}
+
+const char *spice_conversions_unit(const struct spice_conversion_table *table, int row){
+	if(table == NULL || row < 0 || table->rows[row].unit == SPICE_UNIT_TSP){
+		return "tsp";
+	}
+	return "ct";
+}
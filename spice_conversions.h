@@ -0,0 +1,41 @@
+#ifndef SPICE_CONVERSIONS_H
+#define SPICE_CONVERSIONS_H
+
+#include "spice_name_index.h"
+
+#define OUNCES_PER_GRAM 0.0352739619
+#define TSP_PER_TBL 3.0
+
+//Most rows convert to teaspoons. Rows given as a count per ounce ("Bay Leaves,36/oz,") convert to a count.
+enum spice_unit{
+	SPICE_UNIT_TSP = 0,
+	SPICE_UNIT_COUNT
+};
+
+struct spice_conversion{
+	char name[SPICE_NAME_MAX_LEN];
+	//Precomputed so a conversion is a single multiply: quantity = grams * per_gram
+	float per_gram;
+	enum spice_unit unit;
+	int line;
+};
+
+struct spice_conversion_table{
+	struct spice_conversion *rows;
+	int num_rows;
+	int num_bad_rows;
+	struct spice_name_index *index;
+};
+
+//Loads and validates the conversions file in one pass. Columns are located by header name
+//(name, "Tbl per Oz", "Tsp per Oz", "Grams per Tsp"); unknown columns are ignored.
+//Rows that can't be converted are reported to syslog and left out of the table.
+struct spice_conversion_table *spice_conversions_load(const char *file_name);
+void spice_conversions_free(struct spice_conversion_table *table);
+
+//Returns the row for an exact name or alias, or -1
+int spice_conversions_find(const struct spice_conversion_table *table, const char *name);
+float spice_conversions_convert(const struct spice_conversion_table *table, int row, float grams);
+const char *spice_conversions_unit(const struct spice_conversion_table *table, int row);
+
+#endif
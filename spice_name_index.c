@@ -0,0 +1,508 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_name_index.h"
+
+#define TRIGRAM_BUCKETS 1024
+#define INITIAL_CAPACITY 64
+//Candidates sharing no trigram with the query are still considered when one is a prefix of the other
+#define PREFIX_BONUS 0.35
+#define TOKEN_BONUS 0.25
+
+//Key is either the canonical name of a conversion row or an alias for it
+struct name_entry{
+	char key[SPICE_NAME_MAX_LEN];
+	int key_len;
+	int id;
+	int num_trigrams;
+};
+
+//First child / next sibling trie over the normalized keys
+struct trie_node{
+	char c;
+	int child;
+	int sibling;
+	int entry;
+};
+
+struct trigram_postings{
+	uint32_t trigram;
+	int count;
+	int capacity;
+	int *entries;
+};
+
+struct spice_name_index{
+	struct name_entry *entries;
+	int num_entries;
+	int entries_capacity;
+	struct trie_node *nodes;
+	int num_nodes;
+	int nodes_capacity;
+	struct trigram_postings buckets[TRIGRAM_BUCKETS];
+};
+
+struct alias_pair{
+	const char *alias;
+	const char *name;
+};
+
+static const struct alias_pair builtin_aliases[] = {
+	{"annatto", "Annato Powder (Achiote)"},
+	{"annatto powder", "Annato Powder (Achiote)"},
+	{"carom seeds", "Ajwain"},
+	{"bay leaf", "Bay Leaves"},
+	{"cayenne pepper", "Cayenne"},
+	{"red pepper flakes", "Red Chili Flakes"},
+	{"chili flakes", "Red Chili Flakes"},
+	{"five spice", "Chinese 5 Spice"},
+	{"chinese five spice", "Chinese 5 Spice"},
+	{"ground cinnamon", "Cinnamon"},
+	{"cilantro seeds", "Coriander Seeds"},
+	{"dill", "Dill Weed"},
+	{"ground ginger", "Ginger"},
+	{"herbes de provence", "Herbs du Provence"},
+	{"ground mace", "Mace"},
+	{"mint", "Mint Leaves"},
+	{"monosodium glutamate", "MSG"},
+	{"ground mustard", "Mustard Ground"},
+	{"dry mustard", "Mustard Ground"},
+	{"ground nutmeg", "Nutmeg"},
+	{"oregano", "Oregano Leaves"},
+	{"ground paprika", "Paprika"},
+	{"parsley", "Parsley Flakes"},
+	{"black pepper", "Black Pepper Table Grind"},
+	{"ground black pepper", "Black Pepper Table Grind"},
+	{"peppercorns", "Black Peppercorns"},
+	{"pumpkin pie spice", "Pumpkin Spice"},
+	{"rosemary", "Rosemary Leaves"},
+	{"salt", "Table Salt"},
+	{"savory", "Savory Leaves"},
+	{"sugar", "Granulated Sugar"},
+	{"tarragon", "Tarragon Leaves"},
+	{"thyme", "Thyme Leaves"},
+	{"ground turmeric", "Turmeric"},
+	{"chervil", "Chervil Leaves"}
+};
+
+void spice_name_normalize(const char *name, char *normalized, int normalized_len){
+	int j = 0;
+	int pending_space = 0;
+
+	while(*name != '\0' && j < normalized_len - 1){
+		if(isalnum((unsigned char)*name)){
+			if(pending_space && j > 0 && j < normalized_len - 2){
+				normalized[j++] = ' ';
+			}
+			pending_space = 0;
+			normalized[j++] = tolower((unsigned char)*name);
+		}
+		else{
+			pending_space = 1;
+		}
+		name++;
+	}
+	normalized[j] = '\0';
+}
+
+struct spice_name_index *spice_name_index_create(void){
+	struct spice_name_index *index;
+
+	if((index = (struct spice_name_index *)calloc(1, sizeof(struct spice_name_index))) == NULL){
+		log_message(LOG_DEBUG, "spice_name_index: spice_name_index_create - Failed on Malloc - %s\n", strerror(errno));
+		return NULL;
+	}
+	index->entries_capacity = INITIAL_CAPACITY;
+	index->nodes_capacity = INITIAL_CAPACITY * 8;
+	index->entries = (struct name_entry *)malloc(index->entries_capacity * sizeof(struct name_entry));
+	index->nodes = (struct trie_node *)malloc(index->nodes_capacity * sizeof(struct trie_node));
+	if(index->entries == NULL || index->nodes == NULL){
+		log_message(LOG_DEBUG, "spice_name_index: spice_name_index_create - Failed on Malloc - %s\n", strerror(errno));
+		spice_name_index_free(index);
+		return NULL;
+	}
+	//Node 0 is the root
+	index->nodes[0].c = '\0';
+	index->nodes[0].child = -1;
+	index->nodes[0].sibling = -1;
+	index->nodes[0].entry = -1;
+	index->num_nodes = 1;
+	return index;
+}
+
+void spice_name_index_free(struct spice_name_index *index){
+	int i;
+	if(index == NULL){
+		return;
+	}
+	for(i=0;i<TRIGRAM_BUCKETS;i++){
+		free(index->buckets[i].entries);
+	}
+	free(index->entries);
+	free(index->nodes);
+	free(index);
+}
+
+static int trie_child(const struct spice_name_index *index, int node, char c){
+	int child;
+	for(child = index->nodes[node].child; child != -1; child = index->nodes[child].sibling){
+		if(index->nodes[child].c == c){
+			return child;
+		}
+	}
+	return -1;
+}
+
+//Returns the node for key, creating the path if create is set. -1 if absent or out of memory.
+static int trie_walk(struct spice_name_index *index, const char *key, int create){
+	struct trie_node *nodes;
+	int node = 0;
+	int next;
+
+	for(; *key != '\0'; key++){
+		next = trie_child(index, node, *key);
+		if(next == -1){
+			if(create == 0){
+				return -1;
+			}
+			if(index->num_nodes == index->nodes_capacity){
+				nodes = (struct trie_node *)realloc(index->nodes, 2 * index->nodes_capacity * sizeof(struct trie_node));
+				if(nodes == NULL){
+					return -1;
+				}
+				index->nodes = nodes;
+				index->nodes_capacity = 2 * index->nodes_capacity;
+			}
+			next = index->num_nodes++;
+			index->nodes[next].c = *key;
+			index->nodes[next].child = -1;
+			index->nodes[next].entry = -1;
+			index->nodes[next].sibling = index->nodes[node].child;
+			index->nodes[node].child = next;
+		}
+		node = next;
+	}
+	return node;
+}
+
+//Padded so that word starts and ends produce their own trigrams: "  basil " -> "  b", " ba", ... "il "
+static int make_trigrams(const char *key, uint32_t *trigrams, int max_trigrams){
+	char padded[SPICE_NAME_MAX_LEN + 3];
+	int len;
+	int i;
+	int j;
+	int num_trigrams = 0;
+	uint32_t trigram;
+
+	len = snprintf(padded, sizeof(padded), "  %s ", key);
+	for(i=0;i+2<len && num_trigrams<max_trigrams;i++){
+		trigram = ((uint32_t)(unsigned char)padded[i] << 16) | ((uint32_t)(unsigned char)padded[i+1] << 8) | (unsigned char)padded[i+2];
+		//Keep each trigram once so shared counts are set intersections
+		for(j=0;j<num_trigrams && trigrams[j]!=trigram;j++);
+		if(j == num_trigrams){
+			trigrams[num_trigrams++] = trigram;
+		}
+	}
+	return num_trigrams;
+}
+
+static struct trigram_postings *find_bucket(const struct spice_name_index *index, uint32_t trigram, int for_insert){
+	uint32_t slot = (trigram * 2654435761U) & (TRIGRAM_BUCKETS - 1);
+	int probes;
+
+	for(probes=0;probes<TRIGRAM_BUCKETS;probes++){
+		const struct trigram_postings *bucket = &index->buckets[slot];
+		if(bucket->capacity != 0 && bucket->trigram == trigram){
+			return (struct trigram_postings *)bucket;
+		}
+		if(bucket->capacity == 0){
+			return for_insert ? (struct trigram_postings *)bucket : NULL;
+		}
+		slot = (slot + 1) & (TRIGRAM_BUCKETS - 1);
+	}
+	return NULL;
+}
+
+static int add_posting(struct spice_name_index *index, uint32_t trigram, int entry){
+	struct trigram_postings *bucket = find_bucket(index, trigram, 1);
+	int *entries;
+
+	if(bucket == NULL){
+		return -1;
+	}
+	if(bucket->capacity == 0){
+		if((bucket->entries = (int *)malloc(4 * sizeof(int))) == NULL){
+			return -1;
+		}
+		bucket->trigram = trigram;
+		bucket->capacity = 4;
+	}
+	if(bucket->count == bucket->capacity){
+		if((entries = (int *)realloc(bucket->entries, 2 * bucket->capacity * sizeof(int))) == NULL){
+			return -1;
+		}
+		bucket->entries = entries;
+		bucket->capacity = 2 * bucket->capacity;
+	}
+	bucket->entries[bucket->count++] = entry;
+	return 0;
+}
+
+static int add_key(struct spice_name_index *index, const char *name, int id){
+	char key[SPICE_NAME_MAX_LEN];
+	uint32_t trigrams[SPICE_NAME_MAX_LEN + 2];
+	struct name_entry *entries;
+	struct name_entry *entry;
+	int node;
+	int i;
+
+	spice_name_normalize(name, key, sizeof(key));
+	if(key[0] == '\0'){
+		return -1;
+	}
+	node = trie_walk(index, key, 1);
+	if(node == -1 || index->nodes[node].entry != -1){
+		return -1;
+	}
+	if(index->num_entries == index->entries_capacity){
+		if((entries = (struct name_entry *)realloc(index->entries, 2 * index->entries_capacity * sizeof(struct name_entry))) == NULL){
+			return -1;
+		}
+		index->entries = entries;
+		index->entries_capacity = 2 * index->entries_capacity;
+	}
+	entry = &index->entries[index->num_entries];
+	snprintf(entry->key, sizeof(entry->key), "%s", key);
+	entry->key_len = strlen(key);
+	entry->id = id;
+	entry->num_trigrams = make_trigrams(key, trigrams, SPICE_NAME_MAX_LEN + 2);
+	for(i=0;i<entry->num_trigrams;i++){
+		if(add_posting(index, trigrams[i], index->num_entries) != 0){
+			return -1;
+		}
+	}
+	index->nodes[node].entry = index->num_entries;
+	index->num_entries++;
+	return 0;
+}
+
+int spice_name_index_add(struct spice_name_index *index, const char *name, int id){
+	return add_key(index, name, id);
+}
+
+int spice_name_index_add_alias(struct spice_name_index *index, const char *alias, int id){
+	return add_key(index, alias, id);
+}
+
+void spice_name_index_add_derived_aliases(struct spice_name_index *index, const char *name, int id){
+	char part[SPICE_NAME_MAX_LEN];
+	const char *open_paren;
+	const char *close_paren;
+	int len;
+
+	if((open_paren = strchr(name, '(')) == NULL || (close_paren = strchr(open_paren, ')')) == NULL){
+		return;
+	}
+	//Outside the parentheses: "Annato Powder"
+	len = open_paren - name < SPICE_NAME_MAX_LEN - 1 ? open_paren - name : SPICE_NAME_MAX_LEN - 1;
+	snprintf(part, len + 1, "%s", name);
+	add_key(index, part, id);
+	//Inside the parentheses: "Achiote"
+	len = close_paren - open_paren - 1 < SPICE_NAME_MAX_LEN - 1 ? close_paren - open_paren - 1 : SPICE_NAME_MAX_LEN - 1;
+	snprintf(part, len + 1, "%s", open_paren + 1);
+	add_key(index, part, id);
+}
+
+void spice_name_index_add_builtin_aliases(struct spice_name_index *index){
+	int i;
+	int id;
+	for(i=0;i<(int)(sizeof(builtin_aliases)/sizeof(builtin_aliases[0]));i++){
+		if((id = spice_name_index_lookup(index, builtin_aliases[i].name)) != -1){
+			add_key(index, builtin_aliases[i].alias, id);
+		}
+	}
+}
+
+int spice_name_index_lookup(const struct spice_name_index *index, const char *name){
+	char key[SPICE_NAME_MAX_LEN];
+	int node;
+
+	spice_name_normalize(name, key, sizeof(key));
+	if(key[0] == '\0'){
+		return -1;
+	}
+	node = trie_walk((struct spice_name_index *)index, key, 0);
+	if(node == -1 || index->nodes[node].entry == -1){
+		return -1;
+	}
+	return index->entries[index->nodes[node].entry].id;
+}
+
+//Optimal string alignment distance (Levenshtein plus adjacent transpositions)
+static int edit_distance(const char *a, int a_len, const char *b, int b_len){
+	int rows[3][SPICE_NAME_MAX_LEN + 1];
+	int *prev2 = rows[0];
+	int *prev = rows[1];
+	int *curr = rows[2];
+	int *tmp;
+	int i;
+	int j;
+	int cost;
+	int best;
+
+	for(j=0;j<=b_len;j++){
+		prev[j] = j;
+	}
+	for(i=1;i<=a_len;i++){
+		curr[0] = i;
+		for(j=1;j<=b_len;j++){
+			cost = a[i-1] == b[j-1] ? 0 : 1;
+			best = prev[j] + 1;
+			best = curr[j-1] + 1 < best ? curr[j-1] + 1 : best;
+			best = prev[j-1] + cost < best ? prev[j-1] + cost : best;
+			if(i > 1 && j > 1 && a[i-1] == b[j-2] && a[i-2] == b[j-1] && prev2[j-2] + 1 < best){
+				best = prev2[j-2] + 1;
+			}
+			curr[j] = best;
+		}
+		tmp = prev2;
+		prev2 = prev;
+		prev = curr;
+		curr = tmp;
+	}
+	return prev[b_len];
+}
+
+//Every query word is the start of some word in the key: "gr cum" fits "ground cumin"
+static int tokens_match(const char *query, const char *key){
+	char query_copy[SPICE_NAME_MAX_LEN];
+	char *token;
+	char *save_ptr;
+	const char *word;
+	size_t token_len;
+	int found;
+
+	snprintf(query_copy, sizeof(query_copy), "%s", query);
+	for(token = strtok_r(query_copy, " ", &save_ptr); token != NULL; token = strtok_r(NULL, " ", &save_ptr)){
+		token_len = strlen(token);
+		found = 0;
+		for(word = key; word != NULL; word = strchr(word, ' ')){
+			if(*word == ' '){
+				word++;
+			}
+			if(strncmp(word, token, token_len) == 0){
+				found = 1;
+				break;
+			}
+		}
+		if(found == 0){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void mark_prefix_entries(const struct spice_name_index *index, int node, unsigned char *is_prefix){
+	int child;
+	if(index->nodes[node].entry != -1){
+		is_prefix[index->nodes[node].entry] = 1;
+	}
+	for(child = index->nodes[node].child; child != -1; child = index->nodes[child].sibling){
+		mark_prefix_entries(index, child, is_prefix);
+	}
+}
+
+int spice_name_index_suggest(const struct spice_name_index *index, const char *query, struct spice_name_match *matches, int max_matches){
+	char key[SPICE_NAME_MAX_LEN];
+	uint32_t trigrams[SPICE_NAME_MAX_LEN + 2];
+	unsigned short *shared;
+	unsigned char *is_prefix;
+	struct trigram_postings *bucket;
+	struct name_entry *entry;
+	int num_trigrams;
+	int num_matches = 0;
+	int key_len;
+	int node;
+	int i;
+	int j;
+	int k;
+	int longest;
+	float dice;
+	float score;
+
+	spice_name_normalize(query, key, sizeof(key));
+	key_len = strlen(key);
+	if(key_len == 0 || max_matches <= 0){
+		return 0;
+	}
+	shared = (unsigned short *)calloc(index->num_entries, sizeof(unsigned short));
+	is_prefix = (unsigned char *)calloc(index->num_entries, sizeof(unsigned char));
+	if(shared == NULL || is_prefix == NULL){
+		log_message(LOG_DEBUG, "spice_name_index: spice_name_index_suggest - Failed on Malloc - %s\n", strerror(errno));
+		free(shared);
+		free(is_prefix);
+		return 0;
+	}
+
+	//Count shared trigrams through the inverted index, then flag completions of the query from the trie
+	num_trigrams = make_trigrams(key, trigrams, SPICE_NAME_MAX_LEN + 2);
+	for(i=0;i<num_trigrams;i++){
+		if((bucket = find_bucket(index, trigrams[i], 0)) == NULL){
+			continue;
+		}
+		for(j=0;j<bucket->count;j++){
+			shared[bucket->entries[j]]++;
+		}
+	}
+	if((node = trie_walk((struct spice_name_index *)index, key, 0)) != -1){
+		mark_prefix_entries(index, node, is_prefix);
+	}
+
+	for(i=0;i<index->num_entries;i++){
+		if(shared[i] == 0 && is_prefix[i] == 0){
+			continue;
+		}
+		entry = &index->entries[i];
+		dice = 2.0 * shared[i] / (num_trigrams + entry->num_trigrams);
+		longest = key_len > entry->key_len ? key_len : entry->key_len;
+		score = 0.5 * dice + 0.5 * (1.0 - (float)edit_distance(key, key_len, entry->key, entry->key_len) / longest);
+		if(is_prefix[i]){
+			score = score + PREFIX_BONUS;
+		}
+		else if(tokens_match(key, entry->key)){
+			score = score + TOKEN_BONUS;
+		}
+
+		//Keep the best score per id, sorted best first
+		for(j=0;j<num_matches && matches[j].id!=entry->id;j++);
+		if(j < num_matches){
+			if(score <= matches[j].score){
+				continue;
+			}
+			for(;j>0 && matches[j-1].score < score;j--){
+				matches[j] = matches[j-1];
+			}
+			matches[j].id = entry->id;
+			matches[j].score = score;
+			continue;
+		}
+		if(num_matches == max_matches && score <= matches[num_matches-1].score){
+			continue;
+		}
+		k = num_matches < max_matches ? num_matches++ : max_matches - 1;
+		for(;k>0 && matches[k-1].score < score;k--){
+			matches[k] = matches[k-1];
+		}
+		matches[k].id = entry->id;
+		matches[k].score = score;
+	}
+
+	free(shared);
+	free(is_prefix);
+	return num_matches;
+}
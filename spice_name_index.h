@@ -0,0 +1,35 @@
+#ifndef SPICE_NAME_INDEX_H
+#define SPICE_NAME_INDEX_H
+
+//Names are normalized before indexing or lookup: lowercase, punctuation and repeated spaces collapsed
+//to a single space. "Annato Powder  (Achiote)" is stored as "annato powder achiote".
+#define SPICE_NAME_MAX_LEN 64
+
+struct spice_name_match{
+	int id;
+	float score;
+};
+
+struct spice_name_index;
+
+struct spice_name_index *spice_name_index_create(void);
+void spice_name_index_free(struct spice_name_index *index);
+
+//Adds the canonical name of conversion row id. Returns -1 if the normalized name is already taken.
+int spice_name_index_add(struct spice_name_index *index, const char *name, int id);
+int spice_name_index_add_alias(struct spice_name_index *index, const char *alias, int id);
+//Derives aliases from a canonical name: "Annato Powder  (Achiote)" also answers to "Achiote" and
+//"Annato Powder". Aliases that would shadow another name are skipped.
+void spice_name_index_add_derived_aliases(struct spice_name_index *index, const char *name, int id);
+//Adds the built in table of common alternate spellings for names that are present in the index
+void spice_name_index_add_builtin_aliases(struct spice_name_index *index);
+
+//Exact match on the normalized name or alias. Returns the id or -1.
+int spice_name_index_lookup(const struct spice_name_index *index, const char *name);
+//Ranked candidates for a mistyped or partial name, best first, one entry per id.
+//Returns the number of matches written.
+int spice_name_index_suggest(const struct spice_name_index *index, const char *query, struct spice_name_match *matches, int max_matches);
+
+void spice_name_normalize(const char *name, char *normalized, int normalized_len);
+
+#endif
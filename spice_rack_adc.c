@@ -0,0 +1,562 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_rack_adc.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ADC_X86 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ADC_NEON 1
+#include <arm_neon.h>
+#endif
+
+//Squares are summed as integers a chunk at a time, which can't overflow for samples within 2^24 of each other
+#define ADC_STATS_CHUNK 4096
+
+//How raw values become samples: shifted down to drop the padding bits, then the top bits above the real
+//bits cleared, or copied from the sign bit for signed types. swap is set for big endian samples; the SIMD
+//kernels only run on little endian CPUs.
+struct adc_shape{
+	int swap;
+	int shift;
+	int ext;
+	int is_signed;
+};
+
+struct adc_accum{
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	int64_t sum_squares;
+};
+
+//Each function handles as many samples as suits it from the start of the batch and returns how many, the
+//scalar code does the rest
+struct adc_kernel{
+	const char *name;
+	int (*available)(void);
+	int (*decode32)(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples);
+	int (*decode24)(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples);
+	int (*stats)(const int32_t *samples, int num, int32_t base, struct adc_accum *accum);
+};
+
+static int32_t finish_sample(uint32_t raw, const struct adc_shape *shape){
+	raw = (raw >> shape->shift) << shape->ext;
+	if(shape->is_signed){
+		return (int32_t)raw >> shape->ext;
+	}
+	return (int32_t)(raw >> shape->ext);
+}
+
+static int decode32_scalar(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	const uint8_t *raw;
+	int i;
+
+	for(i=0;i<num;i++){
+		raw = buf + i * 4;
+		if(shape->swap){
+			samples[i] = finish_sample((uint32_t)raw[0] << 24 | (uint32_t)raw[1] << 16 | (uint32_t)raw[2] << 8 | raw[3], shape);
+		}
+		else{
+			samples[i] = finish_sample((uint32_t)raw[3] << 24 | (uint32_t)raw[2] << 16 | (uint32_t)raw[1] << 8 | raw[0], shape);
+		}
+	}
+	return num;
+}
+
+static int decode24_scalar(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	const uint8_t *raw;
+	int i;
+
+	for(i=0;i<num;i++){
+		raw = buf + i * 3;
+		if(shape->swap){
+			samples[i] = finish_sample((uint32_t)raw[0] << 16 | (uint32_t)raw[1] << 8 | raw[2], shape);
+		}
+		else{
+			samples[i] = finish_sample((uint32_t)raw[2] << 16 | (uint32_t)raw[1] << 8 | raw[0], shape);
+		}
+	}
+	return num;
+}
+
+static void accumulate(int32_t sample, int32_t base, struct adc_accum *accum){
+	//Wraps like the SIMD subtraction does, which only matters outside the documented range
+	int32_t diff = (int32_t)((uint32_t)sample - (uint32_t)base);
+
+	if(sample < accum->min){
+		accum->min = sample;
+	}
+	if(sample > accum->max){
+		accum->max = sample;
+	}
+	accum->sum = accum->sum + sample;
+	accum->sum_squares = accum->sum_squares + (int64_t)diff * diff;
+}
+
+static int stats_scalar(const int32_t *samples, int num, int32_t base, struct adc_accum *accum){
+	int i;
+
+	for(i=0;i<num;i++){
+		accumulate(samples[i], base, accum);
+	}
+	return num;
+}
+
+#ifdef ADC_X86
+static int avx2_available(void){
+	return __builtin_cpu_supports("avx2");
+}
+
+static int sse41_available(void){
+	return __builtin_cpu_supports("sse4.1");
+}
+
+__attribute__((target("avx2")))
+static __m256i finish_avx2(__m256i raw, const struct adc_shape *shape){
+	__m128i ext = _mm_cvtsi32_si128(shape->ext);
+
+	raw = _mm256_sll_epi32(_mm256_srl_epi32(raw, _mm_cvtsi32_si128(shape->shift)), ext);
+	return shape->is_signed ? _mm256_sra_epi32(raw, ext) : _mm256_srl_epi32(raw, ext);
+}
+
+__attribute__((target("avx2")))
+static int decode32_avx2(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m256i raw;
+	int i;
+
+	for(i=0;i+8<=num;i+=8){
+		raw = _mm256_loadu_si256((const __m256i *)(buf + i * 4));
+		if(shape->swap){
+			raw = _mm256_shuffle_epi8(raw, swap);
+		}
+		_mm256_storeu_si256((__m256i *)(samples + i), finish_avx2(raw, shape));
+	}
+	return i;
+}
+
+//Each 128 bit lane takes four samples from a 16 byte load, so the last load reads 4 bytes past the 24 used
+__attribute__((target("avx2")))
+static int decode24_avx2(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	const __m256i big = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m256i little = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m256i raw;
+	int i;
+
+	for(i=0;(i + 8) * 3 + 4<=num * 3;i+=8){
+		raw = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(buf + i * 3))),
+			_mm_loadu_si128((const __m128i *)(buf + i * 3 + 12)), 1);
+		raw = _mm256_shuffle_epi8(raw, shape->swap ? big : little);
+		_mm256_storeu_si256((__m256i *)(samples + i), finish_avx2(raw, shape));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int stats_avx2(const int32_t *samples, int num, int32_t base, struct adc_accum *accum){
+	__m256i min = _mm256_set1_epi32(accum->min);
+	__m256i max = _mm256_set1_epi32(accum->max);
+	__m256i bases = _mm256_set1_epi32(base);
+	__m256i sum = _mm256_setzero_si256();
+	__m256i sum_squares = _mm256_setzero_si256();
+	__m256i values;
+	__m256i low;
+	__m256i high;
+	int32_t lanes[8];
+	int64_t totals[4];
+	int i;
+
+	for(i=0;i+8<=num;i+=8){
+		values = _mm256_loadu_si256((const __m256i *)(samples + i));
+		min = _mm256_min_epi32(min, values);
+		max = _mm256_max_epi32(max, values);
+		low = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(values));
+		high = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(values, 1));
+		sum = _mm256_add_epi64(sum, _mm256_add_epi64(low, high));
+		values = _mm256_sub_epi32(values, bases);
+		low = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(values));
+		high = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(values, 1));
+		sum_squares = _mm256_add_epi64(sum_squares, _mm256_add_epi64(_mm256_mul_epi32(low, low), _mm256_mul_epi32(high, high)));
+	}
+	_mm256_storeu_si256((__m256i *)lanes, min);
+	for(num=0;num<8;num++){
+		accum->min = lanes[num] < accum->min ? lanes[num] : accum->min;
+	}
+	_mm256_storeu_si256((__m256i *)lanes, max);
+	for(num=0;num<8;num++){
+		accum->max = lanes[num] > accum->max ? lanes[num] : accum->max;
+	}
+	_mm256_storeu_si256((__m256i *)totals, sum);
+	accum->sum = accum->sum + totals[0] + totals[1] + totals[2] + totals[3];
+	_mm256_storeu_si256((__m256i *)totals, sum_squares);
+	accum->sum_squares = accum->sum_squares + totals[0] + totals[1] + totals[2] + totals[3];
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static __m128i finish_sse41(__m128i raw, const struct adc_shape *shape){
+	__m128i ext = _mm_cvtsi32_si128(shape->ext);
+
+	raw = _mm_sll_epi32(_mm_srl_epi32(raw, _mm_cvtsi32_si128(shape->shift)), ext);
+	return shape->is_signed ? _mm_sra_epi32(raw, ext) : _mm_srl_epi32(raw, ext);
+}
+
+__attribute__((target("sse4.1")))
+static int decode32_sse41(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	__m128i raw;
+	int i;
+
+	for(i=0;i+4<=num;i+=4){
+		raw = _mm_loadu_si128((const __m128i *)(buf + i * 4));
+		if(shape->swap){
+			raw = _mm_shuffle_epi8(raw, swap);
+		}
+		_mm_storeu_si128((__m128i *)(samples + i), finish_sse41(raw, shape));
+	}
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static int decode24_sse41(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	const __m128i big = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i little = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m128i raw;
+	int i;
+
+	for(i=0;(i + 4) * 3 + 4<=num * 3;i+=4){
+		raw = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + i * 3)), shape->swap ? big : little);
+		_mm_storeu_si128((__m128i *)(samples + i), finish_sse41(raw, shape));
+	}
+	return i;
+}
+
+__attribute__((target("sse4.1")))
+static int stats_sse41(const int32_t *samples, int num, int32_t base, struct adc_accum *accum){
+	__m128i min = _mm_set1_epi32(accum->min);
+	__m128i max = _mm_set1_epi32(accum->max);
+	__m128i bases = _mm_set1_epi32(base);
+	__m128i sum = _mm_setzero_si128();
+	__m128i sum_squares = _mm_setzero_si128();
+	__m128i values;
+	__m128i low;
+	__m128i high;
+	int32_t lanes[4];
+	int64_t totals[2];
+	int i;
+
+	for(i=0;i+4<=num;i+=4){
+		values = _mm_loadu_si128((const __m128i *)(samples + i));
+		min = _mm_min_epi32(min, values);
+		max = _mm_max_epi32(max, values);
+		low = _mm_cvtepi32_epi64(values);
+		high = _mm_cvtepi32_epi64(_mm_srli_si128(values, 8));
+		sum = _mm_add_epi64(sum, _mm_add_epi64(low, high));
+		values = _mm_sub_epi32(values, bases);
+		low = _mm_cvtepi32_epi64(values);
+		high = _mm_cvtepi32_epi64(_mm_srli_si128(values, 8));
+		sum_squares = _mm_add_epi64(sum_squares, _mm_add_epi64(_mm_mul_epi32(low, low), _mm_mul_epi32(high, high)));
+	}
+	_mm_storeu_si128((__m128i *)lanes, min);
+	for(num=0;num<4;num++){
+		accum->min = lanes[num] < accum->min ? lanes[num] : accum->min;
+	}
+	_mm_storeu_si128((__m128i *)lanes, max);
+	for(num=0;num<4;num++){
+		accum->max = lanes[num] > accum->max ? lanes[num] : accum->max;
+	}
+	_mm_storeu_si128((__m128i *)totals, sum);
+	accum->sum = accum->sum + totals[0] + totals[1];
+	_mm_storeu_si128((__m128i *)totals, sum_squares);
+	accum->sum_squares = accum->sum_squares + totals[0] + totals[1];
+	return i;
+}
+#endif
+
+#ifdef ADC_NEON
+static uint32x4_t finish_neon_shift(uint32x4_t raw, const struct adc_shape *shape){
+	return vshlq_u32(vshlq_u32(raw, vdupq_n_s32(-shape->shift)), vdupq_n_s32(shape->ext));
+}
+
+static int32x4_t finish_neon(uint32x4_t raw, const struct adc_shape *shape){
+	raw = finish_neon_shift(raw, shape);
+	if(shape->is_signed){
+		return vshlq_s32(vreinterpretq_s32_u32(raw), vdupq_n_s32(-shape->ext));
+	}
+	return vreinterpretq_s32_u32(vshlq_u32(raw, vdupq_n_s32(-shape->ext)));
+}
+
+static int decode32_neon(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	uint8x16_t raw;
+	int i;
+
+	for(i=0;i+4<=num;i+=4){
+		raw = vld1q_u8(buf + i * 4);
+		if(shape->swap){
+			raw = vrev32q_u8(raw);
+		}
+		vst1q_s32(samples + i, finish_neon(vreinterpretq_u32_u8(raw), shape));
+	}
+	return i;
+}
+
+//vld3 splits eight samples into their first, second and third bytes
+static int decode24_neon(const uint8_t *buf, int num, const struct adc_shape *shape, int32_t *samples){
+	uint8x8x3_t raw;
+	uint16x8_t high;
+	uint16x8_t middle;
+	uint16x8_t low;
+	uint32x4_t values;
+	int i;
+
+	for(i=0;i+8<=num;i+=8){
+		raw = vld3_u8(buf + i * 3);
+		high = vmovl_u8(shape->swap ? raw.val[0] : raw.val[2]);
+		middle = vmovl_u8(raw.val[1]);
+		low = vmovl_u8(shape->swap ? raw.val[2] : raw.val[0]);
+		values = vorrq_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_low_u16(high)), 16), vshlq_n_u32(vmovl_u16(vget_low_u16(middle)), 8)),
+			vmovl_u16(vget_low_u16(low)));
+		vst1q_s32(samples + i, finish_neon(values, shape));
+		values = vorrq_u32(vorrq_u32(vshlq_n_u32(vmovl_u16(vget_high_u16(high)), 16), vshlq_n_u32(vmovl_u16(vget_high_u16(middle)), 8)),
+			vmovl_u16(vget_high_u16(low)));
+		vst1q_s32(samples + i + 4, finish_neon(values, shape));
+	}
+	return i;
+}
+
+static int stats_neon(const int32_t *samples, int num, int32_t base, struct adc_accum *accum){
+	int32x4_t min = vdupq_n_s32(accum->min);
+	int32x4_t max = vdupq_n_s32(accum->max);
+	int32x4_t bases = vdupq_n_s32(base);
+	int64x2_t sum = vdupq_n_s64(0);
+	int64x2_t sum_squares = vdupq_n_s64(0);
+	int32x4_t values;
+	int32_t lanes[4];
+	int i;
+
+	for(i=0;i+4<=num;i+=4){
+		values = vld1q_s32(samples + i);
+		min = vminq_s32(min, values);
+		max = vmaxq_s32(max, values);
+		sum = vpadalq_s32(sum, values);
+		values = vsubq_s32(values, bases);
+		sum_squares = vmlal_s32(sum_squares, vget_low_s32(values), vget_low_s32(values));
+		sum_squares = vmlal_s32(sum_squares, vget_high_s32(values), vget_high_s32(values));
+	}
+	vst1q_s32(lanes, min);
+	for(num=0;num<4;num++){
+		accum->min = lanes[num] < accum->min ? lanes[num] : accum->min;
+	}
+	vst1q_s32(lanes, max);
+	for(num=0;num<4;num++){
+		accum->max = lanes[num] > accum->max ? lanes[num] : accum->max;
+	}
+	accum->sum = accum->sum + vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1);
+	accum->sum_squares = accum->sum_squares + vgetq_lane_s64(sum_squares, 0) + vgetq_lane_s64(sum_squares, 1);
+	return i;
+}
+#endif
+
+//Best first
+static const struct adc_kernel kernels[] = {
+#ifdef ADC_X86
+	{"avx2", avx2_available, decode32_avx2, decode24_avx2, stats_avx2},
+	{"sse4.1", sse41_available, decode32_sse41, decode24_sse41, stats_sse41},
+#endif
+#ifdef ADC_NEON
+	{"neon", NULL, decode32_neon, decode24_neon, stats_neon},
+#endif
+	{"scalar", NULL, decode32_scalar, decode24_scalar, stats_scalar}
+};
+#define NUM_KERNELS (sizeof(kernels)/sizeof(kernels[0]))
+
+static const struct adc_kernel *kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void){
+	unsigned int i;
+
+	for(i=0;i<NUM_KERNELS;i++){
+		if(kernels[i].available == NULL || kernels[i].available()){
+			kernel = &kernels[i];
+			break;
+		}
+	}
+	log_message(LOG_INFO, "spice_rack_adc: Using %s kernels for ADC samples\n", kernel->name);
+}
+
+static const struct adc_kernel *get_kernel(void){
+	pthread_once(&kernel_once, select_kernel);
+	return kernel;
+}
+
+const char *adc_kernel_name(void){
+	return get_kernel()->name;
+}
+
+int adc_use_kernel(const char *name){
+	unsigned int i;
+
+	get_kernel();
+	for(i=0;i<NUM_KERNELS;i++){
+		if(strcmp(kernels[i].name, name) == 0 && (kernels[i].available == NULL || kernels[i].available())){
+			kernel = &kernels[i];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+int adc_parse_scan_type(const char *str, struct adc_scan_type *type){
+	char endian;
+	char sign;
+	int used = 0;
+
+	memset(type, 0, sizeof(struct adc_scan_type));
+	if(sscanf(str, " %ce:%c%d/%d%n", &endian, &sign, &type->real_bits, &type->storage_bits, &used) != 4){
+		return -1;
+	}
+	if(strncmp(str + used, ">>", 2) == 0 && sscanf(str + used + 2, "%d", &type->shift) != 1){
+		return -1;
+	}
+	if((endian != 'b' && endian != 'l') || (sign != 's' && sign != 'u')){
+		return -1;
+	}
+	type->big_endian = endian == 'b';
+	type->is_signed = sign == 's';
+	if(type->storage_bits != 16 && type->storage_bits != 24 && type->storage_bits != 32){
+		return -1;
+	}
+	if(type->shift < 0 || type->real_bits < 1 || type->real_bits + type->shift > type->storage_bits){
+		return -1;
+	}
+	//An unsigned 32 bit value doesn't fit an int32_t
+	if(type->is_signed == 0 && type->real_bits > 31){
+		return -1;
+	}
+	return 0;
+}
+
+int adc_sample_size(const struct adc_scan_type *type){
+	return type->storage_bits / 8;
+}
+
+int adc_decode(const void *buf, size_t len, const struct adc_scan_type *type, int32_t *samples, int max_samples){
+	const struct adc_kernel *kernel = get_kernel();
+	const uint8_t *raw = buf;
+	struct adc_shape shape;
+	int size = adc_sample_size(type);
+	int num = len / size;
+	int done;
+	int i;
+
+	if(num > max_samples){
+		num = max_samples;
+	}
+	shape.swap = type->big_endian;
+	shape.shift = type->shift;
+	shape.ext = 32 - type->real_bits;
+	shape.is_signed = type->is_signed;
+	switch(type->storage_bits){
+	case 32:
+		done = kernel->decode32(raw, num, &shape, samples);
+		decode32_scalar(raw + done * 4, num - done, &shape, samples + done);
+		break;
+	case 24:
+		done = kernel->decode24(raw, num, &shape, samples);
+		decode24_scalar(raw + done * 3, num - done, &shape, samples + done);
+		break;
+	default:
+		for(i=0;i<num;i++){
+			if(shape.swap){
+				samples[i] = finish_sample((uint32_t)raw[i * 2] << 8 | raw[i * 2 + 1], &shape);
+			}
+			else{
+				samples[i] = finish_sample((uint32_t)raw[i * 2 + 1] << 8 | raw[i * 2], &shape);
+			}
+		}
+		break;
+	}
+	return num;
+}
+
+int adc_parse_text(const char *buf, size_t len, int32_t *value){
+	int64_t result = 0;
+	size_t i = 0;
+	int negative = 0;
+	int digits = 0;
+
+	while(i < len && buf[i] == ' '){
+		i++;
+	}
+	if(i < len && (buf[i] == '-' || buf[i] == '+')){
+		negative = buf[i] == '-';
+		i++;
+	}
+	for(;i<len && buf[i] >= '0' && buf[i] <= '9';i++){
+		result = result * 10 + (buf[i] - '0');
+		if(result > (int64_t)INT32_MAX + 1){
+			return -1;
+		}
+		digits++;
+	}
+	if(digits == 0 || (i < len && buf[i] != '\n' && buf[i] != '\0' && buf[i] != ' ')){
+		return -1;
+	}
+	result = negative ? -result : result;
+	if(result > INT32_MAX){
+		return -1;
+	}
+	*value = (int32_t)result;
+	return 0;
+}
+
+void adc_compute_stats(const int32_t *samples, int num_samples, struct adc_stats *stats){
+	const struct adc_kernel *kernel = get_kernel();
+	struct adc_accum accum;
+	double sum_squares = 0;
+	double offset_mean;
+	int32_t base;
+	int chunk;
+	int done;
+	int i;
+
+	memset(stats, 0, sizeof(struct adc_stats));
+	if(num_samples <= 0){
+		return;
+	}
+	//Squares are taken about the first sample rather than zero, so readings sitting far from zero keep
+	//their precision
+	base = samples[0];
+	stats->min = INT32_MAX;
+	stats->max = INT32_MIN;
+	for(i=0;i<num_samples;i+=chunk){
+		chunk = num_samples - i < ADC_STATS_CHUNK ? num_samples - i : ADC_STATS_CHUNK;
+		accum.min = INT32_MAX;
+		accum.max = INT32_MIN;
+		accum.sum = 0;
+		accum.sum_squares = 0;
+		done = kernel->stats(samples + i, chunk, base, &accum);
+		stats_scalar(samples + i + done, chunk - done, base, &accum);
+		stats->min = accum.min < stats->min ? accum.min : stats->min;
+		stats->max = accum.max > stats->max ? accum.max : stats->max;
+		stats->sum = stats->sum + accum.sum;
+		sum_squares = sum_squares + (double)accum.sum_squares;
+	}
+	stats->count = num_samples;
+	stats->mean = (double)stats->sum / num_samples;
+	offset_mean = (double)(stats->sum - (int64_t)base * num_samples) / num_samples;
+	stats->variance = sum_squares / num_samples - offset_mean * offset_mean;
+	if(stats->variance < 0){
+		stats->variance = 0;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef SPICE_RACK_ADC_H
+#define SPICE_RACK_ADC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Decoding and statistics for batches of ADC samples. The batch functions use AVX2 or SSE4.1 on x86 and
+//NEON on ARM builds with NEON enabled, picked once at first use from what the CPU supports, and plain C
+//otherwise. Every kernel gives exactly the same results.
+
+//Sample layout as written in an IIO scan_elements type file, "[bl]e:[su]<bits>/<storage>>><shift>",
+//e.g. "be:s24/32>>8". A storage of 24 is also accepted for samples packed three bytes each, as an HX711
+//driver without IIO buffer support gives them.
+struct adc_scan_type{
+	int big_endian;
+	int is_signed;
+	int real_bits;
+	int storage_bits;
+	int shift;
+};
+
+struct adc_stats{
+	int count;
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	double mean;
+	//Population variance
+	double variance;
+};
+
+//Returns 0, or -1 if str isn't a layout that can be decoded into int32_t
+int adc_parse_scan_type(const char *str, struct adc_scan_type *type);
+//Bytes per sample
+int adc_sample_size(const struct adc_scan_type *type);
+//Decodes the whole samples in buf into samples, sign extended for signed types. Returns the number decoded.
+int adc_decode(const void *buf, size_t len, const struct adc_scan_type *type, int32_t *samples, int max_samples);
+//One reading from a sysfs in_voltageN_raw file, which is decimal text ending at a newline or NUL. Returns 0,
+//or -1 if buf doesn't start with a number that fits an int32_t.
+int adc_parse_text(const char *buf, size_t len, int32_t *value);
+
+//The variance is exact for samples that are all within 2^24 of each other, as a 24 bit ADC's are
+void adc_compute_stats(const int32_t *samples, int num_samples, struct adc_stats *stats);
+
+//"avx2", "sse4.1", "neon" or "scalar"
+const char *adc_kernel_name(void);
+//Switches to the named kernel, for the tests and benchmarks to compare them. Returns -1 if this build or
+//CPU can't run it.
+int adc_use_kernel(const char *name);
+
+#endif
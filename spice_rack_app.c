@@ -10,397 +10,325 @@
 #include <signal.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <math.h>
+#include "spice_rack_history.h"
+#include "spice_rack_forecast.h"
+#include "spice_conversions.h"
+#include "spice_rack_publish.h"
+#include "spice_rack_snapshot.h"
+#include "spice_rack_config.h"
+#include "spice_rack_workers.h"
+#include "spice_rack_epoch.h"
+#include "spice_rack_persist.h"
+#include "spice_rack_core.h"
+#include "spice_rack_uring.h"
+#include "spice_rack_health.h"
+#include "spice_rack_watchdog.h"
+#include "spice_rack_adc.h"
+#include "spice_rack_io.h"
+#include "spice_rack_log.h"
+#include "spice_rack_process.h"
+#include "spice_rack_trace.h"
 #include "spice_rack_app.h"
 #include <stdbool.h>
 
 //Variables
 #define MAX_FILE_ENTRY_LEN 32
 #define MAX_LINE_LENGTH 160 //80 + (5*MAX_FILE_ENTRY)
-#define SPICE_RACK_SIZE 3
+#define SPICE_RACK_SIZE_DEF 3
 #define NUM_COLUMNS 5
 #define ADC_COLUMN 2
 #define MASS_COLUMN 3
 #define TSP_COLUMN 4
 #define EMPTY_JAR_MASS_DEF 133.245
 #define CALIBRATE_GPIO "27"
+#define FSR_POLL_SEC 5
+#define WEIGHT_SAMPLES 10
+#define MAX_WEIGHT_SAMPLES 1000
+#define FSR_DEBOUNCE_MS 200
+#define MAX_RACK_SIZE SNAPSHOT_MAX_SLOTS
+#define MAX_SUGGESTIONS 5
+#define NUM_RACKS_DEF 1
+#define MAX_RACKS 16
+#define WORKER_THREADS_DEF 2
+#define MAX_WORKER_THREADS 8
+#define READ_LEN 8
+//Bytes asked for per read when the measurements file is read in
+#define FILE_BLOCK_SIZE 4096
+#define SCHEDULER_TICK_MS 150
+#define FLUSH_MS_DEF 1000
+#define IO_URING_DEF 1
+#define LOG_LEVEL_NAME "info"
+//Events kept for -t, 72 bytes each
+#define TRACE_MAX_EVENTS 100000
+//HX711 reads submitted to the ring at once
+#define WEIGHT_BATCH 32
+//A weight measurement gives up after this many reads per sample wanted, or WEIGHT_TIMEOUT_MS
+#define WEIGHT_RETRY_FACTOR 3
+#define WEIGHT_TIMEOUT_MS 5000
+//Identical ADC readings in a row before the weight sensor counts as stuck. The HX711 is noisy enough
+//that a working one practically never repeats this often.
+#define STUCK_SAMPLES 50
+//FSR reads before a debounce that never settles is given up on
+#define FSR_MAX_READS 100
+#define JOB_TIMEOUT_SEC 120
+//A sweep reads the FSR and one weight sample this often, and leaves out the samples from the first
+//SWEEP_SETTLE_MS after a jar moves while the load cell settles
+#define SWEEP_POLL_MS 50
+#define SWEEP_SETTLE_MS 500
+#define SWEEP_TIMEOUT_SEC 900
 //Files
+#define CONFIG_FILE "/usr/bin/spice_rack/spice_rack.conf"
 #define HX711_FILE "/sys/bus/iio/devices/iio:device0/in_voltage0_raw"
+//Empty reads hx711_file as sysfs text
+#define HX711_SCAN_TYPE ""
 #define FSR_FILE "/dev/fsr_gpio_0"
-#define OUTPUT_FILE "/usr/bin/spice_rack/spice_rack_measurements.txt"
-#define CONSOLIDATED_FILE "/usr/bin/spice_rack/spice_rack_consolidated.txt"
-#define TMP_FILE "/var/log/spice_rack_tmp.txt"
+#define DATA_DIR "/usr/bin/spice_rack"
 #define SPICE_CONVERSIONS_FILE "/usr/bin/spice_rack/spice_conversions.csv"
-
-static struct spice_rack *spice_rack;
-static struct calibration_status calibration;
-static bool caught_signal = false;
-
-static void socket_signal_handler (int signal_number){
-        if (signal_number == SIGTERM || signal_number == SIGINT){
-                caught_signal = true;
-        }
-}
-
-//Finding the file size in order to malloc appropriately sized char *.
-static off_t find_file_size(char *file_name){
-	int fd = 0;
-	off_t file_length = 0;
-
-	fd = open(file_name, O_RDONLY);
-	if(fd == -1){
-		perror("Spice_Rack_App: find_file_size - Failed to Open File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: find_file_size - Failed to Open File - %s\n", strerror(errno));
-		return -1;
-	}
-
-	file_length = lseek(fd, 0, SEEK_END);
-	if(file_length  == -1){
-		perror("Spice_Rack_App: find_file_size - Seeking to end of file failed - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: find_file_size - Seeking to end of file failed - %s\n", strerror(errno));
-		return -1;
-	}
-	syslog(LOG_DEBUG, "Spice_Rack_App: find_file_size - file_length = %li\n", file_length);
-
-	close(fd);
-	return file_length;
-}
-
-static int copy_file(int in_fd, int out_fd, off_t end_location){
-	int result = 0;
-	off_t rd_count = 0;
-	off_t wr_count = 0;
-	off_t read_len = 1;
-	off_t curr_position;
-	char next_char[1];
-	
-	//Grab current position because this function is only intended to copy file contents from current location to
-	//a specified end location
-	curr_position = lseek(in_fd, 0, SEEK_CUR);
-	if(curr_position  == -1){
-		perror("Spice_Rack_App: copy_file - Grabbing current position in file failed - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: copy_file - Grabbing current position in file - %s\n", strerror(errno));
-		return -1;
-	}
-
-	//Check end location to determine how long to copy
-	if(end_location != 0){
-		read_len = end_location - curr_position;
+//Per rack files, relative to the rack's data_dir. Rack 1 keeps its files directly in DATA_DIR.
+#define MEASUREMENTS_FILE_NAME "spice_rack_measurements.txt"
+#define CONSOLIDATED_FILE_NAME "spice_rack_consolidated.txt"
+#define INVENTORY_FILE_NAME "spice_rack_inventory.bin"
+#define HISTORY_DIR_NAME "history"
+#define FORECAST_FILE_NAME "spice_rack_forecast.dat"
+
+static struct spice_conversion_table *conversions;
+static struct rack racks[MAX_RACKS];
+static struct worker_pool *workers;
+//Reclaims inventory snapshots replaced while a reader might still hold them
+static struct epoch_domain snapshot_epochs;
+//Writes measurements and published files off the sensing path
+static struct persist_queue *persist;
+//Calibration prompts on stdin, so only one rack calibrates at a time
+static pthread_mutex_t console_lock = PTHREAD_MUTEX_INITIALIZER;
+//Set by the main loop on SIGTERM or SIGINT, read by a sweep in progress on a worker thread
+static atomic_bool caught_signal = false;
+//SIGUSR1 starts an inventory sweep on every rack
+static const int handled_signals[] = {SIGTERM, SIGINT, SIGHUP, SIGUSR1};
+//Fed by the scheduler while no rack's job is stalled
+static struct watchdog watchdog;
+//Defaults below are used for anything the config file doesn't set
+static char config_file[PATH_MAX] = CONFIG_FILE;
+static struct app_config config = {
+	NUM_RACKS_DEF, WORKER_THREADS_DEF, FSR_POLL_SEC, FLUSH_MS_DEF, IO_URING_DEF, JOB_TIMEOUT_SEC, SWEEP_TIMEOUT_SEC, "", LOG_LEVEL_NAME,
+	{HX711_FILE, FSR_FILE, DATA_DIR, CALIBRATE_GPIO, SPICE_RACK_SIZE_DEF, EMPTY_JAR_MASS_DEF, WEIGHT_SAMPLES, FSR_DEBOUNCE_MS,
+	 WEIGHT_TIMEOUT_MS, STUCK_SAMPLES, HX711_SCAN_TYPE}
+};
+static const struct config_option app_options[] = {
+	CONFIG_INT_OPTION(struct app_config, num_racks, CONFIG_RESTART, 1, MAX_RACKS),
+	CONFIG_INT_OPTION(struct app_config, worker_threads, CONFIG_RESTART, 1, MAX_WORKER_THREADS),
+	CONFIG_INT_OPTION(struct app_config, fsr_poll_sec, CONFIG_RELOAD, 1, 3600),
+	CONFIG_INT_OPTION(struct app_config, flush_ms, CONFIG_RESTART, 0, 60000),
+	CONFIG_INT_OPTION(struct app_config, io_uring, CONFIG_RESTART, 0, 1),
+	CONFIG_INT_OPTION(struct app_config, job_timeout_sec, CONFIG_RELOAD, 10, 3600),
+	CONFIG_INT_OPTION(struct app_config, sweep_timeout_sec, CONFIG_RELOAD, 10, 7200),
+	CONFIG_STRING_OPTION(struct app_config, watchdog_device, CONFIG_RESTART),
+	CONFIG_STRING_OPTION(struct app_config, log_level, CONFIG_RELOAD)
+};
+//Allowed in the global section as defaults for every rack and in [rackN] sections
+static const struct config_option rack_options[] = {
+	CONFIG_STRING_OPTION(struct rack_config, hx711_file, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct rack_config, fsr_file, CONFIG_RELOAD),
+	CONFIG_STRING_OPTION(struct rack_config, data_dir, CONFIG_RESTART),
+	CONFIG_STRING_OPTION(struct rack_config, calibrate_gpio, CONFIG_RESTART),
+	CONFIG_INT_OPTION(struct rack_config, rack_size, CONFIG_RESTART, 1, MAX_RACK_SIZE),
+	CONFIG_FLOAT_OPTION(struct rack_config, empty_jar_mass, CONFIG_RELOAD, 0, 10000),
+	CONFIG_INT_OPTION(struct rack_config, weight_samples, CONFIG_RELOAD, 1, MAX_WEIGHT_SAMPLES),
+	CONFIG_INT_OPTION(struct rack_config, debounce_ms, CONFIG_RELOAD, 0, 10000),
+	CONFIG_INT_OPTION(struct rack_config, weight_timeout_ms, CONFIG_RELOAD, 100, 600000),
+	CONFIG_INT_OPTION(struct rack_config, stuck_samples, CONFIG_RELOAD, 0, 1000000),
+	CONFIG_STRING_OPTION(struct rack_config, hx711_scan_type, CONFIG_RELOAD)
+};
+#define NUM_APP_OPTIONS (sizeof(app_options)/sizeof(app_options[0]))
+#define NUM_RACK_OPTIONS (sizeof(rack_options)/sizeof(rack_options[0]))
+//app_options followed by rack_options pointing into app_config.rack, built by setup_config_options()
+static struct config_option global_options[NUM_APP_OPTIONS + NUM_RACK_OPTIONS];
+
+//Reads the whole of fd into a malloc'd, NUL terminated buffer a block at a time, setting len to the bytes
+//read. A 0xff byte ends the file, as it always has (it compares equal to EOF). Returns NULL on failure.
+static char *read_file(int fd, size_t *len){
+	char *contents;
+	char *grown;
+	char *eof_char;
+	size_t size = FILE_BLOCK_SIZE;
+	ssize_t rd_count;
+
+	*len = 0;
+	if((contents = (char *)malloc(size + 1)) == NULL){
+		log_errno("Spice_Rack_App: read_file - Failed on Malloc");
+		return NULL;
 	}
-	else{
-		read_len = 1;
-	}
-	
-	//Copy contents
-	while((rd_count = read(in_fd, next_char, 1)) != 0 && (read_len != 0)){
-		if(rd_count == -1){
-			if(errno == EINTR){
-				continue;
+	while(1){
+		if(*len == size){
+			if((grown = (char *)realloc(contents, 2 * size + 1)) == NULL){
+				log_errno("Spice_Rack_App: read_file - Failed on Realloc");
+				free(contents);
+				return NULL;
 			}
-			perror("Spice_Rack_App: copy_file -  Reading File failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: copy_file - Reading File failed - %s\n", strerror(errno));
-			result = -1;
-			break;
+			contents = grown;
+			size = 2 * size;
 		}
-		if(*next_char == EOF){
+		if((rd_count = pread(fd, contents + *len, size - *len, *len)) == 0){
 			break;
 		}
-		read_len = read_len - rd_count;
-		wr_count = write(out_fd, next_char, 1);
-		if(wr_count == -1){
-			perror("Spice_Rack_App: copy_file - Writing Measurements to File failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: copy_file - Writing Measurements to File failed - %s\n", strerror(errno));
-			result = -1;
-		}
-	}
-		
-	return result;
-}
-
-static int read_line(int fd, char *output_str){
-	int count;
-	int result = 0;
-	char *read_buff;
-
-	if((read_buff = (char *)malloc(2 * sizeof(char))) == NULL){
-		printf("Spice_Rack_App: read_line - Failed on Malloc\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: read_line - Failed on Malloc\n");
-		return -1;
-	}
-	memset(output_str,0,strlen(output_str));
-
-	while((count = read(fd, read_buff, 1)) != 0){
-		if(count == -1){
+		if(rd_count == -1){
 			if(errno == EINTR){
 				continue;
 			}
-			perror("Spice_Rack_App: read_line - Reading File failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: read_line - Reading File failed - %s\n", strerror(errno));
-			result = -1;
-			break;
+			log_errno("Spice_Rack_App: read_file - Reading File failed");
+			free(contents);
+			return NULL;
 		}
-		if(strchr(read_buff, '\n') != NULL){
+		if((eof_char = memchr(contents + *len, EOF, rd_count)) != NULL){
+			*len = eof_char - contents;
 			break;
 		}
-		strncat(output_str, read_buff, 1);
+		*len = *len + rd_count;
 	}
-	
-	free(read_buff);
-	return result;
+	contents[*len] = '\0';
+	return contents;
 }
 
-static int parse_line(char *output_str, int i){
-	int result = 0;
-	int substring_len = 0;
-	char *start_ptr = output_str;
-	char *comma_ptr;
-	int j;
-
-	for(j=0;j<NUM_COLUMNS;j++){
-		if((start_ptr = strstr(output_str, spice_rack->spices[i].spice_search_strings.search_strings[j])) != NULL){
-			start_ptr = start_ptr + strlen(spice_rack->spices[i].spice_search_strings.search_strings[j]);
-		}
-		if((comma_ptr = strchr(start_ptr, ',')) != NULL || (j == NUM_COLUMNS-1)){
-			substring_len = comma_ptr - start_ptr + 1;
-			snprintf(spice_rack->spices[i].spice_entries.entries[j], substring_len, "%s", start_ptr);
-			start_ptr = output_str + strlen(spice_rack->spices[i].spice_search_strings.search_strings[j]) + substring_len;
-		}
-	}
-	return result;
+//Copies the line starting at offset in contents to output_str, cut to output_len, and moves offset past
+//its newline. Past the end of contents the line is empty.
+static void read_line(const char *contents, size_t len, size_t *offset, char *output_str, size_t output_len){
+	const char *line = contents + *offset;
+	const char *newline;
+	size_t line_len;
+
+	if(*offset >= len){
+		output_str[0] = '\0';
+		return;
+	}
+	newline = memchr(line, '\n', len - *offset);
+	line_len = newline != NULL ? (size_t)(newline - line) : len - *offset;
+	*offset = *offset + line_len + (newline != NULL);
+	if(line_len >= output_len){
+		line_len = output_len - 1;
+	}
+	memcpy(output_str, line, line_len);
+	output_str[line_len] = '\0';
 }
 
-static off_t search_file(int in_fd, char *search_term){
-	off_t file_offset;
-	off_t end_of_line = 0;
-	off_t end_of_file = 0;
-	char read_line_buff[MAX_LINE_LENGTH];
-	char *match_str;
-	
-	//Find EOF
-	end_of_file = lseek(in_fd, 0, SEEK_END);
-	if(end_of_file  == -1){
-		perror("Spice_Rack_App: search_file - Seeking to end of file failed - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: search_file - Seeking to end of file failed - %s\n", strerror(errno));
-		return -1;
-	}
+static int parse_line(struct rack *rack, char *output_str, int i){
+	return spice_parse_line(output_str, rack->spice_rack->spices[i].spice_entries.entries, MAX_FILE_ENTRY_LEN);
+}
 
-	//Set position to beginning of file
-	file_offset = lseek(in_fd, 0, SEEK_SET);
-	if(file_offset  == -1){
-		perror("Spice_Rack_App: search_file - Seeking to beginning of file failed - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: search_file - Seeking to beginning of file failed - %s\n", strerror(errno));
-		return -1;
-	}
-	
-	//Search through each line for the search term and stop on the line that you find it
-	while(file_offset < end_of_file){	
-		if(read_line(in_fd, read_line_buff) == -1){
-			printf("Spice_Rack_App: search_file - Failure in reading line\n");
-			syslog(LOG_DEBUG, "Spice_Rack_App: search_file - Failure in reading line\n");
-			return -1;
-		}
-		if((match_str = strstr(read_line_buff, search_term)) != NULL){
-			//Grab end of line position after the read is complete
-			end_of_line = lseek(in_fd, 0, SEEK_CUR);
-			if(end_of_line  == -1){
-				perror("Spice_Rack_App: search_file - Grabbing end of line position failed - ");
-				syslog(LOG_DEBUG, "Spice_Rack_App: search_file - Grabbing enf of line position failed - %s\n", strerror(errno));
-				return -1;
-			}
-			
-			//Restore file offset to beginning of this line
-			file_offset = lseek(in_fd, file_offset, SEEK_SET);
-			if(file_offset  == -1){
-				perror("Spice_Rack_App: search_file - Seeking to beginning of line failed - ");
-				syslog(LOG_DEBUG, "Spice_Rack_App: search_file - Seeking to beginning of line failed - %s\n", strerror(errno));
-				return -1;
-			}
-			break;
-		}		
-		//Grab file offset of current location to determine if EOF
-		file_offset = lseek(in_fd, 0, SEEK_CUR);
-		if(file_offset  == -1){
-			perror("Spice_Rack_App: search_file - Getting current file position failed  - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: search_file - Getting current file position failed - %s\n", strerror(errno));
-			return -1;
+//Finds the first line of contents holding search_term. Returns the offset just past that line, or 0 if no
+//line does, and sets line_start to where the line begins.
+static size_t search_file(const char *contents, size_t len, const char *search_term, size_t *line_start){
+	char line[MAX_LINE_LENGTH];
+	size_t offset = 0;
+	size_t start;
+
+	while(offset < len){
+		start = offset;
+		read_line(contents, len, &offset, line, sizeof(line));
+		if(strstr(line, search_term) != NULL){
+			*line_start = start;
+			return offset;
 		}
-	}	
-
-	return end_of_line;
+	}
+	return 0;
 }
 
+//Names stored by calibrations that predate exact matching may only be part of a spice name,
+//e.g. "Basil" for "Ground Basil". Those resolve to the first row containing them, as they always did.
 static float convert_grams_to_tsp(char *spice_name, float grams){
 	float result = 0;
-	off_t spice_offset = 0;
-	char output_str[50];
-	char *comma_ptr;
-	char res_str[10];
-	int res_str_len;
-	int fd;
-	int i;
-	char *end_ptr;
-	float tsps;
-	float ounces;
-
-	fd = open(SPICE_CONVERSIONS_FILE, O_RDONLY);
-	if(fd == -1){
-		perror("Spice_Rack_App: convert_grams_to_tsp - Failed to Open Conversions File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - Failed to Open Conversions File - %s\n", strerror(errno));
-		return -1;
-	}
+	uint64_t span_start;
+	int row;
 
-	//Search for Spice Name in conversions file
-	if((spice_offset = search_file(fd, spice_name)) == -1){
-		printf("Spice_Rack_App: convert_grams_to_tsp - Searching for spice name in file observed an issue\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - Searching for spice name in file observed an issue\n");
-		return -1;
-	}
-	else if(spice_offset == 0){
+	TRACE_BEGIN(conversion, span_start);
+	//Conversion factors are precomputed at load, so this is a name lookup and a multiply
+	if((row = spice_conversion_lookup(conversions, spice_name)) == -1){
 		printf("Couldn't find Entered Spice Name in %s\n", SPICE_CONVERSIONS_FILE);
-		syslog(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - Couldn't find Entered Spice Name in %s\n", SPICE_CONVERSIONS_FILE);
+		log_message(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - Couldn't find Entered Spice Name in %s\n", SPICE_CONVERSIONS_FILE);
 		return -1;
 	}
-
-	//Parse the line that contains the match to obtain the Grams to TSP conversion
-	read_line(fd, output_str);
-	for(i=0;i<3;i++){
-		if((comma_ptr = strrchr(output_str, ',')) != NULL){
-			comma_ptr = comma_ptr + 1;
-			res_str_len = strlen(output_str) - (comma_ptr - output_str) + 1;
-			snprintf(res_str, res_str_len, "%s", comma_ptr);
-		}
-	}
-
-	//Do math
-	//1gram = 0.03527grams
-	syslog(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - Grams is %f\n", grams);
-	ounces = grams * 0.0352739619;
-	syslog(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - Ounces is %f\n", ounces);
-	tsps = strtof(res_str, &end_ptr);
-	syslog(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - tsps is %f\n", tsps);
-	result = tsps * ounces;
-	syslog(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - Total tsps is %f\n", result);
-	
-	close(fd);
+	result = spice_conversions_convert(conversions, row, grams);
+	TRACE_END(conversion, span_start, "row", row, "milligrams", grams * 1000);
+	log_message(LOG_DEBUG, "Spice_Rack_App: convert_grams_to_tsp - %f grams of %s is %f %s\n", grams, conversions->rows[row].name, result, spice_conversions_unit(conversions, row));
 
 	return result;
 }
 
-static int print_spice_list(){
-	int fd;
+//Prints the closest spice names to what was typed. Returns the number printed.
+static int print_spice_suggestions(char *spice_name, struct spice_name_match *suggestions){
+	int num_suggestions;
 	int i;
-	off_t file_offset;
-	off_t end_of_file;
-	char output_str[50];
-	char *comma_ptr;
-	int res_str_len;
-	char res_str[MAX_FILE_ENTRY_LEN];
-
 
-	fd = open(SPICE_CONVERSIONS_FILE, O_RDONLY);
-	if(fd == -1){
-		perror("Spice_Rack_App: print_spice_list - Failed to Open Consolidated File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: print_spice_list - Failed to Open Consolidated File - %s", strerror(errno));
-		return -1;
+	if(conversions == NULL){
+		return 0;
 	}
-
-	//Find EOF
-	end_of_file = lseek(fd, 0, SEEK_END);
-	if(end_of_file  == -1){
-		perror("Spice_Rack_App: search_file - Seeking to end of file failed - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: search_file - Seeking to end of file failed - %s\n", strerror(errno));
-		return -1;
+	num_suggestions = spice_name_index_suggest(conversions->index, spice_name, suggestions, MAX_SUGGESTIONS);
+	if(num_suggestions == 0){
+		printf("Couldn't find anything close to %s. Enter ? to list all spices\n", spice_name);
+		return 0;
 	}
+	printf("Couldn't find %s. Did you mean:\n", spice_name);
+	for(i=0;i<num_suggestions;i++){
+		printf("  %i) %s\n", i+1, conversions->rows[suggestions[i].id].name);
+	}
+	printf("Enter a number to pick one, type the name again, or enter ? to list all spices\n");
+	return num_suggestions;
+}
 
-	//Set position to beginning of file
-	file_offset = lseek(fd, 0, SEEK_SET);
-	if(file_offset  == -1){
-		perror("Spice_Rack_App: print_spice_list - Seeking to beginning of file failed - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: print_spice_list - Seeking to beginning of file failed - %s\n", strerror(errno));
+static int print_spice_list(){
+	int i;
+
+	if(conversions == NULL){
+		printf("No spice conversions were loaded from %s\n", SPICE_CONVERSIONS_FILE);
 		return -1;
 	}
-
 	printf("Here are the list of spices found in %s\n", SPICE_CONVERSIONS_FILE);
-	//Read Entire File
-	while(file_offset < end_of_file){			
-		read_line(fd, output_str);
-		for(i=0;i<3;i++){
-			if((comma_ptr = strchr(output_str, ',')) != NULL){
-				res_str_len = comma_ptr - output_str + 1;
-				snprintf(res_str, res_str_len, "%s", output_str);
-			}
-		}
-		printf("%s\n", res_str);
-		//Grab file offset of current location to determine if EOF
-		file_offset = lseek(fd, 0, SEEK_CUR);
-		if(file_offset  == -1){
-			perror("Spice_Rack_App: print_spice_list - Getting current line position failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: print_spice_list - Getting current line position failed - %s\n", strerror(errno));
-			return -1;
-		}
+	for(i=0;i<conversions->num_rows;i++){
+		printf("%s\n", conversions->rows[i].name);
 	}
-
-	close(fd);
 	return 0;
 }
 
 //Used to store measurement data to a file. Handles both creating for the first time as well as updating 
 //data for individual spices. 
-static int store_measurement(int spice_num, char *spice_name, char *weight, float mass, float tsps){
+static int store_measurement(struct rack *rack, int spice_num, char *spice_name, char *weight, float mass, float tsps){
 	int input_fd;
-	int temp_fd;
 	int output_fd;
 	int output_str_len;
-	int count;
 	int result = 0;
-	off_t file_length = 0;
-	off_t file_offset = 0;
-	off_t eol;
-	off_t match_offset = 0;
+	size_t file_length;
+	size_t eol;
+	size_t match_offset = 0;
+	char *contents;
 	char *spice_num_str;
-	char file_name[] = OUTPUT_FILE;
+	char *file_name = rack->measurements_file;
 	char *output_format_str;
 	
 	
-	//Open file for RD/WR and create if it doesn't already exist. 
-	input_fd = open(file_name, O_CREAT | O_RDWR);
+	//Open file and create if it doesn't already exist, then read all of it in
+	input_fd = open(file_name, O_CREAT | O_RDONLY, 0666);
 	if(input_fd == -1){
-		perror("Spice_Rack_App: store_measurements - Failed to Open Input File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurements - Failed to Open Input File - %s\n", strerror(errno));
-		return -1;
-	}
-	temp_fd = open(TMP_FILE, O_CREAT | O_RDWR | O_TRUNC, 0666);
-	if(temp_fd == -1){
-		perror("Spice_Rack_App: store_measurements - Failed to Open File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurements - Failed to Open Temp File - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: store_measurements - Failed to Open Input File");
 		return -1;
 	}
-	
-	//Find File Size of Input File
-	file_length = find_file_size(file_name);
-	syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Input file length is %li\n", file_length);
-
-	if(copy_file(input_fd, temp_fd, EOF) == -1){
+	contents = read_file(input_fd, &file_length);
+	close(input_fd);
+	if(contents == NULL){
 		printf("Spice_Rack_App: store_measurement - Failed to read file contents to read buffer");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurements - Failed to Copy Input File to Temp file\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: store_measurements - Failed to read %s\n", file_name);
 		return -1;
 	}
+	log_message(LOG_DEBUG, "Spice_Rack_App: store_measurement - Input file length is %zu\n", file_length);
 
-	//Close input file now that contents were all read out. Going to repoen this file and truncate 
-	//because often measurement changes could be fewer characters and lead to extra whitespace
-	//and newlines at the EOF. So it is needed to write whole file again to avoid that.
-	close(temp_fd);
-	close(input_fd);
-	temp_fd = open(TMP_FILE, O_RDONLY);
-	if(temp_fd == -1){
-		perror("Spice_Rack_App: store_measurements - Failed to Open File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurements - Failed to Open Temp File - %s\n", strerror(errno));
-		return -1;
-	}
-	//Open file for writing and create if it doesn't already exist and truncate because we will rewrite
+	//Reopen the file truncated, because often measurement changes could be fewer characters and lead to
+	//extra whitespace and newlines at the EOF. So it is needed to write whole file again to avoid that.
 	output_fd = open(file_name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
 	if(output_fd == -1){
-		perror("Spice_Rack_App: store_measurement - Failed to Open Output File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurements - Failed to Open Output File - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: store_measurements - Failed to Open Output File");
+		free(contents);
 		return -1;
 	}			
 	
@@ -408,251 +336,518 @@ static int store_measurement(int spice_num, char *spice_name, char *weight, floa
 	//Output format is: Spice_Location, Spice_Name, ADC_Reading, Mass, Teaspoons
 	//Setting the Spice_Location portion of the output string
 	if((spice_num_str = (char *)malloc(MAX_FILE_ENTRY_LEN * sizeof(char))) == NULL){
-		perror("Spice_Rack_App: store_measurement - Couldn't allocate memory - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Couldn't allocate memory - %s", strerror(errno));
+		log_errno("Spice_Rack_App: store_measurement - Couldn't allocate memory");
+		close(output_fd);
+		free(contents);
 		return -1;
 	}
 	memset(spice_num_str, 0, MAX_FILE_ENTRY_LEN);
-	if((strstr(spice_name, "Empty Jar") != NULL) || (strcmp(spice_name, "Empty Rack") == 0)){
-		snprintf(spice_num_str, MAX_FILE_ENTRY_LEN, "N/A-%s", spice_name);
-	} 
-	else{
-		snprintf(spice_num_str,7,"Spice%i", spice_num);
-	}
+	spice_format_location(spice_num_str, MAX_FILE_ENTRY_LEN, spice_num, spice_name);
 
 	//Setting the remaining portions of the output string
 	output_str_len = MAX_LINE_LENGTH;
 	output_format_str = (char *)malloc(output_str_len * sizeof(char));
 	if(output_format_str == NULL){
-		perror("Spice_Rack_App: store_measurement - Couldn't allocate memory - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Couldn't allocate memory - %s", strerror(errno));
+		log_errno("Spice_Rack_App: store_measurement - Couldn't allocate memory");
+		close(output_fd);
+		free(contents);
+		free(spice_num_str);
 		return -1;
 	}
 	memset(output_format_str, 0, output_str_len);
-	snprintf(output_format_str, (output_str_len-1), "Spice_Location:%s,Spice_Name:%s,ADC_Reading:%s,Calibrated_Mass(grams):%3.6f,Teaspoons:%3.6f\n", spice_num_str, spice_name, weight, mass, tsps);
+	spice_format_line(output_format_str, (output_str_len-1), spice_num_str, spice_name, weight, mass, tsps);
 
-	if((eol = search_file(temp_fd, spice_num_str)) == -1){
-		printf("Spice_Rack_App: store_measurement - Searching for spice location in file observed an issue\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Searching for spice location in file observed an issue\n");
-		return -1;
-	}
-	else if(eol == 0){
+	if((eol = search_file(contents, file_length, spice_num_str, &match_offset)) == 0){
 		//Will be appending data to EOF
-		//Reset position to beginning of file
-		file_offset = lseek(temp_fd, 0, SEEK_SET);
-		if(file_offset  == -1){
-			perror("Spice_Rack_App: store_measurement - Seeking to beginning of file failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Seeking to beginning of file failed - %s\n", strerror(errno));
-			result = -1;
-		}
-
-		//copy existing file contents
-		if(copy_file(temp_fd, output_fd, EOF) == -1){
-			perror("Spice_Rack_App: store_measurement - Failed to copy temp file contents to output file - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Failed to copy temp file contents to output file - %s\n", strerror(errno));
-			result = -1;
-		}
-
-		//Write new Entry
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Output String = %s", output_format_str);
-		count = write(output_fd, output_format_str, strlen(output_format_str));
-		if(count == -1){
-			perror("Spice_Rack_App: store_measurement - Writing Measurements to File failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Writing Measurements to File failed - %s\n", strerror(errno));
-			result = -1;
-		}
+		match_offset = file_length;
+		eol = file_length;
 	}
 	else{
-		//Will be inserting at current file position offset
 		printf("Found existing Entry with same Spice Number. Replacing that Line\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Found existing Entry with same Spice Number. Replacing that Line\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: store_measurement - Found existing Entry with same Spice Number. Replacing that Line\n");
+	}
 
-		//Grab offset in file where matching line was found
-		match_offset = lseek(temp_fd, 0, SEEK_CUR);
-		if(match_offset  == -1){
-			perror("Spice_Rack_App: store_measurement - Obtaining current offset in file failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Obtaining current offset in file failed - %s\n", strerror(errno));
-			result = -1;
-		}
+	//Existing contents up to the match, the new entry, then the rest after the replaced line
+	log_message(LOG_DEBUG, "Spice_Rack_App: store_measurement - Output String = %s", output_format_str);
+	if(write_all(output_fd, contents, match_offset) != 0 ||
+	   write_all(output_fd, output_format_str, strlen(output_format_str)) != 0 ||
+	   write_all(output_fd, contents + eol, file_length - eol) != 0){
+		log_errno("Spice_Rack_App: store_measurement - Writing Measurements to File failed");
+		result = -1;
+	}
 
-		//Reset position to beginning of file
-		file_offset = lseek(temp_fd, 0, SEEK_SET);
-		if(file_offset  == -1){
-			perror("Spice_Rack_App: store_measurement - Seeking to beginning of file failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Seeking to beginning of file failed - %s\n", strerror(errno));
-			result = -1;
-		}
+	close(output_fd);
+	free(contents);
+	free(output_format_str);
+	free(spice_num_str);
+	return result;
+}
 
-		//copy existing file contents up to the match location
-		if(match_offset > 0){
-			if(copy_file(temp_fd, output_fd, match_offset) == -1){
-				perror("Spice_Rack_App: store_measurement - Failed to copy temp file contents to output file - ");
-				syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Failed to copy temp file contents to output file - %s\n", strerror(errno));
-				result = -1;
-			}
-		}
+static void free_snapshot(void *snapshot){
+	free(snapshot);
+}
 
-		//Write new Entry
-		syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Output String = %s", output_format_str);
-		count = write(output_fd, output_format_str, strlen(output_format_str));
-		if(count == -1){
-			perror("Spice_Rack_App: store_measurement - Writing Measurements to File failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Writing Measurements to File failed - %s\n", strerror(errno));
-			result = -1;
-		}
+//Swaps next in as the rack's snapshot. The one it replaces is freed once no reader can still hold it,
+//so this never waits on readers.
+static int publish_snapshot(struct rack *rack, const struct inventory_snapshot *next){
+	struct inventory_snapshot *copy;
+	struct inventory_snapshot *old;
 
-		//Seek to EOF
-		file_offset = lseek(temp_fd, eol, SEEK_SET);
-		if(file_offset  == -1){
-			perror("Spice_Rack_App: store_measurement - Seeking to EOF failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Seeking to EOF failed - %s\n", strerror(errno));
-			result = -1;
-		}		
+	if((copy = (struct inventory_snapshot *)malloc(sizeof(struct inventory_snapshot))) == NULL){
+		log_errno("Spice_Rack_App: publish_snapshot - Failed on Malloc");
+		return -1;
+	}
+	*copy = *next;
+	old = atomic_exchange(&rack->snapshot, copy);
+	if(epoch_retire(&snapshot_epochs, old, free_snapshot) != 0){
+		//Leaking one snapshot is better than freeing it under a reader
+		log_message(LOG_DEBUG, "Spice_Rack_App: publish_snapshot - Unable to retire snapshot %llu\n", old == NULL ? 0ULL : (unsigned long long)old->version);
+	}
+	return 0;
+}
 
-		//copy existing file contents from end of replaced line to EOF
-		if(copy_file(temp_fd, output_fd, EOF) == -1){
-			perror("Spice_Rack_App: store_measurement - Failed to copy temp file contents to output file - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: store_measurement - Failed to copy temp file contents to output file - %s\n", strerror(errno));
+//Any thread may read a rack's snapshot this way without locking. The snapshot is never modified and stays
+//valid until release_snapshot(), however many times the rack publishes in the meantime.
+static const struct inventory_snapshot *acquire_snapshot(struct rack *rack, int *reader){
+	*reader = epoch_enter(&snapshot_epochs);
+	return atomic_load(&rack->snapshot);
+}
 
-			result = -1;
+static void release_snapshot(int reader){
+	epoch_exit(&snapshot_epochs, reader);
+}
+
+//Overall state of the rack's sensors as published in its snapshot
+static int rack_health(struct rack *rack, int *faults){
+	int health = SNAPSHOT_HEALTH_OK;
+
+	*faults = 0;
+	if(rack->weight_health.state != HEALTH_OK){
+		*faults = *faults | SNAPSHOT_FAULT_WEIGHT;
+		health = rack->weight_health.state == HEALTH_FAILED ? SNAPSHOT_HEALTH_FAILED : SNAPSHOT_HEALTH_DEGRADED;
+	}
+	if(rack->fsr_health.state != HEALTH_OK){
+		*faults = *faults | SNAPSHOT_FAULT_SLOTS;
+		if(rack->fsr_health.state == HEALTH_FAILED || health == SNAPSHOT_HEALTH_OK){
+			health = rack->fsr_health.state == HEALTH_FAILED ? SNAPSHOT_HEALTH_FAILED : SNAPSHOT_HEALTH_DEGRADED;
 		}
-	}	
+	}
+	return health;
+}
 
-	close(output_fd);
-	close(temp_fd);
-	free(output_format_str);
-	free(spice_num_str);
-	return result;
+//The version to publish after current. It counts up from current but never falls behind the wall clock in
+//milliseconds, so an app that restarts without its published snapshot still starts above every version an
+//earlier run handed out.
+static uint64_t next_version(const struct inventory_snapshot *current){
+	struct timespec now;
+	uint64_t version;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	version = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	if(current != NULL && current->version >= version){
+		version = current->version + 1;
+	}
+	return version;
 }
 
-static int consolidated_spice_file(){
-	int full_fd, consolidated_fd;
+//Gathers the current slot values into a new snapshot. The slot strings are only touched by the rack's own
+//job, which is the only caller, so this is the one place they are read. The version only moves when
+//something a reader would see has changed and never repeats, so readers can use it to tell whether anything
+//they cached is stale.
+static void build_snapshot(struct rack *rack){
+	struct spice_rack *spice_rack = rack->spice_rack;
+	struct inventory_snapshot next;
+	struct inventory_slot *slot;
+	//Only this rack's job publishes, so the current snapshot can't be retired under us
+	const struct inventory_snapshot *current = atomic_load(&rack->snapshot);
 	int i;
 
-	consolidated_fd = open(CONSOLIDATED_FILE, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-	if(consolidated_fd == -1){
-		perror("Spice_Rack_App: consolidated_spice_file - Failed to Open Consolidated File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: consolidated_spice_file - Failed to Open Consolidated File - %s", strerror(errno));
+	memset(&next, 0, sizeof(next));
+	next.num_slots = rack->config.rack_size;
+	next.health = rack_health(rack, &next.faults);
+	for(i=2;i<(rack->config.rack_size+2);i++){
+		slot = &next.slots[i-2];
+		slot->slot = i-1;
+		snprintf(slot->name, SNAPSHOT_NAME_LEN, "%s", spice_rack->spices[i].spice_entries.entries[1]);
+		snprintf(slot->unit, SNAPSHOT_UNIT_LEN, "%s", spice_conversions_unit(conversions, spice_conversions_find(conversions, slot->name)));
+		slot->grams = strtof(spice_rack->spices[i].spice_entries.entries[MASS_COLUMN], NULL);
+		slot->quantity = strtof(spice_rack->spices[i].spice_entries.entries[TSP_COLUMN], NULL);
+		slot->adc = strtol(spice_rack->spices[i].spice_entries.entries[ADC_COLUMN], NULL, 10);
+		//Usage forecast for this slot, when enough readings have been seen to estimate one
+		slot->days_left = forecast_days_until_empty(rack->forecast, i-1);
+		slot->low_stock = forecast_low_stock(rack->forecast, i-1);
+	}
+	if(current == NULL || next.num_slots != current->num_slots || next.health != current->health || next.faults != current->faults ||
+		memcmp(next.slots, current->slots, sizeof(next.slots)) != 0){
+		next.version = next_version(current);
+		next.taken = time(NULL);
+		publish_snapshot(rack, &next);
+	}
+}
+
+//Picks up the snapshot published before a restart, so readers have the last known inventory before the
+//sensors are read and its version keeps counting up from where it was. Returns 0 if one was published.
+static int load_published_snapshot(struct rack *rack){
+	struct inventory_snapshot snapshot;
+	struct stat file_stat;
+	void *map;
+	int result;
+	int fd;
+
+	fd = open(rack->inventory_path, O_RDONLY);
+	if(fd == -1){
 		return -1;
 	}
-	full_fd = open(OUTPUT_FILE, O_RDONLY, 0666);
-	if(full_fd == -1){
-		perror("Spice_Rack_App: consolidated_spice_file - Failed to Open Full File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: consolidated_spice_file - Failed to Open Full File - %s", strerror(errno));
+	if(fstat(fd, &file_stat) != 0 || file_stat.st_size == 0){
+		close(fd);
 		return -1;
 	}
-	
-	for(i=2;i<(SPICE_RACK_SIZE+2);i++){
-		write(consolidated_fd, spice_rack->spices[i].spice_entries.entries[1], strlen(spice_rack->spices[i].spice_entries.entries[1]));
-		write(consolidated_fd, " - ", 3);
-		write(consolidated_fd, spice_rack->spices[i].spice_entries.entries[TSP_COLUMN], strlen(spice_rack->spices[i].spice_entries.entries[TSP_COLUMN]));
-		write(consolidated_fd, "tsp\n", 4);
+	map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		log_message(LOG_DEBUG, "Spice_Rack_App: load_published_snapshot - Failed to map %s - %s\n", rack->inventory_path, strerror(errno));
+		return -1;
 	}
+	result = snapshot_decode(map, file_stat.st_size, &snapshot);
+	munmap(map, file_stat.st_size);
+	if(result != 0){
+		log_message(LOG_DEBUG, "Spice_Rack_App: load_published_snapshot - Ignoring unreadable %s\n", rack->inventory_path);
+		return -1;
+	}
+	return publish_snapshot(rack, &snapshot);
+}
+
+//Writes the snapshot as the human readable consolidated file and as the packed binary file that the
+//socket server renders its other formats from. Both are replaced atomically and only when changed.
+static int write_published_files(struct rack *rack){
+	const struct inventory_snapshot *snapshot;
+	char text[SNAPSHOT_BUFFER_SIZE];
+	char binary[SNAPSHOT_BUFFER_SIZE];
+	int text_len = -1;
+	int binary_len = -1;
+	int reader;
+	int result = 0;
+
+	//Serialized as a reader and released before the slow file writes
+	snapshot = acquire_snapshot(rack, &reader);
+	if(snapshot != NULL){
+		text_len = snapshot_serialize(snapshot, SNAPSHOT_TEXT, text, sizeof(text));
+		binary_len = snapshot_serialize(snapshot, SNAPSHOT_BINARY, binary, sizeof(binary));
+	}
+	release_snapshot(reader);
+	if(text_len == -1 || publish_file(&rack->consolidated_file, text, text_len) == -1){
+		log_message(LOG_DEBUG, "Spice_Rack_App: consolidated_spice_file - Failed to publish %s\n", rack->consolidated_path);
+		result = -1;
+	}
+	if(binary_len == -1 || publish_file(&rack->inventory_file, binary, binary_len) == -1){
+		log_message(LOG_DEBUG, "Spice_Rack_App: consolidated_spice_file - Failed to publish %s\n", rack->inventory_path);
+		result = -1;
+	}
+	return result;
+}
 
-	close(full_fd);
-	close(consolidated_fd);
+//Publishes the rack's current slot values. The snapshot is swapped in here and the files are written by
+//the persistence thread, so callers don't wait on flash.
+static int consolidated_spice_file(struct rack *rack){
+	build_snapshot(rack);
+	if(persist == NULL){
+		return write_published_files(rack);
+	}
+	persist_request_publish(persist, rack->id - 1);
 	return 0;
 }
 
-static int read_weight(char *read_val, int read_len){
+//Hands a measurement to the persistence thread. A newer measurement for the same slot replaces it if it
+//hasn't been written yet.
+static int queue_measurement(struct rack *rack, int spice_num, char *spice_name, char *read_val, float mass, float tsps){
+	struct persist_record record;
+
+	if(persist == NULL){
+		return store_measurement(rack, spice_num, spice_name, read_val, mass, tsps);
+	}
+	memset(&record, 0, sizeof(record));
+	record.rack = rack->id - 1;
+	record.slot = spice_num;
+	snprintf(record.name, sizeof(record.name), "%s", spice_name);
+	snprintf(record.adc, sizeof(record.adc), "%s", read_val);
+	record.mass = mass;
+	record.tsps = tsps;
+	return persist_submit(persist, &record);
+}
+
+//Persistence thread callbacks
+static int persist_write_record(const struct persist_record *record, void *arg){
+	struct persist_record copy = *record;
+	return store_measurement(&racks[record->rack], copy.slot, copy.name, copy.adc, copy.mass, copy.tsps);
+}
+
+static int persist_publish(int rack, void *arg){
+	return write_published_files(&racks[rack]);
+}
+
+static int read_weight(struct rack *rack, char *read_val, int read_len){
 	int hx711_fd;
 	int count = 0;
 	int result = 0;
 	
-	hx711_fd = open(HX711_FILE, O_RDONLY);
+	hx711_fd = open(rack->config.hx711_file, O_RDONLY);
 	if(hx711_fd == -1){
-		perror("Spice_Rack_App: read_weight - Failed to Open HX711 File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: read_weight - Failed to Open HX711 File - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: read_weight - Failed to Open HX711 File");
 		return -1;
 	}
+	//A reading shorter than the last one mustn't pick up its digits
+	memset(read_val, 0, read_len);
 	while(read_len != 0 && (count = read(hx711_fd, read_val, read_len)) != 0){
 		if(count == -1){
 			if(errno == EINTR){
 				continue;
 			}
-			perror("Spice_Rack_App: read_weight - Reading weight failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: read_weight - Reading weight failed - %s\n", strerror(errno));
+			log_errno("Spice_Rack_App: read_weight - Reading weight failed");
 			result = -1;
 			break;
 		}
 		read_len = read_len - count;
 	}
 	
-	syslog(LOG_DEBUG,"Spice_Rack_App: read_weight - ADC Reading is %s", read_val);
+	log_message(LOG_DEBUG,"Spice_Rack_App: read_weight - ADC Reading is %s", read_val);
 	close(hx711_fd);
 	return result;
 }
 
-static int get_average_weight(char *read_val, int read_len, int sample_num){
-	int i;
-	int sample_val = 0;
-	long long sample_total = 0;
-	int sample_average = 0;
-	char *end_ptr;
+//Opens the rack's HX711 file and registers it with the rack's ring, replacing the one registered before.
+//Done again whenever a reload changes hx711_file.
+static int open_hx711_uring(struct rack *rack){
+	int fd;
 
-	//Store previous adc reading in struct before collecting new ones
-	spice_rack->previous_adc_reading = spice_rack->curr_adc_reading;
+	if(rack->hx711_fd != -1){
+		close(rack->hx711_fd);
+		rack->hx711_fd = -1;
+	}
+	fd = open(rack->config.hx711_file, O_RDONLY);
+	if(fd == -1){
+		log_errno("Spice_Rack_App: open_hx711_uring - Failed to Open HX711 File");
+		return -1;
+	}
+	if(uring_register_files(&rack->ring, &fd, 1) != 0){
+		close(fd);
+		return -1;
+	}
+	rack->hx711_fd = fd;
+	strcpy(rack->hx711_open_file, rack->config.hx711_file);
+	return 0;
+}
 
-	//Collect readings and sum together
-	for(i=0; i<sample_num; i++){
-		if(read_weight(read_val, read_len) == -1){
-			syslog(LOG_DEBUG, "Spice_Rack_App: get_average_weight - Failed to get ADC reading\n");
-			i--;
+//Reads num samples in one system call. They are linked so the ADC is sampled one read after another, as
+//read_weight() does. Stores the good samples in values and returns how many there were, or -1 if the ring
+//can't be used.
+static int read_weights_uring(struct rack *rack, int num, int32_t *values){
+	struct uring_io ios[WEIGHT_BATCH];
+	int good = 0;
+	int i;
+
+	if(rack->hx711_fd == -1 || strcmp(rack->hx711_open_file, rack->config.hx711_file) != 0){
+		if(open_hx711_uring(rack) != 0){
+			//Every sample fails, as each read_weight() would have failed to open the file
+			for(i=0;i<num;i++){
+				health_record_error(&rack->weight_health);
+			}
+			return 0;
+		}
+	}
+	for(i=0;i<num;i++){
+		ios[i].op = URING_READ;
+		ios[i].file = 0;
+		ios[i].buf = rack->hx711_samples + i * READ_LEN;
+		ios[i].len = READ_LEN;
+		//sysfs attributes produce a new reading for every read from the start of the file
+		ios[i].offset = 0;
+		ios[i].buffer = 0;
+	}
+	if(uring_run_batch(&rack->ring, ios, num, 1) != 0){
+		return -1;
+	}
+	for(i=0;i<num;i++){
+		if(ios[i].result < 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: read_weights_uring - Reading weight failed - %s\n", strerror(-ios[i].result));
+			health_record_error(&rack->weight_health);
+			continue;
+		}
+		if(adc_parse_text(ios[i].buf, ios[i].result, &values[good]) != 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: read_weights_uring - ADC Reading %.*s isn't a number\n", ios[i].result, (char *)ios[i].buf);
+			health_record_error(&rack->weight_health);
 			continue;
 		}
-		sample_val = strtol(read_val, &end_ptr, 10);
-		sample_total = sample_total + sample_val;
+		health_record_read(&rack->weight_health, values[good]);
+		good++;
 	}
-
-	//Calculate the average from the sum of the previous readings
-	sample_average = sample_total/sample_num;
-	syslog(LOG_DEBUG, "Spice_Rack_App: get_average_weight - Sample Average is %i\n", sample_average);
-
-	//Convert average to string form which is used for the storing to file
-	snprintf(read_val, strlen(read_val), "%i", sample_average);
-
-	//Store new adc reading in struct 
-	spice_rack->curr_adc_reading = sample_average;
-	return sample_average;
+	return good;
 }
 
-static float adc_reading_to_grams(){
-	float m = 0;
-	int x = 0;
-	float result;
-
-	//Calculate the multiplier
-	if(spice_rack->empty_jar_adc && spice_rack->empty_rack_adc){
-		m = ((float)spice_rack->empty_jar_adc - spice_rack->empty_rack_adc)/spice_rack->empty_jar_mass;
-	}
+//Reads num samples from hx711_file as an IIO buffer (/dev/iio:deviceN), in as few reads as the driver
+//allows, and decodes them in one batch. The buffer and its scan elements are enabled by whatever sets up
+//the board. Stores the good samples in values and returns how many there were.
+static int read_weights_buffer(struct rack *rack, const struct adc_scan_type *scan_type, int num, int32_t *values){
+	struct pollfd poll_fd;
+	size_t want = num * adc_sample_size(scan_type);
+	size_t have = 0;
+	int count;
+	int good;
+	int i;
 
-	//Calculate the offset
-	if(spice_rack->curr_adc_reading > spice_rack->previous_adc_reading){
-		x = spice_rack->curr_adc_reading - spice_rack->previous_adc_reading;
+	poll_fd.fd = open(rack->config.hx711_file, O_RDONLY | O_NONBLOCK);
+	if(poll_fd.fd == -1){
+		log_errno("Spice_Rack_App: read_weights_buffer - Failed to Open HX711 Buffer");
+		for(i=0;i<num;i++){
+			health_record_error(&rack->weight_health);
+		}
+		return 0;
 	}
-	else{
-		x = spice_rack->previous_adc_reading - spice_rack->curr_adc_reading;
+	poll_fd.events = POLLIN;
+	while(have < want){
+		if((count = poll(&poll_fd, 1, rack->config.weight_timeout_ms)) == 0){
+			break;
+		}
+		if(count != -1 && (count = read(poll_fd.fd, rack->hx711_raw + have, want - have)) > 0){
+			have = have + count;
+			continue;
+		}
+		if(count == -1 && (errno == EINTR || errno == EAGAIN)){
+			continue;
+		}
+		if(count == -1){
+			log_message(LOG_DEBUG, "Spice_Rack_App: read_weights_buffer - Reading weight failed - %s\n", strerror(errno));
+		}
+		break;
 	}
+	close(poll_fd.fd);
 
-	syslog(LOG_DEBUG,"Spice_Rack_App: adc_reading_to_grams - x=%i and m=%f\n", x, m);
-	result = x/m - spice_rack->empty_jar_mass;
-	printf("Spice_Rack_App: adc_reading_to_grams - Result is %f grams\n", result);
-
-	return result;
+	good = adc_decode(rack->hx711_raw, have, scan_type, values, num);
+	for(i=0;i<num;i++){
+		if(i < good){
+			health_record_read(&rack->weight_health, values[i]);
+		}
+		else{
+			health_record_error(&rack->weight_health);
+		}
+	}
+	return good;
 }
 
-static int read_fsr_status(){
-	int result = 0;
-	int fsr_fd;
-	int count = 0;
+//Reads up to sample_num readings into values. Gives up after WEIGHT_RETRY_FACTOR reads per sample wanted
+//or the rack's weight_timeout_ms. Returns the number of good readings.
+static int read_weight_samples(struct rack *rack, char *read_val, int read_len, int sample_num, int32_t *values){
+	struct adc_scan_type scan_type;
+	struct timespec start;
+	struct timespec now;
 	int i = 0;
-	int debounce_count = 0;
-	unsigned char read_val;
-	
-	fsr_fd = open(FSR_FILE, O_RDONLY);
+	int count;
+	int attempts = 0;
+	int buffered = 0;
+	uint64_t span_start;
+
+	TRACE_BEGIN(sample_batch, span_start);
+	if(rack->config.hx711_scan_type[0] != '\0'){
+		if(adc_parse_scan_type(rack->config.hx711_scan_type, &scan_type) == 0){
+			buffered = 1;
+		}
+		else{
+			log_message(LOG_WARNING, "Spice_Rack_App: read_weight_samples - Rack%i hx711_scan_type %s can't be read, reading hx711_file as text\n", rack->id, rack->config.hx711_scan_type);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	//Collect readings and sum together
+	while(i < sample_num && attempts < sample_num * WEIGHT_RETRY_FACTOR){
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 > rack->config.weight_timeout_ms){
+			log_message(LOG_WARNING, "Spice_Rack_App: read_weight_samples - Rack%i weight sensor timed out after %i of %i readings\n", rack->id, i, sample_num);
+			break;
+		}
+		if(buffered == 1){
+			attempts = attempts + sample_num - i;
+			i = i + read_weights_buffer(rack, &scan_type, sample_num - i, values + i);
+			continue;
+		}
+		if(rack->uring_ready == 1){
+			count = sample_num - i < WEIGHT_BATCH ? sample_num - i : WEIGHT_BATCH;
+			attempts = attempts + count;
+			if((count = read_weights_uring(rack, count, values + i)) != -1){
+				i = i + count;
+				continue;
+			}
+			printf("Rack%i: io_uring reads failed, using read() from now on\n", rack->id);
+			log_message(LOG_WARNING, "Spice_Rack_App: read_weight_samples - Rack%i io_uring reads failed, using read() from now on\n", rack->id);
+			rack->uring_ready = 0;
+		}
+		attempts++;
+		if(read_weight(rack, read_val, read_len) == -1 || adc_parse_text(read_val, read_len, &values[i]) != 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: read_weight_samples - Failed to get ADC reading\n");
+			health_record_error(&rack->weight_health);
+			continue;
+		}
+		health_record_read(&rack->weight_health, values[i]);
+		i++;
+	}
+	TRACE_END(sample_batch, span_start, "rack", rack->id, "samples", i);
+	return i;
+}
+
+//Averages sample_num readings, or whatever good readings read_weight_samples() got. Returns the average,
+//or -1 with the rack's previous readings left as they were if there were none.
+static int get_average_weight(struct rack *rack, char *read_val, int read_len, int sample_num){
+	struct spice_rack *spice_rack = rack->spice_rack;
+	struct adc_stats stats;
+	int32_t *values = rack->weight_values;
+	int sample_average = 0;
+	int i;
+
+	i = read_weight_samples(rack, read_val, read_len, sample_num, values);
+	if(i == 0){
+		printf("Rack%i: No readings from the weight sensor, keeping the last weight\n", rack->id);
+		log_message(LOG_WARNING, "Spice_Rack_App: get_average_weight - Rack%i no readings from the weight sensor, keeping the last weight\n", rack->id);
+		return -1;
+	}
+	if(i < sample_num){
+		log_message(LOG_WARNING, "Spice_Rack_App: get_average_weight - Rack%i averaging %i of %i readings\n", rack->id, i, sample_num);
+	}
+
+	//Calculate the average from the sum of the previous readings. The spread is logged to show how noisy
+	//the load cell is.
+	adc_compute_stats(values, i, &stats);
+	sample_average = stats.sum/i;
+	log_message(LOG_DEBUG, "Spice_Rack_App: get_average_weight - Sample Average is %i, min %i, max %i, std dev %.1f\n", sample_average, stats.min, stats.max, sqrt(stats.variance));
+
+	//Convert average to string form which is used for the storing to file
+	snprintf(read_val, read_len, "%i", sample_average);
+
+	//Store previous adc reading in struct and the new one after it
+	spice_rack->previous_adc_reading = spice_rack->curr_adc_reading;
+	spice_rack->curr_adc_reading = sample_average;
+	return sample_average;
+}
+
+static float adc_reading_to_grams(struct rack *rack){
+	struct spice_rack *spice_rack = rack->spice_rack;
+	float result;
+
+	result = spice_adc_to_grams(spice_rack->empty_rack_adc, spice_rack->empty_jar_adc, spice_rack->empty_jar_mass,
+		spice_rack->previous_adc_reading, spice_rack->curr_adc_reading);
+	printf("Spice_Rack_App: adc_reading_to_grams - Result is %f grams\n", result);
+
+	return result;
+}
+
+static int read_fsr_status(struct rack *rack){
+	int result = 0;
+	int fsr_fd;
+	int count = 0;
+	int i = 0;
+	int reads = 0;
+	int debounce_count = 0;
+	unsigned char read_val;
+	
+	fsr_fd = open(rack->config.fsr_file, O_RDONLY);
 	if(fsr_fd == -1){
-		perror("Spice_Rack_App: read_fsr_status - Failed to Open FSR Device File - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: read_fsr_status - Failed to Open FSR Device File - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: read_fsr_status - Failed to Open FSR Device File");
 		return -1;
 	}
 
@@ -661,21 +856,29 @@ static int read_fsr_status(){
 	//settle but also the Weight sensor must settle too. Took measurements to see about how long it 
 	//took for it to settle and added some guardband.
 	while(i<10 && debounce_count<10){
+		//A sensor flickering between values would otherwise keep this loop going forever
+		if(++reads > FSR_MAX_READS){
+			log_message(LOG_WARNING, "Spice_Rack_App: read_fsr_status - Rack%i FSR reading did not settle in %i reads\n", rack->id, FSR_MAX_READS);
+			close(fsr_fd);
+			return -1;
+		}
 		while((count = read(fsr_fd, &read_val, 1)) != 1){
+			if(count == -1 && errno == EINTR){
+				continue;
+			}
 			if(count == -1){
-				if(errno == EINTR){
-					continue;
-				}
-				perror("Spice_Rack_App: read_fsr_status - Reading FSR status failed - ");
-				syslog(LOG_DEBUG, "Spice_Rack_App: read_fsr_status - Reading FSR status failed - %s\n", strerror(errno));
-				result = -1;
-				break;
+				log_errno("Spice_Rack_App: read_fsr_status - Reading FSR status failed");
 			}
+			else{
+				log_message(LOG_DEBUG, "Spice_Rack_App: read_fsr_status - FSR device returned no data\n");
+			}
+			close(fsr_fd);
+			return -1;
 		}
 		if(i == 0){
 			result = read_val;
 		}
-		usleep(200000);
+		usleep(rack->config.debounce_ms * 1000);
 		i++;
 		if(result == read_val){
 			debounce_count++;
@@ -689,54 +892,79 @@ static int read_fsr_status(){
 	return result;
 }
 
-static int read_in_calibration_data(){
+//One FSR read without debouncing, for a sweep that follows every change. Returns the status or -1.
+static int read_fsr_raw(struct rack *rack){
+	int fsr_fd;
+	int count;
+	unsigned char read_val;
+
+	fsr_fd = open(rack->config.fsr_file, O_RDONLY);
+	if(fsr_fd == -1){
+		log_errno("Spice_Rack_App: read_fsr_raw - Failed to Open FSR Device File");
+		return -1;
+	}
+	while((count = read(fsr_fd, &read_val, 1)) == -1 && errno == EINTR);
+	close(fsr_fd);
+	if(count != 1){
+		log_message(LOG_DEBUG, "Spice_Rack_App: read_fsr_raw - Reading FSR status failed\n");
+		return -1;
+	}
+	return read_val;
+}
+
+static int read_in_calibration_data(struct rack *rack){
+	struct spice_rack *spice_rack = rack->spice_rack;
 	int fd;
 	int i;
 	char output_str[255];
 	char *end_ptr;
-	memset(output_str,0,255);
+	char *contents;
+	size_t file_length;
+	size_t offset = 0;
 
 
-	fd = open(OUTPUT_FILE, O_RDONLY);
+	fd = open(rack->measurements_file, O_RDONLY);
 	if(fd == -1){
-		perror("Spice_Rack_App: read_in_calibration_data - Failed to open calibration data file - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: read_in_calibration_data - Failed to open calibration data file %s\n", OUTPUT_FILE);
+		log_errno("Spice_Rack_App: read_in_calibration_data - Failed to open calibration data file %s", rack->measurements_file);
+		return -1;
+	}
+	contents = read_file(fd, &file_length);
+	close(fd);
+	if(contents == NULL){
+		printf("read_file reported an issue.\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: read_in_calibration_data - read_file reported issues\n");
 		return -1;
 	}
 
-	for(i=0;i<(SPICE_RACK_SIZE+2);i++){
-		if(read_line(fd, output_str) != 0){
-			printf("read_line reported an issue.\n");
-			syslog(LOG_DEBUG, "Spice_Rack_App: read_in_calibration_data - read_line reported issues\n");
-			return -1;
+	for(i=0;i<(rack->config.rack_size+2);i++){
+		read_line(contents, file_length, &offset, output_str, sizeof(output_str));
+		if(parse_line(rack, output_str, i) != 0){
+			log_message(LOG_WARNING, "Spice_Rack_App: read_in_calibration_data - Line %i of %s is incomplete\n", i + 1, rack->measurements_file);
 		}
-		parse_line(output_str,i);
 	}
+	free(contents);
 
 	spice_rack->empty_jar_adc = strtol(spice_rack->spices[1].spice_entries.entries[2], &end_ptr, 10);
 	spice_rack->empty_rack_adc = strtol(spice_rack->spices[0].spice_entries.entries[2], &end_ptr, 10);
 
-	close(fd);
 	return 0;
 }
 
-static int read_calibrate_button(){
+static int read_calibrate_button(struct rack *rack){
 	int fd;
 	int result;
 	char read_val;
-	char gpio_val_filename[29];
+	char gpio_val_filename[64];
 
-	snprintf(gpio_val_filename, 29, "/sys/class/gpio/gpio%s/value", CALIBRATE_GPIO);
+	snprintf(gpio_val_filename, sizeof(gpio_val_filename), "/sys/class/gpio/gpio%s/value", rack->calibration.gpio);
 	fd = open(gpio_val_filename, O_RDONLY);
 	if(fd == -1){
-		perror("Spice_Rack_App: read_calibrate_button - Failed to /sys/class/gpio/gpioX/value - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: read_calibrate_button - Failed to /sys/class/gpio/gpioX/value - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: read_calibrate_button - Failed to /sys/class/gpio/gpioX/value");
 		return -1;
 	}
 	result = read(fd, &read_val, 1);
 	if(result != 1){
-		perror("Spice_Rack_App: read_calibrate_button - Failed to read to /sys/class/gpio/gpioX/value - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: read_calibrate_button - Failed to read to /sys/class/gpio/gpioX/value - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: read_calibrate_button - Failed to read to /sys/class/gpio/gpioX/value");
 		return -1;
 	}
 	close(fd);
@@ -744,27 +972,50 @@ static int read_calibrate_button(){
 	return result;
 }
 
-static void *calibrate_button_routine(){
-	int ret = 0;
-	while(caught_signal == false){
-		ret = read_calibrate_button();
-		usleep(150000);
-		if(ret == 1){
-			printf("Calibrate Button Pressed\n");
-			//Need mutex lock
-			if(pthread_mutex_lock(&calibration.calibration_lock) != 0){
-				perror("Unable to lock mutex\n");
-			}
-			else{
-				calibration.calibration_button = 1;	
-				pthread_mutex_unlock(&calibration.calibration_lock);
-			}
-		}
+//Shows the scheduler the rack's job is still going. With waiting 1 the job is about to wait on something
+//with no time limit, which check_rack_progress() doesn't take for a stall.
+static void job_progress(struct rack *rack, int waiting){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(pthread_mutex_lock(&rack->td.lock) == 0){
+		rack->td.hb = now.tv_sec;
+		rack->td.waiting = waiting;
+		pthread_mutex_unlock(&rack->td.lock);
+	}
+}
+
+//Another rack may be calibrating, which takes as long as the person doing it
+static void lock_console(struct rack *rack){
+	job_progress(rack, 1);
+	pthread_mutex_lock(&console_lock);
+	job_progress(rack, 0);
+}
+
+//fgets() from the console, which waits on whoever is calibrating
+static char *console_gets(struct rack *rack, char *buf, int len){
+	char *result;
+
+	job_progress(rack, 1);
+	result = fgets(buf, len, stdin);
+	job_progress(rack, 0);
+	return result;
+}
+
+//Calibration can't go on without a reading, so it waits for the weight sensor rather than giving up
+static int calibration_weight(struct rack *rack, char *read_val, int read_len){
+	int result;
+	while((result = get_average_weight(rack, read_val, read_len, rack->config.weight_samples)) == -1){
+		printf("The weight sensor is not responding. Check its connection, retrying\n");
+		sleep(1);
 	}
-	return 0;	
+	return result;
 }
 
-static int calibrate_spice_rack(char *read_val, int read_len){
+static int calibrate_spice_rack(struct rack *rack){
+	struct spice_rack *spice_rack = rack->spice_rack;
+	char *read_val = rack->read_val;
+	int read_len = rack->read_len;
 	int fsr_status;
 	int prev_fsr_status = 0;
 	int fsr_diff = 0;
@@ -774,11 +1025,15 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 	char *user_input_val;
 	char *end_ptr;
 	char *spice_name;
+	struct spice_name_match suggestions[MAX_SUGGESTIONS];
+	int num_suggestions = 0;
+	int choice;
+	int id;
 	
 	//Malloc Memory for Spice_Name field. Using MAX_FILE_ENTRY_LEN as length to ensure it isn't too big
 	if((spice_name = (char *)malloc(MAX_FILE_ENTRY_LEN * sizeof(char))) == NULL){
 		printf("Spice_Rack_App: calibrate_spice_rack - Failed on Malloc. Exiting Program\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Failed on Malloc. Exiting Program\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Failed on Malloc. Exiting Program\n");
 		return -1;
 	}
 	memset(spice_name, 0, MAX_FILE_ENTRY_LEN);
@@ -786,68 +1041,67 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 	//----------------------------EMPTY RACK----------------------------
 	//Make sure rack is empty
 	printf("Please remove all spices from Spice Rack to begin calibration\n");
-	syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Please remove all spices from Spice Rack to begin calibration\n");
-	while((fsr_status = read_fsr_status()) != 0){
+	log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Please remove all spices from Spice Rack to begin calibration\n");
+	//The FSR waits below last as long as the person calibrating takes, and show progress on every read
+	while((fsr_status = read_fsr_status(rack)) != 0){
+		job_progress(rack, 0);
 		sleep(1);
 	}
 	printf("All spices have been removed. Collecting weight measurement of empty rack\n");
-	syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - All spices have been removed. Collecting weight measurement of empty rack\n");
+	log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - All spices have been removed. Collecting weight measurement of empty rack\n");
 
 	//Collect ADC measurement
-	spice_rack->empty_rack_adc = get_average_weight(read_val, read_len,10);
-	syslog(LOG_DEBUG,"Spice_Rack_App: calibrate_spice_rack - Empty Rack Weight Reading is %s", read_val);
+	spice_rack->empty_rack_adc = calibration_weight(rack, read_val, read_len);
+	log_message(LOG_DEBUG,"Spice_Rack_App: calibrate_spice_rack - Empty Rack Weight Reading is %s", read_val);
 	
 	//Store Measurement to file
 	strcpy(spice_name, "Empty Rack");
-	if(store_measurement(spice_num, spice_name, read_val, mass, tsps) != 0){
+	if(store_measurement(rack, spice_num, spice_name, read_val, mass, tsps) != 0){
 		printf("Error storing measurements to file\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error storing measurements to file\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error storing measurements to file\n");
 		return -1;
 	}
 
 	//----------------------------EMPTY JAR----------------------------
 	//Checking if user wants to use Default Mass assumption for an Empty Jar
 	printf("An Empty Spice Jar is assumed to be %f Grams.\n", spice_rack->empty_jar_mass);
-	syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - An Empty Spice Jar is assumed to be %f Grams.\n", spice_rack->empty_jar_mass);
+	log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - An Empty Spice Jar is assumed to be %f Grams.\n", spice_rack->empty_jar_mass);
 	printf("Do you wish to change this? (y/n)?)");
-	syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Do you wish to change this? (y/n)?)\n");
+	log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Do you wish to change this? (y/n)?)\n");
 	//Get User Input
 	if((user_input_val = (char *)malloc(10 * sizeof(char))) == NULL){
 		printf("Spice_Rack_App: calibrate_spice_rack - Failed on Malloc. Exiting Program\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Failed on Malloc. Exiting Program\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Failed on Malloc. Exiting Program\n");
 		return -1;
 	}
 	while(1){
 		//Blank out on each loop to erase previous content
 		memset(user_input_val,0,10);
 		//Do you want to change the Default value for Mass of Empty Jar
-		if(fgets(user_input_val, 10, stdin) != NULL){
-			syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - user input is - %s\n", user_input_val);
+		if(console_gets(rack, user_input_val, 10) != NULL){
+			log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - user input is - %s\n", user_input_val);
 			user_input_val[strcspn(user_input_val, "\n")] = 0;
 		}
 		else{
-			perror("Spice_Rack_App: calibrate_spice_rack - fgets failed - ");
-			syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - fgets failed - %s", strerror(errno));
+			log_errno("Spice_Rack_App: calibrate_spice_rack - fgets failed");
 			continue;
 		}
 		if(strcmp(user_input_val,"y") == 0){
 			while(1){
 				printf("Enter the new mass in grams that you wish to use. (Example: 128): ");
-				syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Enter the new mass in grams that you wish to use\n");
+				log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Enter the new mass in grams that you wish to use\n");
 				memset(user_input_val,0,10);
 				//Get New Value of Mass of Empty Jar to Use
-				if(fgets(user_input_val, 10, stdin) != NULL){
+				if(console_gets(rack, user_input_val, 10) != NULL){
 					user_input_val[strcspn(user_input_val, "\n")] = 0;
 				}
 				else{
-					perror("Spice_Rack_App: calibrate_spice_rack - fgets failed - ");
-					syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - fgets failed - %s", strerror(errno));
+					log_errno("Spice_Rack_App: calibrate_spice_rack - fgets failed");
 					continue;
 				}
 				spice_rack->empty_jar_mass = strtof(user_input_val, &end_ptr);
 				if(spice_rack->empty_jar_mass == LONG_MIN || spice_rack->empty_jar_mass == LONG_MAX){
-					perror("Spice_Rack_App: calibrate_spice_rack - User entered mass that is invalid - ");
-					syslog(LOG_DEBUG,"Spice_Rack_App: calibrate_spice_rack - User entered mass that is invalid - %s\n", strerror(errno));
+					log_errno("Spice_Rack_App: calibrate_spice_rack - User entered mass that is invalid");
 					continue;
 				}
 				break;
@@ -859,33 +1113,34 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 		}
 		else{
 			printf("Invalid Entry. Please enter y or n\n");
-			syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Invalid Entry. Please enter y or n\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Invalid Entry. Please enter y or n\n");
 		}
 	}
 	free(user_input_val);	
 	
 	//Collect Mass Now
 	printf("Place an empty jar on the spice rack now in spice1 position\n");
-	syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Place an empty jar on the spice rack now in spice1 position\n");
+	log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Place an empty jar on the spice rack now in spice1 position\n");
 	while(1){
 		//Ensure Empty Jar is Placed on Spice Rack in spice1 position
-		fsr_status = read_fsr_status();
+		job_progress(rack, 0);
+		fsr_status = read_fsr_status(rack);
 		if(fsr_status != 1){
 			continue;
 		}
 		//Collect ADC Measurement
 		printf("Detected a jar was placed in Spice1 position. Beginning weighing now\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Detected a jar was placed in Spice1 position. Beginning weighing now\n");
-		spice_rack->empty_jar_adc = get_average_weight(read_val, read_len, 10);
+		log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Detected a jar was placed in Spice1 position. Beginning weighing now\n");
+		spice_rack->empty_jar_adc = calibration_weight(rack, read_val, read_len);
 		printf("Done collecting measurement.\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Done collecting measurement.\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Empty Jar Weight Reading is %s", read_val);
+		log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Done collecting measurement.\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Empty Jar Weight Reading is %s", read_val);
 		//Store Measurement
 		memset(spice_name, 0, MAX_FILE_ENTRY_LEN);
 		snprintf(spice_name, MAX_FILE_ENTRY_LEN, "Empty Jar-%ig", (int)spice_rack->empty_jar_mass);
-		if(store_measurement(spice_num, spice_name, read_val, mass, tsps) != 0){
+		if(store_measurement(rack, spice_num, spice_name, read_val, mass, tsps) != 0){
 			printf("Error storing measurements to file\n");
-			syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error storing measurements to file\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error storing measurements to file\n");
 			return -1;
 		}
 		break;
@@ -894,7 +1149,8 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 	//Remove Empty Jar
 	printf("Please remove empty jar from Spice1 location now\n");
 	while(fsr_status != 0){
-		fsr_status = read_fsr_status();
+		job_progress(rack, 0);
+		fsr_status = read_fsr_status(rack);
 	}
 
 	//Update spice_rack struct for calculations as spices are added.
@@ -903,13 +1159,14 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 	//----------------------------SPICES----------------------------
 
 	printf("Now you will need to place and leave each spice on the rack. Only place one spice at a time when prompted to do so.\nGo ahead and place the first spice in Spice1 position\n");
-	syslog(LOG_DEBUG, "Now you will need to place and leave each spice on the rack. Only place one spice at a time when prompted to do so.\nGo ahead and place the first spice in Spice1 position\n");
+	log_message(LOG_DEBUG, "Now you will need to place and leave each spice on the rack. Only place one spice at a time when prompted to do so.\nGo ahead and place the first spice in Spice1 position\n");
 	while(1){
 		spice_num = 1;
 		//Wait for next spice to be added
-		fsr_status = read_fsr_status();
+		job_progress(rack, 0);
+		fsr_status = read_fsr_status(rack);
 		if(fsr_status == -1){
-			syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error Reading FSR\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error Reading FSR\n");
 			continue;
 		}
 		if(fsr_status != prev_fsr_status){
@@ -922,27 +1179,45 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 				fsr_diff = fsr_diff >> 1;
 			}
 			printf("Detected a spice was placed in Spice%i position. Beginning weighing now\n", spice_num);
-			syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Detected a spice was placed in Spice%i position. Beginning weighing now\n", spice_num);
-			get_average_weight(read_val, read_len,10);
+			log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Detected a spice was placed in Spice%i position. Beginning weighing now\n", spice_num);
+			calibration_weight(rack, read_val, read_len);
 			printf("Done collecting measurement.\n");
-			syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Done collecting measurement.\n");
-			syslog(LOG_DEBUG,"Spice_Rack_App: calibrate_spice_rack - Weight Reading for Spice%i is %s", spice_num, read_val);
+			log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Done collecting measurement.\n");
+			log_message(LOG_DEBUG,"Spice_Rack_App: calibrate_spice_rack - Weight Reading for Spice%i is %s", spice_num, read_val);
 			//Convert ADC reading to grams
-			mass = adc_reading_to_grams();
+			mass = adc_reading_to_grams(rack);
 
 			while(1){
 				//Name this Spice
 				printf("Enter the name of this spice: ");
-				syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Enter the name of this spice: ");
+				log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Enter the name of this spice: ");
 				memset(spice_name, 0, MAX_FILE_ENTRY_LEN);
-				if(fgets(spice_name, MAX_FILE_ENTRY_LEN, stdin) != NULL){
+				if(console_gets(rack, spice_name, MAX_FILE_ENTRY_LEN) != NULL){
 					spice_name[strcspn(spice_name, "\n")] = 0;
 					printf("Entered Spice Name is %s\n", spice_name);
-					syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Entered Spice Name is %s\n", spice_name);
+					log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Entered Spice Name is %s\n", spice_name);
 				}
 				else{
-					perror("Spice_Rack_App: calibrate_spice_rack - fgets failed - ");
-					syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - fgets failed - %s", strerror(errno));
+					log_errno("Spice_Rack_App: calibrate_spice_rack - fgets failed");
+				}
+				if(strcmp(spice_name, "?") == 0){
+					print_spice_list();
+					num_suggestions = 0;
+					continue;
+				}
+				//A number picks one of the suggestions offered for the previous attempt
+				choice = strtol(spice_name, &end_ptr, 10);
+				if(num_suggestions > 0 && end_ptr != spice_name && *end_ptr == '\0' && choice >= 1 && choice <= num_suggestions){
+					snprintf(spice_name, MAX_FILE_ENTRY_LEN, "%.*s", MAX_FILE_ENTRY_LEN - 1, conversions->rows[suggestions[choice-1].id].name);
+				}
+				if(conversions != NULL){
+					//Only exact names and aliases are accepted here. Store the canonical name so later lookups are exact.
+					if((id = spice_conversions_find(conversions, spice_name)) == -1){
+						num_suggestions = print_spice_suggestions(spice_name, suggestions);
+						continue;
+					}
+					snprintf(spice_name, MAX_FILE_ENTRY_LEN, "%.*s", MAX_FILE_ENTRY_LEN - 1, conversions->rows[id].name);
+					printf("Using %s\n", spice_name);
 				}
 				//Convert grams to tsp and check if valid spice name 
 				tsps = convert_grams_to_tsp(spice_name, mass);
@@ -952,13 +1227,18 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 				print_spice_list();
 			}
 			//Store measurement
-			if(store_measurement(spice_num, spice_name, read_val, mass, tsps) != 0){
+			if(store_measurement(rack, spice_num, spice_name, read_val, mass, tsps) != 0){
 				printf("Error storing measurements to file\n");
-				syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error storing measurements to file\n");
+				log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error storing measurements to file\n");
 				return -1;
 			}
+			if(history_append(rack->history, spice_num, time(NULL), mass) != 0){
+				log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Failed to record Spice%i in history\n", spice_num);
+			}
+			//A newly calibrated spice starts a fresh usage estimate
+			forecast_reset(rack->forecast, spice_num, time(NULL), mass);
 			prev_fsr_status = fsr_status;
-			if(spice_num == SPICE_RACK_SIZE){
+			if(spice_num == rack->config.rack_size){
 				break;
 			}
 			else{
@@ -970,61 +1250,54 @@ static int calibrate_spice_rack(char *read_val, int read_len){
 	free(spice_name);
 
 	//Produce a consolidated data file for TCP socket queries
-	if(consolidated_spice_file() != 0){
+	if(consolidated_spice_file(rack) != 0){
 		printf("Spice_Rack_App: calibrate_spice_rack - Failed to create consolidated spice file\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Failed to create consolidated spice file\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Failed to create consolidated spice file\n");
 	}
 
 	printf("Finished Calibration.\n");
-	syslog(LOG_DEBUG, "Finished Calibration.\n");
+	log_message(LOG_DEBUG, "Finished Calibration.\n");
 
 	return 0;
 }
 
-static int setup_calibrate_button(){
+static int setup_calibrate_button(struct rack *rack){
 	int fd;
 	int result;
-	char direction_filename[40];
+	char direction_filename[64];
+	char *gpio = rack->calibration.gpio;
+
+	//Initialize the mutex first so the scheduler can still use it if the GPIO can't be set up
+	rack->calibration.calibration_button = 0;
+	snprintf(gpio, sizeof(rack->calibration.gpio), "%s", rack->config.calibrate_gpio);
+	if(pthread_mutex_init(&rack->calibration.calibration_lock,NULL) != 0){
+		log_errno("Spice_Rack_App: setup_calibration_button - Failed to initialize Mutex");
+		return -1;
+	}
 
 	//Export GPIO (calibrate button)
 	fd = open("/sys/class/gpio/export", O_WRONLY);
 	if(fd == -1){
-		perror("Spice_Rack_App: setup_caibrate_button - Failed to /sys/class/gpio/export - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: setup_caibrate_button - Failed to /sys/class/gpio/export - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: setup_caibrate_button - Failed to /sys/class/gpio/export");
 		return -1;
 	}
-	result = write(fd, CALIBRATE_GPIO, 2);
-	if(result != 2){
-		perror("Spice_Rack_App: setup_caibrate_button - Failed to write to /sys/class/gpio/export - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: setup_caibrate_button - Failed to write to /sys/class/gpio/export - %s\n", strerror(errno));
+	result = write(fd, gpio, strlen(gpio));
+	if(result != (int)strlen(gpio)){
+		log_errno("Spice_Rack_App: setup_caibrate_button - Failed to write to /sys/class/gpio/export");
 		return -1;
 	}
 	close(fd);
 	
 	//Set direction of GPIO to "in"
-	snprintf(direction_filename, 34, "/sys/class/gpio/gpio%s/direction", CALIBRATE_GPIO);
+	snprintf(direction_filename, sizeof(direction_filename), "/sys/class/gpio/gpio%s/direction", gpio);
 	fd = open(direction_filename, O_WRONLY);
 	if(fd == -1){
-		perror("Spice_Rack_App: setup_caibrate_button - Failed to open GPIO direction file - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: setup_caibrate_button - Failed to open %s - %s\n", direction_filename, strerror(errno));
+		log_errno("Spice_Rack_App: setup_caibrate_button - Failed to open %s", direction_filename);
 		return -1;
 	}
 	result = write(fd, "in", 2);
 	if(result != 2){
-		perror("Spice_Rack_App: setup_calibrate_button - Failed to write to GPIO direction file - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: setup_caibrate_button - Failed to write to %s - %s\n", direction_filename, strerror(errno));
-		return -1;
-	}
-
-	//Initialize Pthread mutex and launch thread to monitor calibrate button
-	if(pthread_mutex_init(&calibration.calibration_lock,NULL) != 0){
-		perror("Spice_Rack_App: setup_calibration_button - Failed to initialize Mutex - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: setup_calibration_button - Failed to initialize Mutex - %s\n", strerror(errno));
-		return -1;
-	}
-	if(pthread_create(&calibration.calibrate_thread, NULL, calibrate_button_routine,NULL) != 0){
-		perror("Spice_Rack_App: setup_calibration_button - Unable to create calibrate button thread - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: setup_calibration_button - Unable to create calibrate button thread - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: setup_caibrate_button - Failed to write to %s", direction_filename);
 		return -1;
 	}
 
@@ -1033,55 +1306,42 @@ static int setup_calibrate_button(){
 	return 0;
 }
 
-int free_calibrate_button(){
+int free_calibrate_button(struct rack *rack){
 	int fd;
 	int result;
 
 	//Unexport GPIO (calibrate button)
 	fd = open("/sys/class/gpio/unexport", O_WRONLY);
 	if(fd == -1){
-		perror("Spice_Rack_App: free_calibrate_button - Failed to /sys/class/gpio/unexport - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: free_calibrate_button - Failed to /sys/class/gpio/unexport - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: free_calibrate_button - Failed to /sys/class/gpio/unexport");
 		return -1;
 	}
-	result = write(fd, CALIBRATE_GPIO, 2);
-	if(result != 2){
-		perror("Spice_Rack_App: free_calibrate_button - Failed to write to /sys/class/gpio/unexport - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: free_calibrate_button - Failed to write to /sys/class/gpio/unexport - %s\n", strerror(errno));
+	result = write(fd, rack->calibration.gpio, strlen(rack->calibration.gpio));
+	if(result != (int)strlen(rack->calibration.gpio)){
+		log_errno("Spice_Rack_App: free_calibrate_button - Failed to write to /sys/class/gpio/unexport");
 		return -1;
 	}
 	close(fd);
 	return 0;
 }
 
-static int setup_spice_rack_struct(){
+static int setup_spice_rack_struct(struct rack *rack){
+	struct spice_rack *spice_rack;
 	int i;
 	int result = 0;
 	int size = MAX_FILE_ENTRY_LEN;
-	int num_entries = SPICE_RACK_SIZE + 2;
+	int num_entries = rack->config.rack_size + 2;
 
 
 	if((spice_rack = (struct spice_rack *)malloc(sizeof(struct spice_rack) + (num_entries*sizeof(struct spice)) + (2*(num_entries * sizeof(char[size]))))) == NULL){
-		result = -1;
+		printf("Spice_Rack_App: setup_spice_rack_struct - Failed on Malloc. Exiting Program\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: setup_spice_rack_struct - Failed on Malloc. Exiting Program\n");
+		return -1;
 	}
+	rack->spice_rack = spice_rack;
 
 	for(i=0;i<num_entries;i++){
 		//Malloc Strings for file entries
-		if((spice_rack->spices[i].spice_search_strings.search_strings[0] = (char *)malloc(size*sizeof(char))) == NULL){
-			result = -1;
-		}
-		if((spice_rack->spices[i].spice_search_strings.search_strings[1] = (char *)malloc(size*sizeof(char))) == NULL){
-			result = -1;
-		}
-		if((spice_rack->spices[i].spice_search_strings.search_strings[2] = (char *)malloc(size*sizeof(char))) == NULL){
-			result = -1;
-		}
-		if((spice_rack->spices[i].spice_search_strings.search_strings[3] = (char *)malloc(size*sizeof(char))) == NULL){
-			result = -1;
-		}
-		if((spice_rack->spices[i].spice_search_strings.search_strings[4] = (char *)malloc(size*sizeof(char))) == NULL){
-			result = -1;
-		}
 		if((spice_rack->spices[i].spice_entries.entries[0] = (char *)malloc(size*sizeof(char))) == NULL){
 			result = -1;
 		}
@@ -1099,19 +1359,9 @@ static int setup_spice_rack_struct(){
 		}
 		if(result == -1){
 			printf("Spice_Rack_App: setup_spice_rack_struct - Failed on Malloc. Exiting Program\n");
-			syslog(LOG_DEBUG, "Spice_Rack_App: setup_spice_rack_struct - Failed on Malloc. Exiting Program\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: setup_spice_rack_struct - Failed on Malloc. Exiting Program\n");
 			return result;
 		}
-		memset(spice_rack->spices[i].spice_search_strings.search_strings[0],0,size);
-		memset(spice_rack->spices[i].spice_search_strings.search_strings[1],0,size);
-		memset(spice_rack->spices[i].spice_search_strings.search_strings[2],0,size);
-		memset(spice_rack->spices[i].spice_search_strings.search_strings[3],0,size);
-		memset(spice_rack->spices[i].spice_search_strings.search_strings[4],0,size);
-		strncpy(spice_rack->spices[i].spice_search_strings.search_strings[0], "Spice_Location:", 16);
-		strncpy(spice_rack->spices[i].spice_search_strings.search_strings[1], "Spice_Name:", 12);
-		strncpy(spice_rack->spices[i].spice_search_strings.search_strings[2], "ADC_Reading:", 13);
-		strncpy(spice_rack->spices[i].spice_search_strings.search_strings[3], "Calibrated_Mass(grams):", 24);
-		strncpy(spice_rack->spices[i].spice_search_strings.search_strings[4], "Teaspoons:", 11);
 		memset(spice_rack->spices[i].spice_entries.entries[0],0,size);
 		memset(spice_rack->spices[i].spice_entries.entries[1],0,size);
 		memset(spice_rack->spices[i].spice_entries.entries[2],0,size);
@@ -1122,100 +1372,41 @@ static int setup_spice_rack_struct(){
 	return result;
 }
 
-static int cleanup_spice_rack_struct(){
+static int cleanup_spice_rack_struct(struct rack *rack){
+	struct spice_rack *spice_rack = rack->spice_rack;
 	int i;
-	int num_entries = SPICE_RACK_SIZE + 2;
+	int num_entries = rack->config.rack_size + 2;
+
+	if(spice_rack == NULL){
+		return 0;
+	}
 	for(i=0;i<num_entries;i++){
-		free(spice_rack->spices[i].spice_search_strings.search_strings[0]); 
-		free(spice_rack->spices[i].spice_search_strings.search_strings[1]); 
-		free(spice_rack->spices[i].spice_search_strings.search_strings[2]); 
-		free(spice_rack->spices[i].spice_search_strings.search_strings[3]); 
-		free(spice_rack->spices[i].spice_search_strings.search_strings[4]); 
 		free(spice_rack->spices[i].spice_entries.entries[0]);
 		free(spice_rack->spices[i].spice_entries.entries[1]);
 		free(spice_rack->spices[i].spice_entries.entries[2]);
 		free(spice_rack->spices[i].spice_entries.entries[3]);
 		free(spice_rack->spices[i].spice_entries.entries[4]);
       	}
+	free(spice_rack);
+	rack->spice_rack = NULL;
 	return 0;
 }
 
-static void fsr_monitor(union sigval sigval){
-	struct thread_data *td = (struct thread_data*) sigval.sival_ptr;
-	if(pthread_mutex_lock(&td->lock) == 0){	
-		td->fsr_prev_status = td->fsr_cur_status;
-		td->fsr_cur_status = read_fsr_status();
-		if(td->fsr_cur_status != td->fsr_prev_status){
-			td->fsr_alert = 1;
-		}
-		pthread_mutex_unlock(&td->lock);
-	}
-	return;
-}
-
-static int setup_fsr_status_timer(struct sigevent *sigev, timer_t *timerid, struct thread_data *td, struct itimerspec *timerspec, struct timespec *start_time){
-	td->hb = 0;
-	td->fsr_alert = 0;
-	td->fsr_cur_status = read_fsr_status();
-	if(pthread_mutex_init(&td->lock,NULL) != 0){
-		perror("Spice_Rack_App: setup_fsr_status_timer - Failed to initiate timer mutex - ");
-		syslog(LOG_DEBUG,"Spice_Rack_App: setup_fsr_status_timer - Failed to initiate timer mutex - %s", strerror(errno));
-		return -1;
-	}
-	sigev->sigev_notify = SIGEV_THREAD;
-	sigev->sigev_value.sival_ptr = td;
-	sigev->sigev_notify_function = fsr_monitor;
-	timerspec->it_interval.tv_sec = 5;
-	timerspec->it_interval.tv_nsec = 0;
-	if(clock_gettime(CLOCK_MONOTONIC, start_time) != 0){
-		perror("Spice_Rack_App: setup_fsr_status_timer - Error getting current time - ");
-		syslog(LOG_DEBUG,"Spice_Rack_App: setup_fsr_status_timer - Error getting current time - %s", strerror(errno));
-		return -1;
-	}
-	
-	start_time->tv_sec = start_time->tv_sec + 2;
-	if(timer_create(CLOCK_MONOTONIC, sigev, timerid) != 0){
-		perror("Spice_Rack_App: setup_fsr_status_timer - Unable to create timer - ");
-		syslog(LOG_DEBUG,"Spice_Rack_App: setup_fsr_status_timer - Unable to create timer - %s", strerror(errno));
-		return -1;
-	}
-	else{
-		syslog(LOG_DEBUG,"Spice_Rack_App: setup_fsr_status_timer - Successfully setup timer\n");
-		timerspec->it_value.tv_sec = start_time->tv_sec;
-		if(timer_settime(*timerid, TIMER_ABSTIME, timerspec, NULL) != 0){
-			perror("Spice_Rack_App: setup_fsr_status_timer - Unable to start timer - ");
-			syslog(LOG_DEBUG,"Spice_Rack_App: setup_fsr_status_timer - Unable to start timer - %s", strerror(errno));
-			return -1;
-		}
-		syslog(LOG_DEBUG, "Spice_Rack_App: setup_fsr_status_timer - Successfully started timer\n");
-	}	
-
-	return 0;
-}
-
-static int convert_fsr_stat_to_spice_num(int spice_num){
-	int i;
-	for(i=0; i < SPICE_RACK_SIZE; i++){
-		if((spice_num >> i) == 1){
-			spice_num = i+1;
-			break;
-		}
-	}
-	return spice_num;
+static int convert_fsr_stat_to_spice_num(struct rack *rack, int spice_num){
+	return spice_fsr_to_slot(spice_num, rack->config.rack_size);
 }
 
-static int update_spice_rack(int spice_num, char *spice_name, char *read_val, float mass, float tsps){
+static int update_spice_rack(struct rack *rack, int spice_num, char *spice_name, char *read_val, float mass, float tsps){
+	struct spice_rack *spice_rack = rack->spice_rack;
 	char *mass_str;
 	char *tsps_str;
 
 	if((mass_str = (char *)malloc(MAX_FILE_ENTRY_LEN * sizeof(char))) == NULL){
-		perror("Spice_Rack_App: update_spice_rack - Failed on Malloc.");
-		syslog(LOG_DEBUG, "Spice_Rack_App: update_spice_rack - Failed on Malloc - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: update_spice_rack - Failed on Malloc");
 	}
 	memset(mass_str, 0, MAX_FILE_ENTRY_LEN);
 	if((tsps_str = (char *)malloc(MAX_FILE_ENTRY_LEN * sizeof(char))) == NULL){
-		perror("Spice_Rack_App: update_spice_rack - Failed on Malloc.");
-		syslog(LOG_DEBUG, "Spice_Rack_App: update_spice_rack - Failed on Malloc. - %s\n", strerror(errno));
+		log_errno("Spice_Rack_App: update_spice_rack - Failed on Malloc.");
 	}
 	memset(tsps_str, 0, MAX_FILE_ENTRY_LEN);
 
@@ -1230,205 +1421,849 @@ static int update_spice_rack(int spice_num, char *spice_name, char *read_val, fl
 	return 0;
 }
 
-int main(int argc, char *argv[]) {
-	struct sigaction socket_sigaction;
-	int daemon_pid;
-	char *read_val;
-	int read_len = 8;
-	int fd;
-	int spice_num;
-	float mass = 0;
-	float tsps = 0;
-	char spice_name[32];
-	struct sigevent sigev;
-	struct itimerspec timerspec;
-	struct timespec start_time;
-	struct thread_data td;
-	timer_t timerid;
+//The rack options also live in the global section, where they set app_config.rack
+static void setup_config_options(){
+	unsigned int i;
+	for(i=0;i<NUM_APP_OPTIONS;i++){
+		global_options[i] = app_options[i];
+	}
+	for(i=0;i<NUM_RACK_OPTIONS;i++){
+		global_options[NUM_APP_OPTIONS + i] = rack_options[i];
+		global_options[NUM_APP_OPTIONS + i].offset += offsetof(struct app_config, rack);
+	}
+}
 
-	//Logging
-	openlog(NULL,0,LOG_USER);
-	syslog(LOG_DEBUG,"Spice_Rack_App: Starting Application");
+static void join_path(char *dest, const char *dir, const char *name){
+	snprintf(dest, PATH_MAX, "%.*s/%s", PATH_MAX - 64, dir, name);
+}
 
-	//Setup Signal Handler
-        memset(&socket_sigaction,0,sizeof(struct sigaction));
-        socket_sigaction.sa_handler=socket_signal_handler;
-        if(sigaction(SIGTERM, &socket_sigaction, NULL) != 0) {
-                perror("Spice_Rack_App: main - Error registering for SIGTERM -  ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Error registering for SIGTERM - %s\n", strerror(errno));
+//Settings for rack id are the global ones with its [rackN] section applied on top
+static void load_rack_config(const struct app_config *app_config, int id, struct rack_config *rack_config){
+	char section[16];
 
-        }
-        if(sigaction(SIGINT, &socket_sigaction, NULL) != 0) {
-                perror("Spice_Rack_App: main - Error registering for SIGINT - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Error registering for SIGINT - %s\n", strerror(errno));
+	*rack_config = app_config->rack;
+	snprintf(section, sizeof(section), "rack%i", id);
+	//Racks after the first get their own directory under the global one unless their section names one
+	if(id > 1){
+		join_path(rack_config->data_dir, app_config->rack.data_dir, section);
+	}
+	config_load(config_file, section, rack_options, NUM_RACK_OPTIONS, rack_config, NULL);
+}
 
-        }
+//Re-reads the config file on SIGHUP. The scheduler applies the global settings itself. Each rack's settings,
+//and the global ones its jobs read, are handed to its next job so nothing changes under a job that is
+//running. Settings that need a restart are left alone.
+static void reload_config(){
+	struct app_config new_config = config;
+	struct rack_config rack_config;
+	struct rack *rack;
+	char section[16];
+	int changed;
+	int rack_changed;
+	int racks_changed = 0;
+	int i;
 
-	//Start Daemon if user provided -d argument
-        if(argc == 2){
-                if(strcmp(argv[1],"-d") == 0){
-                        syslog(LOG_DEBUG,"Spice_Rack_App: main - Starting Daemon\n");
-                        //Create Daemon
-                        daemon_pid = fork();
-                        if (daemon_pid == -1){
-                                return -1;
-                        }
-                        else if (daemon_pid != 0){
-                                exit(EXIT_SUCCESS);
-                        }
-                        setsid();
-                        chdir("/");
-                        open("/dev/null",O_RDWR);
-                        dup(0);
-                        dup(0);
-                }
-        }
-
-	//Setup Calibration Button and Launch Thread to Monitor Status
-	if(setup_calibrate_button() != 0){
-		printf("Spice_Rack_App: main - error in setting up the calibration button. Exiting program\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - error in the setup calibration button function. Exiting program\n");
+	changed = config_load(config_file, NULL, global_options, NUM_APP_OPTIONS + NUM_RACK_OPTIONS, &new_config, &config);
+	if(changed == -1){
+		printf("Unable to reload %s, keeping current settings\n", config_file);
+		log_message(LOG_DEBUG, "Spice_Rack_App: reload_config - Unable to reload %s, keeping current settings\n", config_file);
+		return;
+	}
+	for(i=0;i<config.num_racks;i++){
+		rack = &racks[i];
+		load_rack_config(&new_config, rack->id, &rack_config);
+		snprintf(section, sizeof(section), "rack%i", rack->id);
+		if(pthread_mutex_lock(&rack->td.lock) != 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: reload_config - Failed to lock rack%i mutex\n", rack->id);
+			continue;
+		}
+		config_keep_restart_options(rack_options, NUM_RACK_OPTIONS, &rack_config, &rack->config, section);
+		//Compared with what the rack runs now, so a reload that undoes one not yet applied clears it
+		rack_changed = memcmp(&rack_config, &rack->config, sizeof(rack_config)) != 0;
+		rack->pending_config = rack_config;
+		rack->pending_sweep_timeout_sec = new_config.sweep_timeout_sec;
+		rack->config_pending = rack_changed == 1 || new_config.sweep_timeout_sec != rack->sweep_timeout_sec;
+		racks_changed = racks_changed + rack_changed;
+		pthread_mutex_unlock(&rack->td.lock);
+	}
+	config = new_config;
+	log_set_level(config.log_level);
+	printf("Reloaded %s, %i global settings changed, %i racks changed\n", config_file, changed, racks_changed);
+	log_message(LOG_INFO, "Spice_Rack_App: reload_config - Reloaded %s, %i global settings changed, %i racks changed\n", config_file, changed, racks_changed);
+}
+
+//Called at the start of each job on the rack, so a job always runs with one consistent set of settings
+static void apply_pending_config(struct rack *rack){
+	if(pthread_mutex_lock(&rack->td.lock) != 0){
+		return;
+	}
+	if(rack->config_pending == 1){
+		//A jar mass entered during calibration is kept, only the default is replaced
+		if(rack->spice_rack->empty_jar_mass == rack->config.empty_jar_mass){
+			rack->spice_rack->empty_jar_mass = rack->pending_config.empty_jar_mass;
+		}
+		rack->config = rack->pending_config;
+		rack->sweep_timeout_sec = rack->pending_sweep_timeout_sec;
+		rack->weight_health.stuck_limit = rack->config.stuck_samples;
+		rack->config_pending = 0;
+	}
+	pthread_mutex_unlock(&rack->td.lock);
+}
+
+//Sets up the ring the rack's weight measurements are read through. The HX711 file is opened on the first
+//measurement. Without io_uring the rack reads with read() as before.
+static int setup_rack_uring(struct rack *rack){
+	struct iovec samples;
+
+	rack->uring_ready = 0;
+	rack->hx711_fd = -1;
+	rack->ring.fd = -1;
+	if(config.io_uring == 0){
+		return -1;
+	}
+	if(uring_init(&rack->ring, WEIGHT_BATCH) != 0){
+		printf("Rack%i: io_uring is not available, reading sensors with read()\n", rack->id);
+		log_message(LOG_INFO, "Spice_Rack_App: setup_rack_uring - Rack%i io_uring is not available, reading sensors with read()\n", rack->id);
+		return -1;
+	}
+	if((rack->hx711_samples = (char *)malloc(WEIGHT_BATCH * READ_LEN)) == NULL){
+		log_errno("Spice_Rack_App: setup_rack_uring - Failed on Malloc");
+		uring_free(&rack->ring);
+		return -1;
+	}
+	samples.iov_base = rack->hx711_samples;
+	samples.iov_len = WEIGHT_BATCH * READ_LEN;
+	if(uring_register_buffers(&rack->ring, &samples, 1) != 0){
+		free(rack->hx711_samples);
+		rack->hx711_samples = NULL;
+		uring_free(&rack->ring);
+		return -1;
+	}
+	rack->uring_ready = 1;
+	return 0;
+}
+
+//Allocates the rack's state and opens its files. Nothing here touches the sensors.
+static int setup_rack(struct rack *rack, int id){
+	char path[PATH_MAX];
+
+	memset(rack, 0, sizeof(struct rack));
+	rack->id = id;
+	load_rack_config(&config, id, &rack->config);
+	rack->sweep_timeout_sec = config.sweep_timeout_sec;
+	rack->td.fsr_cur_status = -1;
+	rack->td.fsr_prev_status = -1;
+	health_init(&rack->weight_health, "weight sensor", rack->config.stuck_samples);
+	health_init(&rack->fsr_health, "FSR", 0);
+	if(pthread_mutex_init(&rack->td.lock, NULL) != 0){
+		log_errno("Spice_Rack_App: setup_rack - Failed to initialize Mutex");
+		return -1;
+	}
+	if(mkdir(rack->config.data_dir, 0755) != 0 && errno != EEXIST){
+		log_errno("Spice_Rack_App: setup_rack - Failed to create %s", rack->config.data_dir);
+	}
+	join_path(rack->measurements_file, rack->config.data_dir, MEASUREMENTS_FILE_NAME);
+	join_path(rack->consolidated_path, rack->config.data_dir, CONSOLIDATED_FILE_NAME);
+	join_path(rack->inventory_path, rack->config.data_dir, INVENTORY_FILE_NAME);
+	rack->consolidated_file.file_name = rack->consolidated_path;
+	rack->inventory_file.file_name = rack->inventory_path;
+
+	//Setup Calibration Button. The scheduler polls it.
+	if(setup_calibrate_button(rack) != 0){
+		printf("Spice_Rack_App: setup_rack - error in setting up the calibration button for rack%i\n", id);
+		log_message(LOG_DEBUG, "Spice_Rack_App: setup_rack - error in the setup calibration button function for rack%i\n", id);
 	}
 
 	//Malloc String for Storing ADC measurements in
-	if((read_val = (char *)malloc(read_len * sizeof(char))) == NULL){
-		perror("Spice_Rack_App: main - Failed on Malloc. Exiting Program - ");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed on Malloc. Exiting Program - %s\n", strerror(errno));
+	rack->read_len = READ_LEN;
+	if((rack->read_val = (char *)malloc(rack->read_len * sizeof(char))) == NULL){
+		log_errno("Spice_Rack_App: setup_rack - Failed on Malloc");
+		return -1;
+	}
+	memset(rack->read_val, 0, rack->read_len);
+	if((rack->weight_values = (int32_t *)malloc(MAX_WEIGHT_SAMPLES * sizeof(int32_t))) == NULL ||
+		(rack->hx711_raw = (char *)malloc(MAX_WEIGHT_SAMPLES * sizeof(int32_t))) == NULL){
+		log_errno("Spice_Rack_App: setup_rack - Failed on Malloc");
+		return -1;
 	}
-	memset(read_val,0,read_len);
+	setup_rack_uring(rack);
 
-	
 	//Initialize Spice Rack Struct
-	if(setup_spice_rack_struct() != 0){
-	//	return -1;
-	}	
-	spice_rack->curr_adc_reading = 0;
-	spice_rack->empty_jar_mass = EMPTY_JAR_MASS_DEF;
-	printf("Collecting Weight Measurement now\n");
-	syslog(LOG_DEBUG, "Spice_Rack_App: main - Collecting Weight Measurement now\n");
-	get_average_weight(read_val, read_len, 10);
+	if(setup_spice_rack_struct(rack) != 0){
+		return -1;
+	}
+	rack->spice_rack->curr_adc_reading = 0;
+	rack->spice_rack->empty_jar_mass = rack->config.empty_jar_mass;
+
+	//Open the weight history store. The rack keeps running without history if it can't be opened.
+	join_path(path, rack->config.data_dir, HISTORY_DIR_NAME);
+	if((rack->history = history_open(path, rack->config.rack_size)) == NULL){
+		printf("Spice_Rack_App: setup_rack - Failed to open history store in %s\n", path);
+		log_message(LOG_DEBUG, "Spice_Rack_App: setup_rack - Failed to open history store in %s\n", path);
+	}
+	join_path(path, rack->config.data_dir, FORECAST_FILE_NAME);
+	if((rack->forecast = forecast_open(path, rack->config.rack_size)) == NULL){
+		printf("Spice_Rack_App: setup_rack - Failed to open forecast state %s\n", path);
+		log_message(LOG_DEBUG, "Spice_Rack_App: setup_rack - Failed to open forecast state %s\n", path);
+	}
+
+	//Calibration data and the last inventory come from files, so the rack has something to publish before
+	//its sensors have been read
+	if(access(rack->measurements_file, F_OK) == 0 && read_in_calibration_data(rack) != 0){
+		printf("Spice_Rack_App: setup_rack - Failed to read in calibration data for rack%i\n", id);
+		log_message(LOG_DEBUG, "Spice_Rack_App: setup_rack - Failed to read in calibration data for rack%i\n", id);
+	}
+	if(load_published_snapshot(rack) != 0 && access(rack->measurements_file, F_OK) == 0){
+		build_snapshot(rack);
+	}
+	return 0;
+}
+
+//Republishes when the sensors' health has changed since the snapshot was taken, so clients see a fault
+//within one FSR poll even if no spice moved
+static void publish_health(struct rack *rack){
+	const struct inventory_snapshot *current = atomic_load(&rack->snapshot);
+	int faults;
+	int health = rack_health(rack, &faults);
+
+	if(current != NULL && current->health == health && current->faults == faults){
+		return;
+	}
+	if(health != SNAPSHOT_HEALTH_OK){
+		printf("Rack%i: sensors %s (weight %s, slots %s)\n", rack->id, snapshot_health_name(health),
+			health_state_name(rack->weight_health.state), health_state_name(rack->fsr_health.state));
+	}
+	if(consolidated_spice_file(rack) != 0){
+		log_message(LOG_DEBUG, "Spice_Rack_App: publish_health - Failed to publish rack%i health\n", rack->id);
+	}
+}
+
+//Reads the FSR into the rack's status. Returns 1 if it changed from a known earlier status.
+static int update_fsr_status(struct rack *rack){
+	int status = read_fsr_status(rack);
+
+	if(status == -1){
+		//The last good status stands, so a failed read isn't taken for every spice being removed
+		health_record_error(&rack->fsr_health);
+		return 0;
+	}
+	health_record_read(&rack->fsr_health, status);
+	rack->td.fsr_prev_status = rack->td.fsr_cur_status;
+	rack->td.fsr_cur_status = status;
+	return rack->td.fsr_prev_status != -1 && rack->td.fsr_cur_status != rack->td.fsr_prev_status;
+}
+
+//Marks the rack's job finished for the scheduler
+static void finish_job(struct rack *rack){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(pthread_mutex_lock(&rack->td.lock) == 0){
+		rack->td.hb = now.tv_sec;
+		rack->td.waiting = 0;
+		rack->busy = 0;
+		pthread_mutex_unlock(&rack->td.lock);
+	}
+}
+
+//First job on each rack, queued as soon as the pool starts. Takes the first weight reading, calibrates if
+//the rack has never been calibrated and republishes. The rack is already serving what setup_rack() loaded
+//while this runs. A first calibration waits for the console like a button press does.
+static void warm_rack_job(void *arg){
+	struct rack *rack = (struct rack *)arg;
+	struct timespec start;
+	struct timespec now;
+
+	job_progress(rack, 0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	printf("Rack%i: Collecting Weight Measurement now\n", rack->id);
+	log_message(LOG_DEBUG, "Spice_Rack_App: warm_rack_job - Rack%i: Collecting Weight Measurement now\n", rack->id);
+	get_average_weight(rack, rack->read_val, rack->read_len, rack->config.weight_samples);
 	printf("Done collecting weight\n");
-	syslog(LOG_DEBUG, "Spice_Rack_App: main - Done collecting weight\n");
-	
+	log_message(LOG_DEBUG, "Spice_Rack_App: warm_rack_job - Done collecting weight\n");
+
 	//Check for Previous Calibration Data
-	fd = open(OUTPUT_FILE, O_RDONLY);
-	if(fd == -1){
-		printf("Unable to find previous calibration data to use. Performing a new calibration\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Unable to find previous calibration data to use. Performing a new calibration\n");
+	if(access(rack->measurements_file, F_OK) != 0){
+		lock_console(rack);
+		printf("Unable to find previous calibration data for rack%i. Performing a new calibration\n", rack->id);
+		log_message(LOG_DEBUG, "Spice_Rack_App: warm_rack_job - Unable to find previous calibration data for rack%i. Performing a new calibration\n", rack->id);
 		//Calibrate if none found
-		if(calibrate_spice_rack(read_val, read_len) != 0){
-			printf("Spice_Rack_App: main - Failed in calibrating spice rack\n");
-			syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed in calibrating spice rack\n");
+		if(calibrate_spice_rack(rack) != 0){
+			printf("Spice_Rack_App: warm_rack_job - Failed in calibrating rack%i\n", rack->id);
+			log_message(LOG_DEBUG, "Spice_Rack_App: warm_rack_job - Failed in calibrating rack%i\n", rack->id);
+		}
+		//Read in Calibration Data to Spice Rack Struct
+		if(read_in_calibration_data(rack) != 0){
+			printf("Spice_Rack_App: warm_rack_job - Failed to read in calibration data\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: warm_rack_job - Failed to read in calibration data\n");
 		}
+		pthread_mutex_unlock(&console_lock);
 	}
 	else{
-		printf("Found previous calibration data to use. To perform new calibration press the calibration button\n");	
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Found previous calibration data to use. Using found calibration data\n");
+		printf("Found previous calibration data for rack%i. To perform new calibration press the calibration button\n", rack->id);
+		log_message(LOG_DEBUG, "Spice_Rack_App: warm_rack_job - Found previous calibration data for rack%i. Using found calibration data\n", rack->id);
 	}
 
-	//Read in Calibration Data to Spice Rack Struct
-	if(read_in_calibration_data() != 0){
-		printf("Spice_Rack_App: main - Failed to read in calibration data\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed to read in calibration data\n");
+	//Produce a consolidated data file for TCP socket queries
+	if(consolidated_spice_file(rack) != 0){
+		printf("Spice_Rack_App: warm_rack_job - Failed to create consolidated spice file\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: warm_rack_job - Failed to create consolidated spice file\n");
+	}
+
+	rack->td.fsr_alert = 0;
+	update_fsr_status(rack);
+	publish_health(rack);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	log_message(LOG_INFO, "Spice_Rack_App: warm_rack_job - Rack%i sensors ready in %li ms\n", rack->id,
+		(now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+	if(pthread_mutex_lock(&rack->td.lock) == 0){
+		//First FSR check 2 seconds from now, as the FSR timer used to
+		rack->next_poll.tv_sec = now.tv_sec + 2;
+		rack->next_poll.tv_nsec = now.tv_nsec;
+		pthread_mutex_unlock(&rack->td.lock);
+	}
+	finish_job(rack);
+}
+
+static void cleanup_rack(struct rack *rack){
+	free(atomic_load(&rack->snapshot));
+	cleanup_spice_rack_struct(rack);
+	history_close(rack->history);
+	forecast_close(rack->forecast);
+	free(rack->read_val);
+	free(rack->weight_values);
+	free(rack->hx711_raw);
+	if(rack->hx711_fd != -1){
+		close(rack->hx711_fd);
+	}
+	uring_free(&rack->ring);
+	free(rack->hx711_samples);
+	free_calibrate_button(rack);
+	pthread_mutex_destroy(&rack->calibration.calibration_lock);
+	pthread_mutex_destroy(&rack->td.lock);
+}
+
+//Weighs the rack after a spice was put back or taken off and records the new mass of a spice put back
+static void handle_fsr_change(struct rack *rack){
+	struct thread_data *td = &rack->td;
+	char *read_val = rack->read_val;
+	int read_len = rack->read_len;
+	int spice_num;
+	float mass = 0;
+	float tsps = 0;
+	char spice_name[32];
+	uint64_t span_start;
+
+	TRACE_INSTANT(fsr_change, "rack", rack->id, "status", td->fsr_cur_status);
+	if(td->fsr_cur_status > td->fsr_prev_status){
+		//If a spice was added back
+		TRACE_BEGIN(weigh_complete, span_start);
+		spice_num = td->fsr_cur_status - td->fsr_prev_status;
+		spice_num = convert_fsr_stat_to_spice_num(rack, spice_num);
+		printf("Rack%i: Added spice%i\n", rack->id, spice_num);
+		log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Rack%i: Added spice%i\n", rack->id, spice_num);
+		printf("Collecting Weight Measurement now\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Collecting Weight Measurement now\n");
+		if(get_average_weight(rack, read_val, read_len, rack->config.weight_samples) == -1){
+			printf("Rack%i: Unable to weigh spice%i, keeping its last measurement\n", rack->id, spice_num);
+			log_message(LOG_WARNING, "Spice_Rack_App: handle_fsr_change - Rack%i: Unable to weigh spice%i, keeping its last measurement\n", rack->id, spice_num);
+			return;
+		}
+		printf("Done collecting weight\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Done collecting weight\n");
+		mass = adc_reading_to_grams(rack);
+		strncpy(spice_name, rack->spice_rack->spices[spice_num+1].spice_entries.entries[1],32);
+		spice_name[31] = '\0';
+		tsps = convert_grams_to_tsp(spice_name, mass);
+		update_spice_rack(rack, spice_num, spice_name, read_val, mass, tsps);
+		TRACE_END(weigh_complete, span_start, "rack", rack->id, "slot", spice_num);
+		if(queue_measurement(rack, spice_num, spice_name, read_val, mass, tsps) != 0){
+			printf("Error storing measurements to file\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Error queueing measurement\n");
+		}
+		if(history_append(rack->history, spice_num, time(NULL), mass) != 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Failed to record Spice%i in history\n", spice_num);
+		}
+		if(forecast_update(rack->forecast, spice_num, time(NULL), mass) == 1){
+			printf("Rack%i: Spice%i (%s) is running low\n", rack->id, spice_num, spice_name);
+		}
+		//Produce a consolidated data file for TCP socket queries
+		if(consolidated_spice_file(rack) != 0){
+			printf("Spice_Rack_App: handle_fsr_change - Failed to create consolidated spice file\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Failed to create consolidated spice file\n");
+		}
 	}
+	else{
+		//If a spice was removed
+		spice_num = td->fsr_prev_status - td->fsr_cur_status;
+		spice_num = convert_fsr_stat_to_spice_num(rack, spice_num);
+		printf("Rack%i: Removed Spice%i\n", rack->id, spice_num);
+		log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Rack%i: Removed Spice%i\n", rack->id, spice_num);
+		//Collects weight and updates the prev and curr adc readings in struct
+		printf("Collecting Weight Measurement now\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Collecting Weight Measurement now\n");
+		get_average_weight(rack, read_val, read_len, rack->config.weight_samples);
+		printf("Done collecting weight\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: handle_fsr_change - Done collecting weight\n");
+	}
+}
 
-	//Produce a consolidated data file for TCP socket queries
-	if(consolidated_spice_file() != 0){
-		printf("Spice_Rack_App: main - Failed to create consolidated spice file\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed to create consolidated spice file\n");
+//Re-weighs every jar on the rack in one pass instead of a calibration's jar at a time prompts. The user
+//lifts each jar and puts it back, in any order, while the FSR and one weight sample are read every
+//SWEEP_POLL_MS. The FSR status splits the samples into runs with the same jars on the rack. When a run has
+//weight_samples settled samples its mean is compared with the last settled run, and if one jar moved
+//between them the difference is that jar. A jar's lift and put back are averaged, and every jar weighed is
+//stored and published together at the end. Ends when every jar that was on the rack has been put back, or
+//after sweep_timeout_sec.
+static void sweep_rack(struct rack *rack){
+	struct spice_rack *spice_rack = rack->spice_rack;
+	char *read_val = rack->read_val;
+	int read_len = rack->read_len;
+	struct timespec start;
+	struct timespec now;
+	struct timespec run_start;
+	int64_t delta_sum[MAX_RACK_SIZE + 1] = {0};
+	int delta_count[MAX_RACK_SIZE + 1] = {0};
+	int put_back_adc[MAX_RACK_SIZE + 1];
+	int was_put_back[MAX_RACK_SIZE + 1] = {0};
+	int64_t run_sum = 0;
+	int run_count = 0;
+	int run_status = -1;
+	int64_t last_sum = 0;
+	int last_count = 0;
+	int last_status = -1;
+	int start_status;
+	int put_back = 0;
+	int status;
+	int change;
+	int run_mean;
+	int last_mean;
+	int spice_num;
+	int weighed = 0;
+	int32_t value;
+	float mass;
+	float tsps;
+	char spice_name[32];
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run_start = start;
+	if((start_status = read_fsr_status(rack)) == -1){
+		printf("Rack%i: Unable to read the FSR, sweep cancelled\n", rack->id);
+		log_message(LOG_WARNING, "Spice_Rack_App: sweep_rack - Rack%i unable to read the FSR, sweep cancelled\n", rack->id);
+		return;
 	}
+	if(start_status == 0){
+		printf("Rack%i: No jars on the rack to sweep\n", rack->id);
+		return;
+	}
+	printf("Rack%i: Sweep started. Lift each jar and put it back, one at a time, in any order\n", rack->id);
+	log_message(LOG_INFO, "Spice_Rack_App: sweep_rack - Rack%i sweep started with FSR status %i\n", rack->id, start_status);
+	while(caught_signal == false){
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec - start.tv_sec >= rack->sweep_timeout_sec){
+			printf("Rack%i: Sweep timed out, storing the jars weighed so far\n", rack->id);
+			log_message(LOG_WARNING, "Spice_Rack_App: sweep_rack - Rack%i sweep timed out after %i s\n", rack->id, rack->sweep_timeout_sec);
+			break;
+		}
+		//The sweep runs far longer than a normal job, so it shows the scheduler it's still going
+		job_progress(rack, 0);
+		usleep(SWEEP_POLL_MS * 1000);
+
+		if((status = read_fsr_raw(rack)) == -1){
+			health_record_error(&rack->fsr_health);
+			if(rack->fsr_health.state == HEALTH_FAILED){
+				printf("Rack%i: FSR has failed, ending the sweep\n", rack->id);
+				log_message(LOG_WARNING, "Spice_Rack_App: sweep_rack - Rack%i FSR has failed, ending the sweep\n", rack->id);
+				break;
+			}
+			continue;
+		}
+		health_record_read(&rack->fsr_health, status);
+		if(status != run_status){
+			//A run that never settled, like a jar being slid across, is left out
+			if(run_count >= rack->config.weight_samples){
+				last_status = run_status;
+				last_sum = run_sum;
+				last_count = run_count;
+			}
+			run_status = status;
+			run_start = now;
+			run_sum = 0;
+			run_count = 0;
+		}
+		if(read_weight_samples(rack, read_val, read_len, 1, &value) != 1){
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if((now.tv_sec - run_start.tv_sec) * 1000 + (now.tv_nsec - run_start.tv_nsec) / 1000000 < SWEEP_SETTLE_MS){
+			continue;
+		}
+		run_sum = run_sum + value;
+		run_count++;
+		if(run_count != rack->config.weight_samples || last_count == 0){
+			continue;
+		}
 
-	
-	//Setup timer for monitoring for changes in fsr (Taking off or Putting Back Spices)
-	memset(&sigev, 0, sizeof(struct sigevent));
-	memset(&timerspec, 0, sizeof(struct itimerspec));
-	memset(&td, 0, sizeof(struct thread_data));
-	if(setup_fsr_status_timer(&sigev, &timerid, &td, &timerspec, &start_time) != 0){
-		printf("Spice_Rack_App: main - Failed to setup FSR timer\n");
-		syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed to setup FSR timer\n");
-		return -1;
+		//The run has just settled
+		change = run_status ^ last_status;
+		if(change == 0){
+			continue;
+		}
+		spice_num = convert_fsr_stat_to_spice_num(rack, change);
+		if((change & (change - 1)) != 0 || spice_num > rack->config.rack_size){
+			printf("Rack%i: More than one jar moved, move one jar at a time\n", rack->id);
+			log_message(LOG_DEBUG, "Spice_Rack_App: sweep_rack - Rack%i FSR status went from %i to %i, ignored\n", rack->id, last_status, run_status);
+			continue;
+		}
+		run_mean = run_sum / run_count;
+		last_mean = last_sum / last_count;
+		delta_sum[spice_num] = delta_sum[spice_num] + abs(run_mean - last_mean);
+		delta_count[spice_num]++;
+		if((run_status & change) != 0){
+			put_back = put_back | change;
+			put_back_adc[spice_num] = run_mean;
+			was_put_back[spice_num] = 1;
+			printf("Rack%i: Weighed spice%i\n", rack->id, spice_num);
+		}
+		else{
+			printf("Rack%i: Spice%i lifted\n", rack->id, spice_num);
+		}
+		if((start_status & ~put_back) == 0 && (run_status & start_status) == start_status){
+			printf("Rack%i: Every jar has been weighed\n", rack->id);
+			break;
+		}
 	}
-	
-	
 
+	//Stores every jar that was put back, then publishes once
+	for(i=1;i<=rack->config.rack_size;i++){
+		if(was_put_back[i] == 0){
+			continue;
+		}
+		mass = spice_adc_to_grams(spice_rack->empty_rack_adc, spice_rack->empty_jar_adc, spice_rack->empty_jar_mass,
+			0, delta_sum[i] / delta_count[i]);
+		snprintf(read_val, read_len, "%i", put_back_adc[i]);
+		strncpy(spice_name, spice_rack->spices[i+1].spice_entries.entries[1], 32);
+		spice_name[31] = '\0';
+		tsps = convert_grams_to_tsp(spice_name, mass);
+		printf("Rack%i: Spice%i (%s) is %f grams\n", rack->id, i, spice_name, mass);
+		update_spice_rack(rack, i, spice_name, read_val, mass, tsps);
+		if(queue_measurement(rack, i, spice_name, read_val, mass, tsps) != 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: sweep_rack - Error queueing Spice%i measurement\n", i);
+		}
+		if(history_append(rack->history, i, time(NULL), mass) != 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: sweep_rack - Failed to record Spice%i in history\n", i);
+		}
+		if(forecast_update(rack->forecast, i, time(NULL), mass) == 1){
+			printf("Rack%i: Spice%i (%s) is running low\n", rack->id, i, spice_name);
+		}
+		weighed++;
+	}
+	if(weighed > 0 && consolidated_spice_file(rack) != 0){
+		printf("Spice_Rack_App: sweep_rack - Failed to create consolidated spice file\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: sweep_rack - Failed to create consolidated spice file\n");
+	}
+	//The next FSR check carries on from the rack as the sweep left it
+	if(run_count > 0){
+		spice_rack->previous_adc_reading = run_sum / run_count;
+		spice_rack->curr_adc_reading = run_sum / run_count;
+	}
+	if(run_status != -1){
+		rack->td.fsr_prev_status = run_status;
+		rack->td.fsr_cur_status = run_status;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	printf("Rack%i: Sweep finished, %i jars weighed in %li s\n", rack->id, weighed, now.tv_sec - start.tv_sec);
+	log_message(LOG_INFO, "Spice_Rack_App: sweep_rack - Rack%i sweep weighed %i jars in %li s\n", rack->id, weighed, now.tv_sec - start.tv_sec);
+}
+
+//One unit of work on the pool: a calibration if the rack's button was pressed, a sweep if one was asked
+//for, otherwise an FSR check
+static void rack_job(void *arg){
+	struct rack *rack = (struct rack *)arg;
+	int calibrate = 0;
+	int sweep = 0;
+
+	//Time spent queued behind other racks doesn't count against this job
+	job_progress(rack, 0);
+	apply_pending_config(rack);
+	if(pthread_mutex_lock(&rack->calibration.calibration_lock) == 0){
+		calibrate = rack->calibration.calibration_button;
+		pthread_mutex_unlock(&rack->calibration.calibration_lock);
+	}
+	if(calibrate == 1){
+		//Calibration writes the measurements file directly, so let anything queued for it land first
+		if(persist != NULL){
+			persist_sync(persist);
+		}
+		lock_console(rack);
+		printf("Calibrating rack%i\n", rack->id);
+		calibrate_spice_rack(rack);
+		//Read in Calibration Data to Spice Rack Struct
+		if(read_in_calibration_data(rack) != 0){
+			printf("Spice_Rack_App: rack_job - Failed to read in calibration data\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: rack_job - Failed to read in calibration data\n");
+		}
+		//Produce a consolidated data file for TCP socket queries
+		if(consolidated_spice_file(rack) != 0){
+			printf("Spice_Rack_App: rack_job - Failed to create consolidated spice file\n");
+			log_message(LOG_DEBUG, "Spice_Rack_App: rack_job - Failed to create consolidated spice file\n");
+		}
+		pthread_mutex_unlock(&console_lock);
+		//Presses while calibrating don't start another calibration
+		if(pthread_mutex_lock(&rack->calibration.calibration_lock) == 0){
+			rack->calibration.calibration_button = 0;
+			pthread_mutex_unlock(&rack->calibration.calibration_lock);
+		}
+	}
+	else{
+		if(pthread_mutex_lock(&rack->td.lock) == 0){
+			sweep = rack->sweep;
+			rack->sweep = 0;
+			pthread_mutex_unlock(&rack->td.lock);
+		}
+		if(sweep == 1){
+			sweep_rack(rack);
+		}
+		else if(update_fsr_status(rack) == 1){
+			handle_fsr_change(rack);
+		}
+	}
+	publish_health(rack);
+	finish_job(rack);
+}
 
-	printf("Application is now initialized and running...\n");
-	while(1){
-		spice_num = 0;
-		if(pthread_mutex_lock(&td.lock) == 0){
-			if(td.fsr_alert == 1){
-				td.fsr_alert = 0;
-				if(td.fsr_cur_status > td.fsr_prev_status){
-					//If a spice was added back
-					spice_num = td.fsr_cur_status - td.fsr_prev_status;
-					spice_num = convert_fsr_stat_to_spice_num(spice_num);
-					printf("Added spice%i\n", spice_num);
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Added spice%i\n", spice_num);
-					printf("Collecting Weight Measurement now\n");
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Collecting Weight Measurement now\n");
-					get_average_weight(read_val, read_len, 10);
-					printf("Done collecting weight\n");
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Done collecting weight\n");
-					mass = adc_reading_to_grams();
-					strncpy(spice_name, spice_rack->spices[spice_num+1].spice_entries.entries[1],32);
-					tsps = convert_grams_to_tsp(spice_name, mass);
-					update_spice_rack(spice_num, spice_name, read_val, mass, tsps);
-					if(store_measurement(spice_num, spice_name, read_val, mass, tsps) != 0){
-						printf("Error storing measurements to file\n");
-						syslog(LOG_DEBUG, "Spice_Rack_App: calibrate_spice_rack - Error storing measurements to file\n");
-					}
-					//Produce a consolidated data file for TCP socket queries
-					if(consolidated_spice_file() != 0){
-						printf("Spice_Rack_App: main - Failed to create consolidated spice file\n");
-						syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed to create consolidated spice file\n");
-					}
-				}
-				else{
-					//If a spice was removed
-					spice_num = td.fsr_prev_status - td.fsr_cur_status;
-					spice_num = convert_fsr_stat_to_spice_num(spice_num);
-					printf("Removed Spice%i\n", spice_num);
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Removed Spice%i\n", spice_num);
-					//Collects weight and updates the prev and curr adc readings in struct
-					printf("Collecting Weight Measurement now\n");
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Collecting Weight Measurement now\n");
-					get_average_weight(read_val, read_len, 10);
-					printf("Done collecting weight\n");
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Done collecting weight\n");
-				}
-				
+//Queues a job for the rack if its FSR check is due, its calibration button was pressed or a sweep was
+//asked for. A rack never
+//has more than one job queued or running, so a slow rack can't fill the queue or run on two workers.
+static void schedule_rack(struct rack *rack, struct timespec *now){
+	int calibrate = 0;
+
+	if(read_calibrate_button(rack) == 1 && pthread_mutex_lock(&rack->calibration.calibration_lock) == 0){
+		if(rack->calibration.calibration_button == 0){
+			printf("Rack%i: Calibrate Button Pressed\n", rack->id);
+		}
+		rack->calibration.calibration_button = 1;
+		pthread_mutex_unlock(&rack->calibration.calibration_lock);
+		calibrate = 1;
+	}
+	if(pthread_mutex_lock(&rack->td.lock) != 0){
+		return;
+	}
+	if(rack->busy == 0 && (calibrate == 1 || rack->sweep == 1 || now->tv_sec > rack->next_poll.tv_sec ||
+		(now->tv_sec == rack->next_poll.tv_sec && now->tv_nsec >= rack->next_poll.tv_nsec))){
+		rack->next_poll.tv_sec = now->tv_sec + config.fsr_poll_sec;
+		rack->next_poll.tv_nsec = now->tv_nsec;
+		if(worker_pool_submit(workers, rack_job, rack) == 0){
+			rack->busy = 1;
+			rack->td.hb = now->tv_sec;
+			rack->td.waiting = 1;
+		}
+		else{
+			log_message(LOG_DEBUG, "Spice_Rack_App: schedule_rack - Worker queue full, skipping rack%i\n", rack->id);
+		}
+	}
+	pthread_mutex_unlock(&rack->td.lock);
+}
+
+//A job that runs past job_timeout_sec without showing progress is most likely blocked in a sensor read that
+//will never return. Time queued, or waiting on the console or someone at it, isn't counted.
+//Returns 1 while the rack is stalled, which stops the watchdog being fed so the service gets restarted.
+static int check_rack_progress(struct rack *rack, struct timespec *now){
+	int stalled = 0;
+
+	if(pthread_mutex_lock(&rack->td.lock) != 0){
+		return 0;
+	}
+	if(rack->busy == 1 && rack->td.waiting == 0 && now->tv_sec - rack->td.hb > config.job_timeout_sec){
+		stalled = 1;
+	}
+	pthread_mutex_unlock(&rack->td.lock);
+	if(stalled != rack->stalled){
+		printf("Rack%i: job %s\n", rack->id, stalled == 1 ? "is stalled" : "finished after stalling");
+		log_message(stalled == 1 ? LOG_ERR : LOG_NOTICE, "Spice_Rack_App: check_rack_progress - Rack%i job %s\n", rack->id,
+			stalled == 1 ? "has made no progress, withholding the watchdog" : "finished after stalling");
+		rack->stalled = stalled;
+	}
+	return stalled;
+}
+
+int main(int argc, char *argv[]) {
+	struct pollfd signal_poll;
+	struct timespec start;
+	struct timespec now;
+	struct persist_ops persist_ops = {persist_write_record, persist_publish, NULL};
+	struct persist_stats persist_stats;
+	bool run_as_daemon = false;
+	int num_racks = 0;
+	int signal_number;
+	int stalled;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	//Logging
+	openlog(NULL,0,LOG_USER);
+	log_message(LOG_DEBUG,"Spice_Rack_App: Starting Application");
+
+	//Signals are read from a signalfd in the scheduler loop, so no worker or I/O thread is interrupted by one
+	if((signal_poll.fd = signals_open(handled_signals, sizeof(handled_signals)/sizeof(handled_signals[0]))) == -1){
+		return -1;
+	}
+	signal_poll.events = POLLIN;
+
+	//-d runs as a daemon, -c <file> reads settings from file instead of CONFIG_FILE, -t <file> writes a
+	//Chrome trace of the tracepoints to file on exit
+	for(i=1;i<argc;i++){
+		if(strcmp(argv[i],"-d") == 0){
+			run_as_daemon = true;
+		}
+		else if(strcmp(argv[i],"-c") == 0 && i+1 < argc){
+			i++;
+			//Resolved now so a SIGHUP reload still finds it after the daemon changes directory
+			if(realpath(argv[i], config_file) == NULL){
+				log_errno("Spice_Rack_App: main - Unable to find config file %s", argv[i]);
+				return -1;
 			}
-			pthread_mutex_unlock(&td.lock);
-		}
-		if(pthread_mutex_lock(&calibration.calibration_lock) == 0){
-			if(calibration.calibration_button == 1){
-				calibrate_spice_rack(read_val, read_len);
-				//Read in Calibration Data to Spice Rack Struct
-				if(read_in_calibration_data() != 0){
-					printf("Spice_Rack_App: main - Failed to read in calibration data\n");
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed to read in calibration data\n");
-				}
+		}
+		else if(strcmp(argv[i],"-t") == 0 && i+1 < argc){
+			i++;
+			if(trace_set_file(argv[i]) != 0){
+				return -1;
+			}
+		}
+	}
+	setup_config_options();
+	if(config_load(config_file, NULL, global_options, NUM_APP_OPTIONS + NUM_RACK_OPTIONS, &config, NULL) == -1){
+		printf("No config file at %s, using default settings\n", config_file);
+		log_message(LOG_DEBUG, "Spice_Rack_App: main - No config file at %s, using default settings\n", config_file);
+	}
+
+	log_set_level(config.log_level);
+
+	//Start Daemon if user provided -d argument
+	if(run_as_daemon == true && daemonize() != 0){
+		return -1;
+	}
+	//Until this runs, and if it fails, messages are written as they are logged
+	log_start();
+	if(trace_start(TRACE_MAX_EVENTS) != 0){
+		return -1;
+	}
+
+	//Opened after forking so the daemon holds the device. A missing device is reported and run without.
+	watchdog_open(&watchdog, config.watchdog_device);
+
+	if(epoch_init(&snapshot_epochs) != 0){
+		printf("Spice_Rack_App: main - Failed to set up snapshot reclamation. Exiting program\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: main - Failed to set up snapshot reclamation. Exiting program\n");
+		return -1;
+	}
+
+	//Load and validate the conversions file once. Bad rows are reported here rather than at conversion time.
+	//Every rack shares the one table.
+	if((conversions = spice_conversions_load(SPICE_CONVERSIONS_FILE)) == NULL){
+		printf("Spice_Rack_App: main - Failed to load %s\n", SPICE_CONVERSIONS_FILE);
+		log_message(LOG_DEBUG, "Spice_Rack_App: main - Failed to load %s\n", SPICE_CONVERSIONS_FILE);
+	}
+
+	for(num_racks=0;num_racks<config.num_racks;num_racks++){
+		if(setup_rack(&racks[num_racks], num_racks + 1) != 0){
+			printf("Spice_Rack_App: main - Failed to set up rack%i. Exiting program\n", num_racks + 1);
+			log_message(LOG_DEBUG, "Spice_Rack_App: main - Failed to set up rack%i. Exiting program\n", num_racks + 1);
+			caught_signal = true;
+			break;
+		}
+	}
+	//Slot 0 holds the empty rack and jar readings, so each rack has MAX_RACK_SIZE + 1 slots
+	if(caught_signal == false && (persist = persist_start(config.num_racks, MAX_RACK_SIZE + 1, config.flush_ms, &persist_ops)) == NULL){
+		printf("Spice_Rack_App: main - Failed to start persistence thread. Exiting program\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: main - Failed to start persistence thread. Exiting program\n");
+		caught_signal = true;
+	}
+
+	//Each rack has at most one job waiting, so the queue never needs more room than there are racks
+	if(caught_signal == false && (workers = worker_pool_create(config.worker_threads, config.num_racks)) == NULL){
+		printf("Spice_Rack_App: main - Failed to start worker threads. Exiting program\n");
+		log_message(LOG_DEBUG, "Spice_Rack_App: main - Failed to start worker threads. Exiting program\n");
+		caught_signal = true;
+	}
+	//Racks serve what was loaded from their files until their warm up job has read the sensors. The
+	//scheduler leaves a rack alone while the job runs.
+	for(i=0;i<num_racks && caught_signal == false;i++){
+		if(atomic_load(&racks[i].snapshot) != NULL){
+			persist_request_publish(persist, i);
+		}
+		racks[i].busy = 1;
+		racks[i].td.hb = start.tv_sec;
+		racks[i].td.waiting = 1;
+		if(worker_pool_submit(workers, warm_rack_job, &racks[i]) != 0){
+			log_message(LOG_DEBUG, "Spice_Rack_App: main - Failed to queue warm up for rack%i\n", racks[i].id);
+			racks[i].busy = 0;
+		}
+	}
 
-				//Produce a consolidated data file for TCP socket queries
-				if(consolidated_spice_file() != 0){
-					printf("Spice_Rack_App: main - Failed to create consolidated spice file\n");
-					syslog(LOG_DEBUG, "Spice_Rack_App: main - Failed to create consolidated spice file\n");
+	if(caught_signal == false){
+		watchdog_notify(&watchdog, "READY=1");
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		printf("Application is now initialized and running %i racks on %i worker threads...\n", config.num_racks, config.worker_threads);
+		log_message(LOG_INFO, "Spice_Rack_App: main - Serving %i racks %li ms after start\n", config.num_racks,
+			(now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+	}
+	while(caught_signal == false){
+		while((signal_number = signals_read(signal_poll.fd)) > 0){
+			if(signal_number == SIGHUP){
+				reload_config();
+				continue;
+			}
+			else if(signal_number != SIGUSR1){
+				caught_signal = true;
+				break;
+			}
+			for(i=0;i<num_racks;i++){
+				if(pthread_mutex_lock(&racks[i].td.lock) == 0){
+					racks[i].sweep = 1;
+					pthread_mutex_unlock(&racks[i].td.lock);
 				}
-				calibration.calibration_button = 0;
 			}
-			pthread_mutex_unlock(&calibration.calibration_lock);
+			printf("Sweep requested for %i racks\n", num_racks);
 		}
 		if(caught_signal == true){
-                        syslog(LOG_DEBUG, "SOCKET: Caught signal, exiting");
-			timer_delete(timerid);
-			cleanup_spice_rack_struct();
-        		free(spice_rack);
-        		free(read_val);
-	        	free_calibrate_button();
-			pthread_join(calibration.calibrate_thread, NULL);
-			closelog();
-			return 0;
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		stalled = 0;
+		for(i=0;i<num_racks;i++){
+			schedule_rack(&racks[i], &now);
+			stalled = stalled + check_rack_progress(&racks[i], &now);
+		}
+		if(stalled == 0){
+			watchdog_ping(&watchdog, &now);
+		}
+		//Sleeps for the tick, waking early for a signal
+		if(poll(&signal_poll, 1, SCHEDULER_TICK_MS) == -1 && errno != EINTR){
+			log_errno("Spice_Rack_App: main - poll() failed");
+			break;
 		}
-			
 	}
+
+	log_message(LOG_DEBUG, "SOCKET: Caught signal, exiting");
+	watchdog_close(&watchdog);
+	worker_pool_destroy(workers);
+	//Everything the workers queued is written before the racks are freed
+	if(persist != NULL){
+		persist_get_stats(persist, &persist_stats);
+		log_message(LOG_INFO, "Spice_Rack_App: main - %lu measurements queued, %lu coalesced, %lu written in %lu batches, %lu failed\n",
+			persist_stats.submitted, persist_stats.coalesced, persist_stats.written, persist_stats.batches, persist_stats.failed);
+		persist_stop(persist);
+	}
+	for(i=0;i<num_racks;i++){
+		cleanup_rack(&racks[i]);
+	}
+	epoch_destroy(&snapshot_epochs);
+	spice_conversions_free(conversions);
+	close(signal_poll.fd);
+	trace_stop();
+	log_stop();
+	closelog();
+	return 0;
 }
@@ -1,15 +1,9 @@
-struct spice_search_strings{
-	int num_search_strings;
-	char *search_strings[5];
-};
-
 struct spice_entries{
 	int num_entries;
 	char *entries[5];
 };
 
 struct spice{
-	struct spice_search_strings spice_search_strings;
 	struct spice_entries spice_entries;
 };
 
@@ -24,16 +18,98 @@ struct spice_rack{
 
 struct calibration_status{
 	int calibration_button;
-	pthread_t calibrate_thread;
+	char gpio[8];
 	pthread_mutex_t calibration_lock;
 };
 
+//The FSR status fields are only used by the job running on the rack, fsr_cur_status is -1 until the FSR
+//has been read. lock guards hb, waiting, the rack's busy and sweep flags and pending config, which the
+//scheduler and the job both touch. hb is the monotonic second the rack's job was queued, last made progress
+//or finished. waiting is set while the job is queued behind other racks' jobs or waiting on the console or
+//on someone at it, none of which has a time limit.
 struct thread_data{
 	int hb;
+	int waiting;
 	int fsr_prev_status;
 	int fsr_cur_status;
 	int fsr_alert;
 	pthread_mutex_t lock;
 };
 
+//Settings for one rack. The global section of the config file sets them for every rack and a [rackN]
+//section overrides them for rack N. See spice_rack.conf for what each one does.
+struct rack_config{
+	char hx711_file[PATH_MAX];
+	char fsr_file[PATH_MAX];
+	char data_dir[PATH_MAX];
+	char calibrate_gpio[8];
+	int rack_size;
+	float empty_jar_mass;
+	int weight_samples;
+	int debounce_ms;
+	int weight_timeout_ms;
+	int stuck_samples;
+	char hx711_scan_type[32];
+};
 
+//Settings read from the config file at start and on SIGHUP
+struct app_config{
+	int num_racks;
+	int worker_threads;
+	int fsr_poll_sec;
+	int flush_ms;
+	int io_uring;
+	int job_timeout_sec;
+	int sweep_timeout_sec;
+	char watchdog_device[PATH_MAX];
+	//syslog priority name, messages less important than this are skipped
+	char log_level[16];
+	struct rack_config rack;
+};
+
+//Everything belonging to one physical rack. A rack has at most one job queued or running on the worker
+//pool, and that job owns the rack's state while it runs.
+struct rack{
+	int id;
+	struct rack_config config;
+	//Set by a reload, applied at the start of the rack's next job
+	struct rack_config pending_config;
+	//The one global setting a job reads, handed over with pending_config. Jobs never read the global
+	//app_config, which a reload rewrites.
+	int sweep_timeout_sec;
+	int pending_sweep_timeout_sec;
+	int config_pending;
+	int busy;
+	//Set on SIGUSR1 and cleared by the job that runs the sweep
+	int sweep;
+	struct timespec next_poll;
+	struct thread_data td;
+	struct calibration_status calibration;
+	struct spice_rack *spice_rack;
+	struct history_store *history;
+	struct forecast_table *forecast;
+	//Published by the rack's job, read by any thread through acquire_snapshot()
+	struct inventory_snapshot *_Atomic snapshot;
+	struct published_file consolidated_file;
+	struct published_file inventory_file;
+	char measurements_file[PATH_MAX];
+	char consolidated_path[PATH_MAX];
+	char inventory_path[PATH_MAX];
+	char *read_val;
+	int read_len;
+	//Weight samples are read through the ring when uring_ready is set. hx711_fd is the registered file,
+	//opened from hx711_open_file, and hx711_samples the registered buffer the reads land in.
+	struct uring ring;
+	int uring_ready;
+	int hx711_fd;
+	char hx711_open_file[PATH_MAX];
+	char *hx711_samples;
+	//The readings of the weight measurement in progress, and the raw samples when hx711_file is an IIO buffer
+	int32_t *weight_values;
+	char *hx711_raw;
+	//Sensor health, only touched by the rack's job
+	struct device_health weight_health;
+	struct device_health fsr_health;
+	//Set by the scheduler while the rack's job has run past job_timeout_sec
+	int stalled;
+};
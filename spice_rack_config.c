@@ -0,0 +1,196 @@
+#include <errno.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_rack_config.h"
+
+#define CONFIG_LINE_LEN 512
+
+static char *trim(char *str){
+	char *end;
+	while(isspace((unsigned char)*str)){
+		str++;
+	}
+	end = str + strlen(str);
+	while(end > str && isspace((unsigned char)end[-1])){
+		end--;
+	}
+	*end = '\0';
+	return str;
+}
+
+static void report_bad_line(const char *file_name, int line, const char *reason){
+	printf("%s line %i: %s\n", file_name, line, reason);
+	log_message(LOG_WARNING, "spice_rack_config: %s line %i - %s\n", file_name, line, reason);
+}
+
+static const struct config_option *find_option(const struct config_option *options, int num_options, const char *key){
+	int i;
+	for(i=0;i<num_options;i++){
+		if(strcmp(options[i].key, key) == 0){
+			return &options[i];
+		}
+	}
+	return NULL;
+}
+
+//Parses value for option into parsed. Returns 0 or -1 if the value isn't valid for the option.
+static int parse_value(const struct config_option *option, const char *value, void *parsed){
+	char *end_ptr;
+	long int_value;
+	float float_value;
+
+	switch(option->type){
+	case CONFIG_STRING:
+		if(strlen(value) >= option->len){
+			return -1;
+		}
+		strcpy((char *)parsed, value);
+		return 0;
+	case CONFIG_INT:
+		errno = 0;
+		int_value = strtol(value, &end_ptr, 0);
+		if(errno != 0 || end_ptr == value || *end_ptr != '\0' || int_value < option->min || int_value > option->max){
+			return -1;
+		}
+		*(int *)parsed = int_value;
+		return 0;
+	case CONFIG_FLOAT:
+		float_value = strtof(value, &end_ptr);
+		if(end_ptr == value || *end_ptr != '\0' || !isfinite(float_value) || float_value < option->min || float_value > option->max){
+			return -1;
+		}
+		*(float *)parsed = float_value;
+		return 0;
+	}
+	return -1;
+}
+
+//"[name]" starts a section. Returns a pointer to name with the brackets removed, or NULL if line isn't a header.
+static char *section_header(char *line){
+	char *end;
+	if(*line != '['){
+		return NULL;
+	}
+	if((end = strchr(line, ']')) == NULL){
+		return NULL;
+	}
+	*end = '\0';
+	return trim(line + 1);
+}
+
+int config_load(const char *file_name, const char *section, const struct config_option *options, int num_options, void *config, const void *running){
+	const struct config_option *option;
+	char line_buf[CONFIG_LINE_LEN];
+	//Union so numbers are parsed into suitably aligned storage
+	union{
+		char str[CONFIG_LINE_LEN];
+		int int_value;
+		float float_value;
+	} parsed;
+	char reason[CONFIG_LINE_LEN];
+	char *key;
+	char *value;
+	char *separator;
+	char *field;
+	char *header;
+	size_t value_len;
+	FILE *file;
+	int line = 0;
+	int changed = 0;
+	//Lines before the first header belong to the global section
+	int in_section = section == NULL;
+
+	if((file = fopen(file_name, "r")) == NULL){
+		log_message(LOG_DEBUG, "spice_rack_config: config_load - Unable to open %s - %s\n", file_name, strerror(errno));
+		return -1;
+	}
+	while(fgets(line_buf, sizeof(line_buf), file) != NULL){
+		line++;
+		key = trim(line_buf);
+		if(*key == '\0' || *key == '#'){
+			continue;
+		}
+		if((header = section_header(key)) != NULL){
+			in_section = section != NULL && strcmp(header, section) == 0;
+			continue;
+		}
+		//Other sections are left for the loads that ask for them
+		if(in_section == 0){
+			continue;
+		}
+		if((separator = strchr(key, '=')) == NULL){
+			report_bad_line(file_name, line, "expected key = value");
+			continue;
+		}
+		*separator = '\0';
+		key = trim(key);
+		value = trim(separator + 1);
+		//A quoted value keeps its '#' and surrounding spaces, otherwise '#' starts a comment
+		if(*value == '"'){
+			value++;
+			if((separator = strrchr(value, '"')) == NULL){
+				report_bad_line(file_name, line, "unterminated quote");
+				continue;
+			}
+			*separator = '\0';
+		}
+		else if((separator = strchr(value, '#')) != NULL){
+			*separator = '\0';
+			value = trim(value);
+		}
+
+		if((option = find_option(options, num_options, key)) == NULL){
+			snprintf(reason, sizeof(reason), "unknown option %.64s", key);
+			report_bad_line(file_name, line, reason);
+			continue;
+		}
+		if(parse_value(option, value, &parsed) != 0){
+			snprintf(reason, sizeof(reason), "invalid value for %s", option->key);
+			report_bad_line(file_name, line, reason);
+			continue;
+		}
+		value_len = option->type == CONFIG_STRING ? strlen(parsed.str) + 1 : option->len;
+		field = (char *)config + option->offset;
+		if(memcmp(field, &parsed, value_len) == 0){
+			continue;
+		}
+		if(running != NULL && option->reloadable == CONFIG_RESTART){
+			log_message(LOG_NOTICE, "spice_rack_config: %s changed in %s, restart to apply it\n", option->key, file_name);
+			continue;
+		}
+		memcpy(field, &parsed, value_len);
+		log_message(LOG_DEBUG, "spice_rack_config: %s set from %s line %i\n", option->key, file_name, line);
+		changed++;
+	}
+	fclose(file);
+	return changed;
+}
+
+int config_keep_restart_options(const struct config_option *options, int num_options, void *config, const void *running, const char *name){
+	const char *running_field;
+	char *field;
+	int kept = 0;
+	int i;
+
+	for(i=0;i<num_options;i++){
+		if(options[i].reloadable != CONFIG_RESTART){
+			continue;
+		}
+		field = (char *)config + options[i].offset;
+		running_field = (const char *)running + options[i].offset;
+		if(memcmp(field, running_field, options[i].len) == 0){
+			continue;
+		}
+		if(options[i].type != CONFIG_STRING || strcmp(field, running_field) != 0){
+			log_message(LOG_NOTICE, "spice_rack_config: %s changed for %s, restart to apply it\n", options[i].key, name);
+			kept++;
+		}
+		memcpy(field, running_field, options[i].len);
+	}
+	return kept;
+}
@@ -0,0 +1,53 @@
+#ifndef SPICE_RACK_CONFIG_H
+#define SPICE_RACK_CONFIG_H
+
+#include <stddef.h>
+
+//Config files are "key = value" lines. '#' starts a comment, blank lines are ignored and values may be
+//wrapped in double quotes. Keys not in the option table and values that fail validation are reported
+//with their line number and skipped, leaving that option at its previous value.
+//A "[name]" line starts a section that runs to the next header. Lines before the first header are the
+//global section.
+
+enum config_type{
+	CONFIG_STRING = 0,
+	CONFIG_INT,
+	CONFIG_FLOAT
+};
+
+//Options that can't be changed on a running process (rack geometry, GPIO export) are CONFIG_RESTART.
+//A reload that changes one keeps the running value and logs that a restart is needed.
+#define CONFIG_RELOAD 1
+#define CONFIG_RESTART 0
+
+struct config_option{
+	const char *key;
+	enum config_type type;
+	//Where the value lives in the program's config struct
+	size_t offset;
+	//Buffer size for strings
+	size_t len;
+	int reloadable;
+	//Accepted range for numbers
+	double min;
+	double max;
+};
+
+#define CONFIG_STRING_OPTION(config_type, field, reloadable) \
+	{#field, CONFIG_STRING, offsetof(config_type, field), sizeof(((config_type *)0)->field), reloadable, 0, 0}
+#define CONFIG_INT_OPTION(config_type, field, reloadable, min, max) \
+	{#field, CONFIG_INT, offsetof(config_type, field), sizeof(int), reloadable, min, max}
+#define CONFIG_FLOAT_OPTION(config_type, field, reloadable, min, max) \
+	{#field, CONFIG_FLOAT, offsetof(config_type, field), sizeof(float), reloadable, min, max}
+
+//Reads one section of file_name into config, which should already hold the defaults (first load) or a copy
+//of the running config (reload). section is the name between the brackets, or NULL for the global section.
+//When running is not NULL, CONFIG_RESTART options are held at their running values.
+//Returns the number of options that changed from what config held, or -1 if the file can't be read.
+int config_load(const char *file_name, const char *section, const struct config_option *options, int num_options, void *config, const void *running);
+//Copies every CONFIG_RESTART option from running back into config. For configs built up from several
+//sections, where config_load can't tell which section a restart-only value came from. name is used in
+//the log message. Returns the number of options that had changed.
+int config_keep_restart_options(const struct config_option *options, int num_options, void *config, const void *running, const char *name);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_rack_core.h"
+
+const char *const spice_column_labels[SPICE_NUM_COLUMNS] = {
+	"Spice_Location:", "Spice_Name:", "ADC_Reading:", "Calibrated_Mass(grams):", "Teaspoons:"
+};
+
+void spice_format_location(char *dest, size_t dest_len, int spice_num, const char *spice_name){
+	if(strstr(spice_name, "Empty Jar") != NULL || strcmp(spice_name, "Empty Rack") == 0){
+		snprintf(dest, dest_len, "N/A-%s", spice_name);
+	}
+	else{
+		snprintf(dest, dest_len, "Spice%i", spice_num);
+	}
+}
+
+int spice_format_line(char *dest, size_t dest_len, const char *location, const char *spice_name, const char *adc, float mass, float tsps){
+	return snprintf(dest, dest_len, "%s%s,%s%s,%s%s,%s%3.6f,%s%3.6f\n",
+		spice_column_labels[0], location, spice_column_labels[1], spice_name, spice_column_labels[2], adc,
+		spice_column_labels[3], mass, spice_column_labels[4], tsps);
+}
+
+int spice_parse_line(const char *line, char *const entries[SPICE_NUM_COLUMNS], size_t entry_len){
+	const char *start;
+	const char *end;
+	size_t len;
+	int result = 0;
+	int j;
+
+	for(j=0;j<SPICE_NUM_COLUMNS;j++){
+		if((start = strstr(line, spice_column_labels[j])) == NULL){
+			entries[j][0] = '\0';
+			result = -1;
+			continue;
+		}
+		start = start + strlen(spice_column_labels[j]);
+		//Every column but the last runs to the next comma
+		if(j == SPICE_NUM_COLUMNS - 1 || (end = strchr(start, ',')) == NULL){
+			end = start + strlen(start);
+		}
+		len = end - start;
+		if(len > entry_len - 1){
+			len = entry_len - 1;
+		}
+		memcpy(entries[j], start, len);
+		entries[j][len] = '\0';
+	}
+	return result;
+}
+
+float spice_adc_to_grams(int empty_rack_adc, int empty_jar_adc, float empty_jar_mass, int previous_adc, int curr_adc){
+	float m = 0;
+	int x;
+
+	//Calculate the multiplier
+	if(empty_jar_adc && empty_rack_adc){
+		m = ((float)empty_jar_adc - empty_rack_adc)/empty_jar_mass;
+	}
+	//Calculate the offset
+	if(curr_adc > previous_adc){
+		x = curr_adc - previous_adc;
+	}
+	else{
+		x = previous_adc - curr_adc;
+	}
+	log_message(LOG_DEBUG,"spice_rack_core: spice_adc_to_grams - x=%i and m=%f\n", x, m);
+	return x/m - empty_jar_mass;
+}
+
+int spice_fsr_to_slot(int fsr_change, int rack_size){
+	int i;
+	for(i=0; i < rack_size; i++){
+		if((fsr_change >> i) == 1){
+			return i+1;
+		}
+	}
+	return fsr_change;
+}
+
+int spice_conversion_lookup(const struct spice_conversion_table *table, const char *spice_name){
+	int row;
+	int i;
+
+	if(table == NULL || spice_name[0] == '\0'){
+		return -1;
+	}
+	if((row = spice_conversions_find(table, spice_name)) != -1){
+		return row;
+	}
+	for(i=0;i<table->num_rows;i++){
+		if(strstr(table->rows[i].name, spice_name) != NULL){
+			log_message(LOG_DEBUG, "spice_rack_core: spice_conversion_lookup - %s is not an exact spice name, using %s. Recalibrate to fix\n", spice_name, table->rows[i].name);
+			return i;
+		}
+	}
+	return -1;
+}
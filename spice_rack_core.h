@@ -0,0 +1,40 @@
+#ifndef SPICE_RACK_CORE_H
+#define SPICE_RACK_CORE_H
+
+#include <stddef.h>
+#include "spice_conversions.h"
+
+//Calculations and measurements file formatting with no I/O, shared by the app and its tests
+
+//A measurements file line is "Spice_Location:Spice1,Spice_Name:Paprika,ADC_Reading:9100,
+//Calibrated_Mass(grams):30.000000,Teaspoons:13.200000"
+#define SPICE_NUM_COLUMNS 5
+#define SPICE_LOCATION_COLUMN 0
+#define SPICE_NAME_COLUMN 1
+#define SPICE_ADC_COLUMN 2
+#define SPICE_MASS_COLUMN 3
+#define SPICE_TSP_COLUMN 4
+
+extern const char *const spice_column_labels[SPICE_NUM_COLUMNS];
+
+//The location column: "N/A-<name>" for the empty rack and jar readings, "Spice<n>" for slots
+void spice_format_location(char *dest, size_t dest_len, int spice_num, const char *spice_name);
+//Returns the length written as snprintf does
+int spice_format_line(char *dest, size_t dest_len, const char *location, const char *spice_name, const char *adc, float mass, float tsps);
+//Splits a line (without its newline) into entries, each holding up to entry_len - 1 characters.
+//Columns whose label is missing are left empty. Returns 0, or -1 if any column was missing.
+int spice_parse_line(const char *line, char *const entries[SPICE_NUM_COLUMNS], size_t entry_len);
+
+//Grams on the rack from the change in ADC reading. The scale comes from the empty rack and empty jar
+//readings taken at calibration, and the empty jar's own mass is taken off.
+float spice_adc_to_grams(int empty_rack_adc, int empty_jar_adc, float empty_jar_mass, int previous_adc, int curr_adc);
+
+//Slot number (from 1) of the highest bit set in an FSR status change. A change with no bit set within
+//rack_size is returned unchanged.
+int spice_fsr_to_slot(int fsr_change, int rack_size);
+
+//Conversion row for spice_name, by exact name or alias first and then as a substring of a row name.
+//-1 if nothing matches.
+int spice_conversion_lookup(const struct spice_conversion_table *table, const char *spice_name);
+
+#endif
@@ -0,0 +1,127 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_rack_epoch.h"
+
+int epoch_init(struct epoch_domain *domain){
+	int i;
+
+	//Epochs start at 1 so 0 can mark a free reader slot
+	atomic_init(&domain->epoch, 1);
+	for(i=0;i<EPOCH_MAX_READERS;i++){
+		atomic_init(&domain->readers[i], 0);
+	}
+	domain->retired = NULL;
+	if(pthread_mutex_init(&domain->retire_lock, NULL) != 0){
+		log_message(LOG_DEBUG, "spice_rack_epoch: epoch_init - Failed to init mutex\n");
+		return -1;
+	}
+	return 0;
+}
+
+void epoch_destroy(struct epoch_domain *domain){
+	struct epoch_retired *retired;
+
+	while((retired = domain->retired) != NULL){
+		domain->retired = retired->next;
+		retired->free_fn(retired->ptr);
+		free(retired);
+	}
+	pthread_mutex_destroy(&domain->retire_lock);
+}
+
+int epoch_enter(struct epoch_domain *domain){
+	uint_fast64_t expected;
+	uint_fast64_t epoch;
+	int i;
+
+	//Claiming the slot with the current epoch is the announcement. Every access is sequentially consistent,
+	//so either a writer's scan sees this slot or this reader sees the pointer the writer swapped in.
+	while(1){
+		epoch = atomic_load(&domain->epoch);
+		for(i=0;i<EPOCH_MAX_READERS;i++){
+			expected = 0;
+			if(atomic_compare_exchange_strong(&domain->readers[i], &expected, epoch)){
+				return i;
+			}
+		}
+		//More readers than slots is a sizing bug, but waiting for one to leave is still correct
+		sched_yield();
+	}
+}
+
+void epoch_exit(struct epoch_domain *domain, int slot){
+	atomic_store(&domain->readers[slot], 0);
+}
+
+//Oldest epoch an active reader is in, or the current epoch if none are reading
+static uint_fast64_t oldest_reader(struct epoch_domain *domain){
+	uint_fast64_t oldest = atomic_load(&domain->epoch);
+	uint_fast64_t epoch;
+	int i;
+
+	for(i=0;i<EPOCH_MAX_READERS;i++){
+		epoch = atomic_load(&domain->readers[i]);
+		if(epoch != 0 && epoch < oldest){
+			oldest = epoch;
+		}
+	}
+	return oldest;
+}
+
+int epoch_reclaim(struct epoch_domain *domain){
+	struct epoch_retired **link;
+	struct epoch_retired *retired;
+	struct epoch_retired *safe = NULL;
+	uint_fast64_t oldest;
+	int waiting = 0;
+
+	pthread_mutex_lock(&domain->retire_lock);
+	oldest = oldest_reader(domain);
+	link = &domain->retired;
+	while((retired = *link) != NULL){
+		if(retired->epoch < oldest){
+			*link = retired->next;
+			retired->next = safe;
+			safe = retired;
+		}
+		else{
+			link = &retired->next;
+			waiting++;
+		}
+	}
+	pthread_mutex_unlock(&domain->retire_lock);
+
+	//Freed outside the lock so other writers aren't held up by free_fn
+	while((retired = safe) != NULL){
+		safe = retired->next;
+		retired->free_fn(retired->ptr);
+		free(retired);
+	}
+	return waiting;
+}
+
+int epoch_retire(struct epoch_domain *domain, void *ptr, void (*free_fn)(void *ptr)){
+	struct epoch_retired *retired;
+
+	if(ptr == NULL){
+		return 0;
+	}
+	if((retired = (struct epoch_retired *)malloc(sizeof(struct epoch_retired))) == NULL){
+		log_message(LOG_DEBUG, "spice_rack_epoch: epoch_retire - Failed on Malloc - %s\n", strerror(errno));
+		return -1;
+	}
+	retired->ptr = ptr;
+	retired->free_fn = free_fn;
+	//Readers entering from here on are in a later epoch and can only see the new pointer
+	retired->epoch = atomic_fetch_add(&domain->epoch, 1);
+	pthread_mutex_lock(&domain->retire_lock);
+	retired->next = domain->retired;
+	domain->retired = retired;
+	pthread_mutex_unlock(&domain->retire_lock);
+	epoch_reclaim(domain);
+	return 0;
+}
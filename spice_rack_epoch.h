@@ -0,0 +1,44 @@
+#ifndef SPICE_RACK_EPOCH_H
+#define SPICE_RACK_EPOCH_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+//Epoch based reclamation for data published by pointer swap. Readers announce the epoch they started in
+//and never lock or wait. A writer swaps in the new object, retires the old one and carries on; the old
+//object is freed by a later reclaim once no reader that could still hold it is active.
+#define EPOCH_MAX_READERS 32
+
+struct epoch_retired{
+	struct epoch_retired *next;
+	//Global epoch when this was retired. Readers from later epochs can't have seen it.
+	uint64_t epoch;
+	void *ptr;
+	void (*free_fn)(void *ptr);
+};
+
+struct epoch_domain{
+	atomic_uint_fast64_t epoch;
+	//Epoch each active reader entered in, 0 for a free slot
+	atomic_uint_fast64_t readers[EPOCH_MAX_READERS];
+	//Only writers take this, to share the retired list
+	pthread_mutex_t retire_lock;
+	struct epoch_retired *retired;
+};
+
+int epoch_init(struct epoch_domain *domain);
+//Frees everything still retired. No reader may be active.
+void epoch_destroy(struct epoch_domain *domain);
+
+//Starts a read side section. Pointers loaded after this stay valid until epoch_exit() with the returned slot.
+int epoch_enter(struct epoch_domain *domain);
+void epoch_exit(struct epoch_domain *domain, int slot);
+
+//Hands ptr, already unpublished, to the domain to be freed with free_fn once no reader can hold it.
+//Also frees anything retired earlier that has become safe. Never waits on readers.
+int epoch_retire(struct epoch_domain *domain, void *ptr, void (*free_fn)(void *ptr));
+//Frees what has become safe to free. Returns the number of objects still waiting on readers.
+int epoch_reclaim(struct epoch_domain *domain);
+
+#endif
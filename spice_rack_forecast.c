@@ -0,0 +1,160 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <syslog.h>
+#include <unistd.h>
+#include "spice_rack_log.h"
+#include "spice_rack_forecast.h"
+
+#define SECONDS_PER_DAY 86400.0
+
+struct forecast_table{
+	int fd;
+	int num_slots;
+	struct forecast_state slots[];
+};
+
+struct forecast_table *forecast_open(const char *file_name, int num_slots){
+	struct forecast_table *table;
+	ssize_t count;
+
+	if((table = (struct forecast_table *)calloc(1, sizeof(struct forecast_table) + num_slots * sizeof(struct forecast_state))) == NULL){
+		log_errno("spice_rack_forecast: forecast_open - Failed on Malloc");
+		return NULL;
+	}
+	table->num_slots = num_slots;
+	table->fd = open(file_name, O_CREAT | O_RDWR, 0644);
+	if(table->fd == -1){
+		log_errno("spice_rack_forecast: forecast_open - Failed to open %s", file_name);
+		free(table);
+		return NULL;
+	}
+	//State is one fixed size record per slot. A short or missing file just means those slots start fresh.
+	count = pread(table->fd, table->slots, num_slots * sizeof(struct forecast_state), 0);
+	if(count == -1){
+		log_message(LOG_DEBUG, "spice_rack_forecast: forecast_open - Failed to read %s - %s\n", file_name, strerror(errno));
+		count = 0;
+	}
+	memset((char *)table->slots + count, 0, num_slots * sizeof(struct forecast_state) - count);
+	return table;
+}
+
+static int save_slot(struct forecast_table *table, int slot){
+	off_t offset = (slot - 1) * sizeof(struct forecast_state);
+	if(pwrite(table->fd, &table->slots[slot-1], sizeof(struct forecast_state), offset) != sizeof(struct forecast_state)){
+		log_message(LOG_DEBUG, "spice_rack_forecast: save_slot - Failed to write Spice%i state - %s\n", slot, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int low_stock_check(struct forecast_state *state, int slot){
+	double days = -1;
+	int was_low = state->low_stock;
+
+	if(state->trend < 0){
+		days = state->level / -state->trend / SECONDS_PER_DAY;
+	}
+	if(state->level < LOW_STOCK_GRAMS || (days >= 0 && days < LOW_STOCK_DAYS)){
+		state->low_stock = 1;
+	}
+	else if(state->level > LOW_STOCK_GRAMS * LOW_STOCK_HYSTERESIS && (days < 0 || days > LOW_STOCK_DAYS * LOW_STOCK_HYSTERESIS)){
+		state->low_stock = 0;
+	}
+	if(state->low_stock == 1 && was_low == 0){
+		log_message(LOG_WARNING, "spice_rack_forecast: low_stock_check - Low stock in Spice%i - %.1f grams left, %.1f days at current usage\n", slot, state->level, days);
+		return 1;
+	}
+	return 0;
+}
+
+int forecast_reset(struct forecast_table *table, int slot, time_t when, float grams){
+	struct forecast_state *state;
+
+	if(table == NULL || slot < 1 || slot > table->num_slots){
+		return -1;
+	}
+	state = &table->slots[slot-1];
+	state->level = grams;
+	state->trend = 0;
+	state->last_time = when;
+	state->initialized = 1;
+	state->low_stock = 0;
+	low_stock_check(state, slot);
+	return save_slot(table, slot);
+}
+
+//O(1) per reading: only the previous level, trend and timestamp are needed
+int forecast_update(struct forecast_table *table, int slot, time_t when, float grams){
+	struct forecast_state *state;
+	double dt;
+	double predicted;
+	double previous_level;
+	int alert;
+
+	if(table == NULL || slot < 1 || slot > table->num_slots){
+		return -1;
+	}
+	state = &table->slots[slot-1];
+	if(state->initialized == 0){
+		return forecast_reset(table, slot, when, grams);
+	}
+
+	dt = (double)(when - state->last_time);
+	previous_level = state->level;
+	if(dt <= 0){
+		//Same timestamp (or clock stepped back): refine the level without touching the rate
+		state->level = FORECAST_ALPHA * grams + (1 - FORECAST_ALPHA) * state->level;
+	}
+	else{
+		predicted = state->level + state->trend * dt;
+		if(grams > predicted + FORECAST_REFILL_GRAMS){
+			state->level = grams;
+		}
+		else{
+			state->level = FORECAST_ALPHA * grams + (1 - FORECAST_ALPHA) * predicted;
+			state->trend = FORECAST_BETA * (state->level - previous_level) / dt + (1 - FORECAST_BETA) * state->trend;
+		}
+		state->last_time = when;
+	}
+
+	alert = low_stock_check(state, slot);
+	if(save_slot(table, slot) != 0){
+		return -1;
+	}
+	return alert;
+}
+
+float forecast_days_until_empty(struct forecast_table *table, int slot){
+	struct forecast_state *state;
+
+	if(table == NULL || slot < 1 || slot > table->num_slots){
+		return -1;
+	}
+	state = &table->slots[slot-1];
+	if(state->initialized == 0 || state->trend >= 0){
+		return -1;
+	}
+	if(state->level <= 0){
+		return 0;
+	}
+	return state->level / -state->trend / SECONDS_PER_DAY;
+}
+
+int forecast_low_stock(struct forecast_table *table, int slot){
+	if(table == NULL || slot < 1 || slot > table->num_slots){
+		return 0;
+	}
+	return table->slots[slot-1].low_stock;
+}
+
+void forecast_close(struct forecast_table *table){
+	if(table == NULL){
+		return;
+	}
+	close(table->fd);
+	free(table);
+}
@@ -0,0 +1,38 @@
+#ifndef SPICE_RACK_FORECAST_H
+#define SPICE_RACK_FORECAST_H
+
+#include <stdint.h>
+#include <time.h>
+
+//Holt linear smoothing of the mass in each slot. level is the smoothed mass in grams and trend the
+//smoothed rate of change in grams per second (negative while a spice is being used up).
+#define FORECAST_ALPHA 0.5
+#define FORECAST_BETA 0.3
+//A reading this far above the forecast is a refill. The level restarts but the usage rate is kept.
+#define FORECAST_REFILL_GRAMS 5.0
+//Low stock is raised below either threshold and cleared once the slot is back above both plus hysteresis
+#define LOW_STOCK_GRAMS 5.0
+#define LOW_STOCK_DAYS 7.0
+#define LOW_STOCK_HYSTERESIS 1.2
+
+struct forecast_state{
+	double level;
+	double trend;
+	int64_t last_time;
+	int32_t initialized;
+	int32_t low_stock;
+};
+
+struct forecast_table;
+
+struct forecast_table *forecast_open(const char *file_name, int num_slots);
+//Returns 1 if this update raised a new low stock alert, 0 if not and -1 on error
+int forecast_update(struct forecast_table *table, int slot, time_t when, float grams);
+//Forget the usage history of a slot, e.g. after a new spice was calibrated into it
+int forecast_reset(struct forecast_table *table, int slot, time_t when, float grams);
+//Days until the slot is empty at the current usage rate, or -1 when no usage has been seen yet
+float forecast_days_until_empty(struct forecast_table *table, int slot);
+int forecast_low_stock(struct forecast_table *table, int slot);
+void forecast_close(struct forecast_table *table);
+
+#endif
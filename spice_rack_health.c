@@ -0,0 +1,87 @@
+#include <string.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_rack_health.h"
+
+static const char *state_names[] = {"ok", "degraded", "failed"};
+
+void health_init(struct device_health *device, const char *name, int stuck_limit){
+	memset(device, 0, sizeof(struct device_health));
+	device->name = name;
+	device->stuck_limit = stuck_limit;
+}
+
+static void window_add(struct device_health *device, int error){
+	device->window = (device->window << 1) | (error != 0);
+	if(device->window_reads < HEALTH_WINDOW){
+		device->window_reads++;
+	}
+	device->reads++;
+}
+
+int health_error_rate(const struct device_health *device){
+	unsigned int window = device->window;
+	int errors = 0;
+
+	if(device->window_reads == 0){
+		return 0;
+	}
+	if(device->window_reads < HEALTH_WINDOW){
+		window = window & ((1u << device->window_reads) - 1);
+	}
+	while(window != 0){
+		errors = errors + (window & 1);
+		window = window >> 1;
+	}
+	return errors * 100 / device->window_reads;
+}
+
+int health_is_stuck(const struct device_health *device){
+	return device->stuck_limit > 0 && device->repeats >= device->stuck_limit;
+}
+
+static int update_state(struct device_health *device){
+	enum health_state state = HEALTH_OK;
+	int rate = health_error_rate(device);
+
+	if(device->consecutive_errors >= HEALTH_FAIL_STREAK){
+		state = HEALTH_FAILED;
+	}
+	else if(rate > HEALTH_DEGRADED_RATE || health_is_stuck(device)){
+		state = HEALTH_DEGRADED;
+	}
+	if(state == device->state){
+		return 0;
+	}
+	log_message(state == HEALTH_OK ? LOG_NOTICE : LOG_WARNING, "spice_rack_health: %s is %s - %i%% of recent reads failed, %i identical readings, %lu of %lu reads failed in total\n",
+		device->name, state_names[state], rate, device->repeats, device->errors, device->reads);
+	device->state = state;
+	return 1;
+}
+
+int health_record_read(struct device_health *device, int value){
+	window_add(device, 0);
+	device->consecutive_errors = 0;
+	if(device->reads > 1 && value == device->last_value){
+		device->repeats++;
+	}
+	else{
+		device->repeats = 1;
+	}
+	device->last_value = value;
+	return update_state(device);
+}
+
+int health_record_error(struct device_health *device){
+	window_add(device, 1);
+	device->errors++;
+	device->consecutive_errors++;
+	return update_state(device);
+}
+
+const char *health_state_name(enum health_state state){
+	if(state > HEALTH_FAILED){
+		return "unknown";
+	}
+	return state_names[state];
+}
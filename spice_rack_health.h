@@ -0,0 +1,44 @@
+#ifndef SPICE_RACK_HEALTH_H
+#define SPICE_RACK_HEALTH_H
+
+//Tracks how a sensor has been behaving from the results of its reads. A device is degraded when too many
+//of its recent reads failed or it keeps returning exactly the same value, and failed after a run of
+//consecutive errors. Not thread safe, each device is only updated by the job that owns it.
+#define HEALTH_WINDOW 32
+//Errors in the window above which the device is degraded, in percent
+#define HEALTH_DEGRADED_RATE 25
+//Consecutive errors before the device is failed
+#define HEALTH_FAIL_STREAK 8
+
+enum health_state{
+	HEALTH_OK = 0,
+	HEALTH_DEGRADED,
+	HEALTH_FAILED
+};
+
+struct device_health{
+	const char *name;
+	//Identical readings in a row before the device counts as stuck. 0 for devices whose value is
+	//expected to hold, like the FSR bitmask.
+	int stuck_limit;
+	//One bit per read in the window, set for errors
+	unsigned int window;
+	int window_reads;
+	int consecutive_errors;
+	int last_value;
+	int repeats;
+	unsigned long reads;
+	unsigned long errors;
+	enum health_state state;
+};
+
+void health_init(struct device_health *device, const char *name, int stuck_limit);
+//Record a good read of value or a failed one. Both return 1 if the device's state changed.
+int health_record_read(struct device_health *device, int value);
+int health_record_error(struct device_health *device);
+//Percent of the reads in the window that failed
+int health_error_rate(const struct device_health *device);
+int health_is_stuck(const struct device_health *device);
+const char *health_state_name(enum health_state state);
+
+#endif
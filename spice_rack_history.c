@@ -0,0 +1,504 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include "spice_rack_log.h"
+#include "spice_rack_history.h"
+
+#define HISTORY_MAGIC "SRHC"
+#define HISTORY_FORMAT 1
+#define HISTORY_PATH_LEN 256
+#define HISTORY_CHUNK_BODY (HISTORY_CHUNK_SIZE - sizeof(struct history_chunk_header))
+//A sample is two zigzag varints of at most 10 bytes each
+#define HISTORY_MAX_SAMPLE_LEN 20
+
+struct history_slot{
+	int chunk_fd;
+	int have_chunk;
+	uint32_t oldest_seq;
+	uint32_t next_seq;
+	struct history_chunk_header header;
+	int rollup_fd[HISTORY_NUM_RESOLUTIONS];
+};
+
+struct history_store{
+	char dir[HISTORY_PATH_LEN];
+	int num_slots;
+	struct history_slot slots[];
+};
+
+static const int64_t rollup_width[HISTORY_NUM_RESOLUTIONS] = {0, 60, 3600, 86400};
+static const int64_t rollup_buckets[HISTORY_NUM_RESOLUTIONS] = {0, HISTORY_MINUTE_BUCKETS, HISTORY_HOUR_BUCKETS, HISTORY_DAY_BUCKETS};
+static const char *resolution_names[HISTORY_NUM_RESOLUTIONS] = {"raw", "minute", "hour", "day"};
+
+int history_resolution_from_string(const char *name){
+	int i;
+	for(i=0;i<HISTORY_NUM_RESOLUTIONS;i++){
+		if(strcmp(name, resolution_names[i]) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int encode_varint(unsigned char *out, int64_t value){
+	//Zigzag so small negative deltas stay small
+	uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+	int len = 0;
+	while(zigzag >= 0x80){
+		out[len++] = (unsigned char)(zigzag | 0x80);
+		zigzag = zigzag >> 7;
+	}
+	out[len++] = (unsigned char)zigzag;
+	return len;
+}
+
+static int decode_varint(const unsigned char *in, size_t in_len, int64_t *value){
+	uint64_t zigzag = 0;
+	size_t i;
+	for(i=0;i<in_len && i<10;i++){
+		zigzag = zigzag | ((uint64_t)(in[i] & 0x7f) << (7*i));
+		if((in[i] & 0x80) == 0){
+			*value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+			return i + 1;
+		}
+	}
+	return -1;
+}
+
+//A path too long for HISTORY_PATH_LEN is left empty, so opening it fails instead of using the truncated path
+static void slot_path(char *path, const char *dir, int slot, const char *file_name){
+	int len;
+
+	if(file_name == NULL){
+		len = snprintf(path, HISTORY_PATH_LEN, "%s/slot%i", dir, slot);
+	}
+	else{
+		len = snprintf(path, HISTORY_PATH_LEN, "%s/slot%i/%s", dir, slot, file_name);
+	}
+	if(len >= HISTORY_PATH_LEN){
+		path[0] = '\0';
+	}
+}
+
+static void chunk_path(char *path, const char *dir, int slot, uint32_t seq){
+	char file_name[32];
+	snprintf(file_name, sizeof(file_name), "raw-%u.chk", seq);
+	slot_path(path, dir, slot, file_name);
+}
+
+//Finds the oldest and newest chunk sequence numbers. Returns 0 if chunks exist, 1 if none, -1 on error.
+static int find_chunk_range(const char *dir, int slot, uint32_t *oldest, uint32_t *newest){
+	char path[HISTORY_PATH_LEN];
+	DIR *slot_dir;
+	struct dirent *entry;
+	unsigned int seq;
+	int found = 0;
+
+	slot_path(path, dir, slot, NULL);
+	if((slot_dir = opendir(path)) == NULL){
+		log_message(LOG_DEBUG, "spice_rack_history: find_chunk_range - Failed to open %s - %s\n", path, strerror(errno));
+		return -1;
+	}
+	while((entry = readdir(slot_dir)) != NULL){
+		if(sscanf(entry->d_name, "raw-%u.chk", &seq) != 1){
+			continue;
+		}
+		if(found == 0 || seq < *oldest){
+			*oldest = seq;
+		}
+		if(found == 0 || seq > *newest){
+			*newest = seq;
+		}
+		found = 1;
+	}
+	closedir(slot_dir);
+	return found ? 0 : 1;
+}
+
+static int make_dir(const char *path){
+	if(mkdir(path, 0755) != 0 && errno != EEXIST){
+		log_errno("spice_rack_history: make_dir - Failed to create %s", path);
+		return -1;
+	}
+	return 0;
+}
+
+static int open_rollup(const char *dir, int slot, int resolution){
+	char path[HISTORY_PATH_LEN];
+	char file_name[16];
+	off_t size = rollup_buckets[resolution] * sizeof(struct history_rollup);
+	int fd;
+
+	snprintf(file_name, sizeof(file_name), "%s.rrd", resolution_names[resolution]);
+	slot_path(path, dir, slot, file_name);
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if(fd == -1){
+		log_errno("spice_rack_history: open_rollup - Failed to open %s", path);
+		return -1;
+	}
+	//Rings are allocated at full size up front so buckets can be addressed directly
+	if(lseek(fd, 0, SEEK_END) != size && ftruncate(fd, size) != 0){
+		log_message(LOG_DEBUG, "spice_rack_history: open_rollup - Failed to size %s - %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int write_chunk_header(struct history_slot *slot_state){
+	if(pwrite(slot_state->chunk_fd, &slot_state->header, sizeof(slot_state->header), 0) != sizeof(slot_state->header)){
+		log_message(LOG_DEBUG, "spice_rack_history: write_chunk_header - Failed to write chunk header - %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int start_chunk(struct history_store *store, int slot, time_t when, int32_t value){
+	struct history_slot *slot_state = &store->slots[slot-1];
+	char path[HISTORY_PATH_LEN];
+	uint32_t seq = slot_state->next_seq;
+
+	if(slot_state->have_chunk){
+		close(slot_state->chunk_fd);
+		slot_state->have_chunk = 0;
+	}
+	chunk_path(path, store->dir, slot, seq);
+	slot_state->chunk_fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if(slot_state->chunk_fd == -1){
+		log_errno("spice_rack_history: start_chunk - Failed to create %s", path);
+		return -1;
+	}
+	if(ftruncate(slot_state->chunk_fd, HISTORY_CHUNK_SIZE) != 0){
+		log_message(LOG_DEBUG, "spice_rack_history: start_chunk - Failed to size %s - %s\n", path, strerror(errno));
+	}
+	memset(&slot_state->header, 0, sizeof(slot_state->header));
+	memcpy(slot_state->header.magic, HISTORY_MAGIC, 4);
+	slot_state->header.format = HISTORY_FORMAT;
+	slot_state->header.slot = slot;
+	slot_state->header.seq = seq;
+	slot_state->header.base_time = when;
+	slot_state->header.base_value = value;
+	slot_state->header.last_time = when;
+	slot_state->header.last_value = value;
+	slot_state->have_chunk = 1;
+	slot_state->next_seq = seq + 1;
+
+	//Retention: drop the oldest chunks once the slot holds HISTORY_RAW_CHUNKS of them
+	while(seq - slot_state->oldest_seq >= HISTORY_RAW_CHUNKS){
+		chunk_path(path, store->dir, slot, slot_state->oldest_seq);
+		if(unlink(path) != 0 && errno != ENOENT){
+			log_message(LOG_DEBUG, "spice_rack_history: start_chunk - Failed to remove %s - %s\n", path, strerror(errno));
+		}
+		slot_state->oldest_seq++;
+	}
+	return write_chunk_header(slot_state);
+}
+
+static int load_newest_chunk(struct history_store *store, int slot){
+	struct history_slot *slot_state = &store->slots[slot-1];
+	char path[HISTORY_PATH_LEN];
+	uint32_t oldest;
+	uint32_t newest;
+	int ret;
+
+	ret = find_chunk_range(store->dir, slot, &oldest, &newest);
+	if(ret != 0){
+		return ret == 1 ? 0 : -1;
+	}
+	slot_state->oldest_seq = oldest;
+	slot_state->next_seq = newest + 1;
+	chunk_path(path, store->dir, slot, newest);
+	slot_state->chunk_fd = open(path, O_RDWR);
+	if(slot_state->chunk_fd == -1){
+		log_message(LOG_DEBUG, "spice_rack_history: load_newest_chunk - Failed to open %s - %s\n", path, strerror(errno));
+		return 0;
+	}
+	if(pread(slot_state->chunk_fd, &slot_state->header, sizeof(slot_state->header), 0) != sizeof(slot_state->header) ||
+	   memcmp(slot_state->header.magic, HISTORY_MAGIC, 4) != 0 || slot_state->header.used > HISTORY_CHUNK_BODY){
+		//A damaged newest chunk is left for readers to skip and a fresh one is started on the next append
+		log_message(LOG_DEBUG, "spice_rack_history: load_newest_chunk - Ignoring damaged chunk %s\n", path);
+		close(slot_state->chunk_fd);
+		return 0;
+	}
+	slot_state->have_chunk = 1;
+	return 0;
+}
+
+struct history_store *history_open(const char *dir, int num_slots){
+	struct history_store *store;
+	char path[HISTORY_PATH_LEN];
+	int slot;
+	int resolution;
+
+	if(make_dir(dir) != 0){
+		return NULL;
+	}
+	if((store = (struct history_store *)calloc(1, sizeof(struct history_store) + num_slots * sizeof(struct history_slot))) == NULL){
+		log_errno("spice_rack_history: history_open - Failed on Malloc");
+		return NULL;
+	}
+	snprintf(store->dir, sizeof(store->dir), "%s", dir);
+	store->num_slots = num_slots;
+	for(slot=1;slot<=num_slots;slot++){
+		store->slots[slot-1].chunk_fd = -1;
+		for(resolution=0;resolution<HISTORY_NUM_RESOLUTIONS;resolution++){
+			store->slots[slot-1].rollup_fd[resolution] = -1;
+		}
+	}
+	for(slot=1;slot<=num_slots;slot++){
+		slot_path(path, dir, slot, NULL);
+		if(make_dir(path) != 0 || load_newest_chunk(store, slot) != 0){
+			history_close(store);
+			return NULL;
+		}
+		for(resolution=HISTORY_MINUTE;resolution<HISTORY_NUM_RESOLUTIONS;resolution++){
+			if((store->slots[slot-1].rollup_fd[resolution] = open_rollup(dir, slot, resolution)) == -1){
+				history_close(store);
+				return NULL;
+			}
+		}
+	}
+	return store;
+}
+
+static int update_rollup(int fd, int resolution, time_t when, int32_t value){
+	struct history_rollup rollup;
+	int64_t bucket_start = when - (when % rollup_width[resolution]);
+	off_t offset = ((bucket_start / rollup_width[resolution]) % rollup_buckets[resolution]) * sizeof(struct history_rollup);
+
+	if(pread(fd, &rollup, sizeof(rollup), offset) != sizeof(rollup)){
+		memset(&rollup, 0, sizeof(rollup));
+	}
+	if(rollup.bucket_start != bucket_start || rollup.count == 0){
+		//Bucket belongs to an older lap of the ring, reuse it
+		rollup.bucket_start = bucket_start;
+		rollup.sum = 0;
+		rollup.min = INT32_MAX;
+		rollup.max = INT32_MIN;
+		rollup.count = 0;
+	}
+	rollup.sum = rollup.sum + value;
+	rollup.min = value < rollup.min ? value : rollup.min;
+	rollup.max = value > rollup.max ? value : rollup.max;
+	rollup.last = value;
+	rollup.count++;
+	if(pwrite(fd, &rollup, sizeof(rollup), offset) != sizeof(rollup)){
+		log_message(LOG_DEBUG, "spice_rack_history: update_rollup - Failed to write %s rollup - %s\n", resolution_names[resolution], strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int history_append(struct history_store *store, int slot, time_t when, float grams){
+	struct history_slot *slot_state;
+	unsigned char sample[HISTORY_MAX_SAMPLE_LEN];
+	int32_t value = (int32_t)lrintf(grams * 100);
+	int sample_len;
+	int resolution;
+	int result = 0;
+
+	if(store == NULL || slot < 1 || slot > store->num_slots){
+		return -1;
+	}
+	slot_state = &store->slots[slot-1];
+	if(slot_state->have_chunk == 0 || slot_state->header.used + HISTORY_MAX_SAMPLE_LEN > HISTORY_CHUNK_BODY){
+		if(start_chunk(store, slot, when, value) != 0){
+			return -1;
+		}
+	}
+
+	sample_len = encode_varint(sample, when - slot_state->header.last_time);
+	sample_len = sample_len + encode_varint(sample + sample_len, (int64_t)value - slot_state->header.last_value);
+	if(pwrite(slot_state->chunk_fd, sample, sample_len, sizeof(slot_state->header) + slot_state->header.used) != sample_len){
+		log_message(LOG_DEBUG, "spice_rack_history: history_append - Failed to write sample - %s\n", strerror(errno));
+		return -1;
+	}
+	slot_state->header.used = slot_state->header.used + sample_len;
+	slot_state->header.count++;
+	slot_state->header.last_time = when;
+	slot_state->header.last_value = value;
+	if(write_chunk_header(slot_state) != 0){
+		result = -1;
+	}
+
+	for(resolution=HISTORY_MINUTE;resolution<HISTORY_NUM_RESOLUTIONS;resolution++){
+		if(update_rollup(slot_state->rollup_fd[resolution], resolution, when, value) != 0){
+			result = -1;
+		}
+	}
+	return result;
+}
+
+void history_close(struct history_store *store){
+	int slot;
+	int resolution;
+
+	if(store == NULL){
+		return;
+	}
+	for(slot=0;slot<store->num_slots;slot++){
+		if(store->slots[slot].have_chunk){
+			close(store->slots[slot].chunk_fd);
+		}
+		for(resolution=0;resolution<HISTORY_NUM_RESOLUTIONS;resolution++){
+			if(store->slots[slot].rollup_fd[resolution] != -1){
+				close(store->slots[slot].rollup_fd[resolution]);
+			}
+		}
+	}
+	free(store);
+}
+
+static int query_raw(const char *dir, int slot, time_t from, time_t to, struct history_point *points, int max_points){
+	unsigned char chunk[HISTORY_CHUNK_SIZE];
+	struct history_chunk_header *header = (struct history_chunk_header *)chunk;
+	char path[HISTORY_PATH_LEN];
+	uint32_t oldest;
+	uint32_t newest;
+	uint32_t seq;
+	int64_t time;
+	int64_t value;
+	int64_t delta;
+	size_t offset;
+	int len;
+	int fd;
+	int num_points = 0;
+	int ret;
+
+	ret = find_chunk_range(dir, slot, &oldest, &newest);
+	if(ret != 0){
+		return ret == 1 ? 0 : -1;
+	}
+	for(seq=oldest;seq<=newest && num_points<max_points;seq++){
+		chunk_path(path, dir, slot, seq);
+		if((fd = open(path, O_RDONLY)) == -1){
+			continue;
+		}
+		ret = pread(fd, chunk, sizeof(chunk), 0);
+		close(fd);
+		if(ret < (int)sizeof(struct history_chunk_header) || memcmp(header->magic, HISTORY_MAGIC, 4) != 0 ||
+		   header->used > HISTORY_CHUNK_BODY || header->used > ret - sizeof(struct history_chunk_header)){
+			continue;
+		}
+		//Header carries the chunk's time span so chunks outside the range are never decoded
+		if(header->last_time < from || header->base_time > to){
+			continue;
+		}
+		time = header->base_time;
+		value = header->base_value;
+		offset = sizeof(struct history_chunk_header);
+		while(offset < sizeof(struct history_chunk_header) + header->used && num_points < max_points){
+			if((len = decode_varint(chunk + offset, sizeof(chunk) - offset, &delta)) == -1){
+				break;
+			}
+			time = time + delta;
+			offset = offset + len;
+			if((len = decode_varint(chunk + offset, sizeof(chunk) - offset, &delta)) == -1){
+				break;
+			}
+			value = value + delta;
+			offset = offset + len;
+			if(time < from || time > to){
+				continue;
+			}
+			points[num_points].time = time;
+			points[num_points].min = value / 100.0;
+			points[num_points].max = value / 100.0;
+			points[num_points].avg = value / 100.0;
+			points[num_points].last = value / 100.0;
+			points[num_points].count = 1;
+			num_points++;
+		}
+	}
+	return num_points;
+}
+
+static int query_rollup(const char *dir, int slot, int resolution, time_t from, time_t to, struct history_point *points, int max_points){
+	struct history_rollup *rollups;
+	char path[HISTORY_PATH_LEN];
+	char file_name[16];
+	int64_t width = rollup_width[resolution];
+	int64_t capacity = rollup_buckets[resolution];
+	int64_t first = from - (from % width);
+	int64_t last = to - (to % width);
+	int64_t num_buckets;
+	int64_t start_index;
+	int64_t first_part;
+	int64_t i;
+	int num_points = 0;
+	int fd;
+
+	//Anything older than one lap of the ring has been overwritten. Clamped before taking last - first, which
+	//a far off from would overflow.
+	if(first < last - (capacity - 1) * width){
+		first = last - (capacity - 1) * width;
+	}
+	if(last < first){
+		return 0;
+	}
+	num_buckets = (last - first) / width + 1;
+
+	snprintf(file_name, sizeof(file_name), "%s.rrd", resolution_names[resolution]);
+	slot_path(path, dir, slot, file_name);
+	if((fd = open(path, O_RDONLY)) == -1){
+		log_message(LOG_DEBUG, "spice_rack_history: query_rollup - Failed to open %s - %s\n", path, strerror(errno));
+		return -1;
+	}
+	if((rollups = (struct history_rollup *)calloc(num_buckets, sizeof(struct history_rollup))) == NULL){
+		log_message(LOG_DEBUG, "spice_rack_history: query_rollup - Failed on Malloc - %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	//The requested buckets are contiguous in the ring, so at most two reads are needed
+	start_index = (first / width) % capacity;
+	first_part = num_buckets < capacity - start_index ? num_buckets : capacity - start_index;
+	if(pread(fd, rollups, first_part * sizeof(struct history_rollup), start_index * sizeof(struct history_rollup)) == -1 ||
+	   (num_buckets > first_part && pread(fd, rollups + first_part, (num_buckets - first_part) * sizeof(struct history_rollup), 0) == -1)){
+		log_message(LOG_DEBUG, "spice_rack_history: query_rollup - Failed to read %s - %s\n", path, strerror(errno));
+		free(rollups);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	for(i=0;i<num_buckets && num_points<max_points;i++){
+		if(rollups[i].count == 0 || rollups[i].bucket_start != first + i * width){
+			continue;
+		}
+		points[num_points].time = rollups[i].bucket_start;
+		points[num_points].min = rollups[i].min / 100.0;
+		points[num_points].max = rollups[i].max / 100.0;
+		points[num_points].avg = (rollups[i].sum / (double)rollups[i].count) / 100.0;
+		points[num_points].last = rollups[i].last / 100.0;
+		points[num_points].count = rollups[i].count;
+		num_points++;
+	}
+	free(rollups);
+	return num_points;
+}
+
+int history_query(const char *dir, int slot, enum history_resolution resolution, time_t from, time_t to, struct history_point *points, int max_points){
+	if(slot < 1 || max_points <= 0 || resolution < HISTORY_RAW || resolution >= HISTORY_NUM_RESOLUTIONS){
+		return -1;
+	}
+	//Nothing is stored before 1970, and a negative time would index the rollup rings from before their start
+	if(to < 0){
+		return 0;
+	}
+	if(from < 0){
+		from = 0;
+	}
+	if(resolution == HISTORY_RAW){
+		return query_raw(dir, slot, from, to, points, max_points);
+	}
+	return query_rollup(dir, slot, resolution, from, to, points, max_points);
+}
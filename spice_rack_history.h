@@ -0,0 +1,69 @@
+#ifndef SPICE_RACK_HISTORY_H
+#define SPICE_RACK_HISTORY_H
+
+#include <stdint.h>
+#include <time.h>
+
+//On-disk layout, one directory per slot under the history directory:
+//  slotN/raw-<seq>.chk  fixed size chunks of delta encoded (time, centigrams) samples
+//  slotN/minute.rrd     ring of per-minute rollups (also hour.rrd and day.rrd)
+//Chunks beyond HISTORY_RAW_CHUNKS are deleted and the rollup rings overwrite their oldest buckets,
+//so the store never grows past a fixed size per slot.
+#define HISTORY_CHUNK_SIZE 4096
+#define HISTORY_RAW_CHUNKS 64
+#define HISTORY_MINUTE_BUCKETS 10080	//7 days
+#define HISTORY_HOUR_BUCKETS 2160	//90 days
+#define HISTORY_DAY_BUCKETS 1825	//5 years
+
+enum history_resolution{
+	HISTORY_RAW = 0,
+	HISTORY_MINUTE,
+	HISTORY_HOUR,
+	HISTORY_DAY,
+	HISTORY_NUM_RESOLUTIONS
+};
+
+struct history_chunk_header{
+	char magic[4];
+	uint16_t format;
+	uint16_t slot;
+	uint32_t seq;
+	uint32_t count;
+	uint32_t used;
+	int32_t base_value;
+	int64_t base_time;
+	int64_t last_time;
+	int32_t last_value;
+	uint32_t reserved;
+};
+
+struct history_rollup{
+	int64_t bucket_start;
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+	int32_t last;
+	uint32_t count;
+};
+
+struct history_point{
+	int64_t time;
+	float min;
+	float max;
+	float avg;
+	float last;
+	uint32_t count;
+};
+
+struct history_store;
+
+struct history_store *history_open(const char *dir, int num_slots);
+int history_append(struct history_store *store, int slot, time_t when, float grams);
+void history_close(struct history_store *store);
+
+//Stateless reader so other processes (aesdsocket_server) can serve range queries directly from disk.
+//Returns the number of points written or -1 on error.
+int history_query(const char *dir, int slot, enum history_resolution resolution, time_t from, time_t to, struct history_point *points, int max_points);
+int history_resolution_from_string(const char *name);
+
+#endif
@@ -0,0 +1,123 @@
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "spice_rack_io.h"
+
+int write_all(int fd, const void *buf, size_t len){
+	const char *next = buf;
+	ssize_t count;
+
+	while(len > 0){
+		count = write(fd, next, len);
+		if(count == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		next = next + count;
+		len = len - count;
+	}
+	return 0;
+}
+
+int send_all(int fd, const void *buf, size_t len){
+	const char *next = buf;
+	ssize_t count;
+
+	while(len > 0){
+		count = send(fd, next, len, MSG_NOSIGNAL);
+		if(count == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		next = next + count;
+		len = len - count;
+	}
+	return 0;
+}
+
+int send_all_timeout(int fd, const void *buf, size_t len, int timeout_ms){
+	struct pollfd poll_fd = {fd, POLLOUT, 0};
+	struct timespec last_progress;
+	struct timespec now;
+	const char *next = buf;
+	ssize_t count;
+	long remaining_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_progress);
+	while(len > 0){
+		count = send(fd, next, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(count >= 0){
+			next = next + count;
+			len = len - count;
+			clock_gettime(CLOCK_MONOTONIC, &last_progress);
+			continue;
+		}
+		if(errno == EINTR){
+			continue;
+		}
+		if(errno != EAGAIN && errno != EWOULDBLOCK){
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		remaining_ms = timeout_ms - (now.tv_sec - last_progress.tv_sec) * 1000 - (now.tv_nsec - last_progress.tv_nsec) / 1000000;
+		if(remaining_ms <= 0){
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if(poll(&poll_fd, 1, remaining_ms) == -1 && errno != EINTR){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+ssize_t recv_timeout(int fd, void *buf, size_t len, int timeout_ms){
+	struct pollfd poll_fd = {fd, POLLIN, 0};
+	ssize_t count;
+	int ret;
+
+	while((count = recv(fd, buf, len, MSG_DONTWAIT)) == -1){
+		if(errno == EINTR){
+			continue;
+		}
+		if(errno != EAGAIN && errno != EWOULDBLOCK){
+			return -1;
+		}
+		if((ret = poll(&poll_fd, 1, timeout_ms)) == 0){
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if(ret == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		//Woken by data, the peer closing or an error, all of which the next recv() returns
+		timeout_ms = 0;
+	}
+	return count;
+}
+
+ssize_t read_full(int fd, void *buf, size_t len){
+	char *next = buf;
+	size_t total = 0;
+	ssize_t count;
+
+	while(total < len && (count = read(fd, next + total, len - total)) != 0){
+		if(count == -1){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		total = total + count;
+	}
+	return total;
+}
@@ -0,0 +1,24 @@
+#ifndef SPICE_RACK_IO_H
+#define SPICE_RACK_IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//Read and write loops shared by the app, server and client. Each retries on EINTR and carries on after a
+//short transfer, so callers never see half a line written or a signal as an error.
+
+//Returns 0 once all len bytes are written, or -1 with errno set
+int write_all(int fd, const void *buf, size_t len);
+//write_all() for sockets. A peer that has gone away gives -1 with EPIPE rather than a SIGPIPE.
+int send_all(int fd, const void *buf, size_t len);
+//send_all() for a non-blocking socket, waiting in poll() whenever the socket's send buffer is full. Gives
+//-1 with ETIMEDOUT once the peer has taken nothing for timeout_ms, so a client that stops reading can't hold
+//the sender.
+int send_all_timeout(int fd, const void *buf, size_t len, int timeout_ms);
+//recv() on a non-blocking socket, waiting up to timeout_ms in poll() for something to arrive. Returns the
+//number of bytes read, 0 when the peer has closed, or -1 with errno set, ETIMEDOUT if nothing came.
+ssize_t recv_timeout(int fd, void *buf, size_t len, int timeout_ms);
+//Reads until len bytes or end of file. Returns the number of bytes read, or -1 with errno set.
+ssize_t read_full(int fd, void *buf, size_t len);
+
+#endif
@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "spice_rack_log.h"
+
+#define LOG_BURST 5
+#define LOG_WINDOW_SEC 10
+#define LOG_SITES 64
+#define LOG_RECORD_SIZE 512
+//Records per thread, a power of two. The background thread is woken by the first record after it has
+//caught up, so this only has to hold a burst.
+#define LOG_RING_SIZE 64
+
+enum ring_state{RING_FREE, RING_IN_USE, RING_CLOSED};
+
+struct log_record{
+	int priority;
+	int to_stderr;
+	char message[LOG_RECORD_SIZE];
+};
+
+//Single producer, single consumer. head is only moved by the thread that owns the ring and tail only by
+//the background thread.
+struct log_ring{
+	struct log_record records[LOG_RING_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_uint dropped;
+	atomic_int state;
+	struct log_ring *next;
+};
+
+//Call sites are told apart by their format string, which is a literal unique to each one. Updated
+//without a lock, so a burst that straddles a window can let a message or two more through.
+struct log_site{
+	_Atomic(const char *) format;
+	atomic_llong window_start;
+	atomic_uint count;
+	atomic_uint dropped;
+};
+
+atomic_int log_level = LOG_LEVEL_DEF;
+static struct log_site sites[LOG_SITES];
+//Every ring handed out so far. Rings are only ever pushed on the front, and a ring whose thread has exited
+//is drained and then handed to the next new thread, so the list never shrinks while anything reads it.
+static _Atomic(struct log_ring *) rings;
+static _Thread_local struct log_ring *thread_ring;
+static pthread_key_t ring_key;
+static int ring_key_ready;
+static atomic_int running;
+static atomic_int wake_pending;
+static int wake_fd = -1;
+static pthread_t drain_thread;
+
+static const struct{
+	const char *name;
+	int priority;
+} level_names[] = {
+	{"emerg", LOG_EMERG}, {"alert", LOG_ALERT}, {"crit", LOG_CRIT}, {"err", LOG_ERR}, {"error", LOG_ERR},
+	{"warning", LOG_WARNING}, {"warn", LOG_WARNING}, {"notice", LOG_NOTICE}, {"info", LOG_INFO}, {"debug", LOG_DEBUG}
+};
+
+//Returns 1 if the message should be logged, setting dropped to the number left out since the last one
+static int log_allowed(const char *format, unsigned int *dropped){
+	struct timespec now;
+	struct log_site *site = NULL;
+	const char *expected;
+	long long window_start;
+	unsigned int start = ((uintptr_t)format >> 4) % LOG_SITES;
+	unsigned int i;
+
+	for(i=0;i<LOG_SITES;i++){
+		site = &sites[(start + i) % LOG_SITES];
+		expected = NULL;
+		if(atomic_compare_exchange_strong(&site->format, &expected, format) || expected == format){
+			break;
+		}
+	}
+	//Every slot taken by other call sites, so this one goes unlimited
+	if(i == LOG_SITES){
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	window_start = atomic_load(&site->window_start);
+	if(now.tv_sec - window_start >= LOG_WINDOW_SEC && atomic_compare_exchange_strong(&site->window_start, &window_start, now.tv_sec)){
+		*dropped = atomic_exchange(&site->dropped, 0);
+		atomic_store(&site->count, 0);
+	}
+	if(atomic_fetch_add(&site->count, 1) < LOG_BURST){
+		return 1;
+	}
+	atomic_fetch_add(&site->dropped, 1);
+	return 0;
+}
+
+static void ring_release(void *ring){
+	atomic_store_explicit(&((struct log_ring *)ring)->state, RING_CLOSED, memory_order_release);
+}
+
+//The calling thread's ring, taking over one left by an exited thread before allocating a new one
+static struct log_ring *get_ring(void){
+	struct log_ring *ring;
+	int state;
+
+	if(thread_ring != NULL){
+		return thread_ring;
+	}
+	for(ring = atomic_load(&rings); ring != NULL; ring = ring->next){
+		state = RING_FREE;
+		if(atomic_compare_exchange_strong(&ring->state, &state, RING_IN_USE)){
+			break;
+		}
+	}
+	if(ring == NULL){
+		if((ring = (struct log_ring *)calloc(1, sizeof(struct log_ring))) == NULL){
+			return NULL;
+		}
+		atomic_init(&ring->state, RING_IN_USE);
+		ring->next = atomic_load(&rings);
+		while(atomic_compare_exchange_weak(&rings, &ring->next, ring) == 0);
+	}
+	pthread_setspecific(ring_key, ring);
+	thread_ring = ring;
+	return ring;
+}
+
+static void log_output(const struct log_record *record){
+	if(record->to_stderr == 1){
+		fprintf(stderr, "%s\n", record->message);
+	}
+	syslog(record->priority, "%s", record->message);
+}
+
+static void log_vsubmit(int priority, const char *error, const char *format, va_list args){
+	struct log_record local;
+	struct log_record *record = &local;
+	struct log_ring *ring = NULL;
+	unsigned int dropped = 0;
+	unsigned int head = 0;
+	uint64_t wake = 1;
+	int len;
+
+	if(priority <= LOG_WARNING && log_allowed(format, &dropped) == 0){
+		return;
+	}
+	if(atomic_load_explicit(&running, memory_order_acquire) == 1 && (ring = get_ring()) != NULL){
+		head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_SIZE){
+			atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+			return;
+		}
+		record = &ring->records[head % LOG_RING_SIZE];
+	}
+	record->priority = priority;
+	record->to_stderr = error != NULL;
+	len = vsnprintf(record->message, LOG_RECORD_SIZE, format, args);
+	if(len < 0){
+		len = 0;
+		record->message[0] = '\0';
+	}
+	else if(len >= LOG_RECORD_SIZE){
+		len = LOG_RECORD_SIZE - 1;
+	}
+	//Most format strings end in a newline, which syslog drops anyway
+	if(len > 0 && record->message[len - 1] == '\n'){
+		record->message[--len] = '\0';
+	}
+	if(error != NULL && len < LOG_RECORD_SIZE - 1){
+		len = len + snprintf(record->message + len, LOG_RECORD_SIZE - len, " - %s", error);
+	}
+	if(dropped > 0 && len < LOG_RECORD_SIZE - 1){
+		snprintf(record->message + len, LOG_RECORD_SIZE - len, " (%u more like this not logged)", dropped);
+	}
+
+	if(ring == NULL){
+		log_output(record);
+		return;
+	}
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	//Only the first record after the background thread caught up costs a write
+	if(atomic_exchange(&wake_pending, 1) == 0 && write(wake_fd, &wake, sizeof(wake)) == -1){
+		atomic_store(&wake_pending, 0);
+	}
+}
+
+void log_submit(int priority, const char *format, ...){
+	va_list args;
+
+	va_start(args, format);
+	log_vsubmit(priority, NULL, format, args);
+	va_end(args);
+}
+
+void log_errno(const char *format, ...){
+	int saved_errno = errno;
+	va_list args;
+
+	if(LOG_ERR <= atomic_load_explicit(&log_level, memory_order_relaxed)){
+		va_start(args, format);
+		log_vsubmit(LOG_ERR, strerror(saved_errno), format, args);
+		va_end(args);
+	}
+	errno = saved_errno;
+}
+
+int log_set_level(const char *name){
+	size_t i;
+
+	for(i=0;i<sizeof(level_names)/sizeof(level_names[0]);i++){
+		if(strcasecmp(name, level_names[i].name) == 0){
+			atomic_store_explicit(&log_level, level_names[i].priority, memory_order_relaxed);
+			return 0;
+		}
+	}
+	log_message(LOG_WARNING, "spice_rack_log: log_set_level - Unknown log_level %s, keeping the current level\n", name);
+	return -1;
+}
+
+static void drain_rings(void){
+	struct log_ring *ring;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int dropped;
+	int state;
+
+	for(ring = atomic_load(&rings); ring != NULL; ring = ring->next){
+		//Read before draining, so everything a closed ring's thread wrote is drained before it's reused
+		state = atomic_load_explicit(&ring->state, memory_order_acquire);
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		while(tail != head){
+			log_output(&ring->records[tail % LOG_RING_SIZE]);
+			tail++;
+			atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		}
+		if((dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed)) > 0){
+			syslog(LOG_WARNING, "spice_rack_log: %u messages dropped while the log was backed up\n", dropped);
+		}
+		if(state == RING_CLOSED){
+			atomic_store_explicit(&ring->state, RING_FREE, memory_order_release);
+		}
+	}
+}
+
+static void *log_drain(void *arg){
+	struct pollfd poll_fd = {wake_fd, POLLIN, 0};
+	uint64_t count;
+
+	while(atomic_load_explicit(&running, memory_order_acquire) == 1){
+		if(poll(&poll_fd, 1, -1) == -1 && errno != EINTR){
+			break;
+		}
+		if(read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN){
+			break;
+		}
+		atomic_store(&wake_pending, 0);
+		drain_rings();
+	}
+	drain_rings();
+	return NULL;
+}
+
+int log_start(void){
+	int ret;
+
+	if(ring_key_ready == 0){
+		if((ret = pthread_key_create(&ring_key, ring_release)) != 0){
+			syslog(LOG_ERR, "spice_rack_log: log_start - Failed to create thread key - %s\n", strerror(ret));
+			return -1;
+		}
+		ring_key_ready = 1;
+		//So an error logged just before exit() or a return from main is still written
+		atexit(log_stop);
+	}
+	if((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1){
+		syslog(LOG_ERR, "spice_rack_log: log_start - eventfd() failed - %s\n", strerror(errno));
+		return -1;
+	}
+	atomic_store(&running, 1);
+	if((ret = pthread_create(&drain_thread, NULL, log_drain, NULL)) != 0){
+		syslog(LOG_ERR, "spice_rack_log: log_start - Failed to start log thread - %s\n", strerror(ret));
+		atomic_store(&running, 0);
+		close(wake_fd);
+		wake_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+//Rings are left allocated, as a thread the caller hasn't joined may still hold one
+void log_stop(void){
+	uint64_t wake = 1;
+
+	if(atomic_exchange(&running, 0) == 0){
+		return;
+	}
+	if(write(wake_fd, &wake, sizeof(wake)) == -1){
+		syslog(LOG_ERR, "spice_rack_log: log_stop - Failed to wake log thread - %s\n", strerror(errno));
+	}
+	pthread_join(drain_thread, NULL);
+	close(wake_fd);
+	wake_fd = -1;
+}
@@ -0,0 +1,42 @@
+#ifndef SPICE_RACK_LOG_H
+#define SPICE_RACK_LOG_H
+
+#include <stdatomic.h>
+#include <syslog.h>
+
+//Logging shared by the app, server and client. Messages are filtered by syslog priority twice: anything
+//less important than LOG_COMPILE_LEVEL is compiled out, and anything less important than the runtime
+//level costs one relaxed load. Once log_start() has run, a message is formatted into a ring owned by the
+//calling thread and a background thread hands it to syslog, so logging never waits on syslog, a lock or
+//another thread. A full ring drops the message and the drops are reported. Before log_start() and after
+//log_stop() messages go straight to syslog.
+
+//Build with e.g. make LOG_LEVEL=LOG_INFO to leave out every LOG_DEBUG message
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+#define LOG_LEVEL_DEF LOG_INFO
+
+extern atomic_int log_level;
+
+#define log_message(priority, ...) do{ \
+	if((priority) <= LOG_COMPILE_LEVEL && (priority) <= atomic_load_explicit(&log_level, memory_order_relaxed)){ \
+		log_submit(priority, __VA_ARGS__); \
+	} \
+}while(0)
+
+//Use log_message(), which filters before the arguments are evaluated. Messages at LOG_WARNING or more
+//important are limited to LOG_BURST per call site every LOG_WINDOW_SEC, so an error that repeats every
+//poll can't flood the log. The next one after a quiet window says how many were left out.
+void log_submit(int priority, const char *format, ...) __attribute__((format(printf, 2, 3)));
+//Logs the message followed by strerror(errno) at LOG_ERR to syslog and stderr, leaving errno as it was
+void log_errno(const char *format, ...) __attribute__((format(printf, 1, 2)));
+//Sets the runtime level from a syslog priority name: "err", "warning", "notice", "info", "debug" and so
+//on. An unknown name is logged and leaves the level as it was. Returns 0 or -1 if the name is unknown.
+int log_set_level(const char *name);
+//Starts the background thread. Call after daemonize(), as the thread doesn't survive a fork. Returns 0 or -1.
+int log_start(void);
+//Writes out everything queued and stops the background thread. Also runs at exit.
+void log_stop(void);
+
+#endif
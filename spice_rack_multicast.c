@@ -0,0 +1,184 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include "spice_rack_multicast.h"
+
+static void put_u16(char *dest, uint16_t value){
+	value = htons(value);
+	memcpy(dest, &value, 2);
+}
+
+static void put_u32(char *dest, uint32_t value){
+	value = htonl(value);
+	memcpy(dest, &value, 4);
+}
+
+static void put_u64(char *dest, uint64_t value){
+	put_u32(dest, value >> 32);
+	put_u32(dest + 4, (uint32_t)value);
+}
+
+static void put_f32(char *dest, float value){
+	uint32_t bits;
+
+	memcpy(&bits, &value, 4);
+	put_u32(dest, bits);
+}
+
+static uint16_t get_u16(const char *src){
+	uint16_t value;
+
+	memcpy(&value, src, 2);
+	return ntohs(value);
+}
+
+static uint32_t get_u32(const char *src){
+	uint32_t value;
+
+	memcpy(&value, src, 4);
+	return ntohl(value);
+}
+
+static uint64_t get_u64(const char *src){
+	return (uint64_t)get_u32(src) << 32 | get_u32(src + 4);
+}
+
+static float get_f32(const char *src){
+	uint32_t bits = get_u32(src);
+	float value;
+
+	memcpy(&value, &bits, 4);
+	return value;
+}
+
+//Only what a datagram carries counts, so a change in adc alone sends no record
+static int slot_changed(const struct inventory_slot *slot, const struct inventory_slot *old){
+	return slot->grams != old->grams || slot->quantity != old->quantity || slot->days_left != old->days_left ||
+		slot->low_stock != old->low_stock || strcmp(slot->name, old->name) != 0 || strcmp(slot->unit, old->unit) != 0;
+}
+
+int multicast_encode(const struct inventory_snapshot *snapshot, const struct inventory_snapshot *previous, uint32_t sequence, char *buf, size_t buf_len){
+	const struct inventory_slot *slot;
+	const struct inventory_slot *old;
+	char *record;
+	int num_records = 0;
+	int flags;
+	int i;
+
+	if(buf_len < MULTICAST_HEADER_SIZE + (size_t)snapshot->num_slots * MULTICAST_RECORD_SIZE){
+		return -1;
+	}
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		old = previous != NULL && i < previous->num_slots ? &previous->slots[i] : NULL;
+		if(previous != NULL && old != NULL && slot_changed(slot, old) == 0){
+			continue;
+		}
+		flags = slot->low_stock == 1 ? MULTICAST_FLAG_LOW_STOCK : 0;
+		if(previous != NULL && (old == NULL || strcmp(slot->name, old->name) != 0 || strcmp(slot->unit, old->unit) != 0)){
+			flags = flags | MULTICAST_FLAG_RENAMED;
+		}
+		record = buf + MULTICAST_HEADER_SIZE + num_records * MULTICAST_RECORD_SIZE;
+		put_u16(record, slot->slot);
+		record[2] = flags;
+		record[3] = 0;
+		put_f32(record + 4, slot->grams);
+		put_f32(record + 8, slot->quantity);
+		put_f32(record + 12, slot->days_left);
+		num_records++;
+	}
+	memcpy(buf, MULTICAST_MAGIC, 4);
+	buf[4] = MULTICAST_PROTOCOL;
+	buf[5] = previous != NULL ? MULTICAST_UPDATE : MULTICAST_HEARTBEAT;
+	buf[6] = snapshot->health;
+	buf[7] = snapshot->faults;
+	put_u32(buf + 8, sequence);
+	put_u16(buf + 12, snapshot->num_slots);
+	put_u16(buf + 14, num_records);
+	put_u64(buf + 16, snapshot->version);
+	put_u64(buf + 24, previous != NULL ? previous->version : 0);
+	return MULTICAST_HEADER_SIZE + num_records * MULTICAST_RECORD_SIZE;
+}
+
+void multicast_listener_reset(struct multicast_listener *listener, const struct inventory_snapshot *snapshot){
+	listener->snapshot = *snapshot;
+	listener->have_snapshot = 1;
+}
+
+//Applies an update's records. Returns MULTICAST_APPLIED, or MULTICAST_NEED_SNAPSHOT if one can't be,
+//leaving the snapshot part updated, which the fetch replaces anyway.
+static int apply_records(struct multicast_listener *listener, const char *buf, int num_records){
+	struct inventory_slot *slot;
+	const char *record;
+	int slot_num;
+	int flags;
+	int i;
+	int j;
+
+	for(i=0;i<num_records;i++){
+		record = buf + MULTICAST_HEADER_SIZE + i * MULTICAST_RECORD_SIZE;
+		slot_num = get_u16(record);
+		flags = (unsigned char)record[2];
+		for(j=0;j<listener->snapshot.num_slots && listener->snapshot.slots[j].slot != slot_num;j++);
+		if(j == listener->snapshot.num_slots || (flags & MULTICAST_FLAG_RENAMED) != 0){
+			return MULTICAST_NEED_SNAPSHOT;
+		}
+		slot = &listener->snapshot.slots[j];
+		slot->low_stock = (flags & MULTICAST_FLAG_LOW_STOCK) != 0;
+		slot->grams = get_f32(record + 4);
+		slot->quantity = get_f32(record + 8);
+		slot->days_left = get_f32(record + 12);
+	}
+	return MULTICAST_APPLIED;
+}
+
+int multicast_listener_apply(struct multicast_listener *listener, const char *buf, size_t len){
+	uint32_t sequence;
+	uint64_t version;
+	uint64_t base_version;
+	int num_slots;
+	int num_records;
+	int type;
+
+	if(len < MULTICAST_HEADER_SIZE || memcmp(buf, MULTICAST_MAGIC, 4) != 0 || buf[4] != MULTICAST_PROTOCOL){
+		return -1;
+	}
+	type = buf[5];
+	num_slots = get_u16(buf + 12);
+	num_records = get_u16(buf + 14);
+	if((type != MULTICAST_UPDATE && type != MULTICAST_HEARTBEAT) || num_slots > SNAPSHOT_MAX_SLOTS || num_records > num_slots ||
+		len < MULTICAST_HEADER_SIZE + (size_t)num_records * MULTICAST_RECORD_SIZE){
+		return -1;
+	}
+	//A jump back is the server restarting, and isn't counted
+	sequence = get_u32(buf + 8);
+	if(listener->have_sequence == 1 && sequence - listener->sequence - 1 < 0x80000000U){
+		listener->lost = listener->lost + (sequence - listener->sequence - 1);
+	}
+	listener->sequence = sequence;
+	listener->have_sequence = 1;
+
+	version = get_u64(buf + 16);
+	base_version = get_u64(buf + 24);
+	if(listener->have_snapshot == 0){
+		return MULTICAST_NEED_SNAPSHOT;
+	}
+	//A heartbeat for any other version means something was missed
+	if(type == MULTICAST_HEARTBEAT){
+		return version == listener->snapshot.version ? MULTICAST_CURRENT : MULTICAST_NEED_SNAPSHOT;
+	}
+	//The app never hands out a version lower than one it sent before, even after a restart that lost its
+	//published snapshot, so an update that isn't newer is a repeat or arrived late
+	if(version <= listener->snapshot.version){
+		return MULTICAST_CURRENT;
+	}
+	if(base_version != listener->snapshot.version || num_slots != listener->snapshot.num_slots){
+		return MULTICAST_NEED_SNAPSHOT;
+	}
+	if(apply_records(listener, buf, num_records) != MULTICAST_APPLIED){
+		return MULTICAST_NEED_SNAPSHOT;
+	}
+	listener->snapshot.version = version;
+	listener->snapshot.health = (unsigned char)buf[6];
+	listener->snapshot.faults = (unsigned char)buf[7];
+	return MULTICAST_APPLIED;
+}
@@ -0,0 +1,61 @@
+#ifndef SPICE_RACK_MULTICAST_H
+#define SPICE_RACK_MULTICAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "spice_rack_snapshot.h"
+
+//Inventory updates multicast by aesdsocket_server, so any number of displays on the LAN follow the rack
+//for the cost of one datagram per change. An update carries only the slots that changed since the version
+//before it. A heartbeat carries every slot and goes out every multicast_heartbeat_sec, so a listener that
+//missed something finds out even when nothing is changing. Names and units aren't sent: a listener fetches
+//a full snapshot over TCP (GET /inventory?format=binary) when it starts and whenever the updates it has
+//stop following on from what it holds.
+//
+//Network byte order, as listeners needn't be on the board:
+//  header  "SRMC", u8 protocol, u8 type, u8 health, u8 faults, u32 sequence,
+//          u16 num_slots, u16 num_records, u64 version, u64 base_version          32 bytes
+//  record  u16 slot, u8 flags, u8 reserved, f32 grams, f32 quantity,
+//          f32 days_left                                                          16 bytes each
+//sequence counts every datagram the server sends. base_version is the version an update applies to, 0 in
+//a heartbeat.
+#define MULTICAST_MAGIC "SRMC"
+#define MULTICAST_PROTOCOL 1
+#define MULTICAST_HEADER_SIZE 32
+#define MULTICAST_RECORD_SIZE 16
+#define MULTICAST_MAX_DATAGRAM (MULTICAST_HEADER_SIZE + SNAPSHOT_MAX_SLOTS * MULTICAST_RECORD_SIZE)
+
+#define MULTICAST_UPDATE 1
+#define MULTICAST_HEARTBEAT 2
+
+#define MULTICAST_FLAG_LOW_STOCK 0x1
+//The slot's name or unit changed, which the datagram can't carry
+#define MULTICAST_FLAG_RENAMED 0x2
+
+//What a listener should do after a datagram
+#define MULTICAST_APPLIED 0
+//Nothing new: a heartbeat for the version held, or an update older than the version held
+#define MULTICAST_CURRENT 1
+//Fetch a full snapshot over TCP and pass it to multicast_listener_reset()
+#define MULTICAST_NEED_SNAPSHOT 2
+
+//A listener's copy of the inventory and where it is in the stream
+struct multicast_listener{
+	int have_snapshot;
+	int have_sequence;
+	uint32_t sequence;
+	//Datagrams skipped over in the sequence, whether or not they mattered
+	unsigned long lost;
+	struct inventory_snapshot snapshot;
+};
+
+//Encodes snapshot as an update against previous, or as a heartbeat when previous is NULL. Returns the
+//datagram's length or -1 if buf is too small.
+int multicast_encode(const struct inventory_snapshot *snapshot, const struct inventory_snapshot *previous, uint32_t sequence, char *buf, size_t buf_len);
+//Takes a full snapshot fetched over TCP as the listener's state
+void multicast_listener_reset(struct multicast_listener *listener, const struct inventory_snapshot *snapshot);
+//Applies a received datagram to the listener's snapshot. Returns MULTICAST_APPLIED, MULTICAST_CURRENT,
+//MULTICAST_NEED_SNAPSHOT, or -1 if it isn't a valid datagram.
+int multicast_listener_apply(struct multicast_listener *listener, const char *buf, size_t len);
+
+#endif
@@ -0,0 +1,263 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include "spice_rack_log.h"
+#include "spice_rack_persist.h"
+#include "spice_rack_trace.h"
+
+struct persist_entry{
+	int pending;
+	struct persist_record record;
+};
+
+struct persist_queue{
+	pthread_mutex_t lock;
+	//Signalled when work arrives, a sync is requested or the queue is stopping
+	pthread_cond_t work;
+	//Signalled after each batch is written
+	pthread_cond_t flushed;
+	pthread_t thread;
+	struct persist_ops ops;
+	int num_racks;
+	int num_slots;
+	int flush_ms;
+	int stopping;
+	int sync_waiters;
+	int num_pending;
+	//When the oldest pending work arrived
+	struct timespec oldest;
+	//Bumped for every submit. flushed_gen is the last generation fully written.
+	unsigned long submitted_gen;
+	unsigned long flushed_gen;
+	struct persist_stats stats;
+	int *publish_pending;
+	//num_racks * num_slots entries, indexed by rack then slot
+	struct persist_entry *entries;
+	//Writer's copy of a batch, so the lock isn't held during I/O
+	struct persist_entry *batch;
+	int *batch_publish;
+};
+
+static void add_ms(struct timespec *time, int ms){
+	time->tv_sec = time->tv_sec + ms / 1000;
+	time->tv_nsec = time->tv_nsec + (long)(ms % 1000) * 1000000;
+	if(time->tv_nsec >= 1000000000){
+		time->tv_sec++;
+		time->tv_nsec = time->tv_nsec - 1000000000;
+	}
+}
+
+//Called with the lock held whenever new work arrives
+static void mark_pending(struct persist_queue *queue){
+	if(queue->num_pending == 0){
+		clock_gettime(CLOCK_MONOTONIC, &queue->oldest);
+	}
+	queue->num_pending++;
+	queue->submitted_gen++;
+	pthread_cond_signal(&queue->work);
+}
+
+static void write_batch(struct persist_queue *queue, int total){
+	struct persist_entry *entry;
+	unsigned long written = 0;
+	unsigned long failed = 0;
+	uint64_t span_start;
+	int rack;
+	int slot;
+
+	TRACE_BEGIN(persist, span_start);
+	for(rack=0;rack<queue->num_racks;rack++){
+		for(slot=0;slot<queue->num_slots;slot++){
+			entry = &queue->batch[rack * queue->num_slots + slot];
+			if(entry->pending == 0){
+				continue;
+			}
+			if(queue->ops.write_record(&entry->record, queue->ops.arg) == 0){
+				written++;
+			}
+			else{
+				failed++;
+				log_message(LOG_DEBUG, "spice_rack_persist: write_batch - Failed to write rack%i slot%i\n", rack + 1, slot);
+			}
+		}
+		if(queue->batch_publish[rack] == 1 && queue->ops.publish(rack, queue->ops.arg) != 0){
+			log_message(LOG_DEBUG, "spice_rack_persist: write_batch - Failed to publish rack%i\n", rack + 1);
+		}
+	}
+	TRACE_END(persist, span_start, "records", written, "failed", failed);
+	pthread_mutex_lock(&queue->lock);
+	queue->stats.written = queue->stats.written + written;
+	queue->stats.failed = queue->stats.failed + failed;
+	queue->stats.batches++;
+	pthread_mutex_unlock(&queue->lock);
+	log_message(LOG_DEBUG, "spice_rack_persist: write_batch - Wrote %i entries\n", total);
+}
+
+static void *persist_routine(void *arg){
+	struct persist_queue *queue = (struct persist_queue *)arg;
+	struct timespec deadline;
+	unsigned long batch_gen;
+	int total;
+	int result;
+
+	pthread_mutex_lock(&queue->lock);
+	while(1){
+		while(queue->num_pending == 0 && queue->stopping == 0){
+			pthread_cond_wait(&queue->work, &queue->lock);
+		}
+		if(queue->num_pending == 0 && queue->stopping == 1){
+			break;
+		}
+		//Give more records a chance to arrive and coalesce, unless someone is waiting on them
+		deadline = queue->oldest;
+		add_ms(&deadline, queue->flush_ms);
+		result = 0;
+		while(queue->stopping == 0 && queue->sync_waiters == 0 && result != ETIMEDOUT){
+			result = pthread_cond_timedwait(&queue->work, &queue->lock, &deadline);
+		}
+
+		//Take the whole table as one batch
+		memcpy(queue->batch, queue->entries, queue->num_racks * queue->num_slots * sizeof(struct persist_entry));
+		memcpy(queue->batch_publish, queue->publish_pending, queue->num_racks * sizeof(int));
+		memset(queue->entries, 0, queue->num_racks * queue->num_slots * sizeof(struct persist_entry));
+		memset(queue->publish_pending, 0, queue->num_racks * sizeof(int));
+		total = queue->num_pending;
+		queue->num_pending = 0;
+		batch_gen = queue->submitted_gen;
+		pthread_mutex_unlock(&queue->lock);
+
+		write_batch(queue, total);
+
+		pthread_mutex_lock(&queue->lock);
+		queue->flushed_gen = batch_gen;
+		pthread_cond_broadcast(&queue->flushed);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return NULL;
+}
+
+struct persist_queue *persist_start(int num_racks, int num_slots, int flush_ms, const struct persist_ops *ops){
+	struct persist_queue *queue;
+	pthread_condattr_t cond_attr;
+	int result;
+
+	if((queue = (struct persist_queue *)calloc(1, sizeof(struct persist_queue))) == NULL){
+		log_message(LOG_DEBUG, "spice_rack_persist: persist_start - Failed on Malloc - %s\n", strerror(errno));
+		return NULL;
+	}
+	queue->num_racks = num_racks;
+	queue->num_slots = num_slots;
+	queue->flush_ms = flush_ms;
+	queue->ops = *ops;
+	queue->entries = (struct persist_entry *)calloc(num_racks * num_slots, sizeof(struct persist_entry));
+	queue->batch = (struct persist_entry *)calloc(num_racks * num_slots, sizeof(struct persist_entry));
+	queue->publish_pending = (int *)calloc(num_racks, sizeof(int));
+	queue->batch_publish = (int *)calloc(num_racks, sizeof(int));
+	if(queue->entries == NULL || queue->batch == NULL || queue->publish_pending == NULL || queue->batch_publish == NULL){
+		log_message(LOG_DEBUG, "spice_rack_persist: persist_start - Failed on Malloc - %s\n", strerror(errno));
+		goto fail;
+	}
+	pthread_mutex_init(&queue->lock, NULL);
+	//The flush deadline is on the monotonic clock so a clock change can't stall or rush it
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&queue->work, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+	pthread_cond_init(&queue->flushed, NULL);
+	if((result = pthread_create(&queue->thread, NULL, persist_routine, queue)) != 0){
+		log_message(LOG_DEBUG, "spice_rack_persist: persist_start - Unable to create writer thread - %s\n", strerror(result));
+		pthread_cond_destroy(&queue->flushed);
+		pthread_cond_destroy(&queue->work);
+		pthread_mutex_destroy(&queue->lock);
+		goto fail;
+	}
+	return queue;
+
+fail:
+	free(queue->entries);
+	free(queue->batch);
+	free(queue->publish_pending);
+	free(queue->batch_publish);
+	free(queue);
+	return NULL;
+}
+
+int persist_submit(struct persist_queue *queue, const struct persist_record *record){
+	struct persist_entry *entry;
+
+	if(record->rack < 0 || record->rack >= queue->num_racks || record->slot < 0 || record->slot >= queue->num_slots){
+		return -1;
+	}
+	entry = &queue->entries[record->rack * queue->num_slots + record->slot];
+	pthread_mutex_lock(&queue->lock);
+	queue->stats.submitted++;
+	if(entry->pending == 1){
+		//Only the latest value for a slot matters. It keeps the older record's place in the flush deadline.
+		queue->stats.coalesced++;
+		queue->submitted_gen++;
+	}
+	else{
+		entry->pending = 1;
+		mark_pending(queue);
+	}
+	entry->record = *record;
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
+
+void persist_request_publish(struct persist_queue *queue, int rack){
+	if(rack < 0 || rack >= queue->num_racks){
+		return;
+	}
+	pthread_mutex_lock(&queue->lock);
+	if(queue->publish_pending[rack] == 0){
+		queue->publish_pending[rack] = 1;
+		mark_pending(queue);
+	}
+	else{
+		queue->submitted_gen++;
+	}
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void persist_sync(struct persist_queue *queue){
+	unsigned long target;
+
+	pthread_mutex_lock(&queue->lock);
+	target = queue->submitted_gen;
+	queue->sync_waiters++;
+	pthread_cond_signal(&queue->work);
+	while(queue->flushed_gen < target){
+		pthread_cond_wait(&queue->flushed, &queue->lock);
+	}
+	queue->sync_waiters--;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void persist_get_stats(struct persist_queue *queue, struct persist_stats *stats){
+	pthread_mutex_lock(&queue->lock);
+	*stats = queue->stats;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void persist_stop(struct persist_queue *queue){
+	if(queue == NULL){
+		return;
+	}
+	pthread_mutex_lock(&queue->lock);
+	queue->stopping = 1;
+	pthread_cond_signal(&queue->work);
+	pthread_mutex_unlock(&queue->lock);
+	pthread_join(queue->thread, NULL);
+	pthread_cond_destroy(&queue->flushed);
+	pthread_cond_destroy(&queue->work);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue->entries);
+	free(queue->batch);
+	free(queue->publish_pending);
+	free(queue->batch_publish);
+	free(queue);
+}
@@ -0,0 +1,50 @@
+#ifndef SPICE_RACK_PERSIST_H
+#define SPICE_RACK_PERSIST_H
+
+//Background writer for measurement records and published files, so sensing never waits on flash.
+//Pending work is held in a table with one entry per rack and slot: a newer record for a slot replaces
+//the one still waiting, so the queue is bounded by the number of slots and never blocks a submitter.
+//Records are written once the oldest has waited flush_ms, which bounds what a power cut can lose.
+#define PERSIST_NAME_LEN 32
+#define PERSIST_ADC_LEN 16
+
+struct persist_record{
+	int rack;
+	int slot;
+	char name[PERSIST_NAME_LEN];
+	char adc[PERSIST_ADC_LEN];
+	float mass;
+	float tsps;
+};
+
+struct persist_ops{
+	//Writes one record, the latest submitted for its rack and slot
+	int (*write_record)(const struct persist_record *record, void *arg);
+	//Publishes the rack's files. Runs after the rack's records in the same batch are written.
+	int (*publish)(int rack, void *arg);
+	void *arg;
+};
+
+struct persist_stats{
+	unsigned long submitted;
+	//Records replaced by a newer one for the same slot before they were written
+	unsigned long coalesced;
+	unsigned long written;
+	unsigned long failed;
+	unsigned long batches;
+};
+
+struct persist_queue;
+
+//flush_ms of 0 writes as soon as the writer thread gets to it
+struct persist_queue *persist_start(int num_racks, int num_slots, int flush_ms, const struct persist_ops *ops);
+//Returns 0 or -1 if the record's rack or slot is out of range. Never blocks on I/O.
+int persist_submit(struct persist_queue *queue, const struct persist_record *record);
+void persist_request_publish(struct persist_queue *queue, int rack);
+//Blocks until everything submitted before the call has been written
+void persist_sync(struct persist_queue *queue);
+void persist_get_stats(struct persist_queue *queue, struct persist_stats *stats);
+//Writes whatever is pending, stops the thread and frees the queue
+void persist_stop(struct persist_queue *queue);
+
+#endif
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include "spice_rack_log.h"
+#include "spice_rack_process.h"
+
+int daemonize(void){
+	pid_t daemon_pid;
+	int null_fd;
+
+	log_message(LOG_DEBUG, "spice_rack_process: daemonize - Starting Daemon\n");
+	daemon_pid = fork();
+	if(daemon_pid == -1){
+		log_errno("spice_rack_process: daemonize - fork() failed");
+		return -1;
+	}
+	else if(daemon_pid != 0){
+		exit(EXIT_SUCCESS);
+	}
+	setsid();
+	if(chdir("/") != 0){
+		log_errno("spice_rack_process: daemonize - Unable to change to /");
+	}
+	if((null_fd = open("/dev/null", O_RDWR)) == -1){
+		log_errno("spice_rack_process: daemonize - Unable to open /dev/null");
+		return 0;
+	}
+	dup2(null_fd, STDIN_FILENO);
+	dup2(null_fd, STDOUT_FILENO);
+	dup2(null_fd, STDERR_FILENO);
+	if(null_fd > STDERR_FILENO){
+		close(null_fd);
+	}
+	return 0;
+}
+
+int signals_open(const int *signals, int num_signals){
+	sigset_t mask;
+	int signal_fd;
+	int ret;
+	int i;
+
+	sigemptyset(&mask);
+	for(i=0;i<num_signals;i++){
+		sigaddset(&mask, signals[i]);
+	}
+	if((ret = pthread_sigmask(SIG_BLOCK, &mask, NULL)) != 0){
+		errno = ret;
+		log_errno("spice_rack_process: signals_open - Unable to block signals");
+		return -1;
+	}
+	if((signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1){
+		log_errno("spice_rack_process: signals_open - signalfd() failed");
+		pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+		return -1;
+	}
+	return signal_fd;
+}
+
+int signals_read(int signal_fd){
+	struct signalfd_siginfo info;
+	ssize_t count;
+
+	while((count = read(signal_fd, &info, sizeof(info))) == -1 && errno == EINTR);
+	if(count == -1){
+		if(errno == EAGAIN){
+			return 0;
+		}
+		log_errno("spice_rack_process: signals_read - Reading signalfd failed");
+		return -1;
+	}
+	if(count != sizeof(info)){
+		return -1;
+	}
+	return info.ssi_signo;
+}
@@ -0,0 +1,15 @@
+#ifndef SPICE_RACK_PROCESS_H
+#define SPICE_RACK_PROCESS_H
+
+//Daemon start up and signal handling shared by the app, server and client
+
+//Forks into the background in a new session, leaving the parent to exit, and points stdin, stdout and
+//stderr at /dev/null. Returns 0 in the daemon or -1 if the fork failed.
+int daemonize(void);
+//Blocks signals and returns a non-blocking signalfd that they are read from instead, or -1. Call before
+//starting any thread so every thread inherits the blocked mask and none of them is ever interrupted.
+int signals_open(const int *signals, int num_signals);
+//Returns the next pending signal, 0 if none are pending or -1 on error
+int signals_read(int signal_fd);
+
+#endif
@@ -0,0 +1,120 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+#include "spice_rack_io.h"
+#include "spice_rack_log.h"
+#include "spice_rack_trace.h"
+#include "spice_rack_publish.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+//FNV-1a. Only used to notice identical contents, not for integrity.
+uint64_t publish_hash(const char *contents, size_t len){
+	uint64_t hash = FNV_OFFSET_BASIS;
+	size_t i;
+	for(i=0;i<len;i++){
+		hash = (hash ^ (unsigned char)contents[i]) * FNV_PRIME;
+	}
+	//0 is reserved for "nothing published yet"
+	return hash == 0 ? 1 : hash;
+}
+
+//Hash of what is already on disk, so a restart doesn't rewrite a file that is already current
+static uint64_t hash_existing_file(const char *file_name, size_t expected_len){
+	struct stat file_stat;
+	uint64_t hash = 0;
+	char *contents;
+	int fd;
+
+	fd = open(file_name, O_RDONLY);
+	if(fd == -1){
+		return 0;
+	}
+	if(fstat(fd, &file_stat) == 0 && (size_t)file_stat.st_size == expected_len && (contents = (char *)malloc(expected_len + 1)) != NULL){
+		if(read_full(fd, contents, expected_len) == (ssize_t)expected_len){
+			hash = publish_hash(contents, expected_len);
+		}
+		free(contents);
+	}
+	close(fd);
+	return hash;
+}
+
+//The rename is only durable once the directory entry itself is flushed
+static void sync_parent_dir(const char *file_name){
+	char dir_name[PATH_MAX];
+	char *slash;
+	int fd;
+
+	snprintf(dir_name, sizeof(dir_name), "%s", file_name);
+	slash = strrchr(dir_name, '/');
+	if(slash == NULL){
+		snprintf(dir_name, sizeof(dir_name), ".");
+	}
+	else if(slash == dir_name){
+		slash[1] = '\0';
+	}
+	else{
+		*slash = '\0';
+	}
+	fd = open(dir_name, O_RDONLY | O_DIRECTORY);
+	if(fd == -1){
+		return;
+	}
+	if(fsync(fd) != 0){
+		log_message(LOG_DEBUG, "spice_rack_publish: sync_parent_dir - Failed to sync %s - %s\n", dir_name, strerror(errno));
+	}
+	close(fd);
+}
+
+int publish_file(struct published_file *file, const char *contents, size_t len){
+	char tmp_name[PATH_MAX];
+	uint64_t hash;
+	uint64_t span_start;
+	int fd;
+
+	hash = publish_hash(contents, len);
+	if(file->hash == 0){
+		file->hash = hash_existing_file(file->file_name, len);
+	}
+	if(hash == file->hash){
+		return 0;
+	}
+	TRACE_BEGIN(publish, span_start);
+
+	if(snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file->file_name) >= (int)sizeof(tmp_name)){
+		log_message(LOG_DEBUG, "spice_rack_publish: publish_file - File name too long - %s\n", file->file_name);
+		return -1;
+	}
+	fd = open(tmp_name, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+	if(fd == -1){
+		log_errno("spice_rack_publish: publish_file - Failed to Open %s", tmp_name);
+		return -1;
+	}
+	if(write_all(fd, contents, len) != 0 || fdatasync(fd) != 0){
+		log_errno("spice_rack_publish: publish_file - Failed to Write %s", tmp_name);
+		close(fd);
+		unlink(tmp_name);
+		return -1;
+	}
+	close(fd);
+	if(rename(tmp_name, file->file_name) != 0){
+		log_errno("spice_rack_publish: publish_file - Failed to Rename %s", tmp_name);
+		unlink(tmp_name);
+		return -1;
+	}
+	sync_parent_dir(file->file_name);
+
+	file->hash = hash;
+	file->version++;
+	TRACE_END(publish, span_start, "bytes", len, "version", file->version);
+	return 1;
+}
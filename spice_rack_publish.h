@@ -0,0 +1,23 @@
+#ifndef SPICE_RACK_PUBLISH_H
+#define SPICE_RACK_PUBLISH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//A file that readers (the socket server, scripts) open by name and that must never be seen half written.
+//Contents are written to "<file_name>.tmp", flushed with fdatasync and renamed over file_name, so a
+//reader sees either the previous or the new contents even across a power cut.
+struct published_file{
+	const char *file_name;
+	//Hash of the last contents published, 0 until the first publish
+	uint64_t hash;
+	//Incremented on every publish that reached the disk
+	uint64_t version;
+};
+
+//Returns 1 if the file was replaced, 0 if the contents were unchanged and nothing was written, -1 on error
+int publish_file(struct published_file *file, const char *contents, size_t len);
+
+uint64_t publish_hash(const char *contents, size_t len);
+
+#endif
@@ -0,0 +1,334 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_rack_snapshot.h"
+
+static const char *format_names[SNAPSHOT_NUM_FORMATS] = {"text", "json", "csv", "binary"};
+static const char *content_types[SNAPSHOT_NUM_FORMATS] = {
+	"text/plain", "application/json", "text/csv", "application/octet-stream"
+};
+static const char *health_names[] = {"ok", "degraded", "failed"};
+
+static int append(char *buf, size_t buf_len, size_t *offset, const char *format, ...){
+	va_list args;
+	int count;
+
+	if(*offset >= buf_len){
+		return -1;
+	}
+	va_start(args, format);
+	count = vsnprintf(buf + *offset, buf_len - *offset, format, args);
+	va_end(args);
+	if(count < 0 || (size_t)count >= buf_len - *offset){
+		return -1;
+	}
+	*offset = *offset + count;
+	return 0;
+}
+
+//Quotes and backslashes are escaped, control characters dropped. Names never contain anything else odd.
+static void escape_json(char *dest, size_t dest_len, const char *src){
+	size_t j = 0;
+	while(*src != '\0' && j + 2 < dest_len){
+		if(*src == '"' || *src == '\\'){
+			dest[j++] = '\\';
+			dest[j++] = *src;
+		}
+		else if((unsigned char)*src >= 0x20){
+			dest[j++] = *src;
+		}
+		src++;
+	}
+	dest[j] = '\0';
+}
+
+//Fields holding a comma or quote are quoted, with quotes doubled
+static void escape_csv(char *dest, size_t dest_len, const char *src){
+	size_t j = 0;
+	if(strpbrk(src, ",\"\n") == NULL){
+		snprintf(dest, dest_len, "%s", src);
+		return;
+	}
+	dest[j++] = '"';
+	while(*src != '\0' && j + 3 < dest_len){
+		if(*src == '"'){
+			dest[j++] = '"';
+		}
+		dest[j++] = *src++;
+	}
+	dest[j++] = '"';
+	dest[j] = '\0';
+}
+
+//"Ground Cumin - 20.035000tsp - 12.5 days left - LOW STOCK", the format spice_rack_consolidated.txt has always had
+static int serialize_text(const struct inventory_snapshot *snapshot, char *buf, size_t buf_len, size_t *offset){
+	const struct inventory_slot *slot;
+	int i;
+
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		if(append(buf, buf_len, offset, "%s - %3.6f%s", slot->name, slot->quantity, slot->unit) != 0){
+			return -1;
+		}
+		if(slot->days_left >= 0 && append(buf, buf_len, offset, " - %.1f days left", slot->days_left) != 0){
+			return -1;
+		}
+		if(slot->low_stock == 1 && append(buf, buf_len, offset, " - LOW STOCK") != 0){
+			return -1;
+		}
+		if(append(buf, buf_len, offset, "\n") != 0){
+			return -1;
+		}
+	}
+	//Only added when something is wrong, so a healthy rack's file reads as it always has
+	if(snapshot->health != SNAPSHOT_HEALTH_OK){
+		if(append(buf, buf_len, offset, "SENSOR %s:%s%s\n", snapshot->health == SNAPSHOT_HEALTH_FAILED ? "FAILURE" : "PROBLEM",
+			(snapshot->faults & SNAPSHOT_FAULT_WEIGHT) ? " weight sensor" : "", (snapshot->faults & SNAPSHOT_FAULT_SLOTS) ? " slot sensors" : "") != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int serialize_json(const struct inventory_snapshot *snapshot, char *buf, size_t buf_len, size_t *offset){
+	const struct inventory_slot *slot;
+	char name[SNAPSHOT_NAME_LEN * 2];
+	char days_left[32];
+	int i;
+
+	if(append(buf, buf_len, offset, "{\"version\":%llu,\"time\":%lld,\"health\":\"%s\",\"faults\":[%s%s%s],\"slots\":[",
+		(unsigned long long)snapshot->version, (long long)snapshot->taken, snapshot_health_name(snapshot->health),
+		(snapshot->faults & SNAPSHOT_FAULT_WEIGHT) ? "\"weight\"" : "",
+		(snapshot->faults & SNAPSHOT_FAULT_WEIGHT) && (snapshot->faults & SNAPSHOT_FAULT_SLOTS) ? "," : "",
+		(snapshot->faults & SNAPSHOT_FAULT_SLOTS) ? "\"slots\"" : "") != 0){
+		return -1;
+	}
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		escape_json(name, sizeof(name), slot->name);
+		if(slot->days_left >= 0){
+			snprintf(days_left, sizeof(days_left), "%.1f", slot->days_left);
+		}
+		else{
+			snprintf(days_left, sizeof(days_left), "null");
+		}
+		if(append(buf, buf_len, offset, "%s{\"slot\":%i,\"name\":\"%s\",\"grams\":%.3f,\"quantity\":%.3f,\"unit\":\"%s\",\"days_left\":%s,\"low_stock\":%s,\"adc\":%i}",
+			i == 0 ? "" : ",", slot->slot, name, slot->grams, slot->quantity, slot->unit, days_left,
+			slot->low_stock == 1 ? "true" : "false", slot->adc) != 0){
+			return -1;
+		}
+	}
+	return append(buf, buf_len, offset, "]}\n");
+}
+
+static int serialize_csv(const struct inventory_snapshot *snapshot, char *buf, size_t buf_len, size_t *offset){
+	const struct inventory_slot *slot;
+	char name[SNAPSHOT_NAME_LEN * 2 + 3];
+	int i;
+
+	if(append(buf, buf_len, offset, "slot,name,grams,quantity,unit,days_left,low_stock,adc,health\n") != 0){
+		return -1;
+	}
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		escape_csv(name, sizeof(name), slot->name);
+		if(append(buf, buf_len, offset, "%i,%s,%.3f,%.3f,%s,", slot->slot, name, slot->grams, slot->quantity, slot->unit) != 0){
+			return -1;
+		}
+		//An unknown forecast is left blank rather than written as -1
+		if(slot->days_left >= 0 && append(buf, buf_len, offset, "%.1f", slot->days_left) != 0){
+			return -1;
+		}
+		if(append(buf, buf_len, offset, ",%i,%i,%s\n", slot->low_stock, slot->adc, snapshot_health_name(snapshot->health)) != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int serialize_binary(const struct inventory_snapshot *snapshot, char *buf, size_t buf_len, size_t *offset){
+	const struct inventory_slot *slot;
+	uint16_t format = SNAPSHOT_BINARY_FORMAT;
+	uint16_t num_slots = snapshot->num_slots;
+	uint16_t slot_num;
+	uint8_t low_stock;
+	uint8_t health = snapshot->health;
+	uint8_t faults = snapshot->faults;
+	int32_t adc;
+	char *record;
+	int i;
+
+	if(buf_len < SNAPSHOT_HEADER_SIZE + (size_t)snapshot->num_slots * SNAPSHOT_RECORD_SIZE){
+		return -1;
+	}
+	memcpy(buf, SNAPSHOT_MAGIC, 4);
+	memcpy(buf + 4, &format, 2);
+	memcpy(buf + 6, &num_slots, 2);
+	memcpy(buf + 8, &snapshot->version, 8);
+	memcpy(buf + 16, &snapshot->taken, 8);
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		record = buf + SNAPSHOT_HEADER_SIZE + i * SNAPSHOT_RECORD_SIZE;
+		memset(record, 0, SNAPSHOT_RECORD_SIZE);
+		strncpy(record, slot->name, SNAPSHOT_NAME_LEN - 1);
+		strncpy(record + 32, slot->unit, SNAPSHOT_UNIT_LEN - 1);
+		memcpy(record + 40, &slot->grams, 4);
+		memcpy(record + 44, &slot->quantity, 4);
+		memcpy(record + 48, &slot->days_left, 4);
+		adc = slot->adc;
+		memcpy(record + 52, &adc, 4);
+		slot_num = slot->slot;
+		memcpy(record + 56, &slot_num, 2);
+		low_stock = slot->low_stock;
+		memcpy(record + 58, &low_stock, 1);
+		memcpy(record + 59, &health, 1);
+		memcpy(record + 60, &faults, 1);
+	}
+	*offset = SNAPSHOT_HEADER_SIZE + snapshot->num_slots * SNAPSHOT_RECORD_SIZE;
+	return 0;
+}
+
+int snapshot_serialize(const struct inventory_snapshot *snapshot, enum snapshot_format format, char *buf, size_t buf_len){
+	size_t offset = 0;
+	int result;
+
+	if(buf_len > 0){
+		buf[0] = '\0';
+	}
+	switch(format){
+	case SNAPSHOT_TEXT:
+		result = serialize_text(snapshot, buf, buf_len, &offset);
+		break;
+	case SNAPSHOT_JSON:
+		result = serialize_json(snapshot, buf, buf_len, &offset);
+		break;
+	case SNAPSHOT_CSV:
+		result = serialize_csv(snapshot, buf, buf_len, &offset);
+		break;
+	case SNAPSHOT_BINARY:
+		result = serialize_binary(snapshot, buf, buf_len, &offset);
+		break;
+	default:
+		result = -1;
+		break;
+	}
+	if(result != 0){
+		log_message(LOG_DEBUG, "spice_rack_snapshot: snapshot_serialize - %s output did not fit in %zu bytes\n", format < SNAPSHOT_NUM_FORMATS ? format_names[format] : "unknown", buf_len);
+		return -1;
+	}
+	return offset;
+}
+
+int snapshot_decode(const char *buf, size_t buf_len, struct inventory_snapshot *snapshot){
+	struct inventory_slot *slot;
+	uint16_t format;
+	uint16_t num_slots;
+	uint16_t slot_num;
+	uint8_t low_stock;
+	uint8_t health;
+	uint8_t faults;
+	int32_t adc;
+	const char *record;
+	int i;
+
+	if(buf_len < SNAPSHOT_HEADER_SIZE || memcmp(buf, SNAPSHOT_MAGIC, 4) != 0){
+		return -1;
+	}
+	memcpy(&format, buf + 4, 2);
+	memcpy(&num_slots, buf + 6, 2);
+	if(format != SNAPSHOT_BINARY_FORMAT || num_slots > SNAPSHOT_MAX_SLOTS || buf_len < SNAPSHOT_HEADER_SIZE + (size_t)num_slots * SNAPSHOT_RECORD_SIZE){
+		return -1;
+	}
+	memset(snapshot, 0, sizeof(struct inventory_snapshot));
+	memcpy(&snapshot->version, buf + 8, 8);
+	memcpy(&snapshot->taken, buf + 16, 8);
+	snapshot->num_slots = num_slots;
+	for(i=0;i<num_slots;i++){
+		slot = &snapshot->slots[i];
+		record = buf + SNAPSHOT_HEADER_SIZE + i * SNAPSHOT_RECORD_SIZE;
+		memcpy(slot->name, record, SNAPSHOT_NAME_LEN - 1);
+		memcpy(slot->unit, record + 32, SNAPSHOT_UNIT_LEN - 1);
+		memcpy(&slot->grams, record + 40, 4);
+		memcpy(&slot->quantity, record + 44, 4);
+		memcpy(&slot->days_left, record + 48, 4);
+		memcpy(&adc, record + 52, 4);
+		slot->adc = adc;
+		memcpy(&slot_num, record + 56, 2);
+		slot->slot = slot_num;
+		memcpy(&low_stock, record + 58, 1);
+		slot->low_stock = low_stock;
+		memcpy(&health, record + 59, 1);
+		memcpy(&faults, record + 60, 1);
+		snapshot->health = health;
+		snapshot->faults = faults;
+	}
+	return 0;
+}
+
+int snapshot_format_from_string(const char *name){
+	int i;
+	for(i=0;i<SNAPSHOT_NUM_FORMATS;i++){
+		if(strcmp(name, format_names[i]) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+const char *snapshot_content_type(enum snapshot_format format){
+	if(format >= SNAPSHOT_NUM_FORMATS){
+		return "application/octet-stream";
+	}
+	return content_types[format];
+}
+
+int snapshot_cache_init(struct snapshot_cache *cache){
+	memset(cache->entries, 0, sizeof(cache->entries));
+	if(pthread_mutex_init(&cache->lock, NULL) != 0){
+		log_message(LOG_DEBUG, "spice_rack_snapshot: snapshot_cache_init - Failed to init mutex\n");
+		return -1;
+	}
+	return 0;
+}
+
+void snapshot_cache_destroy(struct snapshot_cache *cache){
+	pthread_mutex_destroy(&cache->lock);
+}
+
+int snapshot_cache_render(struct snapshot_cache *cache, const struct inventory_snapshot *snapshot, enum snapshot_format format, char *out, size_t out_len){
+	struct snapshot_cache_entry *entry;
+	int len;
+
+	if(format >= SNAPSHOT_NUM_FORMATS){
+		return -1;
+	}
+	entry = &cache->entries[format];
+	pthread_mutex_lock(&cache->lock);
+	//Keyed on taken as well, so a snapshot from an older app that reused a version isn't served stale
+	if(entry->valid == 0 || entry->version != snapshot->version || entry->taken != snapshot->taken){
+		entry->len = snapshot_serialize(snapshot, format, entry->buf, sizeof(entry->buf));
+		entry->version = snapshot->version;
+		entry->taken = snapshot->taken;
+		entry->valid = entry->len != -1;
+	}
+	len = entry->len;
+	if(len != -1 && (size_t)len <= out_len){
+		memcpy(out, entry->buf, len);
+	}
+	else{
+		len = -1;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return len;
+}
+
+const char *snapshot_health_name(int health){
+	if(health < SNAPSHOT_HEALTH_OK || health > SNAPSHOT_HEALTH_FAILED){
+		return "unknown";
+	}
+	return health_names[health];
+}
@@ -0,0 +1,99 @@
+#ifndef SPICE_RACK_SNAPSHOT_H
+#define SPICE_RACK_SNAPSHOT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_MAX_SLOTS 32
+#define SNAPSHOT_NAME_LEN 32
+#define SNAPSHOT_UNIT_LEN 8
+//Large enough for any format of a full snapshot
+#define SNAPSHOT_BUFFER_SIZE 8192
+
+//Packed binary layout, host byte order (the app and server run on the same board):
+//  header  "SRIS", u16 format, u16 num_slots, u64 version, i64 taken         24 bytes
+//  slot    name[32], unit[8], f32 grams, f32 quantity, f32 days_left,
+//          i32 adc, u16 slot, u8 low_stock, u8 health, u8 faults,
+//          3 bytes reserved                                                 64 bytes each
+//health and faults are the rack's, repeated in every slot record.
+#define SNAPSHOT_MAGIC "SRIS"
+#define SNAPSHOT_BINARY_FORMAT 1
+#define SNAPSHOT_HEADER_SIZE 24
+#define SNAPSHOT_RECORD_SIZE 64
+
+//Sensor health of the rack when the snapshot was taken. Slot values come from the last good readings
+//when the weight sensor is at fault.
+#define SNAPSHOT_HEALTH_OK 0
+#define SNAPSHOT_HEALTH_DEGRADED 1
+#define SNAPSHOT_HEALTH_FAILED 2
+#define SNAPSHOT_FAULT_WEIGHT 0x1
+#define SNAPSHOT_FAULT_SLOTS 0x2
+
+enum snapshot_format{
+	SNAPSHOT_TEXT = 0,
+	SNAPSHOT_JSON,
+	SNAPSHOT_CSV,
+	SNAPSHOT_BINARY,
+	SNAPSHOT_NUM_FORMATS
+};
+
+struct inventory_slot{
+	int slot;
+	char name[SNAPSHOT_NAME_LEN];
+	char unit[SNAPSHOT_UNIT_LEN];
+	float grams;
+	float quantity;
+	//-1 when there isn't enough usage yet to estimate
+	float days_left;
+	int low_stock;
+	int adc;
+};
+
+//The version only changes when slot contents change and isn't reused, so with taken it can be used as a
+//cache key by readers
+struct inventory_snapshot{
+	uint64_t version;
+	int64_t taken;
+	int num_slots;
+	int health;
+	//SNAPSHOT_FAULT_ flags for the sensors that aren't ok
+	int faults;
+	struct inventory_slot slots[SNAPSHOT_MAX_SLOTS];
+};
+
+//Renders the snapshot into buf. Returns the number of bytes written (text formats are NUL terminated
+//but the NUL isn't counted) or -1 if buf is too small.
+int snapshot_serialize(const struct inventory_snapshot *snapshot, enum snapshot_format format, char *buf, size_t buf_len);
+//Reads the binary layout back. Returns 0 or -1 if buf isn't a valid snapshot.
+int snapshot_decode(const char *buf, size_t buf_len, struct inventory_snapshot *snapshot);
+
+//"text", "json", "csv" or "binary", -1 if unknown
+int snapshot_format_from_string(const char *name);
+const char *snapshot_content_type(enum snapshot_format format);
+//"ok", "degraded" or "failed"
+const char *snapshot_health_name(int health);
+
+//One rendered copy of each format, kept until the snapshot version or time taken changes. Safe to share
+//between threads.
+struct snapshot_cache_entry{
+	int valid;
+	uint64_t version;
+	int64_t taken;
+	int len;
+	char buf[SNAPSHOT_BUFFER_SIZE];
+};
+
+struct snapshot_cache{
+	pthread_mutex_t lock;
+	struct snapshot_cache_entry entries[SNAPSHOT_NUM_FORMATS];
+};
+
+int snapshot_cache_init(struct snapshot_cache *cache);
+void snapshot_cache_destroy(struct snapshot_cache *cache);
+//Copies the rendered snapshot into out, serializing only if this version and time taken haven't been
+//rendered in this format.
+//Returns the length or -1.
+int snapshot_cache_render(struct snapshot_cache *cache, const struct inventory_snapshot *snapshot, enum snapshot_format format, char *out, size_t out_len);
+
+#endif
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "spice_rack_log.h"
+#include "spice_rack_trace.h"
+
+struct trace_event{
+	const char *name;
+	uint64_t start;
+	//0 for an instant event
+	uint64_t duration;
+	int tid;
+	const char *arg_names[2];
+	int64_t args[2];
+	//Set once the event is filled in, so one still being written when recording stops is left out
+	atomic_int ready;
+};
+
+atomic_int trace_recording;
+static struct trace_event *events;
+static unsigned int max_events;
+static atomic_uint num_events;
+static char trace_file[PATH_MAX];
+static uint64_t trace_epoch;
+static _Thread_local int thread_id;
+
+uint64_t trace_clock(void){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void trace_record(const char *name, uint64_t start, const char *arg0_name, int64_t arg0, const char *arg1_name, int64_t arg1){
+	struct trace_event *event;
+	uint64_t now = trace_clock();
+	unsigned int index;
+
+	index = atomic_fetch_add_explicit(&num_events, 1, memory_order_relaxed);
+	if(index >= max_events){
+		return;
+	}
+	if(thread_id == 0){
+		thread_id = syscall(SYS_gettid);
+	}
+	event = &events[index];
+	event->name = name;
+	event->start = start != 0 ? start : now;
+	event->duration = start != 0 ? now - start : 0;
+	event->tid = thread_id;
+	event->arg_names[0] = arg0_name;
+	event->arg_names[1] = arg1_name;
+	event->args[0] = arg0;
+	event->args[1] = arg1;
+	atomic_store_explicit(&event->ready, 1, memory_order_release);
+}
+
+static void trace_stop_at_exit(void){
+	trace_stop();
+}
+
+int trace_set_file(const char *file_name){
+	char cwd[PATH_MAX];
+	int len;
+
+	if(file_name[0] == '/'){
+		len = snprintf(trace_file, sizeof(trace_file), "%s", file_name);
+	}
+	else if(getcwd(cwd, sizeof(cwd)) != NULL){
+		len = snprintf(trace_file, sizeof(trace_file), "%s/%s", cwd, file_name);
+	}
+	else{
+		log_errno("spice_rack_trace: trace_set_file - Unable to find the current directory for %s", file_name);
+		return -1;
+	}
+	if(len >= (int)sizeof(trace_file)){
+		log_message(LOG_ERR, "spice_rack_trace: trace_set_file - File name too long - %s\n", file_name);
+		trace_file[0] = '\0';
+		return -1;
+	}
+	return 0;
+}
+
+//The events are never freed, as a thread still running when recording stops may be part way through one
+int trace_start(unsigned int num){
+	static int registered;
+
+	if(trace_file[0] == '\0'){
+		return 0;
+	}
+	if((events = (struct trace_event *)calloc(num, sizeof(struct trace_event))) == NULL){
+		log_errno("spice_rack_trace: trace_start - Failed to Malloc %u events", num);
+		return -1;
+	}
+	max_events = num;
+	atomic_store(&num_events, 0);
+	trace_epoch = trace_clock();
+	if(registered == 0){
+		atexit(trace_stop_at_exit);
+		registered = 1;
+	}
+	atomic_store(&trace_recording, 1);
+	log_message(LOG_INFO, "spice_rack_trace: trace_start - Recording up to %u events for %s\n", num, trace_file);
+	return 0;
+}
+
+//Timestamps are microseconds since trace_start(), as Chrome's trace format wants
+static void write_event(FILE *file, const struct trace_event *event, int pid, int first){
+	uint64_t start = event->start > trace_epoch ? event->start - trace_epoch : 0;
+
+	fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"spicerack\",\"ph\":\"%s\",\"ts\":%llu.%03llu,", first == 1 ? "" : ",",
+		event->name, event->duration != 0 ? "X" : "i", (unsigned long long)(start / 1000), (unsigned long long)(start % 1000));
+	if(event->duration != 0){
+		fprintf(file, "\"dur\":%llu.%03llu,", (unsigned long long)(event->duration / 1000), (unsigned long long)(event->duration % 1000));
+	}
+	else{
+		fprintf(file, "\"s\":\"t\",");
+	}
+	fprintf(file, "\"pid\":%i,\"tid\":%i,\"args\":{\"%s\":%lld,\"%s\":%lld}}", pid, event->tid,
+		event->arg_names[0], (long long)event->args[0], event->arg_names[1], (long long)event->args[1]);
+}
+
+int trace_stop(void){
+	unsigned int recorded;
+	unsigned int written = 0;
+	unsigned int i;
+	FILE *file;
+	int pid = getpid();
+
+	if(atomic_exchange(&trace_recording, 0) == 0){
+		return 0;
+	}
+	recorded = atomic_load(&num_events);
+	if((file = fopen(trace_file, "w")) == NULL){
+		log_errno("spice_rack_trace: trace_stop - Failed to Open %s", trace_file);
+		return -1;
+	}
+	fprintf(file, "{\"traceEvents\":[");
+	for(i=0;i<recorded && i<max_events;i++){
+		if(atomic_load_explicit(&events[i].ready, memory_order_acquire) == 1){
+			write_event(file, &events[i], pid, written == 0);
+			written++;
+		}
+	}
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%u}}\n", recorded > max_events ? recorded - max_events : 0);
+	if(fclose(file) != 0){
+		log_errno("spice_rack_trace: trace_stop - Failed to Write %s", trace_file);
+		return -1;
+	}
+	log_message(LOG_INFO, "spice_rack_trace: trace_stop - Wrote %u events to %s\n", written, trace_file);
+	return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef SPICE_RACK_TRACE_H
+#define SPICE_RACK_TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+//Static tracepoints. Each one is a USDT probe under the provider "spicerack" when <sys/sdt.h> is available
+//at build time (systemtap-sdt-dev, or systemtap in Yocto), which is a single nop until perf or bpftrace
+//attaches, e.g.
+//  bpftrace -e 'usdt:/usr/bin/spice_rack_app:spicerack:conversion { @us = hist((nsecs - @s[tid]) / 1000); }
+//               usdt:/usr/bin/spice_rack_app:spicerack:conversion_start { @s[tid] = nsecs; }'
+//  perf probe -x /usr/bin/aesdsocket_server sdt_spicerack:send
+//Every tracepoint is also recorded for a Chrome trace (chrome://tracing or ui.perfetto.dev) while
+//trace_start() is in effect, turned on by -t <file> on the app and the server. Otherwise a tracepoint costs
+//the nop and a load of trace_recording.
+//
+//A span is a TRACE_BEGIN, which fires <name>_start, and a TRACE_END, which fires <name>. Every probe has two
+//integer arguments, named for the Chrome trace. Arguments are evaluated twice, so must have no side effects.
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_SDT_PROBE(name) DTRACE_PROBE(spicerack, name)
+#define TRACE_SDT_PROBE2(name, arg0, arg1) DTRACE_PROBE2(spicerack, name, arg0, arg1)
+#endif
+#endif
+#ifndef TRACE_SDT_PROBE
+#define TRACE_SDT_PROBE(name) do{}while(0)
+#define TRACE_SDT_PROBE2(name, arg0, arg1) do{}while(0)
+#endif
+
+extern atomic_int trace_recording;
+
+#define TRACE_IS_RECORDING() __builtin_expect(atomic_load_explicit(&trace_recording, memory_order_relaxed), 0)
+
+#define TRACE_INSTANT(name, arg0_name, arg0, arg1_name, arg1) do{ \
+	TRACE_SDT_PROBE2(name, arg0, arg1); \
+	if(TRACE_IS_RECORDING()){ \
+		trace_record(#name, 0, arg0_name, (int64_t)(arg0), arg1_name, (int64_t)(arg1)); \
+	} \
+}while(0)
+
+//start is a uint64_t the span's start time is kept in, 0 while not recording
+#define TRACE_BEGIN(name, start) do{ \
+	TRACE_SDT_PROBE(name##_start); \
+	start = TRACE_IS_RECORDING() ? trace_clock() : 0; \
+}while(0)
+
+#define TRACE_END(name, start, arg0_name, arg0, arg1_name, arg1) do{ \
+	TRACE_SDT_PROBE2(name, arg0, arg1); \
+	if((start) != 0 && TRACE_IS_RECORDING()){ \
+		trace_record(#name, start, arg0_name, (int64_t)(arg0), arg1_name, (int64_t)(arg1)); \
+	} \
+}while(0)
+
+//Monotonic nanoseconds
+uint64_t trace_clock(void);
+//Records an instant event, or a span from start to now when start isn't 0
+void trace_record(const char *name, uint64_t start, const char *arg0_name, int64_t arg0, const char *arg1_name, int64_t arg1);
+//Sets the file the Chrome trace is written to. A relative name is made absolute now, so call it before
+//daemonize() changes directory. Returns 0 or -1.
+int trace_set_file(const char *file_name);
+//Starts recording up to max_events events if trace_set_file() was called, or does nothing. Call after
+//daemonize(), so the parent exiting doesn't write the trace. Returns 0 or -1.
+int trace_start(unsigned int max_events);
+//Stops recording and writes the Chrome trace. Also runs at exit. Returns 0, or -1 if it couldn't be written.
+int trace_stop(void);
+
+#endif
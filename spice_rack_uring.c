@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "spice_rack_log.h"
+#include "spice_rack_uring.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <stdatomic.h>
+#include <linux/io_uring.h>
+
+static int uring_setup(unsigned entries, struct io_uring_params *params){
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args){
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_init(struct uring *ring, unsigned entries){
+	struct io_uring_params params;
+
+	memset(ring, 0, sizeof(struct uring));
+	memset(&params, 0, sizeof(params));
+	ring->fd = uring_setup(entries, &params);
+	if(ring->fd == -1){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_init - io_uring unavailable - %s\n", strerror(errno));
+		return -1;
+	}
+	//Kernels without a single mmap for both rings are too old for the ops used here
+	if((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_NODROP) == 0){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_init - io_uring too old, features %x\n", params.features);
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+	ring->entries = params.sq_entries;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(ring->cq_ring_size > ring->sq_ring_size){
+		ring->sq_ring_size = ring->cq_ring_size;
+	}
+	ring->cq_ring_size = ring->sq_ring_size;
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sq_ring == MAP_FAILED){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_init - Failed to map ring - %s\n", strerror(errno));
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+	ring->cq_ring = ring->sq_ring;
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_init - Failed to map submission entries - %s\n", strerror(errno));
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+	ring->sq_head = (unsigned *)((char *)ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ring + params.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (char *)ring->cq_ring + params.cq_off.cqes;
+	return 0;
+}
+
+void uring_free(struct uring *ring){
+	if(ring->fd == -1){
+		return;
+	}
+	munmap(ring->sqes, ring->sqes_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+int uring_register_files(struct uring *ring, const int *fds, unsigned num_fds){
+	if(ring->files_registered == 1){
+		uring_register(ring->fd, IORING_UNREGISTER_FILES, NULL, 0);
+		ring->files_registered = 0;
+	}
+	if(uring_register(ring->fd, IORING_REGISTER_FILES, fds, num_fds) != 0){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_register_files - %s\n", strerror(errno));
+		return -1;
+	}
+	ring->files_registered = 1;
+	return 0;
+}
+
+int uring_register_buffers(struct uring *ring, const struct iovec *buffers, unsigned num_buffers){
+	if(uring_register(ring->fd, IORING_REGISTER_BUFFERS, buffers, num_buffers) != 0){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_register_buffers - %s\n", strerror(errno));
+		return -1;
+	}
+	ring->buffers_registered = 1;
+	return 0;
+}
+
+int uring_run_batch(struct uring *ring, struct uring_io *ios, int num_ios, int linked){
+	struct io_uring_sqe *sqes = (struct io_uring_sqe *)ring->sqes;
+	struct io_uring_cqe *cqes = (struct io_uring_cqe *)ring->cqes;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned tail;
+	unsigned head;
+	unsigned index;
+	int completed = 0;
+	int submitted;
+	int result = 0;
+	int i;
+
+	if(num_ios <= 0 || (unsigned)num_ios > ring->entries){
+		return -1;
+	}
+	tail = *ring->sq_tail;
+	for(i=0;i<num_ios;i++){
+		index = (tail + i) & *ring->sq_mask;
+		sqe = &sqes[index];
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		if(ios[i].buffer >= 0){
+			sqe->opcode = ios[i].op == URING_WRITE ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+			sqe->buf_index = ios[i].buffer;
+		}
+		else{
+			sqe->opcode = ios[i].op == URING_WRITE ? IORING_OP_WRITE : IORING_OP_READ;
+		}
+		sqe->fd = ios[i].file;
+		sqe->flags = IOSQE_FIXED_FILE;
+		//A hard link keeps the chain going past short reads, which a plain link would treat as failure
+		if(linked == 1 && i < num_ios - 1){
+			sqe->flags |= IOSQE_IO_HARDLINK;
+		}
+		sqe->addr = (uint64_t)(uintptr_t)ios[i].buf;
+		sqe->len = ios[i].len;
+		sqe->off = ios[i].offset;
+		sqe->user_data = i;
+		ring->sq_array[index] = index;
+		ios[i].result = -ECANCELED;
+	}
+	//The kernel must see the entries before the new tail
+	atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, tail + num_ios, memory_order_release);
+
+	//EINTR here means nothing was submitted, as a signal during the wait returns the number submitted
+	while((submitted = uring_enter(ring->fd, num_ios, num_ios, IORING_ENTER_GETEVENTS)) < 0 && errno == EINTR);
+	if(submitted < 0){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_run_batch - io_uring_enter failed - %s\n", strerror(errno));
+		submitted = 0;
+	}
+	//The kernel stops submitting at an entry it can't start. The rest are taken back out of the ring, so a
+	//later batch doesn't submit them with buffers that have gone, and the caller falls back to plain I/O
+	//once the ones submitted have completed.
+	if(submitted < num_ios){
+		log_message(LOG_DEBUG, "spice_rack_uring: uring_run_batch - Only %i of %i submitted\n", submitted, num_ios);
+		atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, tail + submitted, memory_order_release);
+		result = -1;
+	}
+	while(completed < submitted){
+		head = *ring->cq_head;
+		if(head == atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire)){
+			//Interrupted before everything completed, wait for the rest
+			if(uring_enter(ring->fd, 0, submitted - completed, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR){
+				log_message(LOG_DEBUG, "spice_rack_uring: uring_run_batch - io_uring_enter failed - %s\n", strerror(errno));
+				return -1;
+			}
+			continue;
+		}
+		cqe = &cqes[head & *ring->cq_mask];
+		if(cqe->user_data < (uint64_t)num_ios){
+			ios[cqe->user_data].result = cqe->res;
+		}
+		atomic_store_explicit((_Atomic unsigned *)ring->cq_head, head + 1, memory_order_release);
+		completed++;
+	}
+	return result;
+}
+
+#else
+
+int uring_init(struct uring *ring, unsigned entries){
+	memset(ring, 0, sizeof(struct uring));
+	ring->fd = -1;
+	log_message(LOG_DEBUG, "spice_rack_uring: uring_init - Built without io_uring support\n");
+	return -1;
+}
+
+void uring_free(struct uring *ring){
+}
+
+int uring_register_files(struct uring *ring, const int *fds, unsigned num_fds){
+	return -1;
+}
+
+int uring_register_buffers(struct uring *ring, const struct iovec *buffers, unsigned num_buffers){
+	return -1;
+}
+
+int uring_run_batch(struct uring *ring, struct uring_io *ios, int num_ios, int linked){
+	return -1;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SPICE_RACK_URING_H
+#define SPICE_RACK_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+//Minimal io_uring through the raw syscalls, for batching many small reads or writes into one system call.
+//uring_init() fails on kernels or builds without io_uring (or where it is disabled) and callers keep using
+//plain read() and write().
+#define URING_READ 0
+#define URING_WRITE 1
+
+struct uring{
+	int fd;
+	unsigned entries;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	void *sqes;
+	size_t sqes_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *cqes;
+	int files_registered;
+	int buffers_registered;
+};
+
+struct uring_io{
+	int op;
+	//Index into the registered files
+	int file;
+	void *buf;
+	unsigned len;
+	uint64_t offset;
+	//Index into the registered buffers holding buf, or -1
+	int buffer;
+	//Bytes transferred or -errno, filled in by uring_run_batch()
+	int result;
+};
+
+//Returns 0, or -1 if io_uring can't be used here
+int uring_init(struct uring *ring, unsigned entries);
+void uring_free(struct uring *ring);
+//Replaces any files registered before
+int uring_register_files(struct uring *ring, const int *fds, unsigned num_fds);
+int uring_register_buffers(struct uring *ring, const struct iovec *buffers, unsigned num_buffers);
+
+//Runs ios with one system call and waits for all of them. When linked is set they run one after another
+//in order, otherwise the kernel may run them in parallel. num_ios can't be more than the ring's entries.
+//Returns 0 once every io has a result, or -1 if the ring failed. It's also -1 if the kernel wouldn't take
+//every io, once the ones it took have completed. The rest are left with -ECANCELED.
+int uring_run_batch(struct uring *ring, struct uring_io *ios, int num_ios, int linked);
+
+#endif
@@ -0,0 +1,91 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "spice_rack_log.h"
+#include "spice_rack_watchdog.h"
+
+//Ping interval when only the hardware watchdog is in use. Most have a timeout of 15 s or more.
+#define DEVICE_INTERVAL_MS 5000
+
+int watchdog_open(struct watchdog *watchdog, const char *device){
+	const char *socket_path = getenv("NOTIFY_SOCKET");
+	const char *usec = getenv("WATCHDOG_USEC");
+	long timeout_ms;
+
+	memset(watchdog, 0, sizeof(struct watchdog));
+	watchdog->notify_fd = -1;
+	watchdog->device_fd = -1;
+	watchdog->interval_ms = DEVICE_INTERVAL_MS;
+	if(socket_path != NULL && (socket_path[0] == '/' || socket_path[0] == '@') && strlen(socket_path) < sizeof(watchdog->notify_path)){
+		if((watchdog->notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1){
+			log_message(LOG_DEBUG, "spice_rack_watchdog: watchdog_open - Failed to create notify socket - %s\n", strerror(errno));
+		}
+		strcpy(watchdog->notify_path, socket_path);
+	}
+	if(usec != NULL && (timeout_ms = strtol(usec, NULL, 10) / 1000) > 0 && timeout_ms / 2 < watchdog->interval_ms){
+		watchdog->interval_ms = timeout_ms / 2;
+	}
+	if(device != NULL && device[0] != '\0'){
+		if((watchdog->device_fd = open(device, O_WRONLY | O_CLOEXEC)) == -1){
+			log_errno("spice_rack_watchdog: watchdog_open - Failed to open %s", device);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void watchdog_notify(struct watchdog *watchdog, const char *state){
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+
+	if(watchdog->notify_fd == -1){
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, watchdog->notify_path);
+	addr_len = offsetof(struct sockaddr_un, sun_path) + strlen(watchdog->notify_path);
+	//A leading '@' is an abstract socket, named by what follows a NUL
+	if(addr.sun_path[0] == '@'){
+		addr.sun_path[0] = '\0';
+	}
+	if(sendto(watchdog->notify_fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&addr, addr_len) == -1){
+		log_message(LOG_DEBUG, "spice_rack_watchdog: watchdog_notify - Failed to notify systemd - %s\n", strerror(errno));
+	}
+}
+
+void watchdog_ping(struct watchdog *watchdog, const struct timespec *now){
+	long elapsed_ms = (now->tv_sec - watchdog->last_ping.tv_sec) * 1000 + (now->tv_nsec - watchdog->last_ping.tv_nsec) / 1000000;
+
+	if(elapsed_ms < watchdog->interval_ms){
+		return;
+	}
+	watchdog->last_ping = *now;
+	watchdog_notify(watchdog, "WATCHDOG=1");
+	if(watchdog->device_fd != -1 && write(watchdog->device_fd, "1", 1) != 1){
+		log_message(LOG_DEBUG, "spice_rack_watchdog: watchdog_ping - Failed to feed watchdog device - %s\n", strerror(errno));
+	}
+}
+
+void watchdog_close(struct watchdog *watchdog){
+	watchdog_notify(watchdog, "STOPPING=1");
+	if(watchdog->notify_fd != -1){
+		close(watchdog->notify_fd);
+		watchdog->notify_fd = -1;
+	}
+	if(watchdog->device_fd != -1){
+		//The magic close character disarms drivers that support it, so a clean exit isn't a reboot
+		if(write(watchdog->device_fd, "V", 1) != 1){
+			log_message(LOG_DEBUG, "spice_rack_watchdog: watchdog_close - Failed to disarm watchdog device - %s\n", strerror(errno));
+		}
+		close(watchdog->device_fd);
+		watchdog->device_fd = -1;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef SPICE_RACK_WATCHDOG_H
+#define SPICE_RACK_WATCHDOG_H
+
+#include <time.h>
+
+//Keeps systemd's service watchdog (WatchdogSec= in the unit) and optionally a hardware watchdog device
+//fed while the process is making progress. Deciding whether it is making progress is up to the caller,
+//which simply stops calling watchdog_ping() when it isn't.
+struct watchdog{
+	//Datagram socket to $NOTIFY_SOCKET, -1 when not started by systemd
+	int notify_fd;
+	char notify_path[108];
+	//Open /dev/watchdog style device, -1 if none
+	int device_fd;
+	//How often to ping, half of the shortest timeout
+	long interval_ms;
+	struct timespec last_ping;
+};
+
+//device may be NULL or empty for no hardware watchdog. Returns 0 or -1 if the device can't be opened.
+int watchdog_open(struct watchdog *watchdog, const char *device);
+//Sends a sd_notify style state such as "READY=1" or "STATUS=..." to systemd, if it is listening
+void watchdog_notify(struct watchdog *watchdog, const char *state);
+//Feeds both watchdogs if interval_ms has passed since the last ping
+void watchdog_ping(struct watchdog *watchdog, const struct timespec *now);
+//Tells systemd the process is stopping and disarms the hardware watchdog
+void watchdog_close(struct watchdog *watchdog);
+
+#endif
@@ -0,0 +1,115 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "spice_rack_log.h"
+#include "spice_rack_workers.h"
+
+struct worker_job{
+	void (*run)(void *arg);
+	void *arg;
+};
+
+struct worker_pool{
+	pthread_mutex_t lock;
+	pthread_cond_t job_ready;
+	int stopping;
+	//Ring of queued jobs
+	struct worker_job *jobs;
+	int queue_len;
+	int head;
+	int count;
+	int num_threads;
+	pthread_t threads[];
+};
+
+static void *worker_routine(void *arg){
+	struct worker_pool *pool = (struct worker_pool *)arg;
+	struct worker_job job;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1){
+		while(pool->count == 0 && pool->stopping == 0){
+			pthread_cond_wait(&pool->job_ready, &pool->lock);
+		}
+		if(pool->stopping == 1){
+			break;
+		}
+		job = pool->jobs[pool->head];
+		pool->head = (pool->head + 1) % pool->queue_len;
+		pool->count--;
+		pthread_mutex_unlock(&pool->lock);
+		job.run(job.arg);
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct worker_pool *worker_pool_create(int num_threads, int queue_len){
+	struct worker_pool *pool;
+	int result;
+	int i;
+
+	if((pool = (struct worker_pool *)calloc(1, sizeof(struct worker_pool) + num_threads * sizeof(pthread_t))) == NULL){
+		log_message(LOG_DEBUG, "spice_rack_workers: worker_pool_create - Failed on Malloc - %s\n", strerror(errno));
+		return NULL;
+	}
+	if((pool->jobs = (struct worker_job *)calloc(queue_len, sizeof(struct worker_job))) == NULL){
+		log_message(LOG_DEBUG, "spice_rack_workers: worker_pool_create - Failed on Malloc - %s\n", strerror(errno));
+		free(pool);
+		return NULL;
+	}
+	pool->queue_len = queue_len;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->job_ready, NULL);
+	for(i=0;i<num_threads;i++){
+		if((result = pthread_create(&pool->threads[i], NULL, worker_routine, pool)) != 0){
+			log_message(LOG_DEBUG, "spice_rack_workers: worker_pool_create - Unable to create worker thread - %s\n", strerror(result));
+			break;
+		}
+		pool->num_threads++;
+	}
+	if(pool->num_threads == 0){
+		worker_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+int worker_pool_submit(struct worker_pool *pool, void (*run)(void *arg), void *arg){
+	int result = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->count == pool->queue_len || pool->stopping == 1){
+		result = -1;
+	}
+	else{
+		pool->jobs[(pool->head + pool->count) % pool->queue_len].run = run;
+		pool->jobs[(pool->head + pool->count) % pool->queue_len].arg = arg;
+		pool->count++;
+		pthread_cond_signal(&pool->job_ready);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return result;
+}
+
+void worker_pool_destroy(struct worker_pool *pool){
+	int i;
+
+	if(pool == NULL){
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->job_ready);
+	pthread_mutex_unlock(&pool->lock);
+	for(i=0;i<pool->num_threads;i++){
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_cond_destroy(&pool->job_ready);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->jobs);
+	free(pool);
+}
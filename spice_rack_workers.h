@@ -0,0 +1,14 @@
+#ifndef SPICE_RACK_WORKERS_H
+#define SPICE_RACK_WORKERS_H
+
+//A fixed set of threads running jobs from a bounded queue, oldest first. The app sizes the queue so
+//every rack can have a job waiting, which keeps the thread count independent of the number of racks.
+struct worker_pool;
+
+struct worker_pool *worker_pool_create(int num_threads, int queue_len);
+//Returns 0, or -1 if the queue is full
+int worker_pool_submit(struct worker_pool *pool, void (*run)(void *arg), void *arg);
+//Waits for running jobs to finish and joins the threads. Jobs that haven't started are dropped.
+void worker_pool_destroy(struct worker_pool *pool);
+
+#endif
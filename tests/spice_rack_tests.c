@@ -0,0 +1,999 @@
+//Unit and property tests for the pure logic in spice_rack_core, the conversions table, the name index,
+//snapshots and sensor health, and for the history store and config parser against scratch files under
+///tmp. Run with "make test". Random cases come from a fixed seed so failures reproduce; set
+//SPICE_TEST_SEED to try others.
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "spice_rack_core.h"
+#include "spice_conversions.h"
+#include "spice_name_index.h"
+#include "spice_rack_history.h"
+#include "spice_rack_config.h"
+#include "spice_rack_snapshot.h"
+#include "spice_rack_health.h"
+#include "spice_rack_adc.h"
+#include "spice_rack_multicast.h"
+
+#define PROPERTY_CASES 2000
+#define ENTRY_LEN 32
+#define ADC_TEST_SAMPLES 5000
+#define NAME_TEST_LEN 40
+#define NAME_TEST_MATCHES 5
+#define HISTORY_TEST_SAMPLES 6000
+//Enough samples of the largest size to fill HISTORY_RAW_CHUNKS and a few more
+#define HISTORY_RETENTION_SAMPLES 48000
+
+static int checks;
+static int failures;
+static uint64_t seed = 0x5eed5a1ce;
+
+#define CHECK(cond, ...) do{ \
+	checks++; \
+	if(!(cond)){ \
+		failures++; \
+		printf("FAIL %s:%i: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+}while(0)
+
+//xorshift64, good enough to spread test inputs
+static uint64_t next_random(){
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed;
+}
+
+static int random_int(int min, int max){
+	return min + (int)(next_random() % (uint64_t)(max - min + 1));
+}
+
+static float random_float(float min, float max){
+	return min + (max - min) * (float)(next_random() % 1000000) / 1000000.0f;
+}
+
+//Names as typed at calibration: letters, spaces and the odd punctuation, never ',' or ':'
+static void random_name(char *name, int max_len){
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ -'()&";
+	int len = random_int(1, max_len - 1);
+	int i;
+	for(i=0;i<len;i++){
+		name[i] = chars[random_int(0, sizeof(chars) - 2)];
+	}
+	name[len] = '\0';
+}
+
+static void test_parse_known_line(){
+	char storage[SPICE_NUM_COLUMNS][ENTRY_LEN];
+	char *entries[SPICE_NUM_COLUMNS] = {storage[0], storage[1], storage[2], storage[3], storage[4]};
+
+	CHECK(spice_parse_line("Spice_Location:Spice2,Spice_Name:Paprika,ADC_Reading:9100,Calibrated_Mass(grams):30.000000,Teaspoons:13.200000", entries, ENTRY_LEN) == 0, "valid line rejected");
+	CHECK(strcmp(entries[SPICE_LOCATION_COLUMN], "Spice2") == 0, "location %s", entries[0]);
+	CHECK(strcmp(entries[SPICE_NAME_COLUMN], "Paprika") == 0, "name %s", entries[1]);
+	CHECK(strcmp(entries[SPICE_ADC_COLUMN], "9100") == 0, "adc %s", entries[2]);
+	CHECK(strcmp(entries[SPICE_MASS_COLUMN], "30.000000") == 0, "mass %s", entries[3]);
+	CHECK(strcmp(entries[SPICE_TSP_COLUMN], "13.200000") == 0, "tsp %s", entries[4]);
+
+	//A line cut off part way through, as after a power loss while the file was written
+	CHECK(spice_parse_line("Spice_Location:Spice3,Spice_Name:Gin", entries, ENTRY_LEN) == -1, "truncated line accepted");
+	CHECK(strcmp(entries[SPICE_NAME_COLUMN], "Gin") == 0, "truncated name %s", entries[1]);
+	CHECK(entries[SPICE_ADC_COLUMN][0] == '\0' && entries[SPICE_TSP_COLUMN][0] == '\0', "missing columns not emptied");
+	CHECK(spice_parse_line("", entries, ENTRY_LEN) == -1, "empty line accepted");
+
+	//Columns longer than an entry are cut to fit
+	CHECK(spice_parse_line("Spice_Location:Spice1,Spice_Name:An extremely long spice name that does not fit,ADC_Reading:1,Calibrated_Mass(grams):1,Teaspoons:1", entries, ENTRY_LEN) == 0, "long name rejected");
+	CHECK(strlen(entries[SPICE_NAME_COLUMN]) == ENTRY_LEN - 1, "long name not cut, %zu", strlen(entries[1]));
+}
+
+static void test_location(){
+	char location[ENTRY_LEN];
+
+	spice_format_location(location, sizeof(location), 0, "Empty Rack");
+	CHECK(strcmp(location, "N/A-Empty Rack") == 0, "empty rack location %s", location);
+	spice_format_location(location, sizeof(location), 0, "Empty Jar-133g");
+	CHECK(strcmp(location, "N/A-Empty Jar-133g") == 0, "empty jar location %s", location);
+	spice_format_location(location, sizeof(location), 12, "Paprika");
+	CHECK(strcmp(location, "Spice12") == 0, "two digit slot location %s", location);
+}
+
+//Whatever is written to the measurements file reads back the same
+static void test_format_parse_round_trip(){
+	char storage[SPICE_NUM_COLUMNS][ENTRY_LEN];
+	char *entries[SPICE_NUM_COLUMNS] = {storage[0], storage[1], storage[2], storage[3], storage[4]};
+	char line[256];
+	char location[ENTRY_LEN];
+	char name[ENTRY_LEN];
+	char adc[16];
+	char expected[32];
+	float mass;
+	float tsps;
+	int len;
+	int i;
+
+	for(i=0;i<PROPERTY_CASES;i++){
+		random_name(name, 24);
+		spice_format_location(location, sizeof(location), random_int(1, 32), name);
+		snprintf(adc, sizeof(adc), "%i", random_int(-8388608, 8388607));
+		mass = random_float(-200, 2000);
+		tsps = random_float(0, 500);
+		len = spice_format_line(line, sizeof(line), location, name, adc, mass, tsps);
+		CHECK(len > 0 && (size_t)len < sizeof(line) && line[len - 1] == '\n', "case %i bad line length %i", i, len);
+		line[len - 1] = '\0';
+		CHECK(spice_parse_line(line, entries, ENTRY_LEN) == 0, "case %i rejected: %s", i, line);
+		CHECK(strcmp(entries[SPICE_LOCATION_COLUMN], location) == 0, "case %i location %s != %s", i, entries[0], location);
+		CHECK(strcmp(entries[SPICE_NAME_COLUMN], name) == 0, "case %i name %s != %s", i, entries[1], name);
+		CHECK(strcmp(entries[SPICE_ADC_COLUMN], adc) == 0, "case %i adc %s != %s", i, entries[2], adc);
+		snprintf(expected, sizeof(expected), "%3.6f", mass);
+		CHECK(strcmp(entries[SPICE_MASS_COLUMN], expected) == 0, "case %i mass %s != %s", i, entries[3], expected);
+		snprintf(expected, sizeof(expected), "%3.6f", tsps);
+		CHECK(strcmp(entries[SPICE_TSP_COLUMN], expected) == 0, "case %i tsps %s != %s", i, entries[4], expected);
+	}
+}
+
+static void test_adc_to_grams(){
+	float grams;
+	float previous_grams;
+	int empty_rack;
+	int empty_jar;
+	float jar_mass;
+	int base;
+	int step;
+	int i;
+	int j;
+
+	//Weighing an empty jar gives back zero, whichever way the reading moved
+	CHECK(fabsf(spice_adc_to_grams(1000, 5000, 133.245f, 9000, 13000)) < 0.01f, "empty jar weighs %f", spice_adc_to_grams(1000, 5000, 133.245f, 9000, 13000));
+	CHECK(fabsf(spice_adc_to_grams(1000, 5000, 133.245f, 13000, 9000)) < 0.01f, "empty jar removed weighs %f", spice_adc_to_grams(1000, 5000, 133.245f, 13000, 9000));
+	//Twice the jar's reading is a jar's worth of spice
+	CHECK(fabsf(spice_adc_to_grams(1000, 5000, 133.245f, 0, 8000) - 133.245f) < 0.01f, "full jar weighs %f", spice_adc_to_grams(1000, 5000, 133.245f, 0, 8000));
+
+	//More change in reading is never less mass, and the direction of the change doesn't matter
+	for(i=0;i<PROPERTY_CASES / 10;i++){
+		empty_rack = random_int(-100000, 100000);
+		empty_jar = empty_rack + random_int(1000, 200000);
+		jar_mass = random_float(50, 500);
+		base = random_int(-1000000, 1000000);
+		previous_grams = -INFINITY;
+		step = 0;
+		for(j=0;j<50;j++){
+			step = step + random_int(0, 2000);
+			grams = spice_adc_to_grams(empty_rack, empty_jar, jar_mass, base, base + step);
+			CHECK(grams >= previous_grams, "case %i: %f g at step %i is less than %f g", i, grams, step, previous_grams);
+			CHECK(grams == spice_adc_to_grams(empty_rack, empty_jar, jar_mass, base + step, base), "case %i: not symmetric at step %i", i, step);
+			previous_grams = grams;
+		}
+	}
+}
+
+static void test_fsr_to_slot(){
+	int slot;
+
+	for(slot=1;slot<=SNAPSHOT_MAX_SLOTS - 1;slot++){
+		CHECK(spice_fsr_to_slot(1 << (slot - 1), SNAPSHOT_MAX_SLOTS) == slot, "bit %i gives slot %i", slot - 1, spice_fsr_to_slot(1 << (slot - 1), SNAPSHOT_MAX_SLOTS));
+	}
+	//Two slots changing at once report the higher one
+	CHECK(spice_fsr_to_slot(0x5, 3) == 3, "0x5 gives %i", spice_fsr_to_slot(0x5, 3));
+	//Bits beyond the rack are passed through
+	CHECK(spice_fsr_to_slot(0x8, 3) == 0x8, "0x8 on a 3 slot rack gives %i", spice_fsr_to_slot(0x8, 3));
+}
+
+static void test_conversions(const char *file_name){
+	struct spice_conversion_table *table;
+	float grams;
+	float once;
+	float twice;
+	int row;
+	int i;
+
+	if((table = spice_conversions_load(file_name)) == NULL){
+		CHECK(0, "unable to load %s", file_name);
+		return;
+	}
+	CHECK(table->num_rows > 0, "no rows in %s", file_name);
+	for(i=0;i<table->num_rows;i++){
+		//Every name finds a row with that name, the first if it is listed twice
+		row = spice_conversion_lookup(table, table->rows[i].name);
+		CHECK(row != -1 && strcmp(table->rows[row].name, table->rows[i].name) == 0, "%s looks up row %i", table->rows[i].name, row);
+		//Conversion is linear and never negative
+		grams = random_float(0, 1000);
+		once = spice_conversions_convert(table, i, grams);
+		twice = spice_conversions_convert(table, i, 2 * grams);
+		CHECK(once >= 0, "%s: %f g converts to %f", table->rows[i].name, grams, once);
+		CHECK(fabsf(twice - 2 * once) <= 1e-3f * (1 + fabsf(twice)), "%s: not linear, %f then %f", table->rows[i].name, once, twice);
+	}
+	CHECK(spice_conversion_lookup(table, "") == -1, "empty name matched");
+	CHECK(spice_conversion_lookup(table, "Not a spice at all") == -1, "nonsense name matched");
+	//Part of a name matches the row it is part of
+	row = spice_conversion_lookup(table, "Cumin");
+	CHECK(row != -1 && strstr(table->rows[row].name, "Cumin") != NULL, "Cumin looks up row %i", row);
+	spice_conversions_free(table);
+}
+
+//Names built from a few words as on a spice label, in the case and with the separators people type. The
+//words share most of their trigrams, as real names do, which the index's trigram table is sized for.
+static void random_spice_name(char *name, int max_len){
+	static const char *words[] = {"ground", "smoked", "sea", "salt", "black", "pepper", "red", "chili", "seed", "sweet", "garlic", "onion"};
+	static const char *separators[] = {" ", "  ", "-", ", ", " ("};
+	int num_words = random_int(1, 3);
+	int len = 0;
+	int start;
+	int i;
+
+	for(i=0;i<num_words;i++){
+		if(i > 0){
+			len = len + snprintf(name + len, max_len - len, "%s", separators[random_int(0, 4)]);
+		}
+		start = len;
+		len = len + snprintf(name + len, max_len - len, "%s", words[random_int(0, 11)]);
+		if(random_int(0, 1) == 0){
+			name[start] = toupper((unsigned char)name[start]);
+		}
+	}
+}
+
+static void test_name_index(){
+	static const char *names[] = {"Annato Powder  (Achiote)", "Paprika", "Smoked Paprika", "Ground Cumin", "Cinnamon"};
+	static char added[PROPERTY_CASES / 4][NAME_TEST_LEN];
+	struct spice_name_match matches[NAME_TEST_MATCHES];
+	struct spice_name_index *index;
+	char normalized[SPICE_NAME_MAX_LEN];
+	int ids[PROPERTY_CASES / 4];
+	int num;
+	int i;
+	int j;
+
+	spice_name_normalize("Annato Powder  (Achiote)", normalized, sizeof(normalized));
+	CHECK(strcmp(normalized, "annato powder achiote") == 0, "normalized to %s", normalized);
+	spice_name_normalize("  --Salt!! ", normalized, sizeof(normalized));
+	CHECK(strcmp(normalized, "salt") == 0, "normalized to %s", normalized);
+
+	if((index = spice_name_index_create()) == NULL){
+		CHECK(0, "unable to create a name index");
+		return;
+	}
+	for(i=0;i<(int)(sizeof(names)/sizeof(names[0]));i++){
+		CHECK(spice_name_index_add(index, names[i], i) == 0, "%s not added", names[i]);
+		spice_name_index_add_derived_aliases(index, names[i], i);
+	}
+	spice_name_index_add_builtin_aliases(index);
+	//Exact lookups by canonical name, derived alias or built in alias
+	CHECK(spice_name_index_lookup(index, "annato powder achiote") == 0, "canonical name not found");
+	CHECK(spice_name_index_lookup(index, "ACHIOTE") == 0, "alias from inside the parentheses not found");
+	CHECK(spice_name_index_lookup(index, "Annato Powder") == 0, "alias from outside the parentheses not found");
+	CHECK(spice_name_index_lookup(index, "annatto") == 0, "built in alias annatto not found");
+	CHECK(spice_name_index_lookup(index, "Ground Cinnamon") == 4, "built in alias ground cinnamon not found");
+	CHECK(spice_name_index_lookup(index, "Papri") == -1, "prefix found as an exact match");
+	CHECK(spice_name_index_lookup(index, "") == -1, "empty name found");
+	//A name that normalizes to one already taken is refused and doesn't shadow it
+	CHECK(spice_name_index_add(index, "PAPRIKA!", 9) == -1, "duplicate name added");
+	CHECK(spice_name_index_add_alias(index, "smoked  paprika", 9) == -1, "alias shadowing a name added");
+	CHECK(spice_name_index_lookup(index, "Smoked Paprika") == 2, "shadowed name looks up %i", spice_name_index_lookup(index, "Smoked Paprika"));
+
+	//Mistyped and partial names
+	num = spice_name_index_suggest(index, "paprka", matches, NAME_TEST_MATCHES);
+	CHECK(num > 0 && matches[0].id == 1, "paprka suggests %i first", num > 0 ? matches[0].id : -1);
+	num = spice_name_index_suggest(index, "smoked", matches, NAME_TEST_MATCHES);
+	CHECK(num > 0 && matches[0].id == 2, "smoked suggests %i first", num > 0 ? matches[0].id : -1);
+	num = spice_name_index_suggest(index, "cumn", matches, NAME_TEST_MATCHES);
+	CHECK(num > 0 && matches[0].id == 3, "cumn suggests %i first", num > 0 ? matches[0].id : -1);
+	num = spice_name_index_suggest(index, "cinamon", matches, NAME_TEST_MATCHES);
+	CHECK(num > 0 && matches[0].id == 4, "cinamon suggests %i first", num > 0 ? matches[0].id : -1);
+	//Best first, one entry per id however many of its names match
+	num = spice_name_index_suggest(index, "annato paprika", matches, NAME_TEST_MATCHES);
+	CHECK(num >= 2, "annato paprika suggests %i names", num);
+	for(i=0;i<num;i++){
+		for(j=0;j<i;j++){
+			CHECK(matches[j].id != matches[i].id, "id %i suggested twice", matches[i].id);
+			CHECK(matches[j].score >= matches[i].score, "suggestion %i scores above %i", i, j);
+		}
+	}
+	CHECK(spice_name_index_suggest(index, "paprika", matches, 1) == 1, "more suggestions than asked for");
+	CHECK(spice_name_index_suggest(index, "zzzz", matches, NAME_TEST_MATCHES) == 0, "zzzz has suggestions");
+	CHECK(spice_name_index_suggest(index, "", matches, NAME_TEST_MATCHES) == 0, "empty query has suggestions");
+	spice_name_index_free(index);
+
+	//Every name added finds itself, exactly and as its own best suggestion
+	if((index = spice_name_index_create()) == NULL){
+		CHECK(0, "unable to create a name index");
+		return;
+	}
+	for(i=0;i<PROPERTY_CASES / 4;i++){
+		random_spice_name(added[i], NAME_TEST_LEN);
+		spice_name_normalize(added[i], normalized, sizeof(normalized));
+		//Names that normalize to one added before belong to that one
+		ids[i] = spice_name_index_add(index, added[i], i) == 0 ? i : spice_name_index_lookup(index, added[i]);
+		CHECK(normalized[0] == '\0' || ids[i] != -1, "case %i: %s neither added nor found", i, added[i]);
+	}
+	for(i=0;i<PROPERTY_CASES / 4;i++){
+		if(ids[i] == -1){
+			continue;
+		}
+		CHECK(spice_name_index_lookup(index, added[i]) == ids[i], "case %i: %s looks up %i", i, added[i], spice_name_index_lookup(index, added[i]));
+		num = spice_name_index_suggest(index, added[i], matches, NAME_TEST_MATCHES);
+		CHECK(num > 0 && matches[0].id == ids[i], "case %i: %s suggests %i first", i, added[i], num > 0 ? matches[0].id : -1);
+	}
+	spice_name_index_free(index);
+}
+
+static void random_snapshot(struct inventory_snapshot *snapshot){
+	struct inventory_slot *slot;
+	int i;
+
+	memset(snapshot, 0, sizeof(struct inventory_snapshot));
+	snapshot->version = next_random();
+	snapshot->taken = (int64_t)(next_random() >> 1);
+	snapshot->num_slots = random_int(1, SNAPSHOT_MAX_SLOTS);
+	snapshot->health = random_int(SNAPSHOT_HEALTH_OK, SNAPSHOT_HEALTH_FAILED);
+	snapshot->faults = random_int(0, SNAPSHOT_FAULT_WEIGHT | SNAPSHOT_FAULT_SLOTS);
+	for(i=0;i<snapshot->num_slots;i++){
+		slot = &snapshot->slots[i];
+		slot->slot = i + 1;
+		random_name(slot->name, SNAPSHOT_NAME_LEN);
+		snprintf(slot->unit, SNAPSHOT_UNIT_LEN, "%s", random_int(0, 1) ? "tsp" : "count");
+		slot->grams = random_float(-200, 2000);
+		slot->quantity = random_float(0, 500);
+		slot->days_left = random_int(0, 3) == 0 ? -1 : random_float(0, 365);
+		slot->low_stock = random_int(0, 1);
+		slot->adc = random_int(-8388608, 8388607);
+	}
+}
+
+//Snapshots from two runs of the app can share a version. The cache must not hand out one's rendering for
+//the other.
+static void test_snapshot_cache(){
+	static struct snapshot_cache cache;
+	struct inventory_snapshot snapshots[2];
+	char expected[SNAPSHOT_BUFFER_SIZE];
+	char buf[SNAPSHOT_BUFFER_SIZE];
+	int expected_len;
+	int len;
+	int format;
+	int i;
+	int j;
+
+	if(snapshot_cache_init(&cache) != 0){
+		CHECK(0, "unable to init the snapshot cache");
+		return;
+	}
+	for(i=0;i<PROPERTY_CASES / 20;i++){
+		random_snapshot(&snapshots[0]);
+		random_snapshot(&snapshots[1]);
+		snapshots[1].version = snapshots[0].version;
+		snapshots[1].taken = snapshots[0].taken + random_int(1, 86400);
+		for(j=0;j<4;j++){
+			for(format=0;format<SNAPSHOT_NUM_FORMATS;format++){
+				expected_len = snapshot_serialize(&snapshots[j % 2], format, expected, sizeof(expected));
+				len = snapshot_cache_render(&cache, &snapshots[j % 2], format, buf, sizeof(buf));
+				CHECK(len == expected_len && memcmp(buf, expected, len) == 0, "case %i render %i of format %i is stale", i, j, format);
+			}
+		}
+	}
+	snapshot_cache_destroy(&cache);
+}
+
+static void test_snapshot_round_trip(){
+	struct inventory_snapshot snapshot;
+	struct inventory_snapshot decoded;
+	char buf[SNAPSHOT_BUFFER_SIZE];
+	int len;
+	int format;
+	int i;
+
+	for(i=0;i<PROPERTY_CASES / 4;i++){
+		random_snapshot(&snapshot);
+		len = snapshot_serialize(&snapshot, SNAPSHOT_BINARY, buf, sizeof(buf));
+		CHECK(len == SNAPSHOT_HEADER_SIZE + snapshot.num_slots * SNAPSHOT_RECORD_SIZE, "case %i binary length %i", i, len);
+		CHECK(snapshot_decode(buf, len, &decoded) == 0, "case %i does not decode", i);
+		CHECK(memcmp(&snapshot, &decoded, sizeof(snapshot)) == 0, "case %i decodes differently", i);
+		//A cut off file never decodes
+		CHECK(snapshot_decode(buf, len - 1, &decoded) == -1, "case %i decodes when truncated", i);
+		//Every format fits the buffer every reader uses
+		for(format=0;format<SNAPSHOT_NUM_FORMATS;format++){
+			CHECK(snapshot_serialize(&snapshot, format, buf, sizeof(buf)) > 0, "case %i doesn't fit as %i", i, format);
+		}
+	}
+	//Healthy text output is the consolidated file format clients have always read
+	memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.num_slots = 1;
+	snprintf(snapshot.slots[0].name, SNAPSHOT_NAME_LEN, "Paprika");
+	snprintf(snapshot.slots[0].unit, SNAPSHOT_UNIT_LEN, "tsp");
+	snapshot.slots[0].quantity = 13.2f;
+	snapshot.slots[0].days_left = -1;
+	snapshot_serialize(&snapshot, SNAPSHOT_TEXT, buf, sizeof(buf));
+	CHECK(strcmp(buf, "Paprika - 13.200000tsp\n") == 0, "text output %s", buf);
+	snapshot.health = SNAPSHOT_HEALTH_FAILED;
+	snapshot.faults = SNAPSHOT_FAULT_WEIGHT;
+	snapshot_serialize(&snapshot, SNAPSHOT_TEXT, buf, sizeof(buf));
+	CHECK(strstr(buf, "SENSOR FAILURE: weight sensor\n") != NULL, "failed sensor missing from %s", buf);
+}
+
+//The next version of snapshot, with the values of some slots changed but no names or units
+static void change_snapshot(const struct inventory_snapshot *snapshot, struct inventory_snapshot *next){
+	struct inventory_slot *slot;
+	int i;
+
+	*next = *snapshot;
+	next->version = snapshot->version + 1;
+	next->health = random_int(SNAPSHOT_HEALTH_OK, SNAPSHOT_HEALTH_FAILED);
+	next->faults = random_int(0, SNAPSHOT_FAULT_WEIGHT | SNAPSHOT_FAULT_SLOTS);
+	for(i=0;i<next->num_slots;i++){
+		if(random_int(0, 2) == 0){
+			slot = &next->slots[i];
+			slot->grams = random_float(-200, 2000);
+			slot->quantity = random_float(0, 500);
+			slot->days_left = random_int(0, 3) == 0 ? -1 : random_float(0, 365);
+			slot->low_stock = random_int(0, 1);
+		}
+	}
+}
+
+static int listener_holds(const struct multicast_listener *listener, const struct inventory_snapshot *snapshot){
+	return listener->snapshot.version == snapshot->version && listener->snapshot.health == snapshot->health &&
+		listener->snapshot.faults == snapshot->faults && listener->snapshot.num_slots == snapshot->num_slots &&
+		memcmp(listener->snapshot.slots, snapshot->slots, sizeof(snapshot->slots)) == 0;
+}
+
+static void test_multicast(){
+	static struct multicast_listener listener;
+	struct inventory_snapshot versions[4];
+	char buf[MULTICAST_MAX_DATAGRAM];
+	int len;
+	int ret;
+	int i;
+
+	for(i=0;i<PROPERTY_CASES / 4;i++){
+		random_snapshot(&versions[0]);
+		versions[0].version = versions[0].version >> 1;
+		change_snapshot(&versions[0], &versions[1]);
+		change_snapshot(&versions[1], &versions[2]);
+		change_snapshot(&versions[2], &versions[3]);
+		memset(&listener, 0, sizeof(listener));
+		//Nothing can be applied until a snapshot has been fetched
+		len = multicast_encode(&versions[0], NULL, 0, buf, sizeof(buf));
+		CHECK(len == MULTICAST_HEADER_SIZE + versions[0].num_slots * MULTICAST_RECORD_SIZE, "case %i heartbeat length %i", i, len);
+		CHECK(multicast_listener_apply(&listener, buf, len) == MULTICAST_NEED_SNAPSHOT, "case %i applied without a snapshot", i);
+		multicast_listener_reset(&listener, &versions[0]);
+		CHECK(multicast_listener_apply(&listener, buf, len) == MULTICAST_CURRENT, "case %i heartbeat not current", i);
+		//An update brings the listener to exactly the new version
+		len = multicast_encode(&versions[1], &versions[0], 1, buf, sizeof(buf));
+		CHECK(multicast_listener_apply(&listener, buf, len - 1) == -1, "case %i applies when truncated", i);
+		ret = multicast_listener_apply(&listener, buf, len);
+		CHECK(ret == MULTICAST_APPLIED && listener_holds(&listener, &versions[1]), "case %i update gives %i", i, ret);
+		CHECK(multicast_listener_apply(&listener, buf, len) == MULTICAST_CURRENT, "case %i repeat applied", i);
+		//A lost update is counted, and the one after it can't be applied
+		len = multicast_encode(&versions[3], &versions[2], 3, buf, sizeof(buf));
+		ret = multicast_listener_apply(&listener, buf, len);
+		CHECK(ret == MULTICAST_NEED_SNAPSHOT && listener.lost == 1, "case %i gap gives %i, %lu lost", i, ret, listener.lost);
+		//As does a heartbeat for a version the listener doesn't have
+		len = multicast_encode(&versions[3], NULL, 4, buf, sizeof(buf));
+		CHECK(multicast_listener_apply(&listener, buf, len) == MULTICAST_NEED_SNAPSHOT, "case %i newer heartbeat current", i);
+		multicast_listener_reset(&listener, &versions[3]);
+		CHECK(multicast_listener_apply(&listener, buf, len) == MULTICAST_CURRENT && listener_holds(&listener, &versions[3]), "case %i reset", i);
+	}
+	//A renamed slot has to be fetched, as names aren't sent
+	random_snapshot(&versions[0]);
+	change_snapshot(&versions[0], &versions[1]);
+	snprintf(versions[1].slots[0].name, SNAPSHOT_NAME_LEN, "%s", versions[0].slots[0].name[0] == 'X' ? "Y" : "X");
+	memset(&listener, 0, sizeof(listener));
+	multicast_listener_reset(&listener, &versions[0]);
+	len = multicast_encode(&versions[1], &versions[0], 0, buf, sizeof(buf));
+	CHECK(multicast_listener_apply(&listener, buf, len) == MULTICAST_NEED_SNAPSHOT, "rename applied");
+	CHECK(multicast_encode(&versions[1], NULL, 0, buf, MULTICAST_HEADER_SIZE) == -1, "encoded into too small a buffer");
+}
+
+static void test_health(){
+	struct device_health device;
+	int i;
+
+	health_init(&device, "test", 5);
+	for(i=0;i<HEALTH_WINDOW;i++){
+		health_record_read(&device, i);
+	}
+	CHECK(device.state == HEALTH_OK, "varying readings are %s", health_state_name(device.state));
+	//One failure in the window is noise
+	health_record_error(&device);
+	CHECK(device.state == HEALTH_OK && health_error_rate(&device) == 100 / HEALTH_WINDOW, "one error gives %s at %i%%", health_state_name(device.state), health_error_rate(&device));
+	for(i=0;i<HEALTH_FAIL_STREAK;i++){
+		health_record_error(&device);
+	}
+	CHECK(device.state == HEALTH_FAILED, "%i errors in a row give %s", HEALTH_FAIL_STREAK + 1, health_state_name(device.state));
+	//Recovering, but still too many errors in the window
+	health_record_read(&device, 1);
+	CHECK(device.state == HEALTH_DEGRADED, "first good read after failing gives %s", health_state_name(device.state));
+	for(i=0;i<HEALTH_WINDOW;i++){
+		health_record_read(&device, i + 2);
+	}
+	CHECK(device.state == HEALTH_OK, "a clean window gives %s", health_state_name(device.state));
+	for(i=0;i<5;i++){
+		health_record_read(&device, 42);
+	}
+	CHECK(device.state == HEALTH_DEGRADED && health_is_stuck(&device), "5 identical readings give %s", health_state_name(device.state));
+	health_record_read(&device, 43);
+	CHECK(device.state == HEALTH_OK, "a new value after sticking gives %s", health_state_name(device.state));
+	//Devices expected to hold a value never stick
+	health_init(&device, "fsr", 0);
+	for(i=0;i<1000;i++){
+		health_record_read(&device, 0);
+	}
+	CHECK(device.state == HEALTH_OK, "constant FSR gives %s", health_state_name(device.state));
+}
+
+static void test_adc_known_values(){
+	static const unsigned char packed[] = {0xff, 0xff, 0xff, 0x80, 0x00, 0x00, 0x7f, 0xff, 0xff, 0x00, 0x23, 0x28};
+	static const unsigned char word[] = {0x00, 0x23, 0x28, 0x00, 0xff, 0xff, 0xff, 0x00};
+	struct adc_scan_type type;
+	int32_t samples[4];
+	int32_t value;
+
+	CHECK(adc_parse_scan_type("be:s24/32>>8", &type) == 0 && type.big_endian && type.is_signed && type.real_bits == 24 &&
+		type.storage_bits == 32 && type.shift == 8, "be:s24/32>>8 parsed wrong");
+	CHECK(adc_parse_scan_type("le:u12/16>>4", &type) == 0 && !type.big_endian && !type.is_signed && type.shift == 4, "le:u12/16>>4 parsed wrong");
+	CHECK(adc_parse_scan_type("be:s24/24", &type) == 0 && type.shift == 0, "be:s24/24 parsed wrong");
+	CHECK(adc_parse_scan_type("le:u32/32>>0", &type) == -1, "unsigned 32 bit accepted");
+	CHECK(adc_parse_scan_type("be:s24/32>>12", &type) == -1, "shift past the storage accepted");
+	CHECK(adc_parse_scan_type("xe:s24/32", &type) == -1, "bad endianness accepted");
+	CHECK(adc_parse_scan_type("be:s24/64", &type) == -1, "64 bit storage accepted");
+
+	adc_parse_scan_type("be:s24/24", &type);
+	CHECK(adc_decode(packed, sizeof(packed), &type, samples, 4) == 4, "packed samples not all decoded");
+	CHECK(samples[0] == -1 && samples[1] == -8388608 && samples[2] == 8388607 && samples[3] == 9000, "packed decoded to %i %i %i %i",
+		samples[0], samples[1], samples[2], samples[3]);
+	adc_parse_scan_type("be:s24/32>>8", &type);
+	CHECK(adc_decode(word, sizeof(word), &type, samples, 4) == 2 && samples[0] == 9000 && samples[1] == -1, "words decoded to %i %i", samples[0], samples[1]);
+	CHECK(adc_decode(word, sizeof(word) - 1, &type, samples, 4) == 1, "part of a sample decoded");
+
+	CHECK(adc_parse_text("9000\n", 5, &value) == 0 && value == 9000, "9000 parsed as %i", value);
+	CHECK(adc_parse_text("-8388608\n", 9, &value) == 0 && value == -8388608, "negative parsed as %i", value);
+	CHECK(adc_parse_text("123\0\0\0\0", 8, &value) == 0 && value == 123, "NUL padded parsed as %i", value);
+	CHECK(adc_parse_text("1234", 2, &value) == 0 && value == 12, "length ignored, %i", value);
+	CHECK(adc_parse_text("\n", 1, &value) == -1, "empty reading accepted");
+	CHECK(adc_parse_text("12a\n", 4, &value) == -1, "junk accepted");
+	CHECK(adc_parse_text("2147483648\n", 11, &value) == -1, "overflow accepted");
+}
+
+//Every kernel this CPU can run decodes and summarises exactly as the plain C does, whatever the length
+static void test_adc_kernels(){
+	static const char *const kernels[] = {"avx2", "sse4.1", "neon"};
+	static const char *const types[] = {"be:s24/32>>8", "le:s24/32>>0", "le:u12/16>>4", "be:s24/24", "le:u20/24>>2", "be:s32/32"};
+	static unsigned char raw[ADC_TEST_SAMPLES * 4];
+	static int32_t expected[ADC_TEST_SAMPLES];
+	static int32_t decoded[ADC_TEST_SAMPLES];
+	struct adc_stats expected_stats;
+	struct adc_stats stats;
+	struct adc_scan_type type;
+	const char *best = adc_kernel_name();
+	unsigned int k;
+	unsigned int t;
+	int num;
+	int i;
+
+	for(k=0;k<sizeof(kernels)/sizeof(kernels[0]);k++){
+		if(adc_use_kernel(kernels[k]) != 0){
+			printf("%s kernel not available, skipped\n", kernels[k]);
+			continue;
+		}
+		for(i=0;i<50;i++){
+			num = i < 40 ? i : random_int(40, ADC_TEST_SAMPLES);
+			for(t=0;t<sizeof(raw);t++){
+				raw[t] = next_random();
+			}
+			for(t=0;t<sizeof(types)/sizeof(types[0]);t++){
+				adc_parse_scan_type(types[t], &type);
+				adc_use_kernel("scalar");
+				adc_decode(raw, num * adc_sample_size(&type), &type, expected, num);
+				adc_use_kernel(kernels[k]);
+				CHECK(adc_decode(raw, num * adc_sample_size(&type), &type, decoded, num) == num, "%s %s decoded short", kernels[k], types[t]);
+				CHECK(memcmp(expected, decoded, num * sizeof(int32_t)) == 0, "%s decodes %s differently with %i samples", kernels[k], types[t], num);
+			}
+			//24 bit readings around a load, as the HX711 gives
+			for(t=0;t<(unsigned int)num;t++){
+				expected[t] = random_int(-8388608, 8388607) / (i % 7 + 1);
+			}
+			adc_use_kernel("scalar");
+			adc_compute_stats(expected, num, &expected_stats);
+			adc_use_kernel(kernels[k]);
+			adc_compute_stats(expected, num, &stats);
+			CHECK(memcmp(&expected_stats, &stats, sizeof(stats)) == 0, "%s stats differ with %i samples", kernels[k], num);
+		}
+	}
+	adc_use_kernel(best);
+}
+
+static void test_adc_stats(){
+	static const int32_t samples[] = {8000010, 8000020, 8000030, 8000040};
+	int32_t many[ADC_TEST_SAMPLES];
+	struct adc_stats stats;
+	int i;
+
+	adc_compute_stats(samples, 4, &stats);
+	CHECK(stats.count == 4 && stats.min == 8000010 && stats.max == 8000040 && stats.sum == 32000100, "stats of 4 wrong");
+	CHECK(fabs(stats.mean - 8000025) < 1e-6 && fabs(stats.variance - 125) < 1e-6, "mean %f variance %f", stats.mean, stats.variance);
+	adc_compute_stats(samples, 0, &stats);
+	CHECK(stats.count == 0 && stats.sum == 0, "empty stats not zero");
+	//A constant reading has no spread, across chunk boundaries too
+	for(i=0;i<ADC_TEST_SAMPLES;i++){
+		many[i] = -8388608;
+	}
+	adc_compute_stats(many, ADC_TEST_SAMPLES, &stats);
+	CHECK(stats.variance == 0 && stats.sum == -8388608LL * ADC_TEST_SAMPLES, "constant samples variance %f", stats.variance);
+}
+
+//Removes a scratch directory and everything under it
+static void remove_tree(const char *dir){
+	struct dirent *entry;
+	char path[PATH_MAX];
+	DIR *scratch;
+
+	if((scratch = opendir(dir)) != NULL){
+		while((entry = readdir(scratch)) != NULL){
+			if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0){
+				continue;
+			}
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			if(remove(path) != 0){
+				remove_tree(path);
+			}
+		}
+		closedir(scratch);
+	}
+	remove(dir);
+}
+
+static int count_chunks(const char *slot_dir){
+	struct dirent *entry;
+	DIR *dir;
+	int count = 0;
+
+	if((dir = opendir(slot_dir)) == NULL){
+		return -1;
+	}
+	while((entry = readdir(dir)) != NULL){
+		count = count + (strncmp(entry->d_name, "raw-", 4) == 0);
+	}
+	closedir(dir);
+	return count;
+}
+
+static int same_grams(float grams, int32_t centigrams){
+	return lrintf(grams * 100) == centigrams;
+}
+
+//Known bytes for a few samples: zigzag varint deltas of time and centigrams after the chunk header
+static void test_history_encoding(const char *dir){
+	static const unsigned char expected[] = {0x00, 0x00, 0x02, 0x01, 0x80, 0x01, 0x80, 0x01};
+	unsigned char chunk[sizeof(struct history_chunk_header) + sizeof(expected)];
+	struct history_chunk_header *header = (struct history_chunk_header *)chunk;
+	struct history_point points[4];
+	struct history_store *store;
+	char path[PATH_MAX];
+	//On a minute boundary, 14 minutes into the hour
+	time_t start = 1700000040;
+	FILE *file;
+	int num;
+
+	if((store = history_open(dir, 1)) == NULL){
+		CHECK(0, "unable to open history in %s", dir);
+		return;
+	}
+	CHECK(history_append(store, 1, start, 1.00f) == 0, "first sample not stored");
+	CHECK(history_append(store, 1, start + 1, 0.99f) == 0, "second sample not stored");
+	CHECK(history_append(store, 1, start + 65, 1.63f) == 0, "third sample not stored");
+	CHECK(history_append(store, 2, start, 1.00f) == -1, "sample stored for a slot the store doesn't have");
+	history_close(store);
+
+	snprintf(path, sizeof(path), "%s/slot1/raw-0.chk", dir);
+	if((file = fopen(path, "rb")) == NULL || fread(chunk, sizeof(chunk), 1, file) != 1){
+		CHECK(0, "unable to read %s", path);
+	}
+	else{
+		CHECK(memcmp(header->magic, "SRHC", 4) == 0 && header->slot == 1 && header->count == 3, "chunk header wrong");
+		CHECK(header->used == sizeof(expected), "chunk uses %u bytes", header->used);
+		CHECK(header->base_time == start && header->base_value == 100, "chunk base %lli %i", (long long)header->base_time, header->base_value);
+		CHECK(header->last_time == start + 65 && header->last_value == 163, "chunk last %lli %i", (long long)header->last_time, header->last_value);
+		CHECK(memcmp(chunk + sizeof(struct history_chunk_header), expected, sizeof(expected)) == 0, "samples encoded differently");
+	}
+	if(file != NULL){
+		fclose(file);
+	}
+
+	num = history_query(dir, 1, HISTORY_RAW, start, start + 65, points, 4);
+	CHECK(num == 3, "%i raw points", num);
+	CHECK(num == 3 && points[1].time == start + 1 && same_grams(points[1].last, 99) && same_grams(points[2].last, 163), "raw points decode differently");
+	num = history_query(dir, 1, HISTORY_RAW, start + 1, start + 64, points, 4);
+	CHECK(num == 1 && points[0].time == start + 1, "%i raw points inside the range", num);
+	num = history_query(dir, 1, HISTORY_MINUTE, start, start + 65, points, 4);
+	CHECK(num == 2, "%i minute points", num);
+	CHECK(num == 2 && points[0].time == start && points[0].count == 2 && same_grams(points[0].min, 99) && same_grams(points[0].max, 100) &&
+		fabsf(points[0].avg - 0.995f) < 1e-4f && same_grams(points[0].last, 99), "first minute rolled up wrong");
+	CHECK(num == 2 && points[1].time == start + 60 && points[1].count == 1 && same_grams(points[1].avg, 163), "second minute rolled up wrong");
+	num = history_query(dir, 1, HISTORY_HOUR, start, start + 65, points, 4);
+	CHECK(num == 1 && points[0].time == start - 840 && points[0].count == 3 && same_grams(points[0].min, 99) && same_grams(points[0].max, 163) &&
+		fabsf(points[0].avg - 3.62f / 3) < 1e-4f && same_grams(points[0].last, 163), "hour rolled up wrong");
+	//A from far in the past, or before 1970, still finds the same points
+	num = history_query(dir, 1, HISTORY_MINUTE, INT64_MIN, start + 65, points, 4);
+	CHECK(num == 2 && points[0].time == start && points[1].time == start + 60, "%i minute points from the far past", num);
+	num = history_query(dir, 1, HISTORY_RAW, INT64_MIN, INT64_MAX, points, 4);
+	CHECK(num == 3, "%i raw points over every time", num);
+	num = history_query(dir, 1, HISTORY_DAY, -86400, start + 65, points, 4);
+	CHECK(num == 1 && points[0].count == 3, "%i day points from before 1970", num);
+	CHECK(history_query(dir, 1, HISTORY_HOUR, -7200, -3600, points, 4) == 0, "points found before 1970");
+	CHECK(history_query(dir, 1, HISTORY_NUM_RESOLUTIONS, start, start + 65, points, 4) == -1, "unknown resolution queried");
+	CHECK(history_resolution_from_string("hour") == HISTORY_HOUR && history_resolution_from_string("week") == -1, "resolution names");
+}
+
+//Checks one resolution's rollups of samples against the store. Only the buckets from the ring's last lap
+//are still on disk.
+static void check_rollups(const char *dir, int resolution, int64_t width, int64_t capacity, const time_t *times, const int32_t *values, int num_samples, struct history_point *points){
+	int64_t first = times[num_samples-1] - times[num_samples-1] % width - (capacity - 1) * width;
+	int64_t bucket;
+	int64_t current = 0;
+	int64_t sum = 0;
+	int32_t min = 0;
+	int32_t max = 0;
+	int count = 0;
+	int num;
+	int point = 0;
+	int i;
+
+	num = history_query(dir, 2, resolution, times[0], times[num_samples-1], points, num_samples);
+	for(i=0;i<=num_samples;i++){
+		bucket = i < num_samples ? times[i] - times[i] % width : -1;
+		if(count > 0 && bucket != current){
+			CHECK(point < num && points[point].time == current && points[point].count == (uint32_t)count && same_grams(points[point].min, min) &&
+				same_grams(points[point].max, max) && same_grams(points[point].last, values[i-1]) && fabs(points[point].avg - sum / 100.0 / count) < 1e-2,
+				"resolution %i bucket %lli rolled up wrong", resolution, (long long)current);
+			point++;
+			count = 0;
+		}
+		if(i == num_samples || bucket < first){
+			continue;
+		}
+		if(count == 0){
+			current = bucket;
+			sum = 0;
+			min = values[i];
+			max = values[i];
+		}
+		sum = sum + values[i];
+		min = values[i] < min ? values[i] : min;
+		max = values[i] > max ? values[i] : max;
+		count++;
+	}
+	CHECK(num == point, "resolution %i has %i points, expected %i", resolution, num, point);
+}
+
+//A random walk of weighings, with bursts, long gaps and jars swapped, written across several chunks and
+//reopened part way, reads back sample for sample and rolls up to what the samples add up to
+static void test_history_round_trip(const char *dir){
+	static time_t times[HISTORY_TEST_SAMPLES];
+	static int32_t values[HISTORY_TEST_SAMPLES];
+	static struct history_point points[HISTORY_TEST_SAMPLES];
+	struct history_store *store;
+	char path[PATH_MAX];
+	float grams = 250;
+	time_t from;
+	time_t to;
+	int expected;
+	int num;
+	int i;
+	int j;
+
+	if((store = history_open(dir, 2)) == NULL){
+		CHECK(0, "unable to open history in %s", dir);
+		return;
+	}
+	times[0] = 1690000000;
+	for(i=0;i<HISTORY_TEST_SAMPLES;i++){
+		if(i > 0){
+			times[i] = times[i-1] + (random_int(0, 19) == 0 ? random_int(0, 20000) : random_int(0, 90));
+		}
+		grams = random_int(0, 49) == 0 ? random_float(-5000, 50000) : grams + random_float(-2, 2);
+		values[i] = lrintf(grams * 100);
+		CHECK(history_append(store, 2, times[i], grams) == 0, "sample %i not stored", i);
+		if(i % (HISTORY_TEST_SAMPLES / 4) == 0){
+			history_close(store);
+			if((store = history_open(dir, 2)) == NULL){
+				CHECK(0, "unable to reopen history in %s", dir);
+				return;
+			}
+		}
+	}
+	history_close(store);
+	snprintf(path, sizeof(path), "%s/slot2", dir);
+	CHECK(count_chunks(path) > 1, "samples fit in %i chunk", count_chunks(path));
+
+	num = history_query(dir, 2, HISTORY_RAW, times[0], times[HISTORY_TEST_SAMPLES-1], points, HISTORY_TEST_SAMPLES);
+	CHECK(num == HISTORY_TEST_SAMPLES, "%i of %i samples read back", num, HISTORY_TEST_SAMPLES);
+	for(i=0;i<num;i++){
+		CHECK(points[i].time == times[i] && points[i].count == 1 && same_grams(points[i].last, values[i]),
+			"sample %i read back as %lli %f, stored %lli %i", i, (long long)points[i].time, points[i].last, (long long)times[i], values[i]);
+	}
+	for(i=0;i<PROPERTY_CASES / 40;i++){
+		from = times[0] + random_int(0, times[HISTORY_TEST_SAMPLES-1] - times[0]);
+		to = from + random_int(0, 100000);
+		for(expected=0, j=0;j<HISTORY_TEST_SAMPLES;j++){
+			expected = expected + (times[j] >= from && times[j] <= to);
+		}
+		num = history_query(dir, 2, HISTORY_RAW, from, to, points, HISTORY_TEST_SAMPLES);
+		CHECK(num == expected, "range %lli-%lli has %i samples, expected %i", (long long)from, (long long)to, num, expected);
+	}
+	//Minutes wrap the ring over the weeks the walk covers, hours and days don't
+	check_rollups(dir, HISTORY_MINUTE, 60, HISTORY_MINUTE_BUCKETS, times, values, HISTORY_TEST_SAMPLES, points);
+	check_rollups(dir, HISTORY_HOUR, 3600, HISTORY_HOUR_BUCKETS, times, values, HISTORY_TEST_SAMPLES, points);
+	check_rollups(dir, HISTORY_DAY, 86400, HISTORY_DAY_BUCKETS, times, values, HISTORY_TEST_SAMPLES, points);
+}
+
+//Big swings fill chunks fast. Once there are more than HISTORY_RAW_CHUNKS the oldest are dropped and what
+//is left reads back as the newest samples, in order.
+static void test_history_retention(const char *dir){
+	static struct history_point points[HISTORY_RETENTION_SAMPLES];
+	struct history_store *store;
+	char path[PATH_MAX];
+	time_t start = 1690000000;
+	int num;
+	int i;
+
+	if((store = history_open(dir, 1)) == NULL){
+		CHECK(0, "unable to open history in %s", dir);
+		return;
+	}
+	for(i=0;i<HISTORY_RETENTION_SAMPLES;i++){
+		history_append(store, 1, start + i, i % 2 == 0 ? -20000000.0f : 20000000.0f);
+	}
+	history_close(store);
+	snprintf(path, sizeof(path), "%s/slot1", dir);
+	CHECK(count_chunks(path) == HISTORY_RAW_CHUNKS, "%i chunks kept", count_chunks(path));
+	num = history_query(dir, 1, HISTORY_RAW, start, start + HISTORY_RETENTION_SAMPLES, points, HISTORY_RETENTION_SAMPLES);
+	CHECK(num > 0 && num < HISTORY_RETENTION_SAMPLES, "%i of %i samples kept", num, HISTORY_RETENTION_SAMPLES);
+	for(i=0;i<num;i++){
+		if(points[i].time != start + HISTORY_RETENTION_SAMPLES - num + i){
+			CHECK(0, "kept sample %i is from %lli", i, (long long)points[i].time);
+			break;
+		}
+	}
+	CHECK(num > 0 && same_grams(points[num-1].last, 2000000000), "newest sample reads back as %f", num > 0 ? points[num-1].last : 0);
+}
+
+static void test_history(){
+	char dir[] = "/tmp/spice_rack_tests.XXXXXX";
+	char path[PATH_MAX];
+
+	if(mkdtemp(dir) == NULL){
+		CHECK(0, "unable to create a scratch directory");
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/encoding", dir);
+	test_history_encoding(path);
+	snprintf(path, sizeof(path), "%s/round_trip", dir);
+	test_history_round_trip(path);
+	snprintf(path, sizeof(path), "%s/retention", dir);
+	test_history_retention(path);
+	remove_tree(dir);
+}
+
+struct test_config{
+	int number;
+	float ratio;
+	char name[32];
+	int restart_only;
+};
+
+static const struct config_option test_options[] = {
+	CONFIG_INT_OPTION(struct test_config, number, CONFIG_RELOAD, 0, 100),
+	CONFIG_FLOAT_OPTION(struct test_config, ratio, CONFIG_RELOAD, 0, 1),
+	CONFIG_STRING_OPTION(struct test_config, name, CONFIG_RELOAD),
+	CONFIG_INT_OPTION(struct test_config, restart_only, CONFIG_RESTART, 1, 10),
+};
+#define NUM_TEST_OPTIONS (int)(sizeof(test_options) / sizeof(test_options[0]))
+
+static int write_file(const char *path, const char *contents){
+	FILE *file;
+
+	if((file = fopen(path, "w")) == NULL){
+		return -1;
+	}
+	fputs(contents, file);
+	return fclose(file);
+}
+
+//Known answers for each kind of line, which section a line belongs to and restart-only options on a reload.
+//The bad lines are reported on stdout as they would be at start.
+static void test_config(){
+	static const struct test_config defaults = {1, 0.125f, "default", 1};
+	struct test_config config;
+	struct test_config running;
+	char dir[] = "/tmp/spice_rack_tests.XXXXXX";
+	char path[PATH_MAX];
+	int changed;
+
+	if(mkdtemp(dir) == NULL){
+		CHECK(0, "unable to create a scratch directory");
+		return;
+	}
+	snprintf(path, sizeof(path), "%s/test.conf", dir);
+	write_file(path,
+		"# comment\n"
+		"\n"
+		"number = 7   # trailing comment\n"
+		"  name = \"  spaced # kept  \"   # comment after the quote\n"
+		"ratio=0.5\n"
+		"restart_only = 3\n"
+		"number = 1000\n"
+		"bogus = 1\n"
+		"name = \"unterminated\n"
+		"no separator\n"
+		"[rack2]\n"
+		"number = 42\n"
+		"name = \"rack \"two\"\"\n"
+		"[other]\n"
+		"number = 99\n"
+		"[ rack2 ]\n"
+		"ratio = 0.25\n");
+
+	config = defaults;
+	changed = config_load(path, NULL, test_options, NUM_TEST_OPTIONS, &config, NULL);
+	CHECK(changed == 4, "%i global options changed", changed);
+	CHECK(config.number == 7, "number %i, out of range value not skipped", config.number);
+	CHECK(strcmp(config.name, "  spaced # kept  ") == 0, "quoted name [%s]", config.name);
+	CHECK(config.ratio == 0.5f && config.restart_only == 3, "ratio %f restart_only %i", config.ratio, config.restart_only);
+	//Loading the same file again changes nothing
+	CHECK(config_load(path, NULL, test_options, NUM_TEST_OPTIONS, &config, NULL) == 0, "second load changed options");
+
+	//A section builds on the global settings and may be split across the file
+	running = config;
+	changed = config_load(path, "rack2", test_options, NUM_TEST_OPTIONS, &running, NULL);
+	CHECK(changed == 3 && running.number == 42 && running.ratio == 0.25f && strcmp(running.name, "rack \"two\"") == 0,
+		"rack2 changed %i to %i %f %s", changed, running.number, running.ratio, running.name);
+	running = config;
+	CHECK(config_load(path, "missing", test_options, NUM_TEST_OPTIONS, &running, NULL) == 0 && memcmp(&running, &config, sizeof(config)) == 0,
+		"section not in the file changed options");
+	CHECK(config_load("/nonexistent/test.conf", NULL, test_options, NUM_TEST_OPTIONS, &running, NULL) == -1, "missing file loaded");
+
+	//On a reload restart-only options keep their running values, in one section or built from several
+	write_file(path, "number = 8\nrestart_only = 5\n");
+	running = config;
+	changed = config_load(path, NULL, test_options, NUM_TEST_OPTIONS, &config, &running);
+	CHECK(changed == 1 && config.number == 8 && config.restart_only == 3, "reload changed %i to %i %i", changed, config.number, config.restart_only);
+	config = defaults;
+	config_load(path, NULL, test_options, NUM_TEST_OPTIONS, &config, NULL);
+	CHECK(config.restart_only == 5, "restart_only %i on first load", config.restart_only);
+	CHECK(config_keep_restart_options(test_options, NUM_TEST_OPTIONS, &config, &running, "test") == 1 && config.restart_only == 3 && config.number == 8,
+		"restart_only %i number %i after keeping restart options", config.restart_only, config.number);
+	CHECK(config_keep_restart_options(test_options, NUM_TEST_OPTIONS, &config, &running, "test") == 0, "unchanged restart options counted");
+	remove_tree(dir);
+}
+
+int main(int argc, char *argv[]){
+	const char *conversions_file = argc > 1 ? argv[1] : "spice_conversions.csv";
+
+	if(getenv("SPICE_TEST_SEED") != NULL){
+		seed = strtoull(getenv("SPICE_TEST_SEED"), NULL, 0);
+	}
+	test_parse_known_line();
+	test_location();
+	test_format_parse_round_trip();
+	test_adc_to_grams();
+	test_fsr_to_slot();
+	test_conversions(conversions_file);
+	test_name_index();
+	test_snapshot_round_trip();
+	test_snapshot_cache();
+	test_multicast();
+	test_health();
+	test_adc_known_values();
+	test_adc_kernels();
+	test_adc_stats();
+	test_history();
+	test_config();
+
+	printf("%i checks, %i failed\n", checks, failures);
+	return failures == 0 ? 0 : 1;
+}